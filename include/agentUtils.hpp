@@ -276,17 +276,43 @@ public:
     static int CurrentYear;
 
     /**
-     * @brief Retrieve a list of regular files from a directory.
+     * @brief Retrieve the finished JSON files of a path.
      *
-     * This static method scans a specified directory and collects the paths of all regular files
-     * (excluding directories and special files) it contains. The list of file paths is stored in
-     * the provided vector.
+     * This static method collects the files to upload from `path`. A regular file is returned as is; a directory is
+     * scanned recursively for finished `.json` files, so the temporary files of writers still in progress are skipped.
      *
-     * @param files A vector to store the paths of regular files found in the directory.
+     * @param path The file or directory to read.
+     * @param files A vector to store the paths of the files found.
      *
-     * @return The number of regular files found and added to the vector.
+     * @return SUCCESS if at least one file was found, FAILED otherwise.
      */
-    static int readRegularFiles(vector<string> &files);
+    static int readRegularFiles(const string &path, vector<string> &files);
+
+    /**
+     * @brief Write a file atomically.
+     *
+     * Writes `content` to a temporary file next to `path` and renames it into place, so readers of `path` see either
+     * no file or the complete one.
+     *
+     * @param path The file to write.
+     * @param content The data to write.
+     *
+     * @return SUCCESS if the file was written, FAILED otherwise.
+     */
+    static int writeFileAtomic(const string &path, const string &content);
+
+    /**
+     * @brief Write a whole buffer to a file descriptor.
+     *
+     * Repeats `write` until every byte is written, retrying when it is interrupted by a signal.
+     *
+     * @param fd The descriptor to write to.
+     * @param data The bytes to write.
+     * @param size The number of bytes.
+     *
+     * @return SUCCESS if every byte was written, FAILED otherwise.
+     */
+    static int writeAll(int fd, const char *data, size_t size);
 
     /**
      * @brief Check if a directory exists.
@@ -395,6 +421,15 @@ public:
 
     static int getRegularFiles(const string& directory, vector<string> &files);
 
+    /**
+     * @brief Generate a unique path for a JSON document of the given type.
+     *
+     * The path is under `json/<type>/` of the log directory and does not exist yet; write it with `writeFileAtomic`.
+     *
+     * @param type The log type, used as the subdirectory name.
+     *
+     * @return The path, or an empty string if the directory could not be created.
+     */
     static string getJsonWritePath(const string & type);
 
 };
@@ -471,6 +506,16 @@ public:
 
     static std::time_t convertStrToTime(const string &datetime);
 
+    /**
+     * @brief Convert bytes to lowercase hexadecimal, such as a digest.
+     *
+     * @param data The bytes to convert.
+     * @param size The number of bytes.
+     *
+     * @return A string of `2 * size` hexadecimal digits.
+     */
+    static string toHex(const unsigned char *data, size_t size);
+
     ~AgentUtils() 
     {
         if (logfp.is_open())
@@ -109,9 +109,17 @@ public:
     int getSysLog(map<string, map<string, string>> &configTable, const string &readPath, const string &logName)
     {
         int result;
+        upload_options options;
+        CurlHandler::readOptions(configTable["cloud"], options);
+        // The JSON documents written here are uploaded to monitor_url by appLogManager.
+        if (!CurlHandler::accepting(configTable["cloud"]["monitor_url"], configTable["cloud"]["form_name"], options))
+        {
+            AgentUtils::writeLog("Upload spool is full, reading " + logName + " deferred", WARNING);
+            return FAILED;
+        }
         AgentUtils::writeLog("Reading " + logName + " starting...", INFO);
         Json::Value json;
-        char remote;
+        char remote = 'n';
         const string postUrl = configTable["cloud"]["log_url"];
         const string name = configTable["cloud"]["form_name"];
         string previousTime = _configService.trim(_proxy.getLastLogWrittenTime(logName, readPath));
@@ -120,6 +128,8 @@ public:
         result = _proxy.isValidLogConfig(configTable, json, sysLogName, remote, previousTime);
         if (result == FAILED)
             return result;
+        if ((remote == 'y' || remote == 'Y') && _logService->configureRemote(configTable[sysLogName]) == FAILED)
+            return FAILED;
 
         json["AppName"] = logName;
         result = _logService->getSysLog(logName, json, names, readPath, previousTime, levels, remote);
@@ -133,7 +143,9 @@ public:
      * @brief Application Log Manager
      *
      * This function reads configured log files from the `configTable` and asynchronously invokes the `getAppLog` function
-     * for each configured file. It manages the logging process and returns a result code.
+     * for each configured file. Each application uploads only its own `write_path`; once they are done, the JSON documents
+     * written under the `json/` log directory by the other collectors are uploaded here, by this single owner, which also
+     * drains the records spooled for `monitor_url` before the applications are read.
      *
      * @param[in] configTable A map containing configuration data for log files.
      *                       The map should be structured as follows:
@@ -149,6 +161,12 @@ public:
     {
         int result = SUCCESS;
         vector<string> apps = _configService.toVector(configTable["applog"]["list"], ',');
+        upload_options options;
+        CurlHandler::readOptions(configTable["cloud"], options);
+
+        // Every record spooled for monitor_url is posted from here, so this owner drains it first, even while the
+        // collectors feeding it are paused by backpressure.
+        CurlHandler::drain(configTable["cloud"]["monitor_url"], configTable["cloud"]["form_name"], options);
 
         for (string app : apps)
         {
@@ -165,6 +183,15 @@ public:
         {
             result = asyncTask.get();
         }
+        _asyncAppTasks.clear();
+
+        // The documents of the other collectors are uploaded here once, after every application sent its own file.
+        string jsonDir = BASE_LOG_DIR;
+        jsonDir += "json/";
+        if (CurlHandler::post(configTable["cloud"]["monitor_url"], configTable["cloud"]["form_name"], jsonDir, options) != POST_SUCCESS)
+        {
+            result = FAILED;
+        }
         return result;
     }
 
@@ -188,6 +215,13 @@ public:
      */
     int getAppLog(map<string, map<string, string>> &configTable, const string &logName)
     {
+        upload_options options;
+        CurlHandler::readOptions(configTable["cloud"], options);
+        if (!CurlHandler::accepting(configTable["cloud"]["monitor_url"], configTable["cloud"]["form_name"], options))
+        {
+            AgentUtils::writeLog("Upload spool is full, reading " + logName + " log deferred", WARNING);
+            return FAILED;
+        }
         AgentUtils::writeLog("Reading " + logName + " log starting...", INFO);
         long postResult;
         Json::Value json;
@@ -206,7 +240,7 @@ public:
         if (_logService->getAppLog(json, names, readDir, writePath, previousTime, levels, sep) == FAILED)
             return FAILED;
 
-        postResult = CurlHandler::post(postUrl, attributeName, writePath);
+        postResult = CurlHandler::post(postUrl, attributeName, writePath, options);
 
         if (postResult == POST_SUCCESS)
         {
@@ -111,7 +111,7 @@ public:
         }
         /*else if (processName == "watcher")
         {
-            WatchController watcher(_table[processName]["watch_dir"], _table[processName]["backup_dir"]);
+            WatchController watcher(_table[processName]["watch_dir"], _table[processName]["backup_dir"], _table[processName]["exclude"]);
             watcher.start();
         }
         else if (processName == "tls")
@@ -51,6 +51,16 @@ public:
         string writePath = configTable[monitor]["write_path"];
         string postUrl = configTable["cloud"]["monitor_url"];
         string attributeName = configTable["cloud"]["form_name"];
+        upload_options options;
+
+        CurlHandler::readOptions(configTable["cloud"], options);
+        if (!CurlHandler::accepting(postUrl, attributeName, options))
+        {
+            AgentUtils::writeLog("Upload spool is full, process monitoring deferred", WARNING);
+            return FAILED;
+        }
+        if (_monitorService->configure(configTable[monitor]) == FAILED)
+            return FAILED;
 
         if (_monitorService->getData() == FAILED)
             return FAILED;
@@ -0,0 +1,63 @@
+#ifndef ROOTKIT_CONTROLLER
+#define ROOTKIT_CONTROLLER
+
+#include "rootkit/root_check.hpp"
+
+/**
+ * @brief Rootkit Controller
+ *
+ * The `RootkitController` class serves as the controller layer for rootkit detection. It applies the `[rootkit]`
+ * section of the configuration to a long-lived `RootCheck` and runs its checks on schedule.
+ */
+class RootkitController
+{
+private:
+    RootCheck _rootCheck; /**< A private instance of the RootCheck class, kept across scans. */
+    const string rootkit = "rootkit"; /**< A private constant string for the rootkit section name. */
+
+public:
+    /**
+     * @brief Configure Rootkit Detection
+     *
+     * Applies the `[rootkit]` section of `configTable` to the root check: signature files, thread cap, priority and
+     * the optional link and process event listeners.
+     *
+     * @param[in] configTable A map containing the configuration data.
+     * @return An integer result code:
+     *         - SUCCESS: The configuration was applied.
+     *         - FAILED: A value in the `[rootkit]` section is not valid.
+     */
+    int configure(map<string, map<string, string>> &configTable)
+    {
+        return _rootCheck.configure(configTable[rootkit]);
+    }
+
+    /**
+     * @brief Start Rootkit Check
+     *
+     * Configures the root check from `configTable` and runs every check once. Findings are logged as they are made and
+     * the cost of each check is written to the `rootcheck` log directory.
+     *
+     * @param[in] configTable A map containing the configuration data.
+     * @return An integer result code:
+     *         - SUCCESS: The checks ran.
+     *         - FAILED: The `[rootkit]` configuration is not valid.
+     */
+    int start(map<string, map<string, string>> &configTable)
+    {
+        if (configure(configTable) == FAILED)
+        {
+            return FAILED;
+        }
+        return _rootCheck.check();
+    }
+
+    /**
+     * @brief Destructor for RootkitController.
+     *
+     * Stops the event listeners of the root check.
+     */
+    ~RootkitController() {}
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "controller/logController.hpp"
 #include "controller/monitorController.hpp"
 #include "controller/firmwareController.hpp"
+#include "controller/rootkitController.hpp"
 #include "service/configservice.hpp"
 
 /**
@@ -22,6 +23,7 @@ private:
     LogController _logController;         /**< A private instance of the LogController class. */
     MonitorController _monitorController; /**< A private instance of the MonitorController class. */
     FirmwareController _fController;      /**< A private instance of the FirmWareController class. */
+    RootkitController _rootkitController; /**< A private instance of the RootkitController class. */
     Config _configService;                /**< A private instance of the IniConfig class. */
     map<string, map<string, string>> _configTable;
     bool _isReadyToSchedule = true; /**< A private variable for configuration file status*/
@@ -122,6 +124,11 @@ void Schedule::run(const string &processName, const string &timePattern, int ind
     try
     {
         auto cron = cron::make_cron(timePattern);
+        // The rootkit link and process event listeners report between scans, so they start with the agent.
+        if (strcmp(processName.c_str(), "rootkit") == 0 && _rootkitController.configure(_configTable) == FAILED)
+        {
+            processStatus[index] = false;
+        }
         while (processStatus[index])
         {
             std::chrono::system_clock::time_point currentTime = std::chrono::system_clock::now();
@@ -213,6 +220,19 @@ void Schedule::run(const string &processName, const string &timePattern, int ind
                         break;                        // Exit the loop immediately
                     }
                 }
+                else if (strcmp(processName.c_str(), "rootkit") == 0)
+                {
+                    if (_rootkitController.start(_configTable) == SUCCESS)
+                    {
+                        AgentUtils::writeLog("Rootkit check done.", DEBUG);
+                    }
+                    else
+                    {
+                        AgentUtils::writeLog("Rootkit check process stopped", DEBUG);
+                        processStatus[index] = false; // Mark the process as failed
+                        break;                        // Exit the loop immediately
+                    }
+                }
             }
             AgentUtils::writeLog(processName + " execution done.", DEBUG);
 
@@ -13,106 +13,100 @@
 #endif
 */
 #include "agentUtils.hpp"
+#include "rootkit/fs_index.hpp"
+#include <unordered_set>
 
 class DevCheck
 {
 private:
-    int devErrors;
-    int devTotal;
-    const vector<string> ignore_dev = {
+    int devErrors = 0;
+    int devTotal = 0;
+    const std::unordered_set<string> ignore_dev = {
         "MAKEDEV", "README.MAKEDEV",
         "MAKEDEV.README", ".udevdb",
         ".udev.tdb", ".initramfs-tools",
         "MAKEDEV.local", ".udev", ".initramfs",
-        "oprofile", "fd", "cgroup",
-        ""
+        "oprofile", "fd", "cgroup"
     };
 
-    const vector<string> ignore_dev_full_path = {
+    const std::unordered_set<string> ignore_dev_full_path = {
         "/dev/shm/sysconfig",
         "/dev/bus/usb/.usbfs",
         "/dev/shm",
-        "/dev/gpmctl",
-        ""
+        "/dev/gpmctl"
     };
 public:
-    int read_dev_file(const string file_name)
+    int getTotal() const
     {
-        std::filesystem::path file_path(file_name);
-        if (!std::filesystem::exists(file_path)) 
-        {
-            AgentUtils::writeLog(INVALID_PATH + file_name, FAILED);
-            return FAILED;
-        }
-        if (std::filesystem::is_directory(file_path)) 
-        {
-            return read_dev_dir(file_name);
-        }
-        else if (std::filesystem::is_regular_file(file_path)) 
-        {
-            string error = file_name;
-            std::string op_msg = "File '" + error + "' present on /dev. Possible hidden file.";
-            AgentUtils::writeLog(op_msg, CRITICAL);
-            devErrors++;
-        }
-        return 0;
+        return devTotal;
     }
 
-    int read_dev_dir(const string dir_name)
+    int getFindings() const
     {
-        
-        if (dir_name.empty() || dir_name.length() > PATH_MAX) 
-        {
-            string error = dir_name;
-            AgentUtils::writeLog(INVALID_PATH + error, FAILED);
-            return -1;
-        }
+        return devErrors;
+    }
 
-        for (const auto& entry : std::filesystem::directory_iterator(dir_name)) 
-        {
-            const auto& entry_name = entry.path().filename().string();
+    /* Walks the /dev entries retained by the index. The index lists them in
+       walk order, so a directory's subtree directly follows it and an ignored
+       directory is skipped by its path prefix. */
+    int check(const FsIndex &index, const string &dev_dir = "/dev")
+    {
+        string skip_prefix;
+        string dev_prefix = dev_dir + "/";
 
-            // Ignore . and ..
-            if (entry_name == "." || entry_name == "..") {
+        devTotal = 0;
+        devErrors = 0;
+        AgentUtils::writeLog("Starting on check_rc_dev", INFO);
+
+        for (const fs_entry &entry : index.entries())
+        {
+            if (entry.path.compare(0, dev_prefix.size(), dev_prefix) != 0)
+            {
                 continue;
             }
-
+            if (!skip_prefix.empty() && entry.path.compare(0, skip_prefix.size(), skip_prefix) == 0)
+            {
+                continue;
+            }
+            skip_prefix.clear();
             devTotal++;
 
-            // Check against the list of ignored files
-            if (std::find(std::begin(ignore_dev), std::end(ignore_dev), entry_name) != std::end(ignore_dev)) {
+            const string entry_name = entry.path.substr(entry.path.find_last_of('/') + 1);
+            if (ignore_dev.count(entry_name) || ignore_dev_full_path.count("/dev" + entry.path.substr(dev_dir.size())))
+            {
+                if (entry.type == DT_DIR)
+                {
+                    skip_prefix = entry.path + "/";
+                }
                 continue;
             }
 
-            // Check against the list of ignored full paths
-            if (std::find(std::begin(ignore_dev_full_path), std::end(ignore_dev_full_path), entry.path().string()) != std::end(ignore_dev_full_path)) {
-                continue;
+            if (entry.type == DT_REG)
+            {
+                std::string op_msg = "File '" + entry.path + "' present on /dev. Possible hidden file.";
+                AgentUtils::writeLog(op_msg, CRITICAL);
+                devErrors++;
             }
+        }
 
-            // Found a non-ignored entry in the directory, so process it
-            read_dev_file(entry.path().string());
+        if (devErrors == 0)
+        {
+            string opMessage = "No problem detected on the /dev directory. Analyzed " + std::to_string(devTotal) + " files";
+            AgentUtils::writeLog(opMessage, SUCCESS);
         }
-        return (0);
+        return SUCCESS;
     }
 
     int check()
     {
-        const char *basedir = "/";
-        char file_path[OS_SIZE_1024 + 1];
-
-        devTotal = 0;
-        devErrors = 0;
-        AgentUtils::writeLog("Starting on check_rc_dev", INFO);
+        FsIndex index("/dev");
+        index.retain("/dev");
 
-        snprintf(file_path, OS_SIZE_1024, "%s/dev", basedir);
-
-        read_dev_dir(file_path);
-        if (devErrors == 0)
+        if (index.build() == FAILED)
         {
-            string opMessage = "No problem detected on the /dev directory. Analyzed " + std::to_string(devTotal) + " files";
-            AgentUtils::writeLog(opMessage, SUCCESS);
+            return FAILED;
         }
-        return SUCCESS;
+        return check(index);
     }
 
 
@@ -0,0 +1,272 @@
+#ifndef FS_INDEX_HPP
+#define FS_INDEX_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+#include <sys/syscall.h>
+#include <unordered_set>
+
+#define FS_INDEX_BUFFER 4096
+#define FS_INDEX_MAX_DEPTH 128
+
+typedef struct fs_entry fs_entry;
+typedef struct fs_match fs_match;
+
+/**
+ * @brief File System Entry
+ *
+ * One entry kept by `FsIndex` for a retained subtree.
+ */
+struct fs_entry
+{
+    string path;
+    unsigned char type; /**< `DT_REG`, `DT_DIR`, `DT_LNK`, ... as reported by `getdents64`. */
+};
+
+/**
+ * @brief File System Match
+ *
+ * A path found by the walk that equals a registered path or ends with a registered suffix.
+ */
+struct fs_match
+{
+    int id;
+    string path;
+};
+
+/**
+ * @brief File System Index
+ *
+ * The `FsIndex` class walks a directory tree once with `getdents64` and `openat` and answers every question the
+ * rootkit checks ask about it from that single walk. Before `build`, checks register exact paths and path suffixes
+ * (`addPath`, `addSuffix`), which are looked up in hash tables as each entry is read, and subtrees whose entries they
+ * want to inspect afterwards (`retain`). Ignored paths are pruned with a hash lookup instead of a linear search.
+ *
+ * Symbolic links are reported but not followed, and the walk does not leave the tree through them. Like `find -xdev`,
+ * it also stays on the file system of the root: mount points such as `/proc`, `/sys` or network and removable media
+ * are reported but not entered. A retained subtree on its own file system, such as `/dev`, is walked on that one.
+ */
+class FsIndex
+{
+private:
+    string _root;
+    std::unordered_set<string> _ignorePaths;
+    vector<string> _retain;
+    std::unordered_map<string, vector<int>> _paths;
+    std::unordered_map<string, vector<std::pair<string, int>>> _suffixes; /**< Keyed by the last path component. */
+    vector<fs_entry> _entries;
+    vector<fs_match> _matches;
+    size_t _visited = 0;
+
+    struct linux_dirent64
+    {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    bool _isRetainedRoot(const string &path) const
+    {
+        return std::find(_retain.begin(), _retain.end(), path) != _retain.end();
+    }
+
+    bool _isRetained(const string &path) const
+    {
+        for (const string &subtree : _retain)
+        {
+            if (path.size() >= subtree.size() && path.compare(0, subtree.size(), subtree) == 0 &&
+                (path.size() == subtree.size() || path[subtree.size()] == '/' || subtree == "/"))
+                return true;
+        }
+        return false;
+    }
+
+    void _visit(const string &path, const char *name, unsigned char type)
+    {
+        _visited++;
+        auto exact = _paths.find(path);
+        if (exact != _paths.end())
+        {
+            for (int id : exact->second)
+                _matches.push_back({id, path});
+        }
+        auto suffix = _suffixes.find(name);
+        if (suffix != _suffixes.end())
+        {
+            for (const auto &candidate : suffix->second)
+            {
+                const string &tail = candidate.first;
+                if (path.size() >= tail.size() && path.compare(path.size() - tail.size(), tail.size(), tail) == 0)
+                    _matches.push_back({candidate.second, path});
+            }
+        }
+        if (!_retain.empty() && _isRetained(path))
+            _entries.push_back({path, type});
+    }
+
+    void _walk(int dirFd, const string &path, int depth, dev_t device)
+    {
+        alignas(struct linux_dirent64) char buffer[FS_INDEX_BUFFER];
+        while (true)
+        {
+            long bytes = syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+            if (bytes <= 0)
+                break;
+            for (long offset = 0; offset < bytes;)
+            {
+                struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+                offset += entry->d_reclen;
+                const char *name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                    continue;
+
+                string child = (path == "/") ? path + name : path + "/" + name;
+                if (_ignorePaths.count(child))
+                    continue;
+                unsigned char type = entry->d_type;
+                if (type == DT_UNKNOWN)
+                {
+                    struct stat info;
+                    if (fstatat(dirFd, name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+                        continue;
+                    type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : S_ISLNK(info.st_mode) ? DT_LNK : DT_UNKNOWN;
+                }
+                _visit(child, name, type);
+
+                if (type == DT_DIR && depth < FS_INDEX_MAX_DEPTH)
+                {
+                    int childFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                    if (childFd >= 0)
+                    {
+                        struct stat info;
+                        if (fstat(childFd, &info) == 0 && (info.st_dev == device || _isRetainedRoot(child)))
+                            _walk(childFd, child, depth + 1, info.st_dev);
+                        close(childFd);
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief File System Index Constructor
+     *
+     * @param[in] root The directory to walk.
+     */
+    explicit FsIndex(const string &root = "/") : _root(root)
+    {
+        if (_root.size() > 1 && _root.back() == '/')
+            _root.pop_back();
+    }
+
+    /**
+     * @brief Ignore Path
+     *
+     * Prunes an absolute path, and the subtree below it, from the walk.
+     */
+    void ignorePath(const string &path) { _ignorePaths.insert(path); }
+
+    /**
+     * @brief Retain Subtree
+     *
+     * Keeps the entries below an absolute path, in walk order, for `entries`.
+     */
+    void retain(const string &subtree) { _retain.push_back(subtree); }
+
+    /**
+     * @brief Add Exact Path
+     *
+     * @param[in] path An absolute path reported in `matches` with `id` when the walk reaches it.
+     * @param[in] id The caller's identifier for the path.
+     */
+    void addPath(const string &path, int id) { _paths[path].push_back(id); }
+
+    /**
+     * @brief Add Path Suffix
+     *
+     * @param[in] suffix A suffix such as `/.ark` or `/lib/.x`; every path ending with it is reported in `matches`.
+     * @param[in] id The caller's identifier for the suffix.
+     */
+    void addSuffix(const string &suffix, int id)
+    {
+        size_t slash = suffix.find_last_of('/');
+        string name = (slash == string::npos) ? suffix : suffix.substr(slash + 1);
+        if (!name.empty())
+            _suffixes[name].emplace_back(suffix, id);
+    }
+
+    /**
+     * @brief Build Index
+     *
+     * Walks the tree once, collecting matches and retained entries.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The root was walked.
+     *         - FAILED: The root could not be opened.
+     */
+    int build()
+    {
+        _entries.clear();
+        _matches.clear();
+        _visited = 0;
+        int rootFd = open(_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (rootFd < 0)
+        {
+            AgentUtils::writeLog(INVALID_PATH + _root, FAILED);
+            return FAILED;
+        }
+        struct stat info;
+        if (fstat(rootFd, &info) == 0)
+            _walk(rootFd, _root, 0, info.st_dev);
+        close(rootFd);
+        return SUCCESS;
+    }
+
+    /**
+     * @brief Check Reachability
+     *
+     * @return true if the walk would reach `path`: it is below the root, not below an ignored path, and every parent
+     *         is a directory rather than a symbolic link, on the file system of the root or of a retained subtree.
+     */
+    bool isReachable(const string &path) const
+    {
+        if (_root != "/" && path.compare(0, _root.size() + 1, _root + "/") != 0)
+            return false;
+        struct stat info;
+        if (stat(_root.c_str(), &info) != 0)
+            return false;
+        dev_t device = info.st_dev;
+        for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+        {
+            string prefix = path.substr(0, slash);
+            if (_ignorePaths.count(prefix))
+                return false;
+            if (slash == string::npos)
+                return true;
+            if (lstat(prefix.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+                return false;
+            if (prefix.size() > _root.size() && info.st_dev != device)
+            {
+                if (!_isRetainedRoot(prefix))
+                    return false;
+                device = info.st_dev;
+            }
+        }
+    }
+
+    const vector<fs_entry> &entries() const { return _entries; }
+
+    const vector<fs_match> &matches() const { return _matches; }
+
+    /**
+     * @brief Get Visited Count
+     *
+     * @return The number of entries the last `build` read.
+     */
+    size_t visited() const { return _visited; }
+};
+
+#endif
@@ -4,101 +4,352 @@
 #pragma once
 
 #include "agentUtils.hpp"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <mutex>
 
-#define PROMISCOUS "ifconfig %s | grep PROMISC > /dev/null 2>&1"
+#define NETLINK_BUFFER 32768
+
+typedef struct link_info link_info;
+
+struct link_info
+{
+    int index = 0;
+    unsigned int flags = 0; /* IFF_* */
+    string name;
+};
 
 /*
-    Commmand :: "ifconfig %s | grep PROMISC > /dev/null 2>&1" :: To identify the interface is in promiscuous mode
-    steps    :: Get all the available interfaces.
+    Interfaces and their flags come from one rtnetlink RTM_GETLINK dump, so
+    every interface is seen however many there are and no ifconfig process
+    is started. watch() keeps a socket subscribed to RTMGRP_LINK and reports
+    an interface as soon as it enters promiscuous mode.
 */
 
 class InterfaceCheck
 {
 private:
-    vector<string> promiscuousInterfaces;
-    int fd; /* File descriptor */
-    int errors;
-    int total;
-    struct ifreq tmp_str[16];
-    struct ifconf _if;
-    struct ifreq *_ir;
-    struct ifreq *_ifend;
-    struct ifreq _ifr;
+    int errors = 0;
+    int total = 0;
+    int watchFd = -1;
+    int wakeFd = -1;
+    std::thread watcher;
+    std::atomic<bool> watching{false};
+    std::atomic<unsigned long long> events{0};
+    std::mutex flagsMutex;
+    std::unordered_map<int, unsigned int> linkFlags; /* ifindex -> flags, as last seen */
 
-public:
-    int isInterfaceInPromiscuousMode(const std::string& interfaceName)
+    static int openSocket(unsigned int groups)
     {
-        char nt[OS_SIZE_1024 + 1];
-
-        snprintf(nt, OS_SIZE_1024, PROMISCOUS, interfaceName.c_str());
-        if (system(nt) == 0) {
-            return (1);
+        int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        struct sockaddr_nl address;
+        memset(&address, 0, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = groups;
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            close(fd);
+            return -1;
         }
-        return (0);
+        return fd;
     }
-    
-    int check()
+
+    /* Lists every interface with one RTM_GETLINK dump */
+    static int dumpLinks(vector<link_info> &links)
     {
-        AgentUtils::writeLog("Checking Network Interfaces starting", INFO);
-        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        alignas(struct nlmsghdr) char buffer[NETLINK_BUFFER];
+        struct
+        {
+            struct nlmsghdr header;
+            struct ifinfomsg info;
+        } request;
 
+        int fd = openSocket(0);
         if (fd < 0)
         {
-            AgentUtils::writeLog("Error checking interfaces (socket)", FAILED);
+            AgentUtils::writeLog("Error checking interfaces (netlink socket)", FAILED);
             return FAILED;
         }
 
-        memset(tmp_str, 0, sizeof(struct ifreq) * 16);
-        _if.ifc_len = sizeof(tmp_str);
-        _if.ifc_buf = (caddr_t)(tmp_str);
+        memset(&request, 0, sizeof(request));
+        request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+        request.header.nlmsg_type = RTM_GETLINK;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = 1;
+        request.info.ifi_family = AF_UNSPEC;
 
-        if (ioctl(fd, SIOCGIFCONF, &_if) < 0)
+        if (send(fd, &request, request.header.nlmsg_len, 0) < 0)
         {
             close(fd);
-            AgentUtils::writeLog("Error checking interfaces (ioctl)", FAILED);
+            AgentUtils::writeLog("Error checking interfaces (RTM_GETLINK)", FAILED);
             return FAILED;
         }
 
-        _ifend = (struct ifreq *) (void *) ((char *)tmp_str + _if.ifc_len);
-        _ir = tmp_str;
-
-        for (; _ir < _ifend; _ir++) 
+        while (true)
         {
-            strncpy(_ifr.ifr_name, _ir->ifr_name, sizeof(_ifr.ifr_name));
-            
-            // Get information from each interface
-            if (ioctl(fd, SIOCGIFFLAGS, (char *)&_ifr) == -1) {
+            ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR)
+            {
                 continue;
             }
+            if (bytes <= 0)
+            {
+                close(fd);
+                AgentUtils::writeLog("Error checking interfaces (netlink receive)", FAILED);
+                return FAILED;
+            }
+            for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, (size_t)bytes); header = NLMSG_NEXT(header, bytes))
+            {
+                if (header->nlmsg_type == NLMSG_DONE)
+                {
+                    close(fd);
+                    return SUCCESS;
+                }
+                if (header->nlmsg_type == NLMSG_ERROR)
+                {
+                    close(fd);
+                    AgentUtils::writeLog("Error checking interfaces (netlink error)", FAILED);
+                    return FAILED;
+                }
+                link_info link;
+                if (parseLink(header, link))
+                {
+                    links.push_back(link);
+                }
+            }
+        }
+    }
 
-            total++;
+    void reportPromiscuous(const string &name)
+    {
+        char op_msg[OS_SIZE_1024];
+        snprintf(op_msg, OS_SIZE_1024, "Interface '%s' in promiscuous mode.", name.c_str());
+        AgentUtils::writeLog(op_msg, FAILED);
+    }
+
+    void watch()
+    {
+        alignas(struct nlmsghdr) char buffer[NETLINK_BUFFER];
+        struct pollfd fds[2] = {{watchFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
 
-            if ((_ifr.ifr_flags & IFF_PROMISC)) {
-                char op_msg[OS_SIZE_1024];
-                // Check if the interface is in promiscuous mode
-                if (isInterfaceInPromiscuousMode(_ifr.ifr_name)) {
-                    // Assume we have a function to notify about the promiscuous interface.
-                    snprintf(op_msg, OS_SIZE_1024, "Interface '%s' in promiscuous"
-                         " mode.", _ifr.ifr_name);
+        while (watching.load())
+        {
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                AgentUtils::writeLog("Link event poll failed: " + string(strerror(errno)), FAILED);
+                break;
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                break;
+            }
+            ssize_t bytes = recv(watchFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (bytes < 0)
+            {
+                vector<link_info> links;
+                if (errno == ENOBUFS && dumpLinks(links) == SUCCESS)
+                {
+                    /* Notifications were lost, so compare against a fresh dump */
+                    AgentUtils::writeLog("Link event queue overflowed, rescanning interfaces", WARNING);
+                    for (const link_info &link : updateFlags(links, true))
+                    {
+                        reportPromiscuous(link.name);
+                    }
                 }
-                else
+                continue;
+            }
+            vector<link_info> links;
+            for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, (size_t)bytes); header = NLMSG_NEXT(header, bytes))
+            {
+                link_info link;
+                if (parseLink(header, link))
+                {
+                    events++;
+                    links.push_back(link);
+                }
+            }
+            for (const link_info &link : updateFlags(links))
+            {
+                reportPromiscuous(link.name);
+            }
+        }
+    }
+
+public:
+    InterfaceCheck() {}
+
+    InterfaceCheck(const InterfaceCheck &) = delete;
+    InterfaceCheck &operator=(const InterfaceCheck &) = delete;
+
+    int getTotal() const
+    {
+        return total;
+    }
+
+    int getFindings() const
+    {
+        return errors;
+    }
+
+    unsigned long long getEventCount() const
+    {
+        return events.load();
+    }
+
+    bool isWatching() const
+    {
+        return watching.load();
+    }
+
+    /* Reads the index, flags and name of an RTM_NEWLINK message */
+    static bool parseLink(const struct nlmsghdr *header, link_info &link)
+    {
+        if (header->nlmsg_type != RTM_NEWLINK || header->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+        {
+            return false;
+        }
+        const struct ifinfomsg *info = (const struct ifinfomsg *)NLMSG_DATA(header);
+        link.index = info->ifi_index;
+        link.flags = info->ifi_flags;
+        link.name.clear();
+        int length = IFLA_PAYLOAD(header);
+        for (const struct rtattr *attribute = IFLA_RTA(info); RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length))
+        {
+            if (attribute->rta_type == IFLA_IFNAME)
+            {
+                link.name.assign((const char *)RTA_DATA(attribute), strnlen((const char *)RTA_DATA(attribute), RTA_PAYLOAD(attribute)));
+            }
+        }
+        return true;
+    }
+
+    /* Stores the flags of every link and returns the links that were not
+       promiscuous before. A complete list, from a dump, also forgets the
+       links missing from it, so an interface created in their place is
+       reported when it enters promiscuous mode */
+    vector<link_info> updateFlags(const vector<link_info> &links, bool complete = false)
+    {
+        vector<link_info> entered;
+        std::lock_guard<std::mutex> lock(flagsMutex);
+        if (complete)
+        {
+            std::unordered_map<int, unsigned int> known;
+            for (const link_info &link : links)
+            {
+                auto previous = linkFlags.find(link.index);
+                if (previous != linkFlags.end())
                 {
-                    snprintf(op_msg, OS_SIZE_1024, "Interface '%s' in promiscuous"
-                         " mode, but ifconfig is not showing it"
-                         "(probably trojaned).", _ifr.ifr_name);
+                    known.emplace(previous->first, previous->second);
                 }
-                AgentUtils::writeLog(op_msg, FAILED);
+            }
+            linkFlags.swap(known);
+        }
+        for (const link_info &link : links)
+        {
+            auto previous = linkFlags.find(link.index);
+            if ((link.flags & IFF_PROMISC) && (previous == linkFlags.end() || !(previous->second & IFF_PROMISC)))
+            {
+                entered.push_back(link);
+            }
+            linkFlags[link.index] = link.flags;
+        }
+        return entered;
+    }
+
+    int check()
+    {
+        vector<link_info> links;
+
+        errors = 0;
+        total = 0;
+        AgentUtils::writeLog("Checking Network Interfaces starting", INFO);
+
+        if (dumpLinks(links) == FAILED)
+        {
+            return FAILED;
+        }
+        for (const link_info &link : links)
+        {
+            total++;
+            if (link.flags & IFF_PROMISC)
+            {
+                reportPromiscuous(link.name);
                 errors++;
             }
         }
-        close(fd);
+        updateFlags(links, true);
 
         if (errors == 0) {
-            AgentUtils::writeLog("No problem detected on ifconfig/ifs. Analyzed " + total + " interfaces", INFO);
+            AgentUtils::writeLog("No problem detected on ifconfig/ifs. Analyzed " + std::to_string(total) + " interfaces", INFO);
         }
 
         return SUCCESS;
     }
+
+    /* Subscribes to link notifications and reports interfaces entering
+       promiscuous mode from a background thread until stopWatch() */
+    int startWatch()
+    {
+        if (watching.load())
+        {
+            return SUCCESS;
+        }
+        watchFd = openSocket(RTMGRP_LINK);
+        if (watchFd < 0)
+        {
+            AgentUtils::writeLog("Unable to subscribe to link events: " + string(strerror(errno)), FAILED);
+            return FAILED;
+        }
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wakeFd < 0)
+        {
+            close(watchFd);
+            watchFd = -1;
+            AgentUtils::writeLog("Unable to create link event wake descriptor", FAILED);
+            return FAILED;
+        }
+        /* Subscribe before the baseline dump so no change in between is missed */
+        check();
+        watching.store(true);
+        watcher = std::thread(&InterfaceCheck::watch, this);
+        AgentUtils::writeLog("Link event listener started", INFO);
+        return SUCCESS;
+    }
+
+    void stopWatch()
+    {
+        if (!watching.exchange(false))
+        {
+            return;
+        }
+        uint64_t value = 1;
+        if (write(wakeFd, &value, sizeof(value)) < 0)
+        {
+            AgentUtils::writeLog("Unable to wake link event listener", FAILED);
+        }
+        if (watcher.joinable())
+        {
+            watcher.join();
+        }
+        close(watchFd);
+        close(wakeFd);
+        watchFd = -1;
+        wakeFd = -1;
+    }
+
+    ~InterfaceCheck()
+    {
+        stopWatch();
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
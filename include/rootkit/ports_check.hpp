@@ -1,44 +1,74 @@
-#ifndef PORT_CHCEK
+#ifndef PORT_CHECK
 #define PORT_CHECK
 #pragma once
 
 #include "agentUtils.hpp"
+#include "service/threadpool.hpp"
+#include <bitset>
 
-#define NETSTAT "netstat -an | grep \"^%s\" | " \
-                "grep \"[^0-9]%d \" > /dev/null 2>&1"
+#define MAX_PORT 65535
 
 class PortCheck
 {
     private:
-        int errors;
-        int total;
-        int total_ports_tcp[65535 + 1];
-        int total_ports_udp[65535 + 1];
+        int errors = 0;
+        int total = 0;
+        size_t workers = 0; /* Threads used by the bind sweep, 0 uses the number of online CPUs */
+        std::atomic<long long> workerCpuTime{0}; /* CPU time of the sweep tasks in nanoseconds */
+        std::bitset<MAX_PORT + 1> total_ports_tcp; /* Ports the bind probe found in use */
+        std::bitset<MAX_PORT + 1> total_ports_udp;
+        std::bitset<MAX_PORT + 1> listed_tcp; /* Local ports of every socket in /proc/net/tcp and tcp6 */
+        std::bitset<MAX_PORT + 1> listed_udp; /* Local ports of every socket in /proc/net/udp and udp6 */
 
     public:
 
-        int runNetStat(int protocol, int port)
+        int readProcNet(const char *path, std::bitset<MAX_PORT + 1> &ports)
         {
-            int ret;
-            char nt[OS_SIZE_1024 + 1];
+            char line[OS_SIZE_1024 + 1];
+            unsigned int port;
+            FILE *fp = fopen(path, "r");
 
-            if (protocol == IPPROTO_TCP) {
-                snprintf(nt, OS_SIZE_1024, NETSTAT, "tcp", port);
-            } else if (protocol == IPPROTO_UDP) {
-                snprintf(nt, OS_SIZE_1024, NETSTAT, "udp", port);
-            } else {
-                AgentUtils::writeLog("Netstat error (wrong protocol)", FAILED);
-                return (0);
+            if (fp == NULL) {
+                return FAILED;
+            }
+
+            /* Skip the header, then read the port of "sl: local_address:port ..." */
+            if (fgets(line, OS_SIZE_1024, fp) != NULL) {
+                while (fgets(line, OS_SIZE_1024, fp) != NULL) {
+                    if (sscanf(line, " %*d: %*[0-9A-Fa-f]:%X", &port) == 1 && port <= MAX_PORT) {
+                        ports.set(port);
+                    }
+                }
             }
+            fclose(fp);
+            return SUCCESS;
+        }
 
-            ret = system(nt);
+        void loadProcNet()
+        {
+            listed_tcp.reset();
+            listed_udp.reset();
 
-            if (ret == 0) {
-                return (1);
-            } else if (ret == 1) {
-                return (0);
+            if (readProcNet("/proc/net/tcp", listed_tcp) == FAILED) {
+                AgentUtils::writeLog(FREAD_FAILED + "/proc/net/tcp", FAILED);
+            }
+            readProcNet("/proc/net/tcp6", listed_tcp);
+
+            if (readProcNet("/proc/net/udp", listed_udp) == FAILED) {
+                AgentUtils::writeLog(FREAD_FAILED + "/proc/net/udp", FAILED);
+            }
+            readProcNet("/proc/net/udp6", listed_udp);
+        }
+
+        int isListed(int protocol, int port)
+        {
+            if (protocol == IPPROTO_TCP) {
+                return listed_tcp.test(port) ? 1 : 0;
+            } else if (protocol == IPPROTO_UDP) {
+                return listed_udp.test(port) ? 1 : 0;
             }
-            return (1);
+            AgentUtils::writeLog("Port listing error (wrong protocol)", FAILED);
+            return (0);
         }
 
         int connPort(int protocol, int port)
@@ -72,9 +102,9 @@ class PortCheck
 
             /* Setting if port is open or closed */
             if (protocol == IPPROTO_TCP) {
-                total_ports_tcp[port] = (char) rc;
+                total_ports_tcp[port] = rc;
             } else {
-                total_ports_udp[port] = (char) rc;
+                total_ports_udp[port] = rc;
             }
 
             close(ossock);
@@ -114,28 +144,140 @@ class PortCheck
             return (rc);
         }
 
+        void setWorkers(size_t count)
+        {
+            workers = count;
+        }
+
+        int getTotal() const
+        {
+            return total;
+        }
+
+        int getFindings() const
+        {
+            return errors;
+        }
+
+        /**
+         * @brief Get Worker CPU Time
+         *
+         * @return The CPU time, in seconds, the bind sweeps of the last `check` spent on the worker threads.
+         */
+        double getWorkerCpuTime() const
+        {
+            return workerCpuTime.load() / 1e9;
+        }
+
+        /* Returns 1 if the port can not be bound. A socket whose bind failed is
+        * still unbound and is kept for the next port; a bound one is closed.
+        */
+        static int probeBind(int &ossock, int family, int protocol, int port)
+        {
+            int type = (protocol == IPPROTO_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+
+            if (ossock < 0 && (ossock = socket(family, type | SOCK_CLOEXEC, protocol)) < 0) {
+                return (0);
+            }
+
+            int rc = 0;
+            if (family == AF_INET) {
+                struct sockaddr_in server;
+                memset(&server, 0, sizeof(server));
+                server.sin_family = AF_INET;
+                server.sin_port = htons(port);
+                server.sin_addr.s_addr = htonl(INADDR_ANY);
+                rc = bind(ossock, (struct sockaddr *) &server, sizeof(server)) < 0;
+            } else {
+                struct sockaddr_in6 server6;
+                memset(&server6, 0, sizeof(server6));
+                server6.sin6_family = AF_INET6;
+                server6.sin6_port = htons(port);
+                memcpy(&server6.sin6_addr.s6_addr, &in6addr_any, sizeof in6addr_any);
+                rc = bind(ossock, (struct sockaddr *) &server6, sizeof(server6)) < 0;
+            }
+
+            if (!rc) {
+                close(ossock);
+                ossock = -1;
+            }
+            return (rc);
+        }
+
+        /* Probes [first, last] on IPv4 and IPv6 and returns the ports in use */
+        static std::bitset<MAX_PORT + 1> sweepRange(int protocol, int first, int last)
+        {
+            std::bitset<MAX_PORT + 1> used;
+            int sock4 = -1;
+            int sock6 = -1;
+
+            for (int port = first; port <= last; port++) {
+                int rc = probeBind(sock4, AF_INET, protocol, port);
+                rc |= probeBind(sock6, AF_INET6, protocol, port);
+                if (rc) {
+                    used.set(port);
+                }
+            }
+
+            if (sock4 >= 0) close(sock4);
+            if (sock6 >= 0) close(sock6);
+            return used;
+        }
+
+        /* Splits the port range across a worker pool; each worker fills its own
+        * bitset and the bitsets are merged once all ranges are done.
+        */
+        std::bitset<MAX_PORT + 1> sweepPorts(int protocol)
+        {
+            ThreadPool pool(workers);
+            size_t count = pool.size();
+            vector<std::future<std::bitset<MAX_PORT + 1>>> parts;
+            std::bitset<MAX_PORT + 1> used;
+
+            for (size_t part = 0; part < count; part++) {
+                int first = (int)((MAX_PORT + 1) * part / count);
+                int last = (int)((MAX_PORT + 1) * (part + 1) / count) - 1;
+                parts.push_back(pool.submit([this, protocol, first, last]() {
+                    struct timespec start, end;
+                    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+                    std::bitset<MAX_PORT + 1> used = sweepRange(protocol, first, last);
+                    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+                    workerCpuTime += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+                    return used;
+                }));
+            }
+            for (auto &part : parts) {
+                used |= part.get();
+            }
+            return used;
+        }
+
         void test_ports(int protocol)
         {
             int i;
+            std::bitset<MAX_PORT + 1> &used = (protocol == IPPROTO_TCP) ? total_ports_tcp : total_ports_udp;
 
+            used = sweepPorts(protocol);
             for (i = 0; i <= 65535; i++) {
                 total++;
-                if (connPort(protocol, i)) {
-                    /* Check if we can find it using netstat. If not,
-                    * check again to see if the port is still being used.
+                if (used.test(i)) {
+                    /* Check if the kernel lists it in /proc/net. If not, the
+                    * port may have been opened after the snapshot: reload the
+                    * listing and check again to see if the port is still being used.
                     */
-                    if (runNetStat(protocol, i)) {
+                    if (isListed(protocol, i)) {
                         continue;
                     }
 
-                    if (!runNetStat(protocol, i) && connPort(protocol, i)) {
+                    loadProcNet();
+                    if (!isListed(protocol, i) && connPort(protocol, i)) {
                         char op_msg[OS_SIZE_1024 + 1];
 
                         errors++;
 
                         snprintf(op_msg, OS_SIZE_1024, "Port '%d'(%s) hidden. "
-                                "Kernel-level rootkit or trojaned "
-                                "version of netstat.", i,
+                                "Kernel-level rootkit hiding it "
+                                "from /proc/net.", i,
                                 (protocol == IPPROTO_UDP) ? "udp" : "tcp");
 
                         AgentUtils::writeLog(op_msg, CRITICAL);
@@ -158,15 +300,14 @@ class PortCheck
 
         int check()
         {
-            int i = 0;
-
-            while (i <= 65535) {
-                total_ports_tcp[i] = 0;
-                total_ports_udp[i] = 0;
-                i++;
-            }
-
-            /* Test both TCP and UDP ports */
+            errors = 0;
+            total = 0;
+            total_ports_tcp.reset();
+            total_ports_udp.reset();
+            workerCpuTime = 0;
+
+            /* Load the sockets the kernel reports once, then test both TCP and UDP ports */
+            loadProcNet();
             test_ports(IPPROTO_TCP);
             test_ports(IPPROTO_UDP);
 
@@ -174,18 +315,10 @@ class PortCheck
                 char op_msg[OS_SIZE_1024 + 1];
 
                 snprintf(op_msg, OS_SIZE_1024, "No kernel-level rootkit hiding any port."
-                        "\n      Netstat is acting correctly."
+                        "\n      /proc/net is acting correctly."
                         " Analyzed %d ports.", total);
                 AgentUtils::writeLog(op_msg, SUCCESS);
             }
-
-            for (int port = 0; port < 65535; port++)
-            {
-                if (total_ports_tcp[port])
-                {
-                    cout << "port : " << port << " status : " << total_ports_tcp[port]  << "\n";
-                }
-            }
             return SUCCESS;
         }
 };
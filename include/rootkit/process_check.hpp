@@ -4,32 +4,48 @@
 #pragma once
 
 #include "agentUtils.hpp"
+#include "service/procevents.hpp"
+#include "service/procparser.hpp"
+#include <unordered_set>
 
 class ProcessCheck
 {
     private:
-        int total;
-        int error;
+        int total = 0;
+        int error = 0;
         pid_t max_pid = MAX_PID;
         int noproc = 1;
         int proc_pid_found;
         string proc_0 = "/proc";
         string proc_1 = "/proc/1";
+        const ProcEventListener *tracker = nullptr; /* Process table kept from kernel process events, if any */
         
     public:
 
+        /* Cross-checks the /proc listing against the table of `listener` on every check while it is running */
+        void setTracker(const ProcEventListener *listener)
+        {
+            tracker = listener;
+        }
+
+        int getTotal() const
+        {
+            return total;
+        }
+
+        int getFindings() const
+        {
+            return error;
+        }
+
         bool isDigit(string val)
         {
-            bool result = false;
-            try
+            if (val.empty()) return false;
+            for (char c : val)
             {
-                std::stoi(val);
-                result = true;
-            }catch(exception &e)
-            {
-                cerr<< e.what() << "\n";
+                if (c < '0' || c > '9') return false;
             }
-            return result;
+            return true;
         }
         
         int proc_read(int pid)
@@ -53,33 +69,23 @@ class ProcessCheck
             return OS::isDirExist(filePath);
         }
 
+        /* Enters /proc/PID by name, as chdir(2) did, without moving the working directory of the whole process */
         int proc_chdir(int pid)
         {
-            int ret = 0;
-            char curr_dir[OS_SIZE_1024 + 1];
-            char dir[OS_SIZE_1024 + 1];
-
             if (noproc) {
                 return (0);
             }
-            if (getcwd(curr_dir, OS_SIZE_1024) == NULL) {
+            int proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (proc_fd == -1) {
                 return (0);
             }
-            if (chdir("/proc") == -1) {
+            int pid_fd = openat(proc_fd, std::to_string(pid).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            close(proc_fd);
+            if (pid_fd == -1) {
                 return (0);
             }
-
-            snprintf(dir, OS_SIZE_1024, "/proc/%d", pid);
-            if (chdir(dir) == 0) {
-                ret = 1;
-            }
-
-            /* Returning to the previous directory */
-            if (chdir(curr_dir) == -1) {
-                return (0);
-            }
-
-            return (ret);
+            close(pid_fd);
+            return (1);
         }
 
         int read_proc_file(string file_name, string pid, int position)
@@ -110,13 +116,12 @@ class ProcessCheck
                 const auto& entry_name = entry.path().filename().string();
 
                 // Ignore . and ..
-                if (strcmp(entry_name.c_str(), ".") == 0 || strcmp(entry_name.c_str(),"..")) {
+                if (strcmp(entry_name.c_str(), ".") == 0 || strcmp(entry_name.c_str(), "..") == 0) {
                     continue;
                 }
 
                 if (position == PROC_)
                 {   
-                    cout << entry_name << "\n";
                     if (!isDigit(entry_name)) continue;
                     string fileName = dir_name +  "/" + entry_name;
                     result = read_proc_file(fileName, pid, position + 1);
@@ -145,17 +150,65 @@ class ProcessCheck
             proc_pid_found = 0;
 
             /* NL threads */
+            struct stat statbuf;
             snprintf(char_pid, 31, "/proc/.%d", pid);
-            fstream file(char_pid, std::ios::in);
-            if (!file) return 1;
-            else { file.close(); } 
+            if (stat(char_pid, &statbuf) == 0) return 1;
 
             snprintf(char_pid, 31, "%d", pid);
             read_proc_dir("/proc", char_pid, PROC_);
             return (proc_pid_found);
         }
 
-        int loopAllPids(string ps)
+        pid_t readPidMax()
+        {
+            long value = 0;
+            std::ifstream file("/proc/sys/kernel/pid_max");
+            if (file >> value && value > 0) {
+                return (pid_t)value;
+            }
+            return MAX_PID;
+        }
+
+        /* Marks the PIDs listed in /proc and the threads listed under /proc/PID/task */
+        int snapshotProc(vector<bool> &listed, vector<bool> &tasks)
+        {
+            ProcParser parser;
+            vector<int> pids;
+            vector<int> tids;
+
+            if (parser.listPids(pids) == FAILED) {
+                return FAILED;
+            }
+            for (int pid : pids) {
+                if (pid <= max_pid) listed[pid] = true;
+                tids.clear();
+                parser.listTasks(pid, tids);
+                for (int tid : tids) {
+                    if (tid <= max_pid) tasks[tid] = true;
+                }
+            }
+            return SUCCESS;
+        }
+
+        /* Marks the PIDs reported by one run of ps(1) */
+        int snapshotPs(const string &ps, vector<bool> &in_ps)
+        {
+            char line[64];
+            string command = ps + " -e -o pid= 2>/dev/null";
+            FILE *fp = popen(command.c_str(), "r");
+
+            if (fp == NULL) {
+                return FAILED;
+            }
+            while (fgets(line, sizeof(line), fp) != NULL) {
+                long pid = strtol(line, NULL, 10);
+                if (pid > 0 && pid <= max_pid) in_ps[pid] = true;
+            }
+            return pclose(fp) == 0 ? SUCCESS : FAILED;
+        }
+
+        /* Runs the full set of probes on one PID whose snapshots disagree */
+        void checkPid(pid_t i, const string &ps)
         {
             int _kill0 = 0; 
             int _kill1 = 0;
@@ -168,164 +221,205 @@ class ProcessCheck
             int _proc_read  = 0;
             int _proc_chdir = 0;
 
-            pid_t i = 1;
-            pid_t my_pid;
-
             char command[OS_SIZE_1024 + 1];
 
-            my_pid = getpid();
+            /* kill test */
+            if (!((kill(i, 0) == -1) && (errno == ESRCH))) {
+                _kill0 = 1;
+            }
 
-            for (;; i++) 
-            {
-                cout << i << "\n";
-                if ((i <= 0) || (i > max_pid)) {
-                    break;
-                }
+            /* getsid test */
+            if (!((getsid(i) == -1) && (errno == ESRCH))) {
+                _gsid0 = 1;
+            }
 
-                total++;
+            /* getpgid test */
+            if (!((getpgid(i) == -1) && (errno == ESRCH))) {
+                _gpid0 = 1;
+            }
 
-                _kill0 = 0;
-                _kill1 = 0;
-                _gsid0 = 0;
-                _gsid1 = 0;
-                _gpid0 = 0;
-                _gpid1 = 0;
-                _ps0 = -1;
-
-                /* kill test */
-                if (!((kill(i, 0) == -1) && (errno == ESRCH))) {
-                    _kill0 = 1;
-                }
+            /* /proc test */
+            _proc_stat = proc_stat(i);
+            _proc_read = proc_read(i);
+            _proc_chdir = proc_chdir(i);
 
-                /* getsid test */
-                if (!((getsid(i) == -1) && (errno == ESRCH))) {
-                    _gsid0 = 1;
+            /* If PID does not exist, move on */
+            if (!_kill0     && !_gsid0     && !_gpid0 &&
+                    !_proc_stat && !_proc_read && !_proc_chdir) {
+                return;
+            }
+
+            /* Check if the process appears in ps(1) output */
+            if (!ps.empty()) {
+                snprintf(command, OS_SIZE_1024, "%s -p %d > /dev/null 2>&1", ps.c_str(), (int)i);
+                _ps0 = 0;
+                if (system(command) == 0) {
+                    _ps0 = 1;
                 }
+            }
+
+            /* Everything fine, move on */
+            if (_ps0 && _kill0 && _gsid0 && _gpid0 && _proc_stat && _proc_read) {
+                return;
+            }
+
+            /*
+            * If our kill or getsid system call got the PID but ps(1) did not,
+            * find out if the PID is deleted (not used anymore)
+            */
+            if (!((getsid(i) == -1) && (errno == ESRCH))) {
+                _gsid1 = 1;
+            }
+            if (!((kill(i, 0) == -1) && (errno == ESRCH))) {
+                _kill1 = 1;
+            }
+            if (!((getpgid(i) == -1) && (errno == ESRCH))) {
+                _gpid1 = 1;
+            }
 
-                /* getpgid test */
-                if (!((getpgid(i) == -1) && (errno == ESRCH))) {
-                    _gpid0 = 1;
+            _proc_stat = proc_stat(i);
+            _proc_read = proc_read(i);
+            _proc_chdir = proc_chdir(i);
+
+            /* If it matches, process was terminated in the meantime, so move on */
+            if (!_gsid1 && !_kill1 && !_gpid1 && !_proc_stat &&
+                    !_proc_read && !_proc_chdir) {
+                return;
+            }
+
+            if (_gsid0 == _gsid1 &&
+                    _kill0 == _kill1 &&
+                    _gsid0 != _kill0) {
+                /* If kill worked, but getsid and getpgid did not, it may
+                * be a defunct process -- ignore.
+                */
+                if (! (_kill0 == 1 && _gsid0 == 0 && _gpid0 == 0) ) {
+                    char op_msg[OS_SIZE_1024 + 1];
+
+                    snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
+                            "kill (%d) or getsid (%d). Possible kernel-level"
+                            " rootkit.", (int)i, _kill0, _gsid0);
+                    AgentUtils::writeLog(op_msg, CRITICAL);
+                    error++;
+                }
+            } else if (_kill1 != _gsid1 ||
+                    _gpid1 != _kill1 ||
+                    _gpid1 != _gsid1) {
+                /* See defunct process comment above */
+                if (! (_kill1 == 1 && _gsid0 == 0 && _gpid0 == 0 && _gsid1 == 0) ) {
+                    char op_msg[OS_SIZE_1024 + 1];
+
+                    snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
+                            "kill (%d), getsid (%d) or getpgid. Possible "
+                            "kernel-level rootkit.", (int)i, _kill1, _gsid1);
+                    AgentUtils::writeLog(op_msg, CRITICAL);
+                    error++;
                 }
+            } else if (_proc_read != _proc_stat  ||
+                    _proc_read != _proc_chdir ||
+                    _proc_stat != _kill1) {
+                /* Check if the pid is a thread (not showing in /proc */
+                if (!noproc && !check_rc_readproc((int)i)) {
+                    char op_msg[OS_SIZE_1024 + 1];
+
+                    snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
+                            "/proc. Possible kernel level rootkit.", (int)i);
+                    AgentUtils::writeLog(op_msg, CRITICAL);
+                    error++;
+                }
+            } else if (_gsid1 && _kill1 && !_ps0) {
+                /* checking if the pid is a thread (not showing on ps */
+                if (!check_rc_readproc((int)i)) {
+                    char op_msg[OS_SIZE_1024 + 1];
+
+                    snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
+                            "ps. Possible trojaned version installed.",
+                            (int)i);
+                    AgentUtils::writeLog(op_msg, CRITICAL);
+                    error++;
+                }
+            }
+        }
+
+        int loopAllPids(string ps)
+        {
+            pid_t my_pid = getpid();
+            int have_ps = 0;
 
-                /* /proc test */
-                _proc_stat = proc_stat(i);
-                _proc_read = proc_read(i);
-                _proc_chdir = proc_chdir(i);
+            max_pid = readPidMax();
+            vector<bool> listed(max_pid + 1, false);
+            vector<bool> tasks(max_pid + 1, false);
+            vector<bool> in_ps(max_pid + 1, false);
 
-                /* If PID does not exist, move on */
-                if (!_kill0     && !_gsid0     && !_gpid0 &&
-                        !_proc_stat && !_proc_read && !_proc_chdir) {
+            if (snapshotProc(listed, tasks) == FAILED) {
+                AgentUtils::writeLog(INVALID_PATH + proc_0, FAILED);
+            }
+            if (!ps.empty()) {
+                have_ps = snapshotPs(ps, in_ps) == SUCCESS;
+            }
+
+            /* Cheap pass: only PIDs where kill(2), /proc and ps(1) disagree get the full probes */
+            for (pid_t i = 1; i <= max_pid; i++) {
+                int alive = !((kill(i, 0) == -1) && (errno == ESRCH));
+
+                if (!alive && !listed[i]) {
                     continue;
                 }
+                total++;
 
-                /* Ignore our own pid */
+                if (alive && listed[i] && (!have_ps || in_ps[i])) {
+                    continue;
+                }
+                if (alive && !listed[i] && tasks[i]) {
+                    continue;
+                }
                 if (i == my_pid) {
                     continue;
                 }
 
+                checkPid(i, ps);
+
                 /* Check the number of errors */
                 if (error > 15) {
                     string error_msg = "Excessive number of hidden processes. It maybe a false-positive or something really bad is going on.";
                     AgentUtils::writeLog(error_msg, CRITICAL);
                     return FAILED;
                 }
+            }
 
-                /* Check if the process appears in ps(1) output */
-                if (!ps.empty()) {
-                    snprintf(command, OS_SIZE_1024, "%s -p %d > /dev/null 2>&1", ps.c_str(), (int)i);
-                    _ps0 = 0;
-                    if (system(command) == 0) {
-                        _ps0 = 1;
-                    }
-                }
-
-                /* Everything fine, move on */
-                if (_ps0 && _kill0 && _gsid0 && _gpid0 && _proc_stat && _proc_read) {
-                    continue;
-                }
-
-                /*
-                * If our kill or getsid system call got the PID but ps(1) did not,
-                * find out if the PID is deleted (not used anymore)
-                */
-                if (!((getsid(i) == -1) && (errno == ESRCH))) {
-                    _gsid1 = 1;
-                }
-                if (!((kill(i, 0) == -1) && (errno == ESRCH))) {
-                    _kill1 = 1;
-                }
-                if (!((getpgid(i) == -1) && (errno == ESRCH))) {
-                    _gpid1 = 1;
-                }
-
-                _proc_stat = proc_stat(i);
-                _proc_read = proc_read(i);
-                _proc_chdir = proc_chdir(i);
+            return SUCCESS;
+        }
 
-                /* If it matches, process was terminated in the meantime, so move on */
-                if (!_gsid1 && !_kill1 && !_gpid1 && !_proc_stat &&
-                        !_proc_read && !_proc_chdir) {
+        /**
+         * Compares a process table kept from kernel process events (see ProcEventListener) with the /proc
+         * directory listing. A tracked PID that is still alive but missing from the listing is hidden from
+         * readdir, which is what user- and kernel-level rootkits hook.
+         */
+        int checkTrackedPids(const vector<int> &tracked)
+        {
+            ProcParser parser;
+            vector<int> listed;
+            if (parser.listPids(listed) == FAILED)
+            {
+                AgentUtils::writeLog(INVALID_PATH + proc_0, FAILED);
+                return FAILED;
+            }
+            std::unordered_set<int> visible(listed.begin(), listed.end());
+            for (int pid : tracked)
+            {
+                if (visible.count(pid) || ((kill(pid, 0) == -1) && (errno == ESRCH)))
+                {
                     continue;
                 }
-
-                if (_gsid0 == _gsid1 &&
-                        _kill0 == _kill1 &&
-                        _gsid0 != _kill0) {
-                    /* If kill worked, but getsid and getpgid did not, it may
-                    * be a defunct process -- ignore.
-                    */
-                    if (! (_kill0 == 1 && _gsid0 == 0 && _gpid0 == 0) ) {
-                        char op_msg[OS_SIZE_1024 + 1];
-
-                        snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
-                                "kill (%d) or getsid (%d). Possible kernel-level"
-                                " rootkit.", (int)i, _kill0, _gsid0);
-                        AgentUtils::writeLog(op_msg, CRITICAL);
-                        error++;
-                    }
-                } else if (_kill1 != _gsid1 ||
-                        _gpid1 != _kill1 ||
-                        _gpid1 != _gsid1) {
-                    /* See defunct process comment above */
-                    if (! (_kill1 == 1 && _gsid0 == 0 && _gpid0 == 0 && _gsid1 == 0) ) {
-                        char op_msg[OS_SIZE_1024 + 1];
-
-                        snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
-                                "kill (%d), getsid (%d) or getpgid. Possible "
-                                "kernel-level rootkit.", (int)i, _kill1, _gsid1);
-                        AgentUtils::writeLog(op_msg, CRITICAL);
-                        error++;
-                    }
-                } else if (_proc_read != _proc_stat  ||
-                        _proc_read != _proc_chdir ||
-                        _proc_stat != _kill1) {
-                    /* Check if the pid is a thread (not showing in /proc */
-                    if (!noproc && !check_rc_readproc((int)i)) {
-                        char op_msg[OS_SIZE_1024 + 1];
-
-                        snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
-                                "/proc. Possible kernel level rootkit.", (int)i);
-                        AgentUtils::writeLog(op_msg, CRITICAL);
-                        error++;
-                    }
-                } else if (_gsid1 && _kill1 && !_ps0) {
-                    /* checking if the pid is a thread (not showing on ps */
-                    if (!check_rc_readproc((int)i)) {
-                        char op_msg[OS_SIZE_1024 + 1];
-
-                        snprintf(op_msg, OS_SIZE_1024, "Process '%d' hidden from "
-                                "ps. Possible trojaned version installed.",
-                                (int)i);
-                        AgentUtils::writeLog(op_msg, CRITICAL);
-                        error++;
-                    }
-                }
+                char op_msg[OS_SIZE_1024 + 1];
+                snprintf(op_msg, OS_SIZE_1024, "Process '%d' reported by the kernel but hidden from "
+                        "/proc. Possible kernel level rootkit.", pid);
+                AgentUtils::writeLog(op_msg, CRITICAL);
+                error++;
             }
-
             return SUCCESS;
-
         }
-    
+
         int check()
         {
             int result = SUCCESS;
@@ -341,9 +435,15 @@ class ProcessCheck
                 }
             }
 
+            total = 0;
+            error = 0;
             if (std::filesystem::exists(proc_0) && std::filesystem::exists(proc_1)) { noproc = 0; }
 
-            if ((result = loopAllPids(location)))
+            if ((result = loopAllPids(location)) == SUCCESS && tracker != nullptr && tracker->isRunning())
+            {
+                result = checkTrackedPids(tracker->getPids());
+            }
+            if (result == SUCCESS)
             {
                 AgentUtils::writeLog("Successfully process check completed.", INFO);
             }
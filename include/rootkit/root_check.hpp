@@ -8,92 +8,319 @@
 #include "rootkit/process_check.hpp"
 #include "rootkit/trojen_check.hpp"
 #include "rootkit/sysfile_check.hpp"
+#include "service/threadpool.hpp"
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #define TROJAN_SOURCE_FILE "/etc/scl/ids/source/rootkit_trojans.txt"
 #define SYS_SOURCE_FILE "/etc/scl/ids/source/rootkit_files.txt"
+#define ROOTCHECK_COUNT 7
+
+typedef struct rootcheck_result rootcheck_result;
+
+/**
+ * @brief Root Check Result
+ *
+ * The outcome and cost of one check run by `RootCheck`.
+ */
+struct rootcheck_result
+{
+    string name;
+    int status = FAILED;
+    double wallTime = 0.0; /**< Seconds from start to end of the check. */
+    double cpuTime = 0.0; /**< Seconds of CPU used by the check, including its worker threads. */
+    int items = 0; /**< Files, processes, interfaces or ports analyzed. */
+    int findings = 0;
+};
 
 class RootCheck
 {
-    
+
     private:
         TrojenCheck trojanCheck;
         SysCheck sysCheck;
         ProcessCheck processCheck;
         PortCheck portCheck;
         DevCheck devCheck;
-        interfaceCheck interfaceCheck;
+        InterfaceCheck interfaceCheck;
+        ProcEventListener procEvents; /* Process table from kernel process events, cross-checked by the process check */
+        FsIndex fsIndex; /* One walk of / shared by the sysfile and dev checks */
         string trojanSourceFile;
         string sysSourceFile;
+        size_t maxThreads = 0; /* Checks run at once, 0 runs all of them */
+        int niceValue = 0; /* Scheduling priority of the check threads */
+        vector<rootcheck_result> results;
+
+        static double threadCpuTime()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            return now.tv_sec + now.tv_nsec / 1e9;
+        }
+
+        /* Whether the file system walk finished, logging why when it threw instead */
+        static bool indexAvailable(const std::shared_future<void> &indexReady)
+        {
+            try {
+                indexReady.get();
+                return true;
+            } catch (const std::exception &e) {
+                AgentUtils::writeLog("File system index unavailable: " + string(e.what()), FAILED);
+            } catch (...) {
+                AgentUtils::writeLog("File system index unavailable", FAILED);
+            }
+            return false;
+        }
+
+        rootcheck_result runCheck(const string &name, const std::function<int()> &check)
+        {
+            rootcheck_result result;
+            result.name = name;
+
+            if (niceValue != 0 && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), niceValue) != 0) {
+                AgentUtils::writeLog("Unable to lower the priority of the " + name + " root check", WARNING);
+            }
+            AgentUtils::writeLog("Starting " + name + " root check.", INFO);
+            auto start = std::chrono::steady_clock::now();
+            double cpuStart = threadCpuTime();
+
+            result.status = check();
+
+            result.cpuTime = threadCpuTime() - cpuStart;
+            result.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (result.status == SUCCESS) {
+                AgentUtils::writeLog(name + " root check completed successfully.", SUCCESS);
+            } else {
+                AgentUtils::writeLog(name + " root check failed", FAILED);
+            }
+            return result;
+        }
+
+        int saveResults(double wallTime, double cpuTime)
+        {
+            string path = OS::getJsonWritePath("rootcheck");
+            string hostName;
+            Json::Value jsonData;
+            Json::Value checks(Json::arrayValue);
+            Json::StreamWriterBuilder writerBuilder;
+            writerBuilder["indentation"] = "";
+
+            AgentUtils::getHostName(hostName);
+            for (const rootcheck_result &result : results) {
+                Json::Value value;
+                value["Name"] = result.name;
+                value["Status"] = result.status == SUCCESS ? "success" : "failed";
+                value["WallTime"] = result.wallTime;
+                value["CpuTime"] = result.cpuTime;
+                value["Items"] = result.items;
+                value["Findings"] = result.findings;
+                checks.append(value);
+            }
+            jsonData["HostName"] = hostName;
+            jsonData["TimeGenerated"] = AgentUtils::getCurrentTime();
+            jsonData["WallTime"] = wallTime;
+            jsonData["CpuTime"] = cpuTime;
+            jsonData["MaxThreads"] = (Json::UInt64)maxThreads;
+            jsonData["Checks"] = checks;
+
+            if (path.empty()) {
+                return FAILED;
+            }
+            std::ostringstream document;
+            std::unique_ptr<Json::StreamWriter> writer(writerBuilder.newStreamWriter());
+            writer->write(jsonData, &document);
+            if (OS::writeFileAtomic(path, document.str()) == FAILED) {
+                return FAILED;
+            }
+            AgentUtils::writeLog("Rootkit check results written to " + path, DEBUG);
+            return SUCCESS;
+        }
 
     public:
         RootCheck()
         {
             this->trojanSourceFile = TROJAN_SOURCE_FILE;
             this->sysSourceFile    = SYS_SOURCE_FILE;
+            processCheck.setTracker(&procEvents);
         }
 
         RootCheck(string trojanSourceFile, string sysSourceFile)
         {
             this->trojanSourceFile = trojanSourceFile;
-            this->sysSourceFile    = sysSourceFile; 
+            this->sysSourceFile    = sysSourceFile;
+            processCheck.setTracker(&procEvents);
         }
 
-        int check()
+        /**
+         * @brief Configure Root Check
+         *
+         * Reads the `[rootkit]` section. `trojan_path` and `file_path` replace the signature files, `max_threads` caps
+         * the number of checks, and of trojan scan and port sweep workers, running at once, and `nice` lowers the priority of the
+         * check threads. Together they bound the CPU a scan takes on low-power devices. `interface_events = 1` keeps a
+         * link notification listener running, so interfaces entering promiscuous mode are reported between scans.
+         * `proc_events = 1` keeps a table of the running processes from kernel process events, and the process check
+         * reports every process in that table that is alive but missing from `/proc`.
+         *
+         * @param[in] config The key-value pairs of the `[rootkit]` section.
+         * @return An integer result code:
+         *         - SUCCESS: The configuration was applied.
+         *         - FAILED: A value is not valid.
+         */
+        int configure(map<string, string> &config)
         {
-            AgentUtils::writeLog("Starting trojan root check.", INFO);
-            if (trojanCheck.check(trojanSourceFile))
-            {
-                AgentUtils::writeLog("Trojan root check completed successfully.", SUCCESS);
-            }
-            else
-            {
-                AgentUtils::writeLog("Trojan root check failed", FAILED);
-            }
-            AgentUtils::writeLog("Completed trojan root check.", INFO);
-            AgentUtils::writeLog("Starting sysfiles root check.");
-            if (sysCheck.check(sysSourceFile))
-            {
-                AgentUtils::writeLog("SysFiles root check completed successfully.", SUCCESS);
-            }
-            else
+            string trojanPath = AgentUtils::trim(config["trojan_path"]);
+            string filePath = AgentUtils::trim(config["file_path"]);
+            string threads = AgentUtils::trim(config["max_threads"]);
+            string nice = AgentUtils::trim(config["nice"]);
+            string interfaceEvents = AgentUtils::trim(config["interface_events"]);
+            string processEvents = AgentUtils::trim(config["proc_events"]);
+
+            if (!trojanPath.empty()) trojanSourceFile = trojanPath;
+            if (!filePath.empty()) sysSourceFile = filePath;
+            try
             {
-                AgentUtils::writeLog("Sysfiles root check failed", FAILED);
+                maxThreads = threads.empty() ? 0 : (size_t)std::stoul(threads);
+                niceValue = nice.empty() ? 0 : std::stoi(nice);
             }
-            AgentUtils::writeLog("Completed sysfiles root check.");
-            AgentUtils::writeLog("Starting network interface root check.", INFO);
-            if (interfaceCheck.check())
+            catch (const std::exception &e)
             {
-                AgentUtils::writeLog("network interface  root check completed successfully.", SUCCESS);
+                AgentUtils::writeLog("Invalid max_threads or nice configured for rootkit: " + threads + ", " + nice, FAILED);
+                return FAILED;
             }
-            else
-            {
-                AgentUtils::writeLog("network interface root check failed", FAILED);
+            if (niceValue < 0 || niceValue > 19) {
+                AgentUtils::writeLog("Invalid nice configured for rootkit: " + nice, FAILED);
+                return FAILED;
             }
-            AgentUtils::writeLog("Completed network interface root Check.", INFO);
-            AgentUtils::writeLog("Starting dev root check.", INFO);
-            if (devCheck.check())
-            {
-                AgentUtils::writeLog("dev root check completed successfully.", SUCCESS);
-            }
-            else
-            {
-                AgentUtils::writeLog("dev root check failed", FAILED);
+            trojanCheck.setWorkers(maxThreads);
+            portCheck.setWorkers(maxThreads);
+
+            if (interfaceEvents.empty() || interfaceEvents == "0") {
+                interfaceCheck.stopWatch();
+            } else if (interfaceEvents != "1") {
+                AgentUtils::writeLog("Invalid interface_events configured for rootkit: " + interfaceEvents, FAILED);
+                return FAILED;
+            } else if (interfaceCheck.startWatch() == FAILED) {
+                AgentUtils::writeLog("Link events unavailable, interfaces are checked during scans only", WARNING);
             }
-            AgentUtils::writeLog("Completed dev root check.", INFO);
-            AgentUtils::writeLog("Starting process root check", INFO);
-            AgentUtils::writeLog("This process might take more time");
-            if (processCheck.check())
-            {
-                AgentUtils::writeLog("Process root check completed successfully.", SUCCESS);
+
+            if (processEvents.empty() || processEvents == "0") {
+                procEvents.stop();
+            } else if (processEvents != "1") {
+                AgentUtils::writeLog("Invalid proc_events configured for rootkit: " + processEvents, FAILED);
+                return FAILED;
+            } else if (procEvents.start() == FAILED) {
+                AgentUtils::writeLog("Process events unavailable, hidden processes are found by probing PIDs only", WARNING);
             }
-            else
+            return SUCCESS;
+        }
+
+        /**
+         * @brief Get Check Results
+         *
+         * @return The results of the last `check`, in the order the checks are listed.
+         */
+        const vector<rootcheck_result> &getResults() const
+        {
+            return results;
+        }
+
+        /**
+         * @brief Run Root Check
+         *
+         * Runs the trojan, sysfile, interface, dev, process and port checks concurrently on a pool of at most `max_threads`
+         * threads, so the scan takes as long as the slowest check. The file system is walked once, as its own task,
+         * and the sysfile and dev checks both read that walk. The timing, item count and findings of every task are
+         * written as JSON to the `rootcheck` log directory.
+         *
+         * @return SUCCESS once all checks have finished, whatever their individual status.
+         */
+        int check()
+        {
+            auto start = std::chrono::steady_clock::now();
+            struct rusage usageStart, usageEnd;
+            getrusage(RUSAGE_SELF, &usageStart);
+
+            size_t threads = (maxThreads == 0 || maxThreads > ROOTCHECK_COUNT) ? ROOTCHECK_COUNT : maxThreads;
+            vector<std::future<rootcheck_result>> pending;
+            std::promise<void> indexBuilt;
+            std::shared_future<void> indexReady = indexBuilt.get_future().share();
+            fsIndex = FsIndex("/");
+            fsIndex.retain("/dev");
+            int sysLoaded = sysCheck.load(sysSourceFile, fsIndex);
             {
-                 AgentUtils::writeLog("Process root check failed", FAILED);
+                ThreadPool pool(threads);
+                /* Submitted first, so with a single worker it runs before the checks that wait on it */
+                pending.push_back(pool.submit([this, &indexBuilt] {
+                    rootcheck_result result;
+                    result.name = "filesystem index";
+                    try {
+                        result = runCheck(result.name, [this] { return fsIndex.build(); });
+                        result.items = (int)fsIndex.visited();
+                        indexBuilt.set_value();
+                    } catch (...) {
+                        /* The checks waiting on the index rethrow this and fail instead of blocking */
+                        indexBuilt.set_exception(std::current_exception());
+                    }
+                    return result;
+                }));
+                pending.push_back(pool.submit([this] {
+                    rootcheck_result result = runCheck("trojan", [this] { return trojanCheck.check(trojanSourceFile); });
+                    result.cpuTime += trojanCheck.getWorkerCpuTime();
+                    result.items = trojanCheck.getTotal();
+                    result.findings = trojanCheck.getFindings();
+                    return result;
+                }));
+                pending.push_back(pool.submit([this, sysLoaded, indexReady] {
+                    indexReady.wait();
+                    rootcheck_result result = runCheck("sysfiles", [this, sysLoaded, indexReady] {
+                        return sysLoaded == FAILED || !indexAvailable(indexReady) ? FAILED : sysCheck.check(fsIndex);
+                    });
+                    result.items = sysCheck.getTotal();
+                    result.findings = sysCheck.getFindings();
+                    return result;
+                }));
+                pending.push_back(pool.submit([this] {
+                    rootcheck_result result = runCheck("network interface", [this] { return interfaceCheck.check(); });
+                    result.items = interfaceCheck.getTotal();
+                    result.findings = interfaceCheck.getFindings();
+                    return result;
+                }));
+                pending.push_back(pool.submit([this, indexReady] {
+                    indexReady.wait();
+                    rootcheck_result result = runCheck("dev", [this, indexReady] { return indexAvailable(indexReady) ? devCheck.check(fsIndex) : FAILED; });
+                    result.items = devCheck.getTotal();
+                    result.findings = devCheck.getFindings();
+                    return result;
+                }));
+                pending.push_back(pool.submit([this] {
+                    rootcheck_result result = runCheck("process", [this] { return processCheck.check(); });
+                    result.items = processCheck.getTotal();
+                    result.findings = processCheck.getFindings();
+                    return result;
+                }));
+                pending.push_back(pool.submit([this] {
+                    rootcheck_result result = runCheck("port", [this] { return portCheck.check(); });
+                    result.cpuTime += portCheck.getWorkerCpuTime();
+                    result.items = portCheck.getTotal();
+                    result.findings = portCheck.getFindings();
+                    return result;
+                }));
+
+                results.clear();
+                for (auto &result : pending) {
+                    results.push_back(result.get());
+                }
             }
-            AgentUtils::writeLog("Completed process root check", INFO);
+
+            getrusage(RUSAGE_SELF, &usageEnd);
+            double cpuTime = (usageEnd.ru_utime.tv_sec - usageStart.ru_utime.tv_sec) + (usageEnd.ru_stime.tv_sec - usageStart.ru_stime.tv_sec)
+                + ((usageEnd.ru_utime.tv_usec - usageStart.ru_utime.tv_usec) + (usageEnd.ru_stime.tv_usec - usageStart.ru_stime.tv_usec)) / 1e6;
+            double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            AgentUtils::writeLog("Rootkit check finished in " + std::to_string(wallTime) + " seconds.", INFO);
+            saveResults(wallTime, cpuTime);
             return SUCCESS;
         }
 
 };
 
-#endif
\ No newline at end of file
+#endif
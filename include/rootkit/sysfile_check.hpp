@@ -4,29 +4,57 @@
 
 
 #include "agentUtils.hpp"
+#include "rootkit/fs_index.hpp"
 
 /*
     1.identify the files attendance.
     2.Source file neede to retrive the pre identified malware filepaths.
+    3.Plain entries are paths below base_dir, entries starting with "*" match
+      the part from their first '/' as a suffix anywhere. Both are looked up
+      during one walk of the file system.
 */
 
 class SysCheck
 {
     private:
-        string rk_sys_file[MAX_RK_SYS +  1];
-        string rk_sys_name[MAX_RK_SYS + 1];
-        int rk_sys_count;
-        const string base_dir = "/";
-        int errors;
-        int total;
+        vector<string> rk_sys_file; /* Path, or suffix for wildcard entries */
+        vector<string> rk_sys_name;
+        vector<bool> rk_sys_wildcard;
+        string base_dir = "/";
+        int errors = 0;
+        int total = 0;
     
     public:
 
-        int check(const string sourceFile)
+        SysCheck() {}
+
+        explicit SysCheck(const string &base_dir)
+        {
+            this->base_dir = base_dir;
+            if (this->base_dir.empty() || this->base_dir.back() != '/')
+            {
+                this->base_dir += '/';
+            }
+        }
+
+        int getTotal() const
+        {
+            return total;
+        }
+
+        int getFindings() const
+        {
+            return errors;
+        }
+
+        /* Reads the signature file and registers every entry with the index,
+           which must be built before check(index) */
+        int load(const string sourceFile, FsIndex &index)
         {
             total = 0;
-            errors = 0;
-            rk_sys_count = 0;
+            rk_sys_file.clear();
+            rk_sys_name.clear();
+            rk_sys_wildcard.clear();
             fstream file(sourceFile, std::ios::in);
 
             if (!file)
@@ -34,50 +62,86 @@ class SysCheck
                 AgentUtils::writeLog(sourceFile + " not exists.", FAILED);
                 return FAILED;
             }
+            index.ignorePath(base_dir + "proc");
+            index.ignorePath(base_dir + "sys");
+
             string line;
             while (std::getline(file, line))
             {
-                total++;
-                /* Check rk_sys_count for IOB exception */
-                if (rk_sys_count >= MAX_RK_SYS)
-                {
-                    AgentUtils::writeLog("RK_SYS count reached", WARNING);
-                    break;
-                }
                 /* continue comments and empty lines */
-                if (line[0] == '#' || line.empty())
+                if (line.empty() || line[0] == '#')
                 {
                     continue;
                 } 
+                total++;
 
                 int mid = (int)line.find_first_of('!');
                 string file = AgentUtils::trim(line.substr(0, mid));
                 int end = (int)line.find_first_of(':');
                 string name = AgentUtils::trim(line.substr(mid + 1, end - mid - 1));
-                string filePath = base_dir + file;
+                if (file.empty())
+                {
+                    continue;
+                }
+                int id = (int)rk_sys_file.size();
                 if (file[0] == '*')
                 {
-                    string temp = file.substr(file.find_first_of('/'));
-                    rk_sys_file[rk_sys_count] = temp;
-                    rk_sys_name[rk_sys_count] = name;
-                    if (rk_sys_name[rk_sys_count].empty() || rk_sys_file[rk_sys_count].empty()) 
+                    size_t slash = file.find_first_of('/');
+                    if (slash == string::npos)
                     {
-                        AgentUtils::writeLog("Could not acquire memory", WARNING);
-                        rk_sys_file[rk_sys_count].clear();
-                        rk_sys_name[rk_sys_count].clear();
+                        continue;
                     }
-                    rk_sys_count++;
+                    rk_sys_file.push_back(file.substr(slash));
+                    rk_sys_name.push_back(name);
+                    rk_sys_wildcard.push_back(true);
+                    index.addSuffix(rk_sys_file.back(), id);
                     continue;
                 }
+                rk_sys_file.push_back(base_dir + file);
+                rk_sys_name.push_back(name);
+                rk_sys_wildcard.push_back(false);
+                index.addPath(rk_sys_file.back(), id);
+            }
+
+            file.close();
+            return SUCCESS;
+        }
 
-                if (std::filesystem::exists(filePath))
+        int check(const FsIndex &index)
+        {
+            errors = 0;
+            vector<bool> found(rk_sys_file.size(), false);
+
+            for (const fs_match &match : index.matches())
+            {
+                if (match.id < 0 || match.id >= (int)rk_sys_file.size())
                 {
-                    AgentUtils::writeLog("Rootkit " + name + " detected by the presence of file " + file, CRITICAL);
-                    errors++;
+                    continue;
                 }
+                found[match.id] = true;
+                AgentUtils::writeLog("Rootkit " + rk_sys_name[match.id] + " detected by the presence of file " + match.path, CRITICAL);
+                errors++;
             }
 
-            file.close();
+            /* A listed path the walk did not see, but lstat(2) does, is hidden
+               from readdir(3) or lies outside the walked tree */
+            for (size_t i = 0; i < rk_sys_file.size(); i++)
+            {
+                struct stat statbuf;
+                if (found[i] || rk_sys_wildcard[i] || lstat(rk_sys_file[i].c_str(), &statbuf) != 0)
+                {
+                    continue;
+                }
+                if (index.isReachable(rk_sys_file[i]))
+                {
+                    AgentUtils::writeLog("Rootkit " + rk_sys_name[i] + " detected by the presence of file " + rk_sys_file[i] + ", which is hidden from the directory listing.", CRITICAL);
+                }
+                else
+                {
+                    AgentUtils::writeLog("Rootkit " + rk_sys_name[i] + " detected by the presence of file " + rk_sys_file[i], CRITICAL);
+                }
+                errors++;
+            }
 
             AgentUtils::writeLog("Total " + std::to_string(total) + " number of rootkit files processed.");
 
@@ -88,6 +152,18 @@ class SysCheck
             return SUCCESS;
         }
 
+        int check(const string sourceFile)
+        {
+            FsIndex index(base_dir);
+
+            if (load(sourceFile, index) == FAILED)
+            {
+                return FAILED;
+            }
+            index.build();
+            return check(index);
+        }
+
 };
 
 #endif
\ No newline at end of file
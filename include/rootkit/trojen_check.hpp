@@ -4,42 +4,216 @@
 
 
 #include "agentUtils.hpp"
+#include "service/ahocorasick.hpp"
+#include "service/threadpool.hpp"
+#include <sys/mman.h>
+
+#define TROJAN_MIN_ANCHOR 3
+
+typedef struct trojan_signature trojan_signature;
+typedef struct trojan_target trojan_target;
+
+/**
+ * @brief Trojan Signature
+ *
+ * One line of the trojan signature file: the binary it applies to and the compiled pattern.
+ */
+struct trojan_signature
+{
+    string binary;
+    string pattern;
+    std::regex regex;
+    bool verifyAlways = false; /**< No literal is required by every branch, so the regex runs on every candidate file. */
+};
+
+/**
+ * @brief Trojan Target
+ *
+ * One binary to scan and the signatures that apply to it.
+ */
+struct trojan_target
+{
+    string path;
+    vector<int> signatures;
+};
 
 class TrojenCheck
 {
 private:
     vector<string> rootFolders = {"bin", "sbin", "usr/bin", "usr/sbin"};
-    const string baseDirectory = "/";
-    int detected;
-    int total;
+    string baseDirectory = "/";
+    int detected = 0;
+    int total = 0;
+    size_t workers = 0; /* Threads used to scan binaries, 0 uses the number of online CPUs */
+    std::atomic<long long> workerCpuTime{0}; /* CPU time of the scan tasks in nanoseconds */
+    vector<trojan_signature> signatures;
+    AhoCorasick anchors;
 
-    bool patternMatching(const string file, const string pattern)
+    /**
+     * @brief Split Alternatives
+     *
+     * Splits a pattern on the `|` operators that are not inside a group or a bracket expression.
+     */
+    static vector<string> splitBranches(const string &pattern)
     {
-        std::ifstream fp(file, std::ios::binary);
-
-        if (!fp.is_open())
-        {
-            AgentUtils::writeLog(FILE_ERROR + file, FAILED);
-            return false;
-        }
-        char buffer[OS_SIZE_1024];
-        string content;
-        while (fp.read(buffer, OS_SIZE_1024))
+        vector<string> branches;
+        string current;
+        int depth = 0;
+        bool inBracket = false;
+        for (size_t i = 0; i < pattern.size(); i++)
         {
-            content.append(buffer, fp.gcount());
+            char c = pattern[i];
+            if (c == '\\' && i + 1 < pattern.size())
+            {
+                current += c;
+                current += pattern[++i];
+                continue;
+            }
+            if (inBracket)
+            {
+                if (c == ']')
+                    inBracket = false;
+            }
+            else if (c == '[')
+            {
+                inBracket = true;
+                if (i + 1 < pattern.size() && pattern[i + 1] == '^')
+                    current += pattern[i++];
+                if (i + 1 < pattern.size() && pattern[i + 1] == ']')
+                    current += pattern[i++];
+            }
+            else if (c == '(')
+            {
+                depth++;
+            }
+            else if (c == ')')
+            {
+                depth--;
+            }
+            else if (c == '|' && depth == 0)
+            {
+                branches.push_back(current);
+                current.clear();
+                continue;
+            }
+            current += c;
         }
-        if (fp.bad())
+        branches.push_back(current);
+        return branches;
+    }
+
+    /**
+     * @brief Required Literal
+     *
+     * Returns the longest run of plain characters that every match of the branch must contain. Groups, bracket
+     * expressions, anchors, wildcards and optional characters end a run.
+     *
+     * @param[out] exact Set to true when the branch is nothing but that literal, so finding it is a match.
+     */
+    static string requiredLiteral(const string &branch, bool &exact)
+    {
+        int runs = 0;
+        bool other = false;
+        string best;
+        string current;
+        size_t i = 0;
+        auto endRun = [&]() {
+            if (!current.empty())
+                runs++;
+            if (current.size() > best.size())
+                best = current;
+            current.clear();
+        };
+        while (i < branch.size())
         {
-            AgentUtils::writeLog(FREAD_FAILED + file, FAILED);
-            return false;
+            char c = branch[i];
+            char literal = 0;
+            bool isLiteral = false;
+            if (c == '\\' && i + 1 < branch.size())
+            {
+                char escaped = branch[i + 1];
+                isLiteral = !isalnum((unsigned char)escaped);
+                literal = escaped;
+                i += 2;
+            }
+            else if (c == '[')
+            {
+                i++;
+                if (i < branch.size() && branch[i] == '^')
+                    i++;
+                if (i < branch.size() && branch[i] == ']')
+                    i++;
+                while (i < branch.size() && branch[i] != ']')
+                    i += (branch[i] == '\\') ? 2 : 1;
+                i++;
+            }
+            else if (c == '(')
+            {
+                int depth = 0;
+                while (i < branch.size())
+                {
+                    if (branch[i] == '\\')
+                    {
+                        i += 2;
+                        continue;
+                    }
+                    if (branch[i] == '(')
+                        depth++;
+                    else if (branch[i] == ')' && --depth == 0)
+                        break;
+                    i++;
+                }
+                i++;
+            }
+            else if (c == '{')
+            {
+                while (i < branch.size() && branch[i] != '}')
+                    i++;
+                i++;
+            }
+            else if (strchr(".^$*+?)", c) == NULL)
+            {
+                isLiteral = true;
+                literal = c;
+                i++;
+            }
+            else
+            {
+                i++;
+            }
+
+            if (!isLiteral)
+            {
+                other = true;
+                endRun();
+                continue;
+            }
+            char quantifier = i < branch.size() ? branch[i] : 0;
+            if (quantifier == '*' || quantifier == '?' || quantifier == '{')
+            {
+                other = true;
+                endRun();
+                continue;
+            }
+            current += literal;
+            if (quantifier == '+')
+            {
+                other = true;
+                endRun();
+            }
         }
-        std::regex regex(pattern);
-        return std::regex_search(content, regex);
+        endRun();
+        exact = !other && runs == 1;
+        return best;
     }
 
-public:
-
-    int check(const string filePath)
+    /**
+     * @brief Load Signatures
+     *
+     * Parses the signature file, compiles every pattern once and adds the required literals of all patterns to a
+     * single automaton.
+     */
+    int loadSignatures(const string &filePath)
     {
         fstream fp(filePath, std::ios::in);
         string line;
@@ -48,8 +222,8 @@ public:
             AgentUtils::writeLog(FILE_ERROR + filePath, FAILED);
             return FAILED;
         }
-        detected = 0;
-        total = 0;
+        signatures.clear();
+        anchors = AhoCorasick();
 
         while (std::getline(fp, line))
         {
@@ -58,18 +232,224 @@ public:
             int start = 0;
             int mid = (int)line.find_first_of('!');
             int end = (int)line.find_last_of('!');
-            string searchBinary = AgentUtils::trim(line.substr(start, mid));
-            string pattern = AgentUtils::trim(line.substr(mid + 1, (end - mid - 1)));
+            if (mid < 0 || end <= mid)
+                continue;
             total++;
-            for (string folder : rootFolders)
+
+            trojan_signature signature;
+            signature.binary = AgentUtils::trim(line.substr(start, mid));
+            signature.pattern = AgentUtils::trim(line.substr(mid + 1, (end - mid - 1)));
+            try
+            {
+                signature.regex = std::regex(signature.pattern, std::regex::optimize);
+            }
+            catch (const std::regex_error &e)
+            {
+                AgentUtils::writeLog("Invalid trojan signature for " + signature.binary + ": " + signature.pattern, FAILED);
+                continue;
+            }
+            vector<std::pair<string, bool>> literals;
+            for (const string &branch : splitBranches(signature.pattern))
             {
-                string path = baseDirectory + folder + "/" + searchBinary;
-                if (!std::filesystem::exists(path))
+                bool exact = false;
+                string literal = requiredLiteral(branch, exact);
+                if (literal.size() < TROJAN_MIN_ANCHOR)
+                {
+                    signature.verifyAlways = true;
+                    break;
+                }
+                literals.emplace_back(literal, exact);
+            }
+            // The automaton id carries the signature and whether the literal alone proves a match.
+            int id = (int)signatures.size();
+            if (!signature.verifyAlways)
+            {
+                for (const auto &literal : literals)
+                    anchors.add(literal.first, id * 2 + (literal.second ? 1 : 0));
+            }
+            signatures.push_back(std::move(signature));
+        }
+        anchors.build();
+        return SUCCESS;
+    }
+
+    /**
+     * @brief Collect Targets
+     *
+     * Resolves the binaries named by the signatures under every root folder. Paths that lead to the same file, such as
+     * `/bin/ls` and `/usr/bin/ls` on merged-usr systems, are scanned once.
+     */
+    vector<trojan_target> collectTargets()
+    {
+        vector<trojan_target> targets;
+        std::map<std::pair<dev_t, ino_t>, size_t> seen;
+        for (size_t id = 0; id < signatures.size(); id++)
+        {
+            for (const string &folder : rootFolders)
+            {
+                string path = baseDirectory + folder + "/" + signatures[id].binary;
+                struct stat fileStat;
+                if (stat(path.c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
                     continue;
-                if (patternMatching(path, pattern))
+                auto key = std::make_pair(fileStat.st_dev, fileStat.st_ino);
+                auto found = seen.find(key);
+                if (found == seen.end())
+                {
+                    found = seen.emplace(key, targets.size()).first;
+                    targets.push_back({path, {}});
+                }
+                vector<int> &applied = targets[found->second].signatures;
+                if (std::find(applied.begin(), applied.end(), (int)id) == applied.end())
+                    applied.push_back((int)id);
+            }
+        }
+        return targets;
+    }
+
+    /**
+     * @brief Scan Binary
+     *
+     * Maps the file once and runs the automaton over it. A signature matches outright when a branch that is a plain
+     * literal is found; the regex only runs for signatures whose other literals were found or that have no usable
+     * literal.
+     *
+     * @return The ids of the signatures that matched.
+     */
+    vector<int> scanTarget(const trojan_target &target) const
+    {
+        vector<int> matched;
+        int fd = open(target.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            AgentUtils::writeLog(FILE_ERROR + target.path, FAILED);
+            return matched;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            close(fd);
+            return matched;
+        }
+        size_t size = (size_t)fileStat.st_size;
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            AgentUtils::writeLog(FREAD_FAILED + target.path, FAILED);
+            return matched;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        const char *data = (const char *)mapped;
+
+        // 0: not seen, 1: a literal was found and the regex decides, 2: matched.
+        vector<char> relevant(signatures.size(), 0);
+        vector<char> state(signatures.size(), 0);
+        size_t remaining = 0;
+        for (int id : target.signatures)
+        {
+            relevant[id] = 1;
+            if (signatures[id].verifyAlways)
+                state[id] = 1;
+            else
+                remaining++;
+        }
+        if (remaining > 0)
+        {
+            anchors.scan(data, size, [&](int value) {
+                int id = value / 2;
+                if (relevant[id] && state[id] != 2)
+                {
+                    if (value % 2 == 1)
+                    {
+                        state[id] = 2;
+                        remaining--;
+                    }
+                    else
+                    {
+                        state[id] = 1;
+                    }
+                }
+                return remaining > 0;
+            });
+        }
+        for (int id : target.signatures)
+        {
+            if (state[id] == 2 || (state[id] == 1 && std::regex_search(data, data + size, signatures[id].regex)))
+                matched.push_back(id);
+        }
+        munmap(mapped, size);
+        return matched;
+    }
+
+public:
+
+    TrojenCheck() {}
+
+    /**
+     * @brief Trojan Check Constructor
+     *
+     * @param[in] baseDirectory The directory the root folders are resolved against, "/" by default.
+     */
+    explicit TrojenCheck(const string &baseDirectory)
+    {
+        this->baseDirectory = baseDirectory;
+        if (this->baseDirectory.empty() || this->baseDirectory.back() != '/')
+            this->baseDirectory += '/';
+    }
+
+    void setWorkers(size_t count)
+    {
+        workers = count;
+    }
+
+    int getTotal() const
+    {
+        return total;
+    }
+
+    int getFindings() const
+    {
+        return detected;
+    }
+
+    /**
+     * @brief Get Worker CPU Time
+     *
+     * @return The CPU time, in seconds, the scan tasks of the last `check` spent on the worker threads.
+     */
+    double getWorkerCpuTime() const
+    {
+        return workerCpuTime.load() / 1e9;
+    }
+
+    int check(const string filePath)
+    {
+        detected = 0;
+        total = 0;
+        workerCpuTime = 0;
+        if (loadSignatures(filePath) == FAILED)
+            return FAILED;
+
+        vector<trojan_target> targets = collectTargets();
+        vector<std::future<vector<int>>> results;
+        {
+            ThreadPool pool(std::min(workers == 0 ? (size_t)std::thread::hardware_concurrency() : workers, std::max(targets.size(), (size_t)1)));
+            for (const trojan_target &target : targets)
+                results.push_back(pool.submit([this, &target] {
+                    struct timespec start, end;
+                    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+                    vector<int> matched = scanTarget(target);
+                    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+                    workerCpuTime += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+                    return matched;
+                }));
+
+            for (size_t i = 0; i < targets.size(); i++)
+            {
+                for (int id : results[i].get())
                 {
-                    detected = 1;
-                    string errorMessage = "Trojaned version of file " + path + " detected. Signature used: " + pattern;
+                    detected++;
+                    string errorMessage = "Trojaned version of file " + targets[i].path + " detected. Signature used: " + signatures[id].pattern;
                     AgentUtils::writeLog(errorMessage, CRITICAL);
                 }
             }
@@ -84,4 +464,4 @@ public:
     }
 };
 
-#endif
\ No newline at end of file
+#endif
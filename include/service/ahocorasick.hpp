@@ -0,0 +1,167 @@
+#ifndef AHO_CORASICK_HPP
+#define AHO_CORASICK_HPP
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Multi-Pattern Matcher
+ *
+ * The `AhoCorasick` class finds every occurrence of a fixed set of byte strings in one pass over the input. The
+ * patterns are compiled into a deterministic automaton whose transition table is indexed by byte class, where every
+ * byte that occurs in no pattern shares one class, so the table stays small even for a few thousand patterns. Scanning
+ * costs one table lookup per input byte regardless of the number of patterns.
+ *
+ * Patterns are added with `add`, the automaton is compiled with `build`, and `scan` may then be called from any number
+ * of threads at once.
+ */
+class AhoCorasick
+{
+private:
+    std::vector<uint16_t> _classes;
+    int _classCount = 1;
+    std::vector<std::string> _patterns;
+    std::vector<int> _ids;
+    std::vector<int32_t> _next;
+    std::vector<std::vector<int>> _outputs;
+    bool _built = false;
+
+public:
+    AhoCorasick() : _classes(256, 0) {}
+
+    /**
+     * @brief Add Pattern
+     *
+     * @param[in] pattern The byte string to look for. Empty patterns are ignored.
+     * @param[in] id The value passed to the `scan` callback when the pattern is found.
+     */
+    void add(const std::string &pattern, int id)
+    {
+        if (pattern.empty())
+            return;
+        _patterns.push_back(pattern);
+        _ids.push_back(id);
+        _built = false;
+    }
+
+    /**
+     * @brief Compile Automaton
+     *
+     * Builds the transition table from the patterns added so far.
+     */
+    void build()
+    {
+        _classCount = 1;
+        std::fill(_classes.begin(), _classes.end(), 0);
+        for (const std::string &pattern : _patterns)
+        {
+            for (unsigned char c : pattern)
+            {
+                if (_classes[c] == 0)
+                    _classes[c] = (uint16_t)_classCount++;
+            }
+        }
+
+        // Trie of the patterns; -1 marks a missing edge until the failure links fill it in.
+        _next.assign(_classCount, -1);
+        _outputs.assign(1, std::vector<int>());
+        for (size_t i = 0; i < _patterns.size(); i++)
+        {
+            int state = 0;
+            for (unsigned char c : _patterns[i])
+            {
+                int32_t &edge = _next[state * _classCount + _classes[c]];
+                if (edge < 0)
+                {
+                    edge = (int32_t)_outputs.size();
+                    _outputs.emplace_back();
+                    _next.resize(_next.size() + _classCount, -1);
+                }
+                state = _next[state * _classCount + _classes[c]];
+            }
+            _outputs[state].push_back(_ids[i]);
+        }
+
+        // Breadth-first pass turning the trie into a DFA: missing edges follow the failure link, and every state
+        // inherits the outputs of its failure state.
+        std::vector<int> fail(_outputs.size(), 0);
+        std::queue<int> pending;
+        for (int c = 0; c < _classCount; c++)
+        {
+            int32_t &edge = _next[c];
+            if (edge < 0)
+                edge = 0;
+            else
+                pending.push(edge);
+        }
+        while (!pending.empty())
+        {
+            int state = pending.front();
+            pending.pop();
+            const std::vector<int> &inherited = _outputs[fail[state]];
+            _outputs[state].insert(_outputs[state].end(), inherited.begin(), inherited.end());
+            for (int c = 0; c < _classCount; c++)
+            {
+                int32_t &edge = _next[state * _classCount + c];
+                int32_t fallback = _next[fail[state] * _classCount + c];
+                if (edge < 0)
+                {
+                    edge = fallback;
+                }
+                else
+                {
+                    fail[edge] = fallback;
+                    pending.push(edge);
+                }
+            }
+        }
+        _built = true;
+    }
+
+    /**
+     * @brief Scan Buffer
+     *
+     * Runs the automaton over `data` and calls `onMatch(id)` for every pattern occurrence, in order of the position
+     * where the occurrence ends. Returning false from `onMatch` stops the scan.
+     *
+     * @param[in] data The bytes to scan.
+     * @param[in] size The number of bytes.
+     * @param[in] onMatch A callable `bool(int id)`.
+     * @return false if the callback stopped the scan, true otherwise.
+     */
+    template <typename F>
+    bool scan(const char *data, size_t size, F &&onMatch) const
+    {
+        if (!_built || _patterns.empty())
+            return true;
+        const uint16_t *classes = _classes.data();
+        const int32_t *next = _next.data();
+        int state = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            state = next[state * _classCount + classes[(unsigned char)data[i]]];
+            if (!_outputs[state].empty())
+            {
+                for (int id : _outputs[state])
+                {
+                    if (!onMatch(id))
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Get Pattern Count
+     *
+     * @return The number of patterns added.
+     */
+    size_t size() const { return _patterns.size(); }
+};
+
+#endif
@@ -1,6 +1,32 @@
 #pragma once 
 
 #include "agentUtils.hpp"
+#include "service/spoolqueue.hpp"
+#include "service/uploader.hpp"
+#include <mutex>
+
+#define CURL_POOL_SIZE 4
+
+typedef struct upload_options upload_options;
+
+/**
+ * @brief Upload Options
+ *
+ * How `CurlHandler::post` sends the spooled files, read from the `[cloud]` section by `CurlHandler::readOptions`.
+ */
+struct upload_options
+{
+    size_t maxUploads = UPLOAD_MAX_CONCURRENT; /**< Requests in flight at once. */
+    bool batch = false; /**< Pack files into compressed batches instead of posting each one. */
+    size_t batchBytes = BATCH_MAX_BYTES;
+    time_t batchDelay = BATCH_MAX_DELAY;
+    int compressionLevel = BATCH_COMPRESSION_LEVEL;
+    bool spool = false; /**< Queue records in a durable `SpoolQueue` and deliver them from there. */
+    size_t spoolBytes = SPOOL_MAX_BYTES;
+    time_t retryBase = SPOOL_RETRY_BASE;
+    time_t retryMax = SPOOL_RETRY_MAX;
+    string directory = BASE_LOG_DIR; /**< Where the spool and the batch files are kept. */
+};
 
 /**
  * @brief Curl Handler
@@ -8,10 +34,349 @@
  * The `CurlHandler` class is responsible for managing all API-related activities within the application. It serves as
  * a central component for making HTTP requests, handling responses, and interacting with external services through APIs.
  * This class plays a crucial role in facilitating communication with external systems and services.
+ *
+ * libcurl is initialised once, on first use, by a process-wide client that keeps a pool of `MultiUploader` objects.
+ * Their transfers share a DNS cache and a TLS session cache through a `CURLSH` object, and each uploader keeps its own
+ * keep-alive connections between calls, so a request reuses an open connection to the server instead of repeating the
+ * TCP and TLS handshakes. `post` may be called from several threads at once; each call borrows its own uploader.
  */
 class CurlHandler
 {
+private:
+    CURLSH *_share = nullptr;
+    std::mutex _shareLocks[CURL_LOCK_DATA_LAST];
+    std::mutex _poolMutex;
+    vector<MultiUploader *> _idle;
+    /**
+     * @brief Destination Spool
+     *
+     * The spooled records of one URL and form name, so they are only ever delivered where they were posted.
+     */
+    struct destination_spool
+    {
+        SpoolQueue queue;
+        std::mutex draining; /**< Held by the one thread delivering these records. */
+
+        destination_spool(const string &directory, size_t maxBytes) : queue(directory, maxBytes) {}
+    };
+
+    std::mutex _spoolMutex;
+    map<string, std::unique_ptr<destination_spool>> _spools;
+
+    CurlHandler()
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        _share = curl_share_init();
+        curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, _lock);
+        curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, _unlock);
+        curl_share_setopt(_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        // The connection cache is not shared: libcurl does not support using one from several threads at once.
+    }
+
+    ~CurlHandler()
+    {
+        for (MultiUploader *uploader : _idle)
+        {
+            delete uploader;
+        }
+        curl_share_cleanup(_share);
+        curl_global_cleanup();
+    }
+
+    static void _lock(CURL *, curl_lock_data data, curl_lock_access, void *client)
+    {
+        static_cast<CurlHandler *>(client)->_shareLocks[data].lock();
+    }
+
+    static void _unlock(CURL *, curl_lock_data data, void *client)
+    {
+        static_cast<CurlHandler *>(client)->_shareLocks[data].unlock();
+    }
+
+    /**
+     * @brief Get Client
+     *
+     * @return The process-wide client, created on first use. Function-local statics are initialised once even when
+     *         several threads arrive at the same time.
+     */
+    static CurlHandler &_client()
+    {
+        static CurlHandler client;
+        return client;
+    }
+
+    /**
+     * @brief Acquire Uploader
+     *
+     * Takes an idle uploader, with its open connections, from the pool, or creates one.
+     */
+    MultiUploader *_acquire(size_t maxConcurrent)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_poolMutex);
+            if (!_idle.empty())
+            {
+                MultiUploader *uploader = _idle.back();
+                _idle.pop_back();
+                uploader->setMaxConcurrent(maxConcurrent);
+                return uploader;
+            }
+        }
+        return new MultiUploader(maxConcurrent, _share);
+    }
+
+    /**
+     * @brief Release Uploader
+     *
+     * Returns an uploader to the pool. Uploaders beyond `CURL_POOL_SIZE` are closed.
+     */
+    void _release(MultiUploader *uploader)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_poolMutex);
+            if (_idle.size() < CURL_POOL_SIZE)
+            {
+                _idle.push_back(uploader);
+                return;
+            }
+        }
+        delete uploader;
+    }
+
+    static long _postBatches(CurlHandler &client, const string &postUrl, const string &formName, const vector<string> &jsonFiles, const upload_options &options)
+    {
+        long status = POST_SUCCESS;
+        vector<upload_batch> batches;
+        PayloadBatcher batcher(options.directory + BATCH_DIR, options.batchBytes, options.batchDelay, options.compressionLevel);
+        if (batcher.pack(jsonFiles, batches) == FAILED)
+        {
+            status = FAILED;
+        }
+
+        MultiUploader *uploader = client._acquire(options.maxUploads);
+        for (const upload_batch &batch : batches)
+        {
+            upload_request request;
+            request.url = postUrl;
+            request.formName = formName;
+            request.filePath = batch.path;
+            request.contentType = BATCH_CONTENT_TYPE;
+            request.contentEncoding = "gzip";
+            request.onComplete = [&status, &batch](const upload_request &, long httpCode, CURLcode)
+            {
+                if (httpCode == POST_SUCCESS)
+                {
+                    AgentUtils::writeLog("Sent " + std::to_string(batch.sources.size()) + " files, " + std::to_string(batch.rawBytes) + " bytes as " + std::to_string(batch.compressedBytes), SUCCESS);
+                    for (const string &source : batch.sources)
+                    {
+                        OS::deleteFile(source);
+                    }
+                }
+                else
+                {
+                    AgentUtils::writeLog("Failed to send batch of " + std::to_string(batch.sources.size()) + " files (HTTP " + std::to_string(httpCode) + ")", FAILED);
+                    status = httpCode == 0 ? (long)FAILED : httpCode;
+                }
+            };
+            uploader->add(std::move(request));
+        }
+        uploader->run();
+        client._release(uploader);
+        for (const upload_batch &batch : batches)
+        {
+            unlink(batch.path.c_str());
+        }
+        return status;
+    }
+
+    /**
+     * @brief Get Spool
+     *
+     * Each destination has its own queue, in a subdirectory of the spool directory named after the URL and form name.
+     *
+     * @return The spool of `postUrl` and `formName`, opened on first use, or nullptr if it cannot be opened.
+     */
+    destination_spool *_spoolQueue(const string &postUrl, const string &formName, const upload_options &options)
+    {
+        string key = postUrl + " " + formName;
+        std::lock_guard<std::mutex> lock(_spoolMutex);
+        auto known = _spools.find(key);
+        if (known != _spools.end())
+        {
+            return known->second.get();
+        }
+        string name;
+        for (char c : key)
+        {
+            name += std::isalnum((unsigned char)c) ? c : '_';
+        }
+        string directory = options.directory + SPOOL_DIR;
+        if (OS::isDirExist(directory) == FAILED)
+        {
+            OS::createDir(directory);
+        }
+        std::unique_ptr<destination_spool> spool(new destination_spool(directory + name, options.spoolBytes));
+        if (spool->queue.open() == FAILED)
+        {
+            return nullptr;
+        }
+        return (_spools[key] = std::move(spool)).get();
+    }
+
+    /**
+     * @brief Drain Spool
+     *
+     * Delivers the spooled records in order, up to `maxUploads` compressed batches at a time, and commits the position
+     * after the last batch of an unbroken run of accepted ones. On a failure the remaining records wait for the backoff;
+     * records after the failed batch that were accepted are sent again, so delivery is at least once.
+     */
+    static void _drain(CurlHandler &client, destination_spool *destination, const string &postUrl, const string &formName, const upload_options &options)
+    {
+        SpoolQueue *spool = &destination->queue;
+        std::unique_lock<std::mutex> draining(destination->draining, std::try_to_lock);
+        if (!draining.owns_lock())
+        {
+            return;
+        }
+        if (!spool->ready(time(nullptr)))
+        {
+            AgentUtils::writeLog("Upload retry not due yet, " + std::to_string(spool->usage()) + " bytes remain spooled", DEBUG);
+            return;
+        }
+
+        size_t window = options.maxUploads == 0 ? UPLOAD_MAX_CONCURRENT : options.maxUploads;
+        PayloadBatcher batcher(options.directory + BATCH_DIR, options.batchBytes, 0, options.compressionLevel);
+        MultiUploader *uploader = client._acquire(window);
+        while (true)
+        {
+            vector<upload_batch> batches;
+            vector<spool_position> ends;
+            spool_position position = spool->committed();
+            while (batches.size() < window)
+            {
+                vector<string> records;
+                spool_position next;
+                upload_batch batch;
+                if (spool->peek(position, options.batchBytes, records, next) == FAILED || records.empty() ||
+                    batcher.packRecords(records, batch) == FAILED)
+                {
+                    break;
+                }
+                batches.push_back(batch);
+                ends.push_back(next);
+                position = next;
+            }
+            if (batches.empty())
+            {
+                break;
+            }
+
+            vector<long> codes(batches.size(), 0);
+            for (size_t i = 0; i < batches.size(); i++)
+            {
+                upload_request request;
+                request.url = postUrl;
+                request.formName = formName;
+                request.filePath = batches[i].path;
+                request.contentType = BATCH_CONTENT_TYPE;
+                request.contentEncoding = "gzip";
+                request.onComplete = [&codes, i](const upload_request &, long httpCode, CURLcode) { codes[i] = httpCode; };
+                uploader->add(std::move(request));
+            }
+            uploader->run();
+            for (const upload_batch &batch : batches)
+            {
+                unlink(batch.path.c_str());
+            }
+
+            size_t delivered = 0;
+            while (delivered < codes.size() && codes[delivered] == POST_SUCCESS)
+            {
+                delivered++;
+            }
+            if (delivered > 0)
+            {
+                spool->commit(ends[delivered - 1]);
+            }
+            if (delivered < codes.size())
+            {
+                time_t delay = spool->onFailure(time(nullptr), options.retryBase, options.retryMax);
+                AgentUtils::writeLog("Upload failed (HTTP " + std::to_string(codes[delivered]) + "), retrying in " + std::to_string(delay) + " seconds", WARNING);
+                break;
+            }
+            spool->onSuccess();
+        }
+        client._release(uploader);
+    }
+
+    /**
+     * @brief Post Through Spool
+     *
+     * Moves the spooled JSON files into the spool queue, one record per line, deleting each file once the queue is synced
+     * to disk, and then drains the queue.
+     */
+    static long _postSpooled(CurlHandler &client, const string &postUrl, const string &formName, const vector<string> &jsonFiles, const upload_options &options)
+    {
+        destination_spool *destination = client._spoolQueue(postUrl, formName, options);
+        if (destination == nullptr)
+        {
+            AgentUtils::writeLog("Upload spool unavailable, files are kept", FAILED);
+            return FAILED;
+        }
+        SpoolQueue *spool = &destination->queue;
+
+        long status = POST_SUCCESS;
+        vector<string> queued;
+        for (const string &jsonFile : jsonFiles)
+        {
+            std::ifstream file(jsonFile, std::ios::binary);
+            if (!file)
+            {
+                status = FAILED;
+                continue;
+            }
+            // Each line of a file is a document of its own and is queued as a separate record.
+            bool pushed = true;
+            string line;
+            while (std::getline(file, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                if (line.find_first_not_of(" \t") != string::npos && spool->push(line) == FAILED)
+                {
+                    pushed = false;
+                    break;
+                }
+            }
+            if (!pushed)
+            {
+                status = FAILED;
+                continue;
+            }
+            queued.push_back(jsonFile);
+        }
+        if (spool->sync() == FAILED)
+        {
+            AgentUtils::writeLog("Unable to sync the upload spool, files are kept", FAILED);
+            return FAILED;
+        }
+        for (const string &jsonFile : queued)
+        {
+            OS::deleteFile(jsonFile);
+        }
+
+        _drain(client, destination, postUrl, formName, options);
+        return status;
+    }
+
 public:
+    CurlHandler(const CurlHandler &) = delete;
+    CurlHandler &operator=(const CurlHandler &) = delete;
+
     static size_t writeCallback(char *data, size_t size, size_t nmemb, std::string *response)
     {
         if (response)
@@ -22,17 +387,6 @@ public:
         return 0;
     }
 
-    static size_t headerCallback(char *buffer, size_t size, size_t nitems, long *httpCode)
-    {
-        std::string header(buffer, size * nitems);
-        size_t pos = header.find("HTTP/1.");
-        if (pos != std::string::npos)
-        {
-            *httpCode = std::stoi(header.substr(pos + 9, 3));
-        }
-        return size * nitems;
-    }
-
     static size_t verboseCallback(char *data, size_t size, size_t nmemb, std::string *output)
     {
         if (output)
@@ -43,98 +397,173 @@ public:
         return 0;
     }
 
+    /**
+     * @brief Read Upload Options
+     *
+     * Reads `max_uploads`, `batch_upload` (0 or 1), `batch_max_bytes`, `batch_max_delay` (seconds),
+     * `compression_level`, `spool_upload` (0 or 1), `spool_max_bytes`, `retry_base` and `retry_max` (seconds) from the
+     * `[cloud]` section. Missing keys keep their defaults.
+     *
+     * @param[in] config The key-value pairs of the `[cloud]` section.
+     * @param[out] options The options read.
+     * @return An integer result code:
+     *         - SUCCESS: The options were read.
+     *         - FAILED: A value is not a number.
+     */
+    static int readOptions(map<string, string> &config, upload_options &options)
+    {
+        try
+        {
+            string value = AgentUtils::trim(config["max_uploads"]);
+            if (!value.empty()) options.maxUploads = std::stoul(value);
+            value = AgentUtils::trim(config["batch_upload"]);
+            if (!value.empty()) options.batch = std::stoi(value) != 0;
+            value = AgentUtils::trim(config["batch_max_bytes"]);
+            if (!value.empty()) options.batchBytes = std::stoul(value);
+            value = AgentUtils::trim(config["batch_max_delay"]);
+            if (!value.empty()) options.batchDelay = std::stol(value);
+            value = AgentUtils::trim(config["compression_level"]);
+            if (!value.empty()) options.compressionLevel = std::stoi(value);
+            value = AgentUtils::trim(config["spool_upload"]);
+            if (!value.empty()) options.spool = std::stoi(value) != 0;
+            value = AgentUtils::trim(config["spool_max_bytes"]);
+            if (!value.empty()) options.spoolBytes = std::stoul(value);
+            value = AgentUtils::trim(config["retry_base"]);
+            if (!value.empty()) options.retryBase = std::stol(value);
+            value = AgentUtils::trim(config["retry_max"]);
+            if (!value.empty()) options.retryMax = std::stol(value);
+        }
+        catch (const std::exception &e)
+        {
+            AgentUtils::writeLog("Invalid upload option in cloud config: " + string(e.what()), FAILED);
+            return FAILED;
+        }
+        if (options.retryBase <= 0 || options.retryMax < options.retryBase)
+        {
+            AgentUtils::writeLog("Invalid retry_base or retry_max in cloud config", FAILED);
+            return FAILED;
+        }
+        return SUCCESS;
+    }
+
+    /**
+     * @brief Check Upload Backpressure
+     *
+     * Collectors call this before producing records. In spool mode it returns false while the spool of the destination
+     * their records are posted to is close to its quota, so collection pauses, and the collectors' read positions stay
+     * put, until the owner of those records drains them with `drain`.
+     *
+     * @param[in] postUrl The URL the collector's records are posted to.
+     * @param[in] formName The identifier for the specific form or endpoint on the server.
+     * @param[in] options The spool settings.
+     * @return true if new records can be accepted.
+     */
+    static bool accepting(const string &postUrl, const string &formName, const upload_options &options)
+    {
+        if (!options.spool)
+        {
+            return true;
+        }
+        destination_spool *destination = _client()._spoolQueue(postUrl, formName, options);
+        return destination != nullptr && destination->queue.accepting();
+    }
+
+    /**
+     * @brief Drain Spool
+     *
+     * Delivers the records spooled for `postUrl` and `formName`, once their retry is due, without posting new files.
+     * Called by the owner of the records on every run, so a spool past its high-water mark recovers even while the
+     * collectors feeding it are paused.
+     *
+     * @param[in] postUrl The URL the records were posted to.
+     * @param[in] formName The identifier for the specific form or endpoint on the server.
+     * @param[in] options The spool settings.
+     * @return SUCCESS, or FAILED if the spool cannot be opened. Records that are not delivered stay spooled.
+     */
+    static int drain(const string &postUrl, const string &formName, const upload_options &options)
+    {
+        if (!options.spool)
+        {
+            return SUCCESS;
+        }
+        CurlHandler &client = _client();
+        destination_spool *destination = client._spoolQueue(postUrl, formName, options);
+        if (destination == nullptr)
+        {
+            return FAILED;
+        }
+        _drain(client, destination, postUrl, formName, options);
+        return SUCCESS;
+    }
+
     /**
      * @brief Perform POST Request
      *
      * The `post` function is a static method used to perform a POST request to the server. It sends data to a specific URL
      * identified by `postUrl` and retrieves the response. The `formName` parameter specifies the specific identifier for
-     * the URL to which data is posted, and the `logName` parameter indicates where to fetch the data for the POST request.
+     * the URL to which data is posted, and the `logName` parameter indicates where to fetch the data for the POST request: a
+     * single file, or a directory whose finished `.json` files are sent.
+     *
+     * The files are sent concurrently, at most `maxUploads` at a time, and each one is deleted as soon as the server
+     * answers it with HTTP 200. Files that fail are kept for the next call. With `batch` set, the files are first packed
+     * by `PayloadBatcher` into gzip-compressed newline-delimited JSON, one request per batch, sent with
+     * `Content-Encoding: gzip`; a batch's files are deleted when it is accepted and repacked on the next call otherwise.
+     * With `spool` set, the files are moved into a durable `SpoolQueue` and delivered from it in order, in compressed
+     * batches, with exponential backoff after a failure; the call then succeeds once the records are safely queued.
      *
      * @param[in] postUrl The URL to which the POST request is sent.
      * @param[in] formName The identifier for the specific form or endpoint on the server.
-     * @param[in] logName The identifier specifying which log to be sent.
-     * @return A long integer representing the result of the POST request, typically an HTTP status code.
+     * @param[in] logName The file or directory to be sent; each caller passes only the files it owns.
+     * @param[in] options The concurrency limit and batching mode.
+     * @return POST_SUCCESS when every file was accepted, otherwise the status of a failed request, or FAILED.
      */
-    static long post(const string& postUrl, const string& formName, const string& logName)
+    static long post(const string& postUrl, const string& formName, const string& logName, const upload_options &options = upload_options())
     {
-        CURLcode res;
-        const char *contentType = "application/json";
-        std::string response;
-        long httpCode = 0;
-        curl_global_init(CURL_GLOBAL_DEFAULT);
-
-        CURL *curl = curl_easy_init();
         vector<string> jsonFiles;
-        int result = OS::readRegularFiles(jsonFiles);
+        int result = OS::readRegularFiles(logName, jsonFiles);
+        if (options.spool)
+        {
+            // Records queued earlier are delivered even when there are no new files.
+            return _postSpooled(_client(), postUrl, formName, jsonFiles, options);
+        }
         if (result == FAILED)
         {
             AgentUtils::writeLog(FILE_ERROR + logName, FAILED);
             return FAILED;
         }
-
-        if (curl)
+        if (jsonFiles.empty())
         {
-            // Set the target URL
-            curl_easy_setopt(curl, CURLOPT_URL, postUrl.c_str());
-
-            // Set the request headers
-            struct curl_slist *headers = nullptr;
-            headers = curl_slist_append(headers, "accept: */*");
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            return POST_SUCCESS;
+        }
 
-            // Set the request as a POST
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            for (string jsonFile : jsonFiles)
+        long status = POST_SUCCESS;
+        CurlHandler &client = _client();
+        if (options.batch)
+        {
+            return _postBatches(client, postUrl, formName, jsonFiles, options);
+        }
+        MultiUploader *uploader = client._acquire(options.maxUploads);
+        for (const string &jsonFile : jsonFiles)
+        {
+            upload_request request;
+            request.url = postUrl;
+            request.formName = formName;
+            request.filePath = jsonFile;
+            request.onComplete = [&status](const upload_request &done, long httpCode, CURLcode)
             {
-
-                // Set the request as multipart/form-data
-                struct curl_httppost *form = nullptr;
-                struct curl_httppost *last = nullptr;
-                curl_formadd(&form, &last, CURLFORM_COPYNAME, formName.c_str(), CURLFORM_FILE, jsonFile.c_str(), CURLFORM_CONTENTTYPE, contentType, CURLFORM_END);
-                curl_easy_setopt(curl, CURLOPT_HTTPPOST, form);
-
-                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-                curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-
-                curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
-                curl_easy_setopt(curl, CURLOPT_HEADERDATA, &httpCode);
-
-                // Enable verbose output
-                // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-
-                curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-                curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-
-                res = curl_easy_perform(curl);
-                if (res == CURLE_OK)
-                {
-                    AgentUtils::writeLog("Request successful");
-                    AgentUtils::writeLog("HTTP Status Code: " + std::to_string(httpCode), SUCCESS);
-                    std::cout << "Response: " << response << "\n";
-                }
-                else
-                {
-                    string error = curl_easy_strerror(res);
-                    AgentUtils::writeLog("Request failed: " + error, FAILED);
-                }
-
                 if (httpCode == POST_SUCCESS)
                 {
-                    OS::deleteFile(jsonFile);
-                }
-                else
-                {
-                    AgentUtils::writeLog("Failed to send this file " + jsonFile, FAILED);
+                    AgentUtils::writeLog("HTTP Status Code: " + std::to_string(httpCode), SUCCESS);
+                    OS::deleteFile(done.filePath);
+                    return;
                 }
-                std::chrono::seconds sleepDuration(1);
-                std::this_thread::sleep_for(sleepDuration);
-            }
-
-            curl_slist_free_all(headers);
-            curl_easy_cleanup(curl);
+                AgentUtils::writeLog("Failed to send this file " + done.filePath + " (HTTP " + std::to_string(httpCode) + ")", FAILED);
+                status = httpCode == 0 ? (long)FAILED : httpCode;
+            };
+            uploader->add(std::move(request));
         }
-
-        curl_global_cleanup();
-        return httpCode;
+        uploader->run();
+        client._release(uploader);
+        return status;
     }
-};
\ No newline at end of file
+};
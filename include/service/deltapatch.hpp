@@ -0,0 +1,84 @@
+#ifndef DELTA_PATCH_HPP
+#define DELTA_PATCH_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+
+#define DELTA_MAGIC "SCLDLT01"
+#define DELTA_MAGIC_SIZE 8
+#define DELTA_DIGEST_SIZE 32
+#define DELTA_BLOCK_SIZE 4096
+#define DELTA_MAX_INSERT 65536
+#define DELTA_OP_COPY 'C'
+#define DELTA_OP_INSERT 'I'
+#define DELTA_OP_END 'E'
+
+typedef struct delta_header delta_header;
+
+/**
+ * @brief Delta Header
+ *
+ * The lengths and SHA-256 digests, as raw bytes, of the file a patch applies to and the file it produces.
+ */
+struct delta_header
+{
+    uint64_t sourceLength = 0;
+    unsigned char sourceDigest[DELTA_DIGEST_SIZE] = {0};
+    uint64_t targetLength = 0;
+    unsigned char targetDigest[DELTA_DIGEST_SIZE] = {0};
+};
+
+/**
+ * @brief Binary Delta Patch
+ *
+ * The `DeltaPatch` class creates and applies binary patches that rebuild a new file from an old one. A patch is a
+ * header followed by operations: COPY takes a range of the old file, INSERT carries new bytes, END closes the patch.
+ * All integers are little-endian.
+ *
+ * `create` finds the reusable ranges with an rsync-style rolling checksum: every `blockSize` block of the old file
+ * is indexed by its weak checksum, and the checksum is rolled one byte at a time over the new file, confirming each
+ * candidate by comparing the bytes. `apply` maps the old file and streams the patch into a staging file, hashing
+ * the output as it is written, so neither the patch nor the result is ever held in memory. A patch is only applied
+ * to the exact file it was made from, and its output must match the target digest in the header.
+ */
+class DeltaPatch
+{
+public:
+    /**
+     * @brief Create Patch
+     *
+     * @param[in] sourcePath The old file.
+     * @param[in] targetPath The new file.
+     * @param[in] patchPath Where the patch is written.
+     * @param[in] blockSize The size of the blocks matched against the old file.
+     * @return An integer result code:
+     *         - SUCCESS: The patch was written.
+     *         - FAILED: A file could not be read or written.
+     */
+    static int create(const string &sourcePath, const string &targetPath, const string &patchPath, size_t blockSize = DELTA_BLOCK_SIZE);
+
+    /**
+     * @brief Apply Patch
+     *
+     * Rebuilds the new file into `stagingPath`, synced to disk. The staging file is removed if anything fails.
+     *
+     * @param[in] sourcePath The old file the patch was made from.
+     * @param[in] patchPath The patch.
+     * @param[in] stagingPath Where the new file is written.
+     * @param[out] digest The lowercase hexadecimal SHA-256 of the new file.
+     * @return An integer result code:
+     *         - SUCCESS: The new file was written and matches the target digest of the patch.
+     *         - FAILED: The old file is not the one the patch expects, the patch is malformed, or the output does not
+     *           match.
+     */
+    static int apply(const string &sourcePath, const string &patchPath, const string &stagingPath, string &digest);
+
+    /**
+     * @brief Read Patch Header
+     *
+     * @return SUCCESS, or FAILED if `patchPath` is not a patch.
+     */
+    static int readHeader(const string &patchPath, delta_header &header);
+};
+
+#endif
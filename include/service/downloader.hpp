@@ -0,0 +1,153 @@
+#ifndef DOWNLOADER_HPP
+#define DOWNLOADER_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+#include <openssl/evp.h>
+
+#define DOWNLOAD_SEGMENTS 4
+#define DOWNLOAD_CHUNK_SIZE (1024 * 1024)
+#define DOWNLOAD_CHUNK_RETRY 3
+#define DOWNLOAD_SIDECAR_SUFFIX ".chunks"
+#define DOWNLOAD_HASH_BUFFER 65536
+
+/**
+ * @brief Segmented Downloader
+ *
+ * The `SegmentedDownloader` class fetches one HTTP(S) file as fixed-size chunks, up to `segments` of them at a time
+ * through one libcurl multi handle, each with its own `Range` request. The target file is preallocated to its full
+ * size and every chunk is written in place with `pwrite`, so chunks may land in any order.
+ *
+ * Completed chunks are recorded in a sidecar bitmap next to the file, after the chunk's data has been synced, so a
+ * download interrupted by a crash or a lost link resumes with the missing chunks only. The sidecar also keeps the
+ * length and the `ETag` or `Last-Modified` of the file; if the server's copy changed, the download starts over.
+ *
+ * The SHA-256 of the file is computed while the download runs, over the completed prefix of chunks, so it is ready
+ * as soon as the last chunk lands.
+ */
+class SegmentedDownloader
+{
+private:
+    struct segment
+    {
+        SegmentedDownloader *owner;
+        size_t chunk;
+        uint64_t start;
+        uint64_t length;
+        uint64_t written;
+        char range[64];
+    };
+
+    string _url;
+    string _path;
+    string _sidecarPath;
+    size_t _segments;
+    size_t _chunkSize;
+    string _credentials;
+    long _minSpeed = 0;
+    long _maxSpeed = 0;
+    long _timeout = 0;
+    bool _supportsRanges = false;
+    bool _rangesIgnored = false;
+    uint64_t _length = 0;
+    string _validator;
+    int _fd = -1;
+    int _sidecarFd = -1;
+    size_t _headerSize = 0;
+    vector<unsigned char> _bitmap;
+    vector<unsigned int> _attempts;
+    size_t _chunks = 0;
+    size_t _completed = 0;
+    size_t _hashed = 0;
+    EVP_MD_CTX *_hash = nullptr;
+    string _digest;
+
+    static size_t _onHeader(char *buffer, size_t size, size_t nitems, void *downloader);
+    static size_t _onData(char *data, size_t size, size_t nmemb, void *current);
+    void _setOptions(CURL *curl);
+    bool _isDone(size_t chunk) const { return _bitmap[chunk / 8] & (1 << (chunk % 8)); }
+    int _openTarget();
+    int _markDone(size_t chunk);
+    int _advanceHash();
+    void _close();
+
+public:
+    /**
+     * @brief Segmented Downloader Constructor
+     *
+     * @param[in] url The HTTP or HTTPS URL of the file.
+     * @param[in] path Where the file is written. The sidecar is `path` followed by `DOWNLOAD_SIDECAR_SUFFIX`.
+     * @param[in] segments The largest number of range requests in flight at once.
+     * @param[in] chunkSize The size of one range request, and one bit of the sidecar.
+     */
+    SegmentedDownloader(const string &url, const string &path, size_t segments = DOWNLOAD_SEGMENTS, size_t chunkSize = DOWNLOAD_CHUNK_SIZE);
+
+    SegmentedDownloader(const SegmentedDownloader &) = delete;
+    SegmentedDownloader &operator=(const SegmentedDownloader &) = delete;
+
+    void setCredentials(const string &username, const string &password);
+
+    /**
+     * @brief Set Transfer Limits
+     *
+     * @param[in] minSpeed A chunk slower than this many bytes per second for `timeout` seconds is retried.
+     * @param[in] maxSpeed The download speed limit in bytes per second, shared by the segments; 0 is unlimited.
+     * @param[in] timeout The time limit in seconds of one chunk; 0 is unlimited.
+     */
+    void setLimits(long minSpeed, long maxSpeed, long timeout);
+
+    /**
+     * @brief Probe Server
+     *
+     * Sends a HEAD request for the length, validator and `Accept-Ranges` of the file.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The server reports a length and byte ranges, so `run` can be used.
+     *         - FAILED: The request failed or ranges are not supported; use a serial download instead.
+     */
+    int probe();
+
+    /**
+     * @brief Run Download
+     *
+     * Downloads the chunks the sidecar does not mark as complete. The sidecar is removed once the file is complete.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: Every chunk is on disk and `digest` holds the SHA-256 of the file.
+     *         - FAILED: A chunk failed `DOWNLOAD_CHUNK_RETRY` times, or the server ignored a range; the completed
+     *           chunks are kept for the next run.
+     */
+    int run();
+
+    /**
+     * @brief Check Ignored Ranges
+     *
+     * @return true if the server answered a range request with the whole file, in which case `run` gave up and the
+     *         file should be downloaded serially.
+     */
+    bool rangesIgnored() const { return _rangesIgnored; }
+
+    uint64_t length() const { return _length; }
+
+    /**
+     * @brief Get Digest
+     *
+     * @return The lowercase hexadecimal SHA-256 of the file after a successful `run`, otherwise an empty string.
+     */
+    const string &digest() const { return _digest; }
+
+    /**
+     * @brief Hash File
+     *
+     * Computes the SHA-256 of a file already on disk, for downloads that did not go through `run`.
+     *
+     * @param[in] path The file to hash.
+     * @param[out] digest The lowercase hexadecimal SHA-256.
+     * @return SUCCESS, or FAILED if the file cannot be read.
+     */
+    static int sha256File(const string &path, string &digest);
+
+    ~SegmentedDownloader();
+};
+
+#endif
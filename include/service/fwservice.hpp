@@ -2,6 +2,10 @@
 #define FWSERVICE_HPP
 
 #include "agentUtils.hpp"
+#include "service/downloader.hpp"
+#include "service/deltapatch.hpp"
+
+#define STAGING_SUFFIX ".staging"
 
 #define MAX_RETRY_COUNT 3
 #define TIME_OUT_ERROR 12
@@ -25,6 +29,13 @@ typedef struct download_props download_props;
  * @var url The URL from which the file is to be downloaded.
  * @var fileName The name of the downloaded file.
  * @var downloadPath The complete path to the downloaded file.
+ * @var segments The number of concurrent range requests.
+ * @var chunkSize The size of one range request in bytes.
+ * @var sha256 The expected SHA-256 of the file in hexadecimal; required, updates are refused without it.
+ * @var targetSha256 The expected SHA-256 of the binary a patch produces; required for patching.
+ * @var application The name of the installed binary in `rootDir`, replaced by either kind of update.
+ * @var patchUrl The URL of a delta patch from the installed binary to the new one; empty disables patching.
+ * @var patchPath The complete path to the downloaded patch.
  */
 struct download_props
 {
@@ -38,6 +49,13 @@ struct download_props
    string url;
    string fileName;
    string downloadPath;
+   size_t segments;
+   size_t chunkSize;
+   string sha256;
+   string targetSha256;
+   string application;
+   string patchUrl;
+   string patchPath;
    
    /**
     * @brief Default Constructor
@@ -48,8 +66,9 @@ struct download_props
     * - `minSpeed` to 0
     * - `timeout` to 0
     * - `retry` to a predefined maximum retry count (MAX_RETRY_COUNT)
+    * - `segments` and `chunkSize` to DOWNLOAD_SEGMENTS and DOWNLOAD_CHUNK_SIZE
     */
-   download_props() : size(0L), maxSpeed(0), minSpeed(0), timeout(0), retry(MAX_RETRY_COUNT) {}
+   download_props() : size(0L), maxSpeed(0), minSpeed(0), timeout(0), retry(MAX_RETRY_COUNT), segments(DOWNLOAD_SEGMENTS), chunkSize(DOWNLOAD_CHUNK_SIZE) {}
 };
 
 struct sftp_data
@@ -140,27 +159,84 @@ private:
     string extractFileName(const string &url);
     
     /**
-     * @brief Download File via HTTPS Protocol
+     * @brief Download File Serially
      *
-     * The `download` function without parameters is used to initiate a file download using the HTTPS protocol. It downloads
-     * the specified file from a remote server over a secure connection.
+     * The `download` function fetches the file as one stream over any protocol libcurl supports, such as HTTPS or SFTP,
+     * appending to a partial file left by an earlier attempt. The configured username and password are sent when set.
      *
+     * @param[in] url The URL of the file.
+     * @param[in] path Where the file is written.
      * @return An integer result code indicating the success or failure of the download operation.
      */
-    int download();
+    int download(const string &url, const string &path);
+
+    /**
+     * @brief Fetch File
+     *
+     * The `fetch` function downloads HTTP and HTTPS files with `SegmentedDownloader`, as concurrent range requests that
+     * resume after a crash, and falls back to the serial `download` for other protocols and for servers that do not
+     * support ranges. Before an HTTP download falls back, the partial file and sidecar of the segmented attempt are
+     * deleted.
+     *
+     * @param[in] url The URL of the file.
+     * @param[in] path Where the file is written.
+     * @param[out] digest The SHA-256 of the downloaded file in hexadecimal.
+     * @return An integer result code indicating the success or failure of the download.
+     */
+    int fetch(const string &url, const string &path, string &digest);
+
+    /**
+     * @brief Verify Firmware
+     *
+     * The `verify` function compares the SHA-256 of a new image with the configured digest it must match. An image that
+     * does not match, or cannot be checked because no digest is configured, is deleted, so it is never installed.
+     *
+     * @param[in] path The new image.
+     * @param[in] digest The SHA-256 of the image in hexadecimal.
+     * @param[in] expected The configured SHA-256, `sha256` for a full image or `target_sha256` for a patched one.
+     * @return An integer result code:
+     *         - SUCCESS: The digest matches.
+     *         - FAILED: The digest does not match, or either digest is empty.
+     */
+    int verify(const string &path, const string &digest, const string &expected);
+
+    /**
+     * @brief Install Binary
+     *
+     * The `install` function renames a verified staging file over the binary installed in `root_dir` and syncs the
+     * directory, so the binary is replaced atomically and a failed update leaves the old one in place.
+     *
+     * @param[in] staging The verified new binary, next to the installed one.
+     * @return An integer result code:
+     *         - SUCCESS: The new binary is installed.
+     *         - FAILED: The rename failed; the staging file is removed.
+     */
+    int install(const string &staging);
+
+    /**
+     * @brief Update by Delta Patch
+     *
+     * The `patch` function downloads the patch at `patch_url` and applies it to the binary installed in `root_dir`,
+     * streaming the new binary into a staging file next to it. Once the staging file matches the target digest of the
+     * patch and the configured `target_sha256`, it is installed. Without `target_sha256` no patch is applied.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The new binary is installed.
+     *         - FAILED: No `target_sha256` is configured, or the patch could not be downloaded or applied; the full image
+     *           should be downloaded instead.
+     */
+    int patch();
 
     /**
-     * @brief Download File via SFTP Protocol with Credentials
+     * @brief Update Firmware
      *
-     * The `download` function with parameters `username` and `password` is used to initiate a file download using the SFTP
-     * protocol. It downloads the specified file from a remote server over a secure connection with the provided
-     * authentication credentials.
+     * The `update` function tries `patch` when a patch URL is configured, and otherwise, or if patching fails, fetches
+     * and verifies the full image named by `url`, copies it into a staging file and installs it. Both ways end with the
+     * new binary in `root_dir` and no download left in `write_path`.
      *
-     * @param[in] username The username or account name for SFTP authentication.
-     * @param[in] password The password or authentication token for SFTP authentication.
-     * @return An integer result code indicating the success or failure of the SFTP download operation.
+     * @return An integer result code indicating the success or failure of the update.
      */
-    int download(const string& username, const string& password);
+    int update();
     
 public:
 
@@ -5,6 +5,7 @@
 #include "agentUtils.hpp"
 #include "service/configservice.hpp"
 #include "udp.hpp"
+#include "tcp.hpp"
 
 typedef struct standard_log_attrs standard_log_attrs;
 
@@ -112,6 +113,19 @@ public:
         string &previousTime,
         const vector<string>& levels,
         const char& delimeter) = 0;
+
+    /**
+     * @brief Configure Remote Syslog Intake
+     *
+     * This pure virtual function is meant to be implemented by derived classes. It applies the remote intake settings
+     * (listening ports, receiver threads) from the syslog section of the configuration before remote logs are read.
+     *
+     * @param[in] config The syslog section of the configuration table.
+     * @return An integer result code:
+     *         - SUCCESS: The settings were applied.
+     *         - FAILED: The settings are invalid.
+     */
+    virtual int configureRemote(map<string, string> &config) = 0;
     
     /**
      * @brief Virtual Destructor
@@ -133,6 +147,8 @@ class LogService : public ILog
 private:
     Config _configService; /**< A private instance of IniConfig for configuration management. */
     map<string, int> _logLevel{{"none", 0}, {"trace", 1}, {"debug", 2}, {"warning", 3}, {"error", 4}, {"critical", 5}}; /**< A private constant map<string, int> for system log name. */
+    UdpQueue _udpQueue; /**< A private long-lived UDP receiver for remote syslog. */
+    TcpQueue _tcpQueue; /**< A private long-lived TCP listener feeding the UDP receiver shards. */
     
 private:
     /**
@@ -227,15 +243,14 @@ private:
     /**
      * @brief Verify JSON Path
      *
-     * The `verifyJsonPath` function is a private method used to verify the existence of a file specified by the provided `timestamp`.
-     * If the file does not exist, this function creates a new file at the specified path. It ensures that the path is
-     * available for storing JSON data.
+     * The `verifyJsonPath` function is a private method used to resolve where a JSON document is written. An absolute
+     * path, such as an application's `write_path`, is used as is; any other name becomes a file under the `json/` log
+     * directory. The directory is created if needed; the file itself is written later through `OS::writeFileAtomic`.
      *
-     * @param[in,out] timestamp The path to the file to be verified or created. If the file does not exist, a new file
-     *                          will be created at this path.
+     * @param[in,out] timestamp The name or path of the document, replaced by the resolved path.
      * @return An integer result code:
-     *         - SUCCESS: The file path was verified, and the file exists or was successfully created.
-     *         - FAILED: The operation encountered errors, and the file path could not be verified or created.
+     *         - SUCCESS: The directory of the resolved path exists.
+     *         - FAILED: The directory could not be created.
      */
     int verifyJsonPath(string &timestamp);
 
@@ -273,9 +288,10 @@ private:
     /**
      * @brief Read Remote Syslog Data
      *
-     * The `readRemoteSysLog` function is used to read syslog data from a remote source connected through UDP. It retrieves
-     * syslog data from the `queue` and stores it in the `logs` vector. This function is responsible for reading logs
-     * from a remote source when a remote connection is established.
+     * The `readRemoteSysLog` function is used to read syslog data from remote sources connected through UDP or TCP. It
+     * drains every message received since the previous call from the `queue` and stores it in the `logs` vector. The
+     * receivers are started on the first call and keep listening in the background afterwards; the TCP listener, when a
+     * `tcp_port` is configured, feeds the same shards as the UDP receivers.
      *
      * @param[in] queue The UDP queue for receiving syslog data from a remote source.
      * @param[in, out] logs A vector to store the received syslog data.
@@ -336,6 +352,20 @@ public:
      */
     int getAppLog(Json::Value &json, const vector<string>& names, const string& readDir, const string& writePath, string &previousTime, const vector<string>& levels, const char& delimeter);
 
+    /**
+     * @brief Configure Remote Syslog Intake
+     *
+     * The `configureRemote` function is an implementation of a virtual function defined in the `ILog` interface. It reads
+     * the `port`, `receivers` and `tcp_port` keys of the syslog section and applies them to the UDP receivers and the TCP
+     * listener. Both keep running between collection rounds, so the settings only change before the first remote read.
+     *
+     * @param[in] config The syslog section of the configuration table.
+     * @return An integer result code:
+     *         - SUCCESS: The settings were applied.
+     *         - FAILED: The configured port is invalid.
+     */
+    int configureRemote(map<string, string> &config);
+
      /**
      * @brief Destructor for LogService.
      *
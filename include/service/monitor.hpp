@@ -3,18 +3,17 @@
 #pragma once
 
 #include "agentUtils.hpp"
+#include "service/threadpool.hpp"
+#include "service/procparser.hpp"
+#include "service/sampler.hpp"
+#include "service/procevents.hpp"
 
-#define MAX_NICE_VALUE 20
-#define CLK_TCK 100
-#define UITME 13
-#define STIME 14
-#define CUTIME 15
-#define CSTIME 16
-#define NICETIME 18
-#define START_TIME 21
+#define MAX_MONITOR_WORKERS 4
 
 typedef struct process_data process_data;
 typedef struct sys_properties sys_properties;
+typedef struct process_sample process_sample;
+typedef struct process_delta process_delta;
 
 /**
  * @brief System Properties Structure
@@ -88,6 +87,21 @@ struct process_data {
      */
     string diskUsage;
 
+    /**
+     * @brief Memory Change
+     *
+     * A string representing the change of the resident memory, in bytes, since the previous sampling round.
+     */
+    string memChange;
+
+    /**
+     * @brief Disk Rate
+     *
+     * A string representing the bytes per second the process read from or wrote to storage since the previous
+     * sampling round.
+     */
+    string diskRate;
+
     /**
      * @brief Constructor
      *
@@ -99,53 +113,42 @@ struct process_data {
      * @param[in] cTime The CPU time consumed by the process.
      * @param[in] mUsage The memory usage of the process.
      * @param[in] dUsage The disk usage of the process.
+     * @param[in] mChange The resident memory change since the previous round.
+     * @param[in] dRate The disk I/O rate since the previous round.
      */
-    process_data(string id, string name, string cTime, string mUsage, string dUsage) 
-        : processId(id), processName(name), cpuTime(cTime), memUsage(mUsage), diskUsage(dUsage)
+    process_data(string id, string name, string cTime, string mUsage, string dUsage, string mChange = "0", string dRate = "0")
+        : processId(id), processName(name), cpuTime(cTime), memUsage(mUsage), diskUsage(dUsage), memChange(mChange), diskRate(dRate)
     {}
 };
 
-
 /**
- * @brief CPU Table
+ * @brief Process Sample
  *
- * The `CpuTable` class contains information and values used to calculate the CPU time consumed by a process. It may
- * include data such as CPU usage percentages, process IDs, and other relevant information related to CPU monitoring
- * and resource consumption analysis.
+ * The `process_sample` struct is the part of a process reading that is kept until the next sampling round. It is
+ * matched to the next reading by PID and start time, so a reused PID is treated as a new process.
  */
-class CpuTable
-{
-private:
-    int _utime;
-    int _stime;
-    int _cutime;
-    int _cstime;
-    int _startTime;
-    int _niceTime;
-    int _upTime;
-    int _cpuCount;
-    int _getUpTime();
+struct process_sample {
+    unsigned long long startTime = 0; /**< Start time after boot, in clock ticks. */
+    unsigned long long cpuTicks = 0; /**< User plus system time, in clock ticks. */
+    unsigned long long ioBytes = 0; /**< Storage bytes read plus written. */
+    long long rss = 0; /**< Resident set size, in pages. */
+    string processName;
+};
 
-public:
-    CpuTable(int utime, int stime, int cutime, int cstime, int niceTime, int startTime)
-        : _utime(utime), _stime(stime), _cutime(cutime), _cstime(cstime), _startTime(startTime)
-    {
-        this->_upTime = _getUpTime();
-        this->_cpuCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
-    }
-
-    CpuTable() {}
-
-    int getUTime() { return _utime; }
-    int getSTime() { return _stime; }
-    int getCuTime() { return _cutime; }
-    int getCsTime() { return _cstime; }
-    int getStartTime() { return _startTime; }
-    int getUpTime() { return _upTime; }
-    int getCpuCount() { return _cpuCount; }
-    int getNiceTime() { return _niceTime; }
+/**
+ * @brief Process Delta
+ *
+ * The `process_delta` struct holds the usage of a process between two sampling rounds, as computed by
+ * `MonitorService::computeDelta`.
+ */
+struct process_delta {
+    double cpuUsage = 0.0; /**< CPU usage in percent of one CPU. */
+    double memChange = 0.0; /**< Change of the resident memory, in bytes. */
+    double diskRate = 0.0; /**< Storage bytes read plus written per second. */
+    bool continued = false; /**< Whether the previous reading belongs to the same process. */
 };
 
+
 /**
  * @brief Interface for Monitor Data
  *
@@ -194,6 +197,19 @@ public:
      */
     virtual sys_properties getAvailedSystemProperties() = 0;
 
+    /**
+     * @brief Configure Monitor
+     *
+     * This pure virtual function is meant to be implemented by derived classes. It applies the settings of the monitor
+     * section of the configuration before data is collected.
+     *
+     * @param[in] config The monitor section of the configuration table.
+     * @return An integer result code:
+     *         - SUCCESS: The settings were applied.
+     *         - FAILED: The settings are invalid.
+     */
+    virtual int configure(map<string, string> &config) = 0;
+
     /**
      * @brief Virtual Destructor
      *
@@ -213,34 +229,50 @@ public:
 class MonitorService : public IMonitor
 {
 private:
-    vector<std::future<void>> _asyncTasks;    
+    ThreadPool _pool; /**< A private fixed-size pool sampling processes in parallel. */
+    ProcParser _parser; /**< A private parser shared by the pool workers. */
+    host_info _host; /**< Host constants read once at the start of every sampling round. */
+    std::unordered_map<int, process_sample> _samples; /**< Readings of the previous round, keyed by PID. */
+    double _lastUpTime = 0.0; /**< Uptime of the previous round, 0 before the first one. */
+    double _interval = 0.0; /**< Seconds between the previous and the current round. */
+    SystemSampler _sampler; /**< Background sampler of the host-wide counters, started by the first `getData`. */
+    long long _lastReport = 0; /**< Timestamp of the newest sample rolled up into the previous report. */
+    ProcEventListener _events; /**< Optional process table kept up to date from kernel process events. */
 private:
     /**
      * @brief Save Process Data with Custom JSON Keys
      *
      * The `_saveLog` private method is used to store collected process data in a structured format. It takes a vector of
      * `process_data` objects representing process information and a vector of custom JSON attribute keys to specify
-     * how the data should be stored in the output structure.
+     * how the data should be stored in the output structure. Device totals and usage come from the latest sampler
+     * reading, and the samples taken since the previous report are added as per-minute min/max/avg rollups under
+     * `SystemMetrics`.
      *
      * @param[in] logs A vector of `process_data` objects containing process information to be stored.
-     * @param[in] columns A vector of custom JSON attribute keys to specify the structure of the log data.
+     * @param[in] running The processes of the event table, written under `ProcessObjects` with their parent and start
+     *                    time instead of usage figures.
+     * @param[in] exited The processes that exited since the previous report, written under `ExitedProcesses`.
      * @return An integer result code:
      *         - SUCCESS: The process data was successfully stored.
      *         - FAILED: The operation encountered errors and failed to store the process data.
      */
-    int _saveLog(const vector<process_data>& logs);
+    int _saveLog(const vector<process_data>& logs, const vector<tracked_process>& running, const vector<tracked_process>& exited);
 
     /**
-     * @brief Get Process Name by Process ID
+     * @brief Convert Metric Rollup
      *
-     * The `_getProcessNameById` private method is used to retrieve the name of a process identified by its unique
-     * process ID (PID).
+     * @param[in] rollup The minimum, maximum and average of a metric.
+     * @return A JSON object with `min`, `max` and `avg` members.
+     */
+    Json::Value _toJson(const metric_rollup& rollup);
+
+    /**
+     * @brief Convert Tracked Process
      *
-     * @param[in] processId The unique Process ID (PID) for which the process name is to be retrieved.
-     * @return A string representing the name of the process associated with the provided Process ID.
-     *         If no process is found with the given ID, an empty string is returned.
+     * @param[in] process An entry of the process event table.
+     * @return A JSON object with the PID, parent, name and start time, plus the exit time and code once it exited.
      */
-    string _getProcesNameById(const unsigned int& processId);
+    Json::Value _toJson(const tracked_process& process);
 
     /**
      * @brief Get All Process IDs
@@ -253,54 +285,14 @@ private:
     vector<int> _getProcessIds();
 
     /**
-     * @brief Read CPU Table for Process by ID
-     *
-     * The `_readProcessingTimeById` method is used to read the CPU table information for a specific process identified by its
-     * unique Process ID (PID). This function retrieves the CPU time-related data for the specified process, which can be used
-     * to calculate the CPU time taken by that process.
-     *
-     * @param[in] processId The unique Process ID (PID) of the process for which CPU time data is to be retrieved.
-     * @return A `CpuTable` object containing CPU time-related information for the specified process.
-     *         If the process ID is not found or there's an error reading the data, an empty `CpuTable` is returned.
-     */
-    CpuTable _readProcessingTimeById(const unsigned int& processId);
-
-    /**
-     * @brief Calculate CPU Time
-     *
-     * The `_calculateCpuTime` private method is used to calculate the actual CPU time taken based on the data in a `CpuTable`
-     * object. This function processes the CPU time-related information in the provided `CpuTable` to determine the total
-     * CPU time consumed.
-     *
-     * @param[in] table A `CpuTable` object containing CPU time-related information.
-     * @return A double value representing the total CPU time taken, calculated based on the data in the `CpuTable`.
-     *         If there is no valid CPU time data or an error occurs during calculation, 0.0 is returned.
-     */
-    double _calculateCpuTime(CpuTable& table);
-
-    /**
-     * @brief Get Memory Usage for Process by ID
-     *
-     * The `_getMemoryUsage` private method is used to retrieve the memory(RAM) usage of a specific process identified by its unique
-     * Process ID (PID). This function retrieves the memory(RAM) usage data for the specified process.
-     *
-     * @param[in] processId The unique Process ID (PID) of the process for which memory(RAM) usage is to be retrieved.
-     * @return A double value representing the memory(RAM) usage of the specified process in a suitable unit (e.g., megabytes).
-     *         If the process ID is not found or there's an error retrieving the data, 0.0 is returned.
-     */
-    double _getMemoryUsage(const unsigned int& processId);
-
-    /**
-     * @brief Get Disk Usage for Process by ID
+     * @brief Get Memory Usage
      *
-     * The `_getDiskUsage` private method is used to retrieve the disk usage of a specific process identified by its unique
-     * Process ID (PID). This function retrieves the disk usage data for the specified process.
+     * The `_getMemoryUsage` private method converts a resident set size into a percentage of the physical memory.
      *
-     * @param[in] processId The unique Process ID (PID) of the process for which disk usage is to be retrieved.
-     * @return A double value representing the disk usage of the specified process in a suitable unit (e.g., megabytes).
-     *         If the process ID is not found or there's an error retrieving the data, 0.0 is returned.
+     * @param[in] rss The resident set size in pages.
+     * @return The memory(RAM) usage in percent, or -1.0 when the physical memory is unknown.
      */
-    double _getDiskUsage(const unsigned int& processId);
+    double _getMemoryUsage(long long rss);
 
     /**
      * @brief Get Write Path for Storing Process Data
@@ -317,27 +309,54 @@ public:
      * @brief Default Constructor for MonitorService
      *
      * The default constructor for the `MonitorService` class creates an instance of the class with default settings.
-     * It initializes the object to its default state.
+     * It starts the worker pool, sized to the online CPUs and capped at `MAX_MONITOR_WORKERS`, that is reused by every
+     * sampling round.
      */
-    MonitorService() {}
+    MonitorService();
+
+    /**
+     * @brief Compute Process Delta
+     *
+     * The `computeDelta` function turns two readings of a process into its usage over the interval between them. The
+     * previous reading only counts when its start time matches, so a reused PID is treated as a new process. For a
+     * continued process the CPU usage covers the interval; for a new one it is averaged over the lifetime of the
+     * process, which for a process started since the last round is the same window. The memory change and disk rate
+     * of a new process are 0. The function reads no file, so it can be called with made-up readings.
+     *
+     * @param[in] stat The current `/proc/PID/stat` fields of the process.
+     * @param[in] io The current I/O counters, or nullptr if they could not be read.
+     * @param[in] previous The reading of the previous round with the same PID, or nullptr.
+     * @param[in] host The host constants of the current round.
+     * @param[in] interval The seconds between the previous and the current round, 0 for the first round.
+     * @return The usage of the process; CPU usage is 0.0 when no elapsed time is known.
+     */
+    static process_delta computeDelta(const proc_stat& stat, const proc_io* io, const process_sample* previous, const host_info& host, double interval);
 
     /**
      * @brief Create Process Data by Process ID
      *
      * The `createProcessData` function is used to construct a `process_data` object representing process information based
-     * on the provided Process ID (PID). This function creates a `process_data` object with relevant data fields initialized.
+     * on the provided Process ID (PID). The reading of the previous round is looked up by PID and start time; when it
+     * matches, the CPU usage, memory change and disk rate cover the interval between the rounds and the cached name is
+     * reused instead of reading `comm` again. The function only reads the cache, so pool workers may call it in parallel.
      *
      * @param[in] processId The unique Process ID (PID) for which process data is to be created.
-     * @return A `process_data` object initialized with information based on the provided Process ID.
+     * @param[out] data Receives the process information.
+     * @param[out] sample Receives the reading to keep for the next round.
+     * @return An integer result code:
+     *         - SUCCESS: The process was read.
+     *         - FAILED: The process exited before it could be read.
      */
-    process_data createProcessData(int processId);
+    int createProcessData(int processId, process_data& data, process_sample& sample);
 
     /**
      * @brief Get and Parse Monitor Data
      *
      * The `getData` function overrides the pure virtual function from the `IMonitor` class. It is used to retrieve monitor
-     * data, parse it into a JSON format, and process it. Derived classes must implement this function to provide specific
-     * functionality for retrieving and processing monitor data.
+     * data, parse it into a JSON format, and process it. The process IDs are split into one slice per pool worker; each
+     * worker fills its own result vector and the vectors are merged once every slice is done, so no lock is taken per
+     * process. The sample cache is replaced by the readings of this round after the merge, which also drops exited
+     * processes. While the process event listener runs, its table is serialized instead and no `/proc` file is read.
      *
      * @param[in] columns A vector of column names or identifiers to specify the format and structure of the monitor data.
      * @return An integer result code:
@@ -368,6 +387,21 @@ public:
      */
     sys_properties getAvailedSystemProperties();
 
+    /**
+     * @brief Configure Monitor
+     *
+     * The `configure` function overrides the pure virtual function from the `IMonitor` class. When `proc_events` is 1 it
+     * starts the process event listener; `getData` then writes the listener's table instead of scanning `/proc`, and
+     * reports the processes that exited between two rounds. When the listener cannot be started,
+     * for example without `CAP_NET_ADMIN`, the monitor keeps scanning `/proc`.
+     *
+     * @param[in] config The monitor section of the configuration table.
+     * @return An integer result code:
+     *         - SUCCESS: The settings were applied.
+     *         - FAILED: `proc_events` is not 0 or 1.
+     */
+    int configure(map<string, string> &config);
+
     /**
      * @brief Destructor for MonitorService
      *
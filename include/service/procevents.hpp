@@ -0,0 +1,139 @@
+#ifndef PROC_EVENTS_HPP
+#define PROC_EVENTS_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+#include "service/procparser.hpp"
+#include <mutex>
+#include <deque>
+
+#define PROC_EVENT_BUFFER 16384
+#define PROC_EVENT_RCVBUF (4 * 1024 * 1024)
+#define PROC_EVENT_MAX_EXITED 4096
+
+typedef struct tracked_process tracked_process;
+
+/**
+ * @brief Tracked Process
+ *
+ * The `tracked_process` struct is one entry of the process table kept by `ProcEventListener`.
+ */
+struct tracked_process
+{
+    int pid = 0;
+    int ppid = 0;
+    string processName;
+    long long started = 0; /**< Seconds since the epoch when the process was first seen. */
+    long long exited = 0; /**< Seconds since the epoch when the process exited, 0 while it runs. */
+    int exitCode = 0;
+};
+
+/**
+ * @brief Process Event Listener
+ *
+ * The `ProcEventListener` class subscribes to the kernel process connector (`NETLINK_CONNECTOR`, `CN_IDX_PROC`) and
+ * keeps a table of the running processes up to date from `PROC_EVENT_FORK`, `PROC_EVENT_EXEC`, `PROC_EVENT_COMM` and
+ * `PROC_EVENT_EXIT` messages. The table is seeded from `/proc` once and rebuilt only when the socket overflows, so
+ * reading the process list costs no file system access. Processes that exit between two reads are kept in a separate
+ * list, which lets the monitor report processes that lived for less than one sampling interval.
+ *
+ * The subscription needs `CAP_NET_ADMIN`; callers fall back to scanning `/proc` when `start` fails.
+ */
+class ProcEventListener
+{
+private:
+    ProcParser _parser;
+    int _socket = -1;
+    int _wakeFd = -1;
+    std::thread _thread;
+    std::atomic<bool> _running;
+    std::atomic<unsigned long long> _events;
+    std::atomic<unsigned long long> _overflows;
+    mutable std::mutex _mutex;
+    std::unordered_map<int, tracked_process> _processes;
+    std::deque<tracked_process> _exited;
+
+    int _subscribe(bool enable);
+    void _scan();
+    void _handle(const char *data, size_t length);
+    void _run();
+
+public:
+    ProcEventListener();
+
+    ProcEventListener(const ProcEventListener &) = delete;
+    ProcEventListener &operator=(const ProcEventListener &) = delete;
+
+    /**
+     * @brief Start Listening
+     *
+     * Opens and subscribes the connector socket, seeds the table from `/proc` and starts the listener thread. Calling
+     * `start` on a running listener does nothing.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The listener is running.
+     *         - FAILED: The socket could not be opened or subscribed, usually for lack of privileges.
+     */
+    int start();
+
+    /**
+     * @brief Stop Listening
+     *
+     * Unsubscribes, joins the listener thread and closes the socket. The table is kept.
+     */
+    void stop();
+
+    /**
+     * @brief Check Listener State
+     *
+     * @return true if the listener thread is running.
+     */
+    bool isRunning() const { return _running.load(); }
+
+    /**
+     * @brief Get Running Process IDs
+     *
+     * @return The PIDs in the table, in no particular order.
+     */
+    vector<int> getPids() const;
+
+    /**
+     * @brief Get Running Processes
+     *
+     * @return A copy of the table entries.
+     */
+    vector<tracked_process> getProcesses() const;
+
+    /**
+     * @brief Drain Exited Processes
+     *
+     * Returns the processes that exited since the previous call and clears the list. At most
+     * `PROC_EVENT_MAX_EXITED` entries are kept; older ones are dropped first.
+     *
+     * @return The exited processes, oldest first.
+     */
+    vector<tracked_process> drainExited();
+
+    /**
+     * @brief Get Event Count
+     *
+     * @return The number of process events handled since the listener was created.
+     */
+    unsigned long long getEventCount() const { return _events.load(); }
+
+    /**
+     * @brief Get Overflow Count
+     *
+     * @return The number of times the socket buffer overflowed and the table was rebuilt from `/proc`.
+     */
+    unsigned long long getOverflowCount() const { return _overflows.load(); }
+
+    /**
+     * @brief Destructor for ProcEventListener.
+     *
+     * Stops the listener.
+     */
+    ~ProcEventListener();
+};
+
+#endif
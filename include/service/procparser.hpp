@@ -0,0 +1,249 @@
+#ifndef PROC_PARSER_HPP
+#define PROC_PARSER_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+
+#define PROC_READ_BUFFER 1024
+
+typedef struct proc_stat proc_stat;
+typedef struct proc_io proc_io;
+typedef struct host_info host_info;
+
+/**
+ * @brief Process Status Fields
+ *
+ * The `proc_stat` struct holds the fields of `/proc/PID/stat` that the monitor uses. Times are in clock ticks and the
+ * resident set size is in pages, exactly as reported by the kernel.
+ */
+struct proc_stat
+{
+    int pid = 0;
+    char state = 0;
+    int ppid = 0;
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    long long cutime = 0;
+    long long cstime = 0;
+    long long nice = 0;
+    unsigned long long startTime = 0;
+    unsigned long long vsize = 0;
+    long long rss = 0;
+};
+
+/**
+ * @brief Process I/O Counters
+ *
+ * The `proc_io` struct holds the storage layer byte counters of `/proc/PID/io`.
+ */
+struct proc_io
+{
+    unsigned long long readBytes = 0;
+    unsigned long long writeBytes = 0;
+};
+
+/**
+ * @brief Host Constants
+ *
+ * The `host_info` struct holds the host-wide values needed to turn per-process counters into percentages. They are
+ * read once per sampling round instead of once per process.
+ */
+struct host_info
+{
+    long pageSize = 0;
+    unsigned long long totalMemory = 0; /**< Physical memory in bytes. */
+    double upTime = 0.0; /**< Seconds since boot. */
+    int cpuCount = 1;
+    long clockTicks = 100; /**< Clock ticks per second. */
+};
+
+/**
+ * @brief Low-Overhead /proc Parser
+ *
+ * The `ProcParser` class reads per-process files with `openat` relative to a `/proc` directory descriptor opened once,
+ * `pread`s them into a stack buffer and scans the numbers by hand. No stream, string split or exception is involved on
+ * the per-process path. The parser holds no mutable state after construction, so one instance can be shared by several
+ * sampling threads.
+ */
+class ProcParser
+{
+private:
+    int _procFd;
+
+    ssize_t _read(int processId, const char *name, char *buffer, size_t size) const;
+
+public:
+    /**
+     * @brief Proc Parser Constructor
+     *
+     * Opens the proc directory.
+     *
+     * @param[in] root The mount point of procfs.
+     */
+    explicit ProcParser(const string &root = "/proc");
+
+    ProcParser(const ProcParser &) = delete;
+    ProcParser &operator=(const ProcParser &) = delete;
+
+    /**
+     * @brief Check Proc Directory
+     *
+     * @return true if the proc directory was opened.
+     */
+    bool isOpen() const { return _procFd >= 0; }
+
+    /**
+     * @brief Read Host Constants
+     *
+     * Fills `info` with the page size, physical memory, CPU count, clock ticks and the current uptime.
+     *
+     * @param[out] info Receives the host constants.
+     * @return An integer result code:
+     *         - SUCCESS: The values were read.
+     *         - FAILED: `/proc/uptime` could not be read.
+     */
+    int readHostInfo(host_info &info) const;
+
+    /**
+     * @brief List Process IDs
+     *
+     * @param[out] processIds Receives the numeric entries of the proc directory.
+     * @return SUCCESS, or FAILED if the directory could not be listed.
+     */
+    int listPids(vector<int> &processIds) const;
+
+    /**
+     * @brief List Thread IDs
+     *
+     * @param[in] processId The process whose threads are listed.
+     * @param[out] taskIds Receives the entries of `/proc/PID/task`, the main thread included.
+     * @return SUCCESS, or FAILED if the process is gone.
+     */
+    int listTasks(int processId, vector<int> &taskIds) const;
+
+    /**
+     * @brief Read Process Status
+     *
+     * @param[in] processId The process to read.
+     * @param[out] stat Receives the parsed `/proc/PID/stat` fields.
+     * @return SUCCESS, or FAILED if the process is gone or the file is malformed.
+     */
+    int readStat(int processId, proc_stat &stat) const;
+
+    /**
+     * @brief Read Resident Pages
+     *
+     * @param[in] processId The process to read.
+     * @param[out] resident Receives the resident set size in pages from `/proc/PID/statm`.
+     * @return SUCCESS, or FAILED if the process is gone or the file is malformed.
+     */
+    int readStatm(int processId, unsigned long long &resident) const;
+
+    /**
+     * @brief Read Process I/O
+     *
+     * `/proc/PID/io` is only readable by the owner of the process or by root.
+     *
+     * @param[in] processId The process to read.
+     * @param[out] io Receives the parsed byte counters.
+     * @return SUCCESS, or FAILED if the file could not be read.
+     */
+    int readIo(int processId, proc_io &io) const;
+
+    /**
+     * @brief Read Process Name
+     *
+     * @param[in] processId The process to read.
+     * @param[out] name Receives the content of `/proc/PID/comm` without the trailing newline.
+     * @return SUCCESS, or FAILED if the process is gone.
+     */
+    int readComm(int processId, string &name) const;
+
+    /**
+     * @brief Parse Stat Buffer
+     *
+     * The command name is located through the last `)` so names containing spaces or parentheses are handled.
+     *
+     * @param[in] buffer The content of a `/proc/PID/stat` file.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] stat Receives the parsed fields.
+     * @return true if every field was found.
+     */
+    static bool parseStat(const char *buffer, size_t length, proc_stat &stat);
+
+    /**
+     * @brief Parse Statm Buffer
+     *
+     * @param[in] buffer The content of a `/proc/PID/statm` file.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] resident Receives the second field, the resident pages.
+     * @return true if the field was found.
+     */
+    static bool parseStatm(const char *buffer, size_t length, unsigned long long &resident);
+
+    /**
+     * @brief Parse I/O Buffer
+     *
+     * @param[in] buffer The content of a `/proc/PID/io` file.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] io Receives the `read_bytes` and `write_bytes` counters.
+     * @return true if both counters were found.
+     */
+    static bool parseIo(const char *buffer, size_t length, proc_io &io);
+
+    /**
+     * @brief Parse Uptime Buffer
+     *
+     * @param[in] buffer The content of `/proc/uptime`.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] upTime Receives the seconds since boot.
+     * @return true if the value was found.
+     */
+    static bool parseUpTime(const char *buffer, size_t length, double &upTime);
+
+    /**
+     * @brief Parse CPU Times
+     *
+     * Reads the aggregate `cpu` line of `/proc/stat`. Idle and I/O wait count as idle time.
+     *
+     * @param[in] buffer The content of `/proc/stat`; only the first line is needed.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] busy Receives the non-idle clock ticks.
+     * @param[out] total Receives all clock ticks.
+     * @return true if the line was found.
+     */
+    static bool parseCpuTimes(const char *buffer, size_t length, unsigned long long &busy, unsigned long long &total);
+
+    /**
+     * @brief Parse Memory Information
+     *
+     * @param[in] buffer The content of `/proc/meminfo`.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] total Receives `MemTotal` in kB.
+     * @param[out] available Receives `MemAvailable` in kB, or `MemFree` on kernels without it.
+     * @return true if the total was found.
+     */
+    static bool parseMemInfo(const char *buffer, size_t length, unsigned long long &total, unsigned long long &available);
+
+    /**
+     * @brief Parse Network Counters
+     *
+     * Sums the byte counters of every interface in `/proc/net/dev` except the loopback.
+     *
+     * @param[in] buffer The content of `/proc/net/dev`.
+     * @param[in] length The number of bytes in `buffer`.
+     * @param[out] received Receives the received bytes.
+     * @param[out] transmitted Receives the transmitted bytes.
+     * @return true if the buffer had the expected layout.
+     */
+    static bool parseNetDev(const char *buffer, size_t length, unsigned long long &received, unsigned long long &transmitted);
+
+    /**
+     * @brief Destructor for ProcParser.
+     *
+     * Closes the proc directory.
+     */
+    ~ProcParser();
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief Bounded Lock-Free Ring Buffer
+ *
+ * The `RingBuffer` class is a fixed-capacity queue that hands items from producer threads to consumer threads without
+ * taking a lock. Every slot carries a sequence number which tells producers and consumers whether the slot is free or
+ * holds data for the current lap, so any number of producers and consumers may use it at the same time (SPSC and MPSC
+ * are special cases). When the ring is full `push` fails immediately instead of blocking, which lets the caller count
+ * the drop and keep reading from the network.
+ *
+ * @tparam T The type of the queued items. It must be default constructible and move assignable.
+ */
+template <typename T>
+class RingBuffer
+{
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<cell[]> _buffer; /**< Preallocated slots, the count is always a power of two. */
+    size_t _mask; /**< Slot count minus one, used to wrap positions. */
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> _enqueuePos; /**< Next position a producer claims. */
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> _dequeuePos; /**< Next position a consumer claims. */
+
+    static size_t _roundUp(size_t value)
+    {
+        size_t size = 2;
+        while (size < value)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+public:
+    /**
+     * @brief Ring Buffer Constructor
+     *
+     * Allocates every slot up front. The requested capacity is rounded up to the next power of two.
+     *
+     * @param[in] capacity The minimum number of items the ring can hold.
+     */
+    explicit RingBuffer(size_t capacity) : _mask(_roundUp(capacity) - 1), _enqueuePos(0), _dequeuePos(0)
+    {
+        _buffer.reset(new cell[_mask + 1]);
+        for (size_t i = 0; i <= _mask; i++)
+        {
+            _buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    /**
+     * @brief Push Item
+     *
+     * Moves `item` into the next free slot.
+     *
+     * @param[in] item The item to enqueue.
+     * @return true if the item was queued, false if the ring is full.
+     */
+    bool push(T &&item)
+    {
+        cell *slot;
+        size_t position = _enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            slot = &_buffer[position & _mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+            if (diff == 0)
+            {
+                if (_enqueuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->data = std::move(item);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pop Item
+     *
+     * Moves the oldest queued item into `item`.
+     *
+     * @param[out] item Receives the dequeued item.
+     * @return true if an item was dequeued, false if the ring is empty.
+     */
+    bool pop(T &item)
+    {
+        cell *slot;
+        size_t position = _dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            slot = &_buffer[position & _mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+            if (diff == 0)
+            {
+                if (_dequeuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = _dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(slot->data);
+        slot->sequence.store(position + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get Capacity
+     *
+     * @return The number of slots in the ring.
+     */
+    size_t capacity() const { return _mask + 1; }
+
+    /**
+     * @brief Get Approximate Size
+     *
+     * The value is only a snapshot when other threads are pushing or popping.
+     *
+     * @return The number of items currently queued.
+     */
+    size_t size() const
+    {
+        size_t enqueue = _enqueuePos.load(std::memory_order_relaxed);
+        size_t dequeue = _dequeuePos.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+};
+
+#endif
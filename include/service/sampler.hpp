@@ -0,0 +1,161 @@
+#ifndef SYSTEM_SAMPLER_HPP
+#define SYSTEM_SAMPLER_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+#include <condition_variable>
+#include <mutex>
+#include "service/procparser.hpp"
+#include "service/timeseries.hpp"
+
+#define SAMPLER_INTERVAL_MS 1000
+#define SAMPLER_CAPACITY 3600
+#define SAMPLER_ROLLUP_SECONDS 60
+
+typedef struct system_sample system_sample;
+typedef struct metric_rollup metric_rollup;
+typedef struct sample_rollup sample_rollup;
+
+/**
+ * @brief System Sample
+ *
+ * The `system_sample` struct is one reading of the host-wide counters. Usage values are percentages and rates are
+ * bytes per second since the previous reading.
+ */
+struct system_sample
+{
+    long long timestamp; /**< Seconds since the epoch. */
+    double cpuUsage;
+    double ramUsage;
+    double diskUsage;
+    double networkRx;
+    double networkTx;
+    double cpuTotal; /**< Clock ticks since boot, summed over all CPUs. */
+    double ramTotal; /**< Physical memory in GB. */
+    double diskTotal; /**< Size of the root file system in GB. */
+};
+
+/**
+ * @brief Metric Rollup
+ *
+ * The minimum, maximum and average of one metric over a rollup window.
+ */
+struct metric_rollup
+{
+    double min = 0.0;
+    double max = 0.0;
+    double avg = 0.0;
+};
+
+/**
+ * @brief Sample Rollup
+ *
+ * The `sample_rollup` struct summarises the samples of one rollup window.
+ */
+struct sample_rollup
+{
+    long long start = 0; /**< Timestamp of the first sample in the window. */
+    size_t count = 0;
+    metric_rollup cpuUsage;
+    metric_rollup ramUsage;
+    metric_rollup diskUsage;
+    metric_rollup networkRx;
+    metric_rollup networkTx;
+};
+
+/**
+ * @brief System Sampler
+ *
+ * The `SystemSampler` class reads the CPU, memory, disk and network counters of the host on a background thread every
+ * `SAMPLER_INTERVAL_MS` and appends them to a lock-free `TimeSeries`. `/proc/stat`, `/proc/meminfo` and `/proc/net/dev`
+ * are opened once and re-read with `pread`, so a sample costs a handful of system calls. Reports read the ring instead
+ * of the files, which gives them second-level resolution without any file I/O on the request path.
+ */
+class SystemSampler
+{
+private:
+    TimeSeries<system_sample> _series;
+    int _intervalMs;
+    int _statFd = -1;
+    int _memInfoFd = -1;
+    int _netDevFd = -1;
+    unsigned long long _lastBusy = 0;
+    unsigned long long _lastTotal = 0;
+    unsigned long long _lastRx = 0;
+    unsigned long long _lastTx = 0;
+    std::chrono::steady_clock::time_point _lastSample;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::atomic<bool> _running;
+
+    int _sample(system_sample &sample);
+    void _run();
+
+public:
+    /**
+     * @brief System Sampler Constructor
+     *
+     * @param[in] capacity The number of samples kept, one per interval.
+     * @param[in] intervalMs The sampling interval in milliseconds.
+     */
+    explicit SystemSampler(size_t capacity = SAMPLER_CAPACITY, int intervalMs = SAMPLER_INTERVAL_MS);
+
+    SystemSampler(const SystemSampler &) = delete;
+    SystemSampler &operator=(const SystemSampler &) = delete;
+
+    /**
+     * @brief Start Sampling
+     *
+     * Takes the first sample synchronously, so `latest` succeeds as soon as `start` returns, and starts the
+     * background thread. Calling `start` on a running sampler does nothing.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The sampler is running.
+     *         - FAILED: The proc files could not be opened.
+     */
+    int start();
+
+    /**
+     * @brief Stop Sampling
+     *
+     * Wakes and joins the background thread. The collected samples are kept.
+     */
+    void stop();
+
+    /**
+     * @brief Check Sampler State
+     *
+     * @return true if the background thread is running.
+     */
+    bool isRunning() const { return _running.load(); }
+
+    /**
+     * @brief Get Latest Sample
+     *
+     * @param[out] sample Receives the most recent sample.
+     * @return true if a sample was available.
+     */
+    bool latest(system_sample &sample) const { return _series.latest(sample); }
+
+    /**
+     * @brief Roll Up Samples
+     *
+     * Groups the samples taken after `since` into windows of `bucketSeconds` and computes the minimum, maximum and
+     * average of every metric in each window.
+     *
+     * @param[in] since Only samples with a later timestamp are used; 0 uses the whole ring.
+     * @param[in] bucketSeconds The width of one window.
+     * @return The windows, oldest first.
+     */
+    vector<sample_rollup> rollup(long long since, int bucketSeconds = SAMPLER_ROLLUP_SECONDS) const;
+
+    /**
+     * @brief Destructor for SystemSampler.
+     *
+     * Stops the background thread and closes the proc files.
+     */
+    ~SystemSampler();
+};
+
+#endif
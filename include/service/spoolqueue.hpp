@@ -0,0 +1,195 @@
+#ifndef SPOOL_QUEUE_HPP
+#define SPOOL_QUEUE_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+#include <deque>
+#include <mutex>
+#include <random>
+
+#define SPOOL_DIR "spool/"
+#define SPOOL_INDEX_FILE "index"
+#define SPOOL_SEGMENT_SUFFIX ".seg"
+#define SPOOL_MAX_BYTES (64 * 1024 * 1024)
+#define SPOOL_SEGMENT_BYTES (1024 * 1024)
+#define SPOOL_HIGH_WATER 90 /* Percent of the quota above which new records are refused. */
+#define SPOOL_RETRY_BASE 5
+#define SPOOL_RETRY_MAX 1800
+#define SPOOL_RECORD_HEADER 8
+
+typedef struct spool_position spool_position;
+
+/**
+ * @brief Spool Position
+ *
+ * A record boundary in the queue: the sequence number of a segment file and a byte offset into it.
+ */
+struct spool_position
+{
+    uint64_t segment = 0;
+    uint64_t offset = 0;
+};
+
+/**
+ * @brief Spool Queue
+ *
+ * The `SpoolQueue` class is a persistent first-in, first-out queue of records waiting to be uploaded. Records are
+ * appended to numbered segment files, each record framed by its length and CRC-32, and a new segment is started once
+ * the current one reaches `segmentBytes`. The position up to which records have been delivered is kept in an index
+ * file that is replaced atomically on every `commit`, and segments wholly before it are deleted, so after a restart
+ * delivery resumes at the first record that was not acknowledged. A record torn by a crash is cut off when the queue
+ * is opened.
+ *
+ * The segments never take more than `maxBytes` of disk: when a record would exceed it, the oldest segments are
+ * dropped first. Above `SPOOL_HIGH_WATER` percent of the quota `accepting` returns false, which the collectors use
+ * to stop producing until the queue drains.
+ *
+ * Failed deliveries are retried with exponential backoff and jitter, and the time of the next attempt is kept in the
+ * index so that a restart, or many devices coming back online together, do not all retry at once.
+ *
+ * All methods are thread-safe.
+ */
+class SpoolQueue
+{
+private:
+    string _directory;
+    size_t _maxBytes;
+    size_t _segmentBytes;
+    mutable std::mutex _mutex;
+    std::deque<std::pair<uint64_t, size_t>> _segments; /**< Sequence number and size, oldest first. */
+    size_t _totalBytes = 0;
+    int _writeFd = -1;
+    spool_position _committed;
+    unsigned int _failures = 0;
+    time_t _nextAttempt = 0;
+    size_t _evictedBytes = 0;
+    std::mt19937 _random;
+
+    string _segmentPath(uint64_t segment) const;
+    int _openSegment(uint64_t segment);
+    int _recoverSegment(uint64_t segment, size_t &size);
+    int _loadIndex();
+    int _saveIndex();
+    void _evict(size_t incoming);
+
+public:
+    /**
+     * @brief Spool Queue Constructor
+     *
+     * @param[in] directory Where the segments and the index are kept; created if missing.
+     * @param[in] maxBytes The disk quota of the segments.
+     * @param[in] segmentBytes The size at which a new segment is started.
+     */
+    explicit SpoolQueue(const string &directory, size_t maxBytes = SPOOL_MAX_BYTES, size_t segmentBytes = SPOOL_SEGMENT_BYTES);
+
+    SpoolQueue(const SpoolQueue &) = delete;
+    SpoolQueue &operator=(const SpoolQueue &) = delete;
+
+    /**
+     * @brief Open Queue
+     *
+     * Lists the existing segments, cuts a torn record off the newest one and reads the index.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The queue is ready.
+     *         - FAILED: The directory or a segment could not be opened.
+     */
+    int open();
+
+    /**
+     * @brief Push Record
+     *
+     * Appends a record. It is durable once `sync` returns.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The record was appended, possibly after dropping the oldest segments.
+     *         - FAILED: The record is larger than the quota or could not be written.
+     */
+    int push(const string &record);
+
+    /**
+     * @brief Sync Queue
+     *
+     * Flushes the appended records to disk.
+     */
+    int sync();
+
+    /**
+     * @brief Peek Records
+     *
+     * Reads records, without removing them, from `from` onwards until `maxBytes` is reached. At least one record is
+     * returned when the queue is not empty.
+     *
+     * @param[in] from The position to read from, `committed()` or the `next` of an earlier peek.
+     * @param[in] maxBytes The size budget of the records read.
+     * @param[out] records The records read.
+     * @param[out] next The position after the last record read.
+     * @return An integer result code:
+     *         - SUCCESS: Zero or more records were read.
+     *         - FAILED: A segment could not be read.
+     */
+    int peek(const spool_position &from, size_t maxBytes, vector<string> &records, spool_position &next);
+
+    /**
+     * @brief Commit Position
+     *
+     * Marks every record before `position` as delivered, saves the index and deletes the segments that are no longer
+     * needed.
+     */
+    int commit(const spool_position &position);
+
+    spool_position committed() const;
+
+    /**
+     * @brief Check Backpressure
+     *
+     * @return false while the records not yet delivered take more than `SPOOL_HIGH_WATER` percent of the quota.
+     */
+    bool accepting() const;
+
+    /**
+     * @brief Get Disk Usage
+     *
+     * @return The bytes taken by the segments.
+     */
+    size_t usage() const;
+
+    /**
+     * @brief Get Evicted Bytes
+     *
+     * @return The bytes of records dropped to stay within the quota since the queue was created.
+     */
+    size_t evicted() const;
+
+    /**
+     * @brief Check Retry Time
+     *
+     * @return true if no delivery has failed since the last success, or the backoff has elapsed.
+     */
+    bool ready(time_t now) const;
+
+    /**
+     * @brief Record Failed Delivery
+     *
+     * Schedules the next attempt after a random delay between half and all of `base * 2^failures`, capped at `max`.
+     *
+     * @return The delay in seconds.
+     */
+    time_t onFailure(time_t now, time_t base = SPOOL_RETRY_BASE, time_t max = SPOOL_RETRY_MAX);
+
+    /**
+     * @brief Record Successful Delivery
+     *
+     * Resets the backoff.
+     */
+    void onSuccess();
+
+    /**
+     * @brief Destructor for SpoolQueue.
+     *
+     * Syncs and closes the segment being written.
+     */
+    ~SpoolQueue();
+};
+
+#endif
@@ -0,0 +1,549 @@
+#ifndef TCP_QUEUE
+#define TCP_QUEUE
+
+#include "agentUtils.hpp"
+#include "service/ringbuffer.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_TCP_MSG_SIZE 65536
+#define TCP_READ_BUFFER (64 * 1024)
+#define TCP_MAX_CONNECTIONS 8192
+#define TCP_MAX_EVENTS 256
+#define TCP_POLL_TIMEOUT_MS 500
+
+typedef struct tcp_stats tcp_stats;
+
+/**
+ * @brief TCP Receiver Statistics
+ *
+ * The `tcp_stats` struct holds the counters of the TCP syslog listener. They are updated by the event loop thread and
+ * can be read at any time by other threads.
+ */
+struct tcp_stats
+{
+    std::atomic<unsigned long long> accepted{0};    /**< Connections accepted. */
+    std::atomic<unsigned long long> rejected{0};    /**< Connections closed because the limit was reached. */
+    std::atomic<unsigned long long> active{0};      /**< Connections currently open. */
+    std::atomic<unsigned long long> received{0};    /**< Messages framed and queued. */
+    std::atomic<unsigned long long> ringDropped{0}; /**< Messages dropped because the ring was full. */
+    std::atomic<unsigned long long> truncated{0};   /**< Messages cut to MAX_TCP_MSG_SIZE. */
+    std::atomic<unsigned long long> malformed{0};   /**< Connections closed on an invalid octet count. */
+};
+
+/**
+ * @brief Syslog Stream Framer
+ *
+ * The `SyslogFramer` class splits a TCP byte stream into syslog messages following RFC 6587. A frame that starts with
+ * a digit uses octet counting (`MSG-LEN SP SYSLOG-MSG`), any other frame is terminated by a line feed (non-transparent
+ * framing); both may be mixed on one connection. Complete frames found in the data passed to `feed` are copied once,
+ * straight into the delivered string. Only the tail of a frame split across reads is kept, in `_message`, and later
+ * bytes are appended to it directly.
+ */
+class SyslogFramer
+{
+private:
+    enum frame_state
+    {
+        FRAME_START,
+        FRAME_LENGTH,
+        FRAME_OCTETS,
+        FRAME_LINE,
+        FRAME_SKIP_LINE
+    };
+
+    frame_state _state = FRAME_START;
+    size_t _expected = 0; /**< Octets still missing in the current octet-counted frame. */
+    size_t _skip = 0;     /**< Octets of an oversized octet-counted frame left to discard. */
+    size_t _maxSize;
+    string _message;      /**< Partial frame carried over to the next read. */
+
+    static void _trimLine(const char *data, size_t &length)
+    {
+        if (length > 0 && data[length - 1] == '\r')
+            length--;
+    }
+
+public:
+    size_t truncated = 0; /**< Frames cut to the maximum size. */
+
+    explicit SyslogFramer(size_t maxSize = MAX_TCP_MSG_SIZE) : _maxSize(maxSize) {}
+
+    /**
+     * @brief Feed Stream Data
+     *
+     * Frames as many messages as possible from `data` and hands each one to `deliver`. Incomplete frames are carried
+     * over to the next call.
+     *
+     * @param[in] data The bytes read from the connection.
+     * @param[in] length The number of bytes in `data`.
+     * @param[in] deliver A callable receiving each message as `string&&`.
+     * @return The number of delivered messages, or -1 if the octet count is invalid.
+     */
+    template <typename Deliver>
+    int feed(const char *data, size_t length, Deliver &&deliver)
+    {
+        int count = 0;
+        size_t position = 0;
+        while (position < length)
+        {
+            switch (_state)
+            {
+            case FRAME_START:
+                if (data[position] == '\n' || data[position] == '\r' || data[position] == '\0')
+                {
+                    position++; /* Stray separators between frames. */
+                }
+                else if (isdigit((unsigned char)data[position]))
+                {
+                    _expected = 0;
+                    _state = FRAME_LENGTH;
+                }
+                else
+                {
+                    _state = FRAME_LINE;
+                }
+                break;
+
+            case FRAME_LENGTH:
+                while (position < length && isdigit((unsigned char)data[position]))
+                {
+                    _expected = _expected * 10 + (data[position] - '0');
+                    if (_expected > 99999999)
+                        return -1;
+                    position++;
+                }
+                if (position < length)
+                {
+                    if (data[position] != ' ')
+                        return -1;
+                    position++;
+                    _skip = _expected > _maxSize ? _expected - _maxSize : 0;
+                    _expected -= _skip;
+                    if (_skip > 0)
+                        truncated++;
+                    _state = FRAME_OCTETS;
+                    if (_expected == 0 && _skip == 0)
+                        _state = FRAME_START;
+                }
+                break;
+
+            case FRAME_OCTETS:
+            {
+                size_t available = length - position;
+                if (_expected > 0)
+                {
+                    size_t take = std::min(available, _expected);
+                    if (_message.empty() && take == _expected)
+                    {
+                        deliver(string(data + position, take));
+                        count++;
+                    }
+                    else
+                    {
+                        if (_message.empty())
+                            _message.reserve(_expected);
+                        _message.append(data + position, take);
+                        if (take == _expected)
+                        {
+                            deliver(std::move(_message));
+                            _message = string();
+                            count++;
+                        }
+                    }
+                    position += take;
+                    _expected -= take;
+                }
+                else
+                {
+                    size_t take = std::min(length - position, _skip);
+                    position += take;
+                    _skip -= take;
+                }
+                if (_expected == 0 && _skip == 0)
+                    _state = FRAME_START;
+                break;
+            }
+
+            case FRAME_LINE:
+            {
+                const char *end = (const char *)memchr(data + position, '\n', length - position);
+                size_t take = (end ? (size_t)(end - data) : length) - position;
+                if (_message.size() + take > _maxSize)
+                {
+                    _message.append(data + position, _maxSize - _message.size());
+                    deliver(std::move(_message));
+                    _message = string();
+                    truncated++;
+                    count++;
+                    _state = FRAME_SKIP_LINE;
+                    break;
+                }
+                if (end == nullptr)
+                {
+                    _message.append(data + position, take);
+                    position = length;
+                    break;
+                }
+                if (_message.empty())
+                {
+                    _trimLine(data + position, take);
+                    deliver(string(data + position, take));
+                }
+                else
+                {
+                    _message.append(data + position, take);
+                    size_t size = _message.size();
+                    _trimLine(_message.data(), size);
+                    _message.resize(size);
+                    deliver(std::move(_message));
+                    _message = string();
+                }
+                count++;
+                position = end - data + 1;
+                _state = FRAME_START;
+                break;
+            }
+
+            case FRAME_SKIP_LINE:
+            {
+                const char *end = (const char *)memchr(data + position, '\n', length - position);
+                if (end == nullptr)
+                {
+                    position = length;
+                }
+                else
+                {
+                    position = end - data + 1;
+                    _state = FRAME_START;
+                }
+                break;
+            }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Flush Pending Line
+     *
+     * Delivers an unterminated line-framed message when the sender closes the connection. Incomplete octet-counted
+     * frames are discarded.
+     *
+     * @param[in] deliver A callable receiving the message as `string&&`.
+     * @return 1 if a message was delivered, 0 otherwise.
+     */
+    template <typename Deliver>
+    int flush(Deliver &&deliver)
+    {
+        int count = 0;
+        if (_state == FRAME_LINE && !_message.empty())
+        {
+            deliver(std::move(_message));
+            count = 1;
+        }
+        _message = string();
+        _state = FRAME_START;
+        return count;
+    }
+};
+
+/**
+ * @brief TCP Syslog Listener
+ *
+ * The `TcpQueue` class accepts remote syslog over TCP. A single event loop thread drives the listening socket and every
+ * sender connection through `epoll`, so thousands of concurrent senders cost one thread. Each connection owns a
+ * `SyslogFramer` that supports RFC 6587 octet counting and newline framing. Framed messages go to the same shard rings
+ * that the UDP receivers feed, so consumers see one ingestion stream regardless of the transport.
+ */
+class TcpQueue
+{
+private:
+    int _port;
+    int _listenSocket = -1;
+    int _epollFd = -1;
+    int _wakeFd = -1;
+    vector<std::shared_ptr<RingBuffer<string>>> _shards;
+    std::unordered_map<int, std::unique_ptr<SyslogFramer>> _connections;
+    tcp_stats _stats;
+    std::atomic<bool> _running{false};
+    std::thread _loop;
+    std::mutex _startMutex;
+
+    int _openSocket()
+    {
+        int listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenSocket == -1)
+            return FAILED;
+
+        int enable = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        struct sockaddr_in serverAddr;
+        memset(&serverAddr, 0, sizeof(serverAddr));
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(_port);
+        serverAddr.sin_addr.s_addr = INADDR_ANY;
+
+        if (bind(listenSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1 || listen(listenSocket, SOMAXCONN) == -1)
+        {
+            AgentUtils::writeLog("Error listening on TCP port " + std::to_string(_port), FAILED);
+            close(listenSocket);
+            return FAILED;
+        }
+        return listenSocket;
+    }
+
+    void _accept()
+    {
+        while (true)
+        {
+            int client = accept4(_listenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client == -1)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+                {
+                    AgentUtils::writeLog("Failed to accept syslog connection: " + string(strerror(errno)), WARNING);
+                }
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+            if (_connections.size() >= TCP_MAX_CONNECTIONS)
+            {
+                _stats.rejected.fetch_add(1, std::memory_order_relaxed);
+                close(client);
+                continue;
+            }
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+            event.data.fd = client;
+            if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, client, &event) == -1)
+            {
+                close(client);
+                continue;
+            }
+            _connections[client].reset(new SyslogFramer());
+            _stats.accepted.fetch_add(1, std::memory_order_relaxed);
+            _stats.active.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void _closeConnection(int client)
+    {
+        auto it = _connections.find(client);
+        if (it == _connections.end())
+            return;
+        RingBuffer<string> &ring = *_shards[client % _shards.size()];
+        it->second->flush([&](string &&message) { _push(ring, std::move(message)); });
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, client, nullptr);
+        close(client);
+        _connections.erase(it);
+        _stats.active.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void _push(RingBuffer<string> &ring, string &&message)
+    {
+        if (ring.push(std::move(message)))
+            _stats.received.fetch_add(1, std::memory_order_relaxed);
+        else
+            _stats.ringDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void _read(int client, vector<char> &buffer)
+    {
+        auto it = _connections.find(client);
+        if (it == _connections.end())
+            return;
+        SyslogFramer &framer = *it->second;
+        RingBuffer<string> &ring = *_shards[client % _shards.size()];
+        size_t truncated = framer.truncated;
+        while (true)
+        {
+            ssize_t length = read(client, buffer.data(), buffer.size());
+            if (length > 0)
+            {
+                if (framer.feed(buffer.data(), (size_t)length, [&](string &&message) { _push(ring, std::move(message)); }) < 0)
+                {
+                    _stats.malformed.fetch_add(1, std::memory_order_relaxed);
+                    _closeConnection(client);
+                    return;
+                }
+                continue;
+            }
+            if (length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (length == -1 && errno == EINTR)
+                continue;
+            _stats.truncated.fetch_add(framer.truncated - truncated, std::memory_order_relaxed);
+            _closeConnection(client); /* Orderly shutdown or error. */
+            return;
+        }
+        _stats.truncated.fetch_add(framer.truncated - truncated, std::memory_order_relaxed);
+    }
+
+    void _run()
+    {
+        vector<struct epoll_event> events(TCP_MAX_EVENTS);
+        vector<char> buffer(TCP_READ_BUFFER);
+        while (_running.load(std::memory_order_relaxed))
+        {
+            int count = epoll_wait(_epollFd, events.data(), TCP_MAX_EVENTS, TCP_POLL_TIMEOUT_MS);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                AgentUtils::writeLog("Syslog event loop failed: " + string(strerror(errno)), FAILED);
+                break;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == _wakeFd)
+                    continue;
+                if (fd == _listenSocket)
+                {
+                    _accept();
+                    continue;
+                }
+                if (events[i].events & EPOLLIN)
+                {
+                    _read(fd, buffer); /* Drains the data that arrived before a hangup as well. */
+                }
+                else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    _closeConnection(fd);
+                }
+            }
+        }
+        while (!_connections.empty())
+        {
+            _closeConnection(_connections.begin()->first);
+        }
+    }
+
+    void _close()
+    {
+        if (_listenSocket >= 0)
+            close(_listenSocket);
+        if (_wakeFd >= 0)
+            close(_wakeFd);
+        if (_epollFd >= 0)
+            close(_epollFd);
+        _listenSocket = _wakeFd = _epollFd = -1;
+    }
+
+public:
+    /**
+     * @brief TCP Listener Constructor
+     *
+     * @param[in] port The TCP port to listen on.
+     */
+    TcpQueue(int port = 0) : _port(port) {}
+
+    /**
+     * @brief Set Listening Port
+     *
+     * Changes the port used by the next `start`. It has no effect on a listener that is already running.
+     *
+     * @param[in] port The TCP port to listen on.
+     */
+    void setPort(int port)
+    {
+        std::lock_guard<std::mutex> lock(_startMutex);
+        if (!_running.load())
+        {
+            _port = port;
+        }
+    }
+
+    /**
+     * @brief Start Listener
+     *
+     * Opens the listening socket and starts the event loop thread. Connections are spread across `shards` by their
+     * descriptor, so every message of one connection lands in the same shard and keeps its order.
+     *
+     * @param[in] shards The rings to feed, normally those of the UDP receivers.
+     * @return An integer result code:
+     *         - SUCCESS: The listener is running.
+     *         - FAILED: The socket or the event loop could not be created.
+     */
+    int start(const vector<std::shared_ptr<RingBuffer<string>>> &shards)
+    {
+        std::lock_guard<std::mutex> lock(_startMutex);
+        if (_running.load())
+            return SUCCESS;
+        if (shards.empty())
+            return FAILED;
+        _shards = shards;
+
+        if ((_listenSocket = _openSocket()) < 0 || (_epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            (_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+            _close();
+            return FAILED;
+        }
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = _listenSocket;
+        epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenSocket, &event);
+        event.data.fd = _wakeFd;
+        epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event);
+
+        _running.store(true);
+        _loop = std::thread(&TcpQueue::_run, this);
+        AgentUtils::writeLog("Listening on TCP port " + std::to_string(_port), INFO);
+        return SUCCESS;
+    }
+
+    /**
+     * @brief Stop Listener
+     *
+     * Stops the event loop, closes every sender connection and the listening socket.
+     */
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(_startMutex);
+        if (!_running.load())
+            return;
+        _running.store(false);
+        uint64_t one = 1;
+        if (write(_wakeFd, &one, sizeof(one)) == -1)
+        {
+            AgentUtils::writeLog("Failed to wake the syslog event loop", WARNING);
+        }
+        if (_loop.joinable())
+            _loop.join();
+        _close();
+    }
+
+    /**
+     * @brief Get Listening Port
+     *
+     * @return The configured port, 0 when TCP intake is disabled.
+     */
+    int getPort() const { return _port; }
+
+    /**
+     * @brief Check Listener State
+     *
+     * @return true if the event loop is running.
+     */
+    bool isRunning() const { return _running.load(); }
+
+    /**
+     * @brief Get Listener Statistics
+     *
+     * @return A reference to the live counters of the listener.
+     */
+    const tcp_stats &getStats() const { return _stats; }
+
+    ~TcpQueue()
+    {
+        stop();
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed-Size Thread Pool
+ *
+ * The `ThreadPool` class runs submitted tasks on a fixed number of worker threads that are created once and reused for
+ * the lifetime of the pool. It replaces launching one `std::async` thread per work item, which creates an unbounded
+ * number of OS threads when the amount of work grows.
+ */
+class ThreadPool
+{
+private:
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stopping = false;
+
+    void _work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+                if (_stopping && _tasks.empty())
+                    return;
+                task = std::move(_tasks.front());
+                _tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    /**
+     * @brief Thread Pool Constructor
+     *
+     * Starts the worker threads.
+     *
+     * @param[in] size The number of worker threads. A value of 0 uses the number of online CPUs.
+     */
+    explicit ThreadPool(size_t size = 0)
+    {
+        if (size == 0)
+        {
+            size = std::thread::hardware_concurrency();
+        }
+        if (size == 0)
+        {
+            size = 1;
+        }
+        for (size_t i = 0; i < size; i++)
+        {
+            _workers.emplace_back(&ThreadPool::_work, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief Submit Task
+     *
+     * Queues `task` for execution on one of the workers.
+     *
+     * @param[in] task A callable without arguments.
+     * @return A future holding the result of `task`, or the exception it threw.
+     */
+    template <typename F>
+    auto submit(F &&task) -> std::future<decltype(task())>
+    {
+        using result_type = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(task));
+        std::future<result_type> future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.emplace([packaged]() { (*packaged)(); });
+        }
+        _condition.notify_one();
+        return future;
+    }
+
+    /**
+     * @brief Get Pool Size
+     *
+     * @return The number of worker threads.
+     */
+    size_t size() const { return _workers.size(); }
+
+    /**
+     * @brief Destructor for ThreadPool.
+     *
+     * Finishes the queued tasks and joins every worker.
+     */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        for (auto &worker : _workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+    }
+};
+
+#endif
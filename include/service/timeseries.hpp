@@ -0,0 +1,163 @@
+#ifndef TIME_SERIES_HPP
+#define TIME_SERIES_HPP
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Lock-Free Time-Series Ring
+ *
+ * The `TimeSeries` class keeps the most recent samples written by a single producer thread in a fixed number of slots.
+ * Each slot is guarded by a sequence counter (a seqlock): the writer makes the counter odd while it copies a sample in
+ * and even again when it is done, and readers skip a slot whose counter changed while they copied it. Readers therefore
+ * never block the sampler and the sampler never waits for readers. Samples are stored as relaxed atomic words so
+ * concurrent copies are well defined.
+ *
+ * @tparam T The sample type. It must be trivially copyable.
+ */
+template <typename T>
+class TimeSeries
+{
+    static_assert(std::is_trivially_copyable<T>::value, "TimeSeries samples must be trivially copyable");
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct slot
+    {
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> words[WORDS];
+    };
+
+    std::unique_ptr<slot[]> _slots;
+    size_t _capacity;
+    std::atomic<uint64_t> _written; /**< Number of samples written so far. */
+
+public:
+    /**
+     * @brief Time Series Constructor
+     *
+     * Allocates every slot up front.
+     *
+     * @param[in] capacity The number of most recent samples kept.
+     */
+    explicit TimeSeries(size_t capacity) : _slots(new slot[capacity ? capacity : 1]), _capacity(capacity ? capacity : 1), _written(0)
+    {
+        for (size_t i = 0; i < _capacity; i++)
+        {
+            _slots[i].sequence.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    TimeSeries(const TimeSeries &) = delete;
+    TimeSeries &operator=(const TimeSeries &) = delete;
+
+    /**
+     * @brief Append Sample
+     *
+     * Overwrites the oldest slot once the ring is full. Only one thread may call `push`.
+     *
+     * @param[in] value The sample to store.
+     */
+    void push(const T &value)
+    {
+        uint64_t index = _written.load(std::memory_order_relaxed);
+        slot &target = _slots[index % _capacity];
+        uint64_t sequence = target.sequence.load(std::memory_order_relaxed);
+        target.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint64_t words[WORDS] = {};
+        memcpy(words, &value, sizeof(T));
+        for (size_t i = 0; i < WORDS; i++)
+        {
+            target.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        target.sequence.store(sequence + 2, std::memory_order_release);
+        _written.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Copy Recent Samples
+     *
+     * Copies up to `count` of the most recent samples into `samples`, oldest first. Slots overwritten during the copy
+     * are left out.
+     *
+     * @param[out] samples Receives the samples; existing content is replaced.
+     * @param[in] count The maximum number of samples to copy.
+     * @return The number of samples copied.
+     */
+    size_t snapshot(std::vector<T> &samples, size_t count) const
+    {
+        samples.clear();
+        uint64_t written = _written.load(std::memory_order_acquire);
+        uint64_t available = written < _capacity ? written : _capacity;
+        uint64_t first = written - (count < available ? count : available);
+        samples.reserve(written - first);
+        for (uint64_t index = first; index < written; index++)
+        {
+            const slot &source = _slots[index % _capacity];
+            uint64_t expected = 2 * (index / _capacity + 1);
+            if (source.sequence.load(std::memory_order_acquire) != expected)
+            {
+                continue;
+            }
+            uint64_t words[WORDS];
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                words[i] = source.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (source.sequence.load(std::memory_order_relaxed) != expected)
+            {
+                continue;
+            }
+            T value;
+            memcpy(&value, words, sizeof(T));
+            samples.push_back(value);
+        }
+        return samples.size();
+    }
+
+    /**
+     * @brief Get Latest Sample
+     *
+     * @param[out] value Receives the most recent sample.
+     * @return true if a sample was available.
+     */
+    bool latest(T &value) const
+    {
+        std::vector<T> samples;
+        if (snapshot(samples, 1) == 0)
+        {
+            return false;
+        }
+        value = samples.back();
+        return true;
+    }
+
+    /**
+     * @brief Get Capacity
+     *
+     * @return The number of slots in the ring.
+     */
+    size_t capacity() const { return _capacity; }
+
+    /**
+     * @brief Get Size
+     *
+     * @return The number of samples currently held.
+     */
+    size_t size() const
+    {
+        uint64_t written = _written.load(std::memory_order_acquire);
+        return written < _capacity ? written : _capacity;
+    }
+};
+
+#endif
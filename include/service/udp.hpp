@@ -2,104 +2,360 @@
 #define UDP_QUEUE
 
 #include "agentUtils.hpp"
+#include "service/ringbuffer.hpp"
 
 #define MAX_UDP_MSG_SIZE 65507
+#define UDP_BATCH_SIZE 64
+#define UDP_RING_CAPACITY 65536
+#define UDP_RECV_BUFFER (16 * 1024 * 1024)
+#define UDP_RECV_TIMEOUT_MS 500
+
+typedef struct udp_stats udp_stats;
+
+/**
+ * @brief UDP Receiver Statistics
+ *
+ * The `udp_stats` struct holds the counters of a UDP receiver. They are updated by the receiver thread and can be read
+ * at any time by other threads.
+ */
+struct udp_stats
+{
+    std::atomic<unsigned long long> received{0};      /**< Datagrams read from the socket. */
+    std::atomic<unsigned long long> batches{0};       /**< `recvmmsg` calls that returned data. */
+    std::atomic<unsigned long long> ringDropped{0};   /**< Datagrams dropped because the ring was full. */
+    std::atomic<unsigned long long> truncated{0};     /**< Datagrams larger than a slab slot. */
+    std::atomic<unsigned long long> kernelDropped{0}; /**< Datagrams dropped by the kernel (SO_RXQ_OVFL). */
+};
 
-/*
-    Create a UDP socket.
-    Bind the socket to the server address
-    Wait until the datagrams packets arrived from the client.
-    Process the datagram packet and send reply to the client.
-*/
 /**
- * @cond HIDE_THIS_CLASS
- * @brief This class is for internal use only and should not be documented.
+ * @brief UDP Receiver Shard
+ *
+ * The `udp_receiver` struct groups the socket, thread, ring and counters of one receiver. Every receiver feeds its own
+ * ring so that receivers never contend on a shared queue.
+ */
+struct udp_receiver
+{
+    int socket = -1;                               /**< Socket bound to the shared port with SO_REUSEPORT. */
+    std::thread thread;                            /**< Receiver thread reading `socket`. */
+    std::shared_ptr<RingBuffer<string>> ring;      /**< Ring the receiver pushes datagrams into. */
+    udp_stats stats;                               /**< Counters of this receiver. */
+};
+
+/**
+ * @brief UDP Syslog Receiver
+ *
+ * The `UdpQueue` class receives remote syslog datagrams on a configurable port. It runs one or more receiver threads,
+ * each with its own socket bound to the same port with `SO_REUSEPORT`, so the kernel hashes senders across the sockets
+ * and the load spreads over several cores. Every receiver reads its socket in batches with `recvmmsg` into a
+ * preallocated slab and hands the datagrams to its own lock-free ring (its shard). `getMessage` drains the shards
+ * into one batch without ever blocking a receiver, since the syslog collector turns each run into a single document.
+ * The receivers never look at the sender addresses, so they share no state on the receive path. The socket receive
+ * buffers are enlarged with `SO_RCVBUF` so that bursts are absorbed by the kernel, and datagrams lost anywhere on the
+ * way are counted per receiver in `udp_stats`.
  */
 class UdpQueue
 {
 private:
-    int serverSocket = -1;
-    struct sockaddr_in serverAddr, clientAddr;
-    char buffer[BUFFER_SIZE];
+    int _port;
+    int _receiverCount = 1;
+    vector<std::unique_ptr<udp_receiver>> _receivers;
+    std::atomic<bool> _running{false};
+    std::mutex _startMutex;
 
-public:
-    int start()
+    int _openSocket()
     {
-        serverSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        int serverSocket = socket(AF_INET, SOCK_DGRAM, 0);
         if (serverSocket == -1)
             return FAILED; /* Socket creation failed */
 
-        memset(&serverAddr, 0, sizeof(serverAddr));
-        memset(&clientAddr, 0, sizeof(clientAddr));
+        int enable = 1;
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+        {
+            AgentUtils::writeLog("Failed to set SO_REUSEPORT on the UDP socket", WARNING);
+        }
+        int size = UDP_RECV_BUFFER;
+        /* SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN, fall back to the capped option. */
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1 &&
+            setsockopt(serverSocket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+        {
+            AgentUtils::writeLog("Failed to enlarge the UDP receive buffer", WARNING);
+        }
+        setsockopt(serverSocket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+        struct timeval timeout = {0, UDP_RECV_TIMEOUT_MS * 1000};
+        setsockopt(serverSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
+        struct sockaddr_in serverAddr;
+        memset(&serverAddr, 0, sizeof(serverAddr));
         serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(UDP_PORT);
+        serverAddr.sin_port = htons(_port);
         serverAddr.sin_addr.s_addr = INADDR_ANY;
 
         if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
         {
-            AgentUtils::writeLog("Error binding socket to port.", FAILED);
+            AgentUtils::writeLog("Error binding socket to port " + std::to_string(_port), FAILED);
             close(serverSocket);
+            return FAILED;
         }
-        AgentUtils::writeLog("Binding successfule");
         return serverSocket;
     }
 
-    void stop()
+    void _receive(udp_receiver *receiver)
     {
-        if (serverSocket)
+        const size_t controlSize = CMSG_SPACE(sizeof(uint32_t));
+        vector<char> slab((size_t)UDP_BATCH_SIZE * MAX_UDP_MSG_SIZE);
+        vector<char> control(UDP_BATCH_SIZE * controlSize);
+        vector<struct mmsghdr> messages(UDP_BATCH_SIZE);
+        vector<struct iovec> iovecs(UDP_BATCH_SIZE);
+        udp_stats &stats = receiver->stats;
+
+        for (int i = 0; i < UDP_BATCH_SIZE; i++)
         {
-            close(serverSocket);
+            iovecs[i].iov_base = &slab[(size_t)i * MAX_UDP_MSG_SIZE];
+            iovecs[i].iov_len = MAX_UDP_MSG_SIZE;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = nullptr; /* Sender addresses are not needed. */
+        }
+
+        while (_running.load(std::memory_order_relaxed))
+        {
+            for (int i = 0; i < UDP_BATCH_SIZE; i++)
+            {
+                /* The kernel overwrites these fields on every call. */
+                messages[i].msg_hdr.msg_control = &control[i * controlSize];
+                messages[i].msg_hdr.msg_controllen = controlSize;
+                messages[i].msg_hdr.msg_flags = 0;
+            }
+
+            int count = recvmmsg(receiver->socket, messages.data(), UDP_BATCH_SIZE, MSG_WAITFORONE, nullptr);
+            if (count < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+                if (_running.load(std::memory_order_relaxed))
+                {
+                    AgentUtils::writeLog("Error receiving data: " + string(strerror(errno)), FAILED);
+                }
+                break;
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                struct msghdr &header = messages[i].msg_hdr;
+                if (header.msg_flags & MSG_TRUNC)
+                {
+                    stats.truncated.fetch_add(1, std::memory_order_relaxed);
+                }
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg))
+                {
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                    {
+                        uint32_t dropped;
+                        memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                        stats.kernelDropped.store(dropped, std::memory_order_relaxed); /* Cumulative value. */
+                    }
+                }
+                const char *data = &slab[(size_t)i * MAX_UDP_MSG_SIZE];
+                size_t length = messages[i].msg_len;
+                while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\0'))
+                {
+                    length--;
+                }
+                if (!receiver->ring->push(string(data, length)))
+                {
+                    stats.ringDropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (count > 0)
+            {
+                stats.received.fetch_add(count, std::memory_order_relaxed);
+                stats.batches.fetch_add(1, std::memory_order_relaxed);
+            }
         }
     }
 
-    int getMessage(vector<string> &logs)
+    /* More receivers than cores only adds threads contending for the same CPUs. */
+    static int _clampReceivers(int receivers)
     {
-        if (serverSocket < 0 && start() < 0)
+        int cores = std::max(1, (int)std::thread::hardware_concurrency());
+        if (receivers > cores)
         {
-            return FAILED;
+            AgentUtils::writeLog("Limiting UDP receivers from " + std::to_string(receivers) + " to " + std::to_string(cores) + " cores", WARNING);
+            return cores;
         }
-        socklen_t length;
-        while (1)
+        return receivers > 0 ? receivers : 1;
+    }
+
+    void _drain(udp_receiver &receiver, vector<string> &logs)
+    {
+        string message;
+        while (receiver.ring->pop(message))
         {
-            ssize_t recvBytes = recvfrom(serverSocket, buffer, BUFFER_SIZE, MSG_WAITALL,
-                                         (struct sockaddr *)&clientAddr, &length);
-            if (recvBytes == -1)
+            logs.push_back(std::move(message));
+        }
+    }
+
+    void _close()
+    {
+        for (auto &receiver : _receivers)
+        {
+            if (receiver->socket >= 0)
+            {
+                shutdown(receiver->socket, SHUT_RDWR);
+            }
+        }
+        for (auto &receiver : _receivers)
+        {
+            if (receiver->thread.joinable())
+            {
+                receiver->thread.join();
+            }
+            if (receiver->socket >= 0)
+            {
+                close(receiver->socket);
+                receiver->socket = -1;
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief UDP Receiver Constructor
+     *
+     * @param[in] port The UDP port to listen on.
+     * @param[in] receivers The number of receiver threads (and shards) to run, at most one per core.
+     */
+    UdpQueue(int port = UDP_PORT, int receivers = 1) : _port(port), _receiverCount(_clampReceivers(receivers)) {}
+
+    /**
+     * @brief Set Listening Port and Receiver Count
+     *
+     * Changes the settings used by the next `start`. It has no effect on a receiver that is already running.
+     *
+     * @param[in] port The UDP port to listen on.
+     * @param[in] receivers The number of receiver threads (and shards) to run, at most one per core.
+     */
+    void configure(int port, int receivers)
+    {
+        std::lock_guard<std::mutex> lock(_startMutex);
+        if (!_running.load())
+        {
+            _port = port;
+            _receiverCount = _clampReceivers(receivers);
+        }
+    }
+
+    /**
+     * @brief Start Receivers
+     *
+     * Creates one socket per receiver, binds them all to the configured port and starts the receiver threads. Calling it
+     * on a running queue does nothing.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: The receivers are running.
+     *         - FAILED: A socket could not be created or bound.
+     */
+    int start()
+    {
+        std::lock_guard<std::mutex> lock(_startMutex);
+        if (_running.load())
+            return SUCCESS;
+
+        _receivers.clear();
+        for (int i = 0; i < _receiverCount; i++)
+        {
+            std::unique_ptr<udp_receiver> receiver(new udp_receiver());
+            receiver->ring = std::make_shared<RingBuffer<string>>(UDP_RING_CAPACITY);
+            if ((receiver->socket = _openSocket()) < 0)
             {
-                AgentUtils::writeLog("Error receiving data.", FAILED);
-                close(serverSocket);
+                _close();
+                _receivers.clear();
                 return FAILED;
             }
-            buffer[recvBytes] = '\0';
-            // string log(buffer);
-            logs.push_back(buffer);
+            _receivers.push_back(std::move(receiver));
+        }
+        _running.store(true);
+        for (auto &receiver : _receivers)
+        {
+            receiver->thread = std::thread(&UdpQueue::_receive, this, receiver.get());
         }
-        close(serverSocket);
+        AgentUtils::writeLog("Listening on UDP port " + std::to_string(_port) + " with " + std::to_string(_receiverCount) + " receivers", INFO);
         return SUCCESS;
     }
 
-    int sendMessage(const string message)
+    /**
+     * @brief Stop Receivers
+     *
+     * Stops the receiver threads and closes the sockets. Messages still queued in the shards stay available to
+     * `getMessage` until the next `start`.
+     */
+    void stop()
     {
-        if (serverSocket < 0)
+        std::lock_guard<std::mutex> lock(_startMutex);
+        _running.store(false);
+        _close();
+    }
+
+    /**
+     * @brief Drain Received Messages
+     *
+     * Starts the receivers if needed and moves every datagram queued so far in all shards into `logs`. It never waits
+     * for new data.
+     *
+     * @param[in, out] logs A vector receiving the queued syslog messages.
+     * @return An integer result code:
+     *         - SUCCESS: The queued messages were moved into `logs`.
+     *         - FAILED: The receivers could not be started.
+     */
+    int getMessage(vector<string> &logs)
+    {
+        if (!_running.load() && start() == FAILED)
         {
             return FAILED;
         }
+        for (auto &receiver : _receivers)
+        {
+            _drain(*receiver, logs);
+        }
+        return SUCCESS;
+    }
 
-        socklen_t clientAddrLen;
-        ssize_t sendBytes = sendto(serverSocket, message.c_str(), sizeof(message), 0,
-                                   (struct sockaddr *)&clientAddr, clientAddrLen);
+    /**
+     * @brief Get Receiver Count
+     *
+     * @return The number of running receivers, which is also the number of shards.
+     */
+    size_t getShardCount() const { return _receivers.size(); }
 
-        if (sendBytes == -1)
+    /**
+     * @brief Get Shard Rings
+     *
+     * Other transports push into these rings so that all remote syslog is drained through one queue.
+     *
+     * @return The rings of the running receivers, one per shard.
+     */
+    vector<std::shared_ptr<RingBuffer<string>>> getShards() const
+    {
+        vector<std::shared_ptr<RingBuffer<string>>> shards;
+        for (const auto &receiver : _receivers)
         {
-            cerr << "Error sending data." << "\n";
-            close(serverSocket);
-            return FAILED;
+            shards.push_back(receiver->ring);
         }
-        return SUCCESS;
+        return shards;
+    }
+
+    /**
+     * @brief Get Receiver Statistics
+     *
+     * @param[in] shard The index of the receiver.
+     * @return A reference to the live counters of the receiver.
+     */
+    const udp_stats &getStats(size_t shard) const { return _receivers.at(shard)->stats; }
+
+    ~UdpQueue()
+    {
+        stop();
     }
 };
-/**
- * @endcond
- */
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,220 @@
+#ifndef UPLOADER_HPP
+#define UPLOADER_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+#include <deque>
+#include <functional>
+
+#define UPLOAD_MAX_CONCURRENT 8
+#define UPLOAD_POLL_TIMEOUT_MS 1000
+#define UPLOAD_CONTENT_TYPE "application/json"
+#define UPLOAD_KEEPALIVE_IDLE 60L
+#define UPLOAD_KEEPALIVE_INTERVAL 30L
+#define UPLOAD_CONNECTION_MAXAGE 300L
+#define BATCH_CONTENT_TYPE "application/x-ndjson"
+#define BATCH_MAX_BYTES (4 * 1024 * 1024)
+#define BATCH_MAX_DELAY 300
+#define BATCH_COMPRESSION_LEVEL 6
+#define BATCH_READ_SIZE 65536
+#define BATCH_DIR "batch/"
+
+typedef struct upload_request upload_request;
+typedef struct upload_batch upload_batch;
+
+/**
+ * @brief Upload Request
+ *
+ * One file to post, as a multipart form or, when it is already encoded, as the request body, and the function to call
+ * when the transfer ends.
+ */
+struct upload_request
+{
+    string url;
+    string formName;
+    string filePath;
+    /**
+     * Called on the thread running `MultiUploader::run` with the HTTP status, 0 if no response was received, and the
+     * libcurl result of the transfer.
+     */
+    std::function<void(const upload_request &request, long httpCode, CURLcode result)> onComplete;
+    string contentType; /**< Type of the form part, or of the body; empty sends `UPLOAD_CONTENT_TYPE`. */
+    string contentEncoding; /**< When not empty, the file is the whole request body, sent with this `Content-Encoding`. */
+};
+
+/**
+ * @brief Upload Batch
+ *
+ * A gzip-compressed file holding several spooled JSON files, one document per line.
+ */
+struct upload_batch
+{
+    string path;
+    vector<string> sources; /**< The spooled files packed into `path`, to delete once it is accepted. */
+    size_t rawBytes = 0;
+    size_t compressedBytes = 0;
+    time_t oldest = 0; /**< Modification time of the oldest source. */
+};
+
+/**
+ * @brief Payload Batcher
+ *
+ * The `PayloadBatcher` class packs spooled JSON files into batches of at most `maxBytes` uncompressed bytes. Each batch
+ * is written as newline-delimited JSON through a gzip stream, reading the sources in `BATCH_READ_SIZE` blocks, so
+ * neither a source nor a batch is ever held in memory. A batch that is not full is held back until its oldest source
+ * is `maxDelay` seconds old, which bounds both the number of requests and how late a record is delivered.
+ */
+class PayloadBatcher
+{
+private:
+    string _directory;
+    size_t _maxBytes;
+    time_t _maxDelay;
+    int _level;
+    unsigned long _sequence = 0;
+
+    gzFile _open(upload_batch &batch);
+    int _close(upload_batch &batch, gzFile output);
+    int _write(upload_batch &batch);
+
+public:
+    /**
+     * @brief Payload Batcher Constructor
+     *
+     * @param[in] directory Where batch files are written; created if missing.
+     * @param[in] maxBytes The uncompressed size budget of a batch. A larger single file forms a batch of its own.
+     * @param[in] maxDelay Seconds a record may wait for a batch to fill before it is sent anyway.
+     * @param[in] level The zlib compression level, 1 to 9.
+     */
+    PayloadBatcher(const string &directory, size_t maxBytes = BATCH_MAX_BYTES, time_t maxDelay = BATCH_MAX_DELAY, int level = BATCH_COMPRESSION_LEVEL);
+
+    /**
+     * @brief Pack Files
+     *
+     * Groups `files`, oldest first, into batches and writes the ones that are due.
+     *
+     * @param[in] files The spooled JSON files.
+     * @param[out] batches The batches written, ready to upload.
+     * @param[in] flush Write the last batch even if it is neither full nor old enough.
+     * @return An integer result code:
+     *         - SUCCESS: Every due batch was written.
+     *         - FAILED: A batch could not be written; the batches before it are still returned.
+     */
+    int pack(const vector<string> &files, vector<upload_batch> &batches, bool flush = false);
+
+    /**
+     * @brief Pack Records
+     *
+     * Writes records already in memory, one per line, as a single batch. The records must not contain line breaks.
+     *
+     * @param[in] records The JSON documents to pack.
+     * @param[out] batch The batch written; its `sources` are left empty.
+     * @return SUCCESS, or FAILED if the batch could not be written.
+     */
+    int packRecords(const vector<string> &records, upload_batch &batch);
+
+    /**
+     * @brief Split Records
+     *
+     * Compacts a chunk of newline-delimited JSON in place so that every record is on its own line: carriage returns
+     * end a line like newlines do and empty lines are dropped.
+     *
+     * @param[in,out] data The chunk to compact.
+     * @param[in] size The length of the chunk.
+     * @param[in,out] open Whether the previous chunk ended inside a record; updated for the next chunk.
+     * @return The length of the compacted chunk.
+     */
+    static size_t splitRecords(char *data, size_t size, bool &open);
+};
+
+/**
+ * @brief Concurrent Uploader
+ *
+ * The `MultiUploader` class posts queued files through one libcurl multi handle, with at most `maxConcurrent`
+ * transfers in flight. Transfers to the same host are multiplexed over a single HTTP/2 connection when the server
+ * negotiates it, and otherwise spread over up to `maxConcurrent` keep-alive HTTP/1.1 connections. File bodies are
+ * streamed from disk by `curl_mime_filedata`. The multi handle, its connection cache and the easy handles are kept
+ * between calls to `run`.
+ */
+class MultiUploader
+{
+private:
+    struct transfer
+    {
+        upload_request request;
+        curl_mime *mime = nullptr;
+        FILE *body = nullptr;
+        struct curl_slist *headers = nullptr;
+        string response;
+    };
+
+    CURLM *_multi = nullptr;
+    CURLSH *_share;
+    size_t _maxConcurrent;
+    std::deque<upload_request> _queue;
+    vector<CURL *> _idle;
+    vector<CURL *> _active;
+    struct curl_slist *_headers = nullptr;
+    size_t _failures = 0;
+
+    static size_t _discard(char *data, size_t size, size_t nmemb, void *response);
+    static void _reject(upload_request &request);
+    int _start(upload_request &&request);
+    void _finish(CURL *curl, CURLcode result);
+    void _abort();
+
+public:
+    /**
+     * @brief Multi Uploader Constructor
+     *
+     * @param[in] maxConcurrent The largest number of transfers in flight at once; 0 uses `UPLOAD_MAX_CONCURRENT`.
+     * @param[in] share An optional share handle whose DNS and TLS session caches the transfers use.
+     */
+    explicit MultiUploader(size_t maxConcurrent = UPLOAD_MAX_CONCURRENT, CURLSH *share = nullptr);
+
+    MultiUploader(const MultiUploader &) = delete;
+    MultiUploader &operator=(const MultiUploader &) = delete;
+
+    /**
+     * @brief Set Concurrency Limit
+     *
+     * @param[in] maxConcurrent The largest number of transfers in flight at once; 0 uses `UPLOAD_MAX_CONCURRENT`.
+     */
+    void setMaxConcurrent(size_t maxConcurrent);
+
+    /**
+     * @brief Queue Upload
+     *
+     * @param[in] request The file to post. Nothing is sent until `run` is called.
+     */
+    void add(upload_request request);
+
+    /**
+     * @brief Run Uploads
+     *
+     * Sends every queued request and returns once all of them have completed, calling each request's `onComplete` as
+     * its transfer ends. A request whose file cannot be opened is not sent and completes with `CURLE_READ_ERROR`. If the multi handle fails, the transfers in flight are removed and the queued requests dropped,
+     * each completing with `CURLE_ABORTED_BY_CALLBACK`, so nothing is left behind for the next call.
+     *
+     * @return An integer result code:
+     *         - SUCCESS: Every transfer received HTTP 200.
+     *         - FAILED: At least one transfer failed or received another status.
+     */
+    int run();
+
+    /**
+     * @brief Get Queue Size
+     *
+     * @return The number of requests waiting for `run`.
+     */
+    size_t pending() const { return _queue.size(); }
+
+    /**
+     * @brief Destructor for MultiUploader.
+     *
+     * Releases the easy handles and the multi handle. Queued requests that were never run are dropped.
+     */
+    ~MultiUploader();
+};
+
+#endif
@@ -426,34 +426,73 @@ int OS::isDirExist(const string& dirName)
     return FAILED;
 }
 
-int OS::readRegularFiles(vector<string> &files)
+int OS::readRegularFiles(const string &path, vector<string> &files)
 {
-    string directory = BASE_LOG_DIR;
-    directory += "josn/";
-    if (!std::filesystem::exists(directory))
+    if (std::filesystem::is_regular_file(path))
     {
-        AgentUtils::writeLog(INVALID_PATH + directory, FAILED);
+        files.push_back(path);
+        return SUCCESS;
+    }
+    if (!std::filesystem::is_directory(path))
+    {
+        AgentUtils::writeLog(INVALID_PATH + path, FAILED);
         return FAILED;
     }
-    for (const auto &entry : std::filesystem::directory_iterator(directory))
+    // Each log type writes to its own subdirectory; writers still in progress hold a .tmp name.
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(path))
     {
-        string filePath = directory;
-        if (std::filesystem::is_regular_file(entry))
+        if (std::filesystem::is_regular_file(entry) && entry.path().extension() == ".json")
         {
-            filePath += entry.path().string();
-            files.push_back(filePath);
+            files.push_back(entry.path().string());
         }
     }
 
     if (files.size() == 0)
     {
-        AgentUtils::writeLog(INVALID_PATH + directory, FAILED);
+        AgentUtils::writeLog(INVALID_PATH + path, FAILED);
         return FAILED;
     }
 
     return SUCCESS;
 }
 
+int OS::writeFileAtomic(const string &path, const string &content)
+{
+    string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + tempPath, FAILED);
+        return FAILED;
+    }
+    file << content;
+    file.close();
+    if (file.fail() || std::rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + path, FAILED);
+        std::remove(tempPath.c_str());
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int OS::writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t bytes = write(fd, data, size);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FAILED;
+        }
+        data += bytes;
+        size -= bytes;
+    }
+    return SUCCESS;
+}
+
 int OS::getRegularFiles(const string& directory, vector<string> &files)
 {
     int result = SUCCESS;
@@ -487,6 +526,19 @@ std::time_t AgentUtils::convertStrToTime(const string &datetime)
     return std::mktime(&tm);
 }
 
+string AgentUtils::toHex(const unsigned char *data, size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; i++)
+    {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0x0f];
+    }
+    return hex;
+}
+
 string OS::getJsonWritePath(const string & type)
 {
     string time = AgentUtils::getCurrentTime();
@@ -506,13 +558,17 @@ string OS::getJsonWritePath(const string & type)
     {
         OS::createDir(filePath);
     }
-    filePath += "/" + time + ".json";
-    std::ofstream file(filePath);
-    if (!file)
+    if (OS::isDirExist(filePath) == FAILED)
     {
         AgentUtils::writeLog(FILE_ERROR + filePath, FAILED);
         return "";
     }
-    file.close();
-    return filePath;
+    // Documents written within the same second get a sequence suffix instead of replacing each other.
+    string base = filePath + "/" + time;
+    string path = base + ".json";
+    for (int sequence = 1; std::filesystem::exists(path); sequence++)
+    {
+        path = base + "-" + std::to_string(sequence) + ".json";
+    }
+    return path;
 }
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include "service/deltapatch.hpp"
+#include <openssl/evp.h>
+#include <sys/mman.h>
+
+#define DELTA_MAX_CANDIDATES 8 /* Blocks kept per weak checksum, bounding the comparisons at one offset. */
+
+static void putInt(string &out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        out += (char)((value >> (8 * i)) & 0xff);
+    }
+}
+
+static uint64_t getInt(const unsigned char *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+    {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static void sha256(const string &data, unsigned char *digest)
+{
+    unsigned int size = 0;
+    EVP_Digest(data.data(), data.size(), digest, &size, EVP_sha256(), nullptr);
+}
+
+static int readFile(const string &path, string &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    content.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return file.bad() ? FAILED : SUCCESS;
+}
+
+/* rsync's weak checksum: a is the byte sum, b the sum weighted by distance from the block end, both modulo 2^16. */
+static uint32_t weakChecksum(const unsigned char *data, size_t size, uint32_t &a, uint32_t &b)
+{
+    a = 0;
+    b = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        a += data[i];
+        b += (uint32_t)(size - i) * data[i];
+    }
+    a &= 0xffff;
+    b &= 0xffff;
+    return a | (b << 16);
+}
+
+int DeltaPatch::create(const string &sourcePath, const string &targetPath, const string &patchPath, size_t blockSize)
+{
+    string source, target;
+    if (blockSize == 0 || readFile(sourcePath, source) == FAILED || readFile(targetPath, target) == FAILED)
+    {
+        return FAILED;
+    }
+    const unsigned char *src = (const unsigned char *)source.data();
+    const unsigned char *tgt = (const unsigned char *)target.data();
+
+    string patch = DELTA_MAGIC;
+    unsigned char digest[DELTA_DIGEST_SIZE];
+    putInt(patch, source.size(), 8);
+    sha256(source, digest);
+    patch.append((const char *)digest, DELTA_DIGEST_SIZE);
+    putInt(patch, target.size(), 8);
+    sha256(target, digest);
+    patch.append((const char *)digest, DELTA_DIGEST_SIZE);
+
+    std::unordered_map<uint32_t, vector<uint64_t>> blocks;
+    uint32_t a, b;
+    for (uint64_t offset = 0; offset + blockSize <= source.size(); offset += blockSize)
+    {
+        vector<uint64_t> &candidates = blocks[weakChecksum(src + offset, blockSize, a, b)];
+        if (candidates.size() < DELTA_MAX_CANDIDATES)
+        {
+            candidates.push_back(offset);
+        }
+    }
+
+    uint64_t copyOffset = 0, copyLength = 0;
+    auto flushCopy = [&]() {
+        if (copyLength > 0)
+        {
+            patch += DELTA_OP_COPY;
+            putInt(patch, copyOffset, 8);
+            putInt(patch, copyLength, 8);
+            copyLength = 0;
+        }
+    };
+    auto flushInsert = [&](size_t from, size_t to) {
+        if (from < to)
+        {
+            flushCopy();
+        }
+        for (; from < to; from += std::min<size_t>(to - from, DELTA_MAX_INSERT))
+        {
+            size_t length = std::min<size_t>(to - from, DELTA_MAX_INSERT);
+            patch += DELTA_OP_INSERT;
+            putInt(patch, length, 4);
+            patch.append(target, from, length);
+        }
+    };
+
+    size_t position = 0, literal = 0;
+    bool rolling = false;
+    while (position + blockSize <= target.size())
+    {
+        if (!rolling)
+        {
+            weakChecksum(tgt + position, blockSize, a, b);
+            rolling = true;
+        }
+        uint64_t match = UINT64_MAX;
+        auto found = blocks.find(a | (b << 16));
+        if (found != blocks.end())
+        {
+            for (uint64_t offset : found->second)
+            {
+                if (memcmp(src + offset, tgt + position, blockSize) == 0)
+                {
+                    match = offset;
+                    break;
+                }
+            }
+        }
+        if (match == UINT64_MAX)
+        {
+            if (position + blockSize < target.size())
+            {
+                unsigned char out = tgt[position], in = tgt[position + blockSize];
+                a = (a - out + in) & 0xffff;
+                b = (b - (uint32_t)blockSize * out + a) & 0xffff;
+            }
+            position++;
+            continue;
+        }
+
+        // Matches often run past the block, so extend them byte by byte before looking again.
+        size_t length = blockSize;
+        while (match + length < source.size() && position + length < target.size() && src[match + length] == tgt[position + length])
+        {
+            length++;
+        }
+        flushInsert(literal, position);
+        if (copyLength > 0 && copyOffset + copyLength == match)
+        {
+            copyLength += length;
+        }
+        else
+        {
+            flushCopy();
+            copyOffset = match;
+            copyLength = length;
+        }
+        position += length;
+        literal = position;
+        rolling = false;
+    }
+    flushInsert(literal, target.size());
+    flushCopy();
+    patch += DELTA_OP_END;
+
+    std::ofstream file(patchPath, std::ios::binary | std::ios::trunc);
+    if (!file.write(patch.data(), patch.size()))
+    {
+        AgentUtils::writeLog(FILE_ERROR + patchPath, FAILED);
+        return FAILED;
+    }
+    AgentUtils::writeLog("Created patch " + patchPath + " of " + std::to_string(patch.size()) + " bytes for " + std::to_string(target.size()) + " bytes", DEBUG);
+    return SUCCESS;
+}
+
+int DeltaPatch::readHeader(const string &patchPath, delta_header &header)
+{
+    unsigned char buffer[DELTA_MAGIC_SIZE + 2 * (8 + DELTA_DIGEST_SIZE)];
+    std::ifstream file(patchPath, std::ios::binary);
+    if (!file.read((char *)buffer, sizeof(buffer)) || memcmp(buffer, DELTA_MAGIC, DELTA_MAGIC_SIZE) != 0)
+    {
+        AgentUtils::writeLog(patchPath + " is not a delta patch", FAILED);
+        return FAILED;
+    }
+    const unsigned char *field = buffer + DELTA_MAGIC_SIZE;
+    header.sourceLength = getInt(field, 8);
+    memcpy(header.sourceDigest, field + 8, DELTA_DIGEST_SIZE);
+    field += 8 + DELTA_DIGEST_SIZE;
+    header.targetLength = getInt(field, 8);
+    memcpy(header.targetDigest, field + 8, DELTA_DIGEST_SIZE);
+    return SUCCESS;
+}
+
+int DeltaPatch::apply(const string &sourcePath, const string &patchPath, const string &stagingPath, string &digest)
+{
+    delta_header header;
+    if (readHeader(patchPath, header) == FAILED)
+    {
+        return FAILED;
+    }
+    int sourceFd = open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (sourceFd < 0 || fstat(sourceFd, &info) != 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + sourcePath, FAILED);
+        if (sourceFd >= 0)
+            close(sourceFd);
+        return FAILED;
+    }
+    if ((uint64_t)info.st_size != header.sourceLength)
+    {
+        AgentUtils::writeLog(sourcePath + " is not the file " + patchPath + " was made from", FAILED);
+        close(sourceFd);
+        return FAILED;
+    }
+    const unsigned char *source = nullptr;
+    if (header.sourceLength > 0)
+    {
+        void *mapped = mmap(nullptr, header.sourceLength, PROT_READ, MAP_PRIVATE, sourceFd, 0);
+        source = mapped == MAP_FAILED ? nullptr : (const unsigned char *)mapped;
+    }
+    close(sourceFd);
+    if (header.sourceLength > 0 && source == nullptr)
+    {
+        AgentUtils::writeLog("Failed to map " + sourcePath, FAILED);
+        return FAILED;
+    }
+
+    unsigned char value[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    EVP_Digest(source, header.sourceLength, value, &size, EVP_sha256(), nullptr);
+    if (memcmp(value, header.sourceDigest, DELTA_DIGEST_SIZE) != 0)
+    {
+        AgentUtils::writeLog(sourcePath + " is not the file " + patchPath + " was made from", FAILED);
+        if (source != nullptr)
+            munmap((void *)source, header.sourceLength);
+        return FAILED;
+    }
+
+    std::ifstream patch(patchPath, std::ios::binary);
+    patch.seekg(DELTA_MAGIC_SIZE + 2 * (8 + DELTA_DIGEST_SIZE));
+    int fd = open(stagingPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 07777);
+    if (fd < 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + stagingPath, FAILED);
+        if (source != nullptr)
+            munmap((void *)source, header.sourceLength);
+        return FAILED;
+    }
+    fchmod(fd, info.st_mode & 07777);
+
+    EVP_MD_CTX *hash = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(hash, EVP_sha256(), nullptr);
+    vector<char> buffer(DELTA_MAX_INSERT);
+    uint64_t written = 0;
+    int result = FAILED;
+    string error = "Malformed patch " + patchPath;
+    char op;
+    while (patch.get(op))
+    {
+        unsigned char field[16];
+        if (op == DELTA_OP_END)
+        {
+            result = SUCCESS;
+            break;
+        }
+        else if (op == DELTA_OP_COPY)
+        {
+            if (!patch.read((char *)field, 16))
+                break;
+            uint64_t offset = getInt(field, 8), length = getInt(field + 8, 8);
+            if (offset > header.sourceLength || length > header.sourceLength - offset || length > header.targetLength - written)
+                break;
+            if (OS::writeAll(fd, (const char *)source + offset, length) == FAILED)
+            {
+                error = FILE_ERROR + stagingPath;
+                break;
+            }
+            EVP_DigestUpdate(hash, source + offset, length);
+            written += length;
+        }
+        else if (op == DELTA_OP_INSERT)
+        {
+            if (!patch.read((char *)field, 4))
+                break;
+            uint64_t length = getInt(field, 4);
+            if (length > buffer.size() || length > header.targetLength - written || !patch.read(buffer.data(), length))
+                break;
+            if (OS::writeAll(fd, buffer.data(), length) == FAILED)
+            {
+                error = FILE_ERROR + stagingPath;
+                break;
+            }
+            EVP_DigestUpdate(hash, buffer.data(), length);
+            written += length;
+        }
+        else
+        {
+            break;
+        }
+    }
+    EVP_DigestFinal_ex(hash, value, &size);
+    EVP_MD_CTX_free(hash);
+    if (source != nullptr)
+        munmap((void *)source, header.sourceLength);
+
+    if (result == SUCCESS && (written != header.targetLength || memcmp(value, header.targetDigest, DELTA_DIGEST_SIZE) != 0))
+    {
+        error = "Patched " + stagingPath + " does not match the target of " + patchPath;
+        result = FAILED;
+    }
+    if (result == SUCCESS && fsync(fd) != 0)
+    {
+        error = FILE_ERROR + stagingPath;
+        result = FAILED;
+    }
+    close(fd);
+    if (result == FAILED)
+    {
+        AgentUtils::writeLog(error, FAILED);
+        OS::deleteFile(stagingPath);
+        return FAILED;
+    }
+    digest = AgentUtils::toHex(value, size);
+    return SUCCESS;
+}
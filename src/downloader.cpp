@@ -0,0 +1,441 @@
+#include "service/downloader.hpp"
+#include <deque>
+#include <strings.h>
+
+SegmentedDownloader::SegmentedDownloader(const string &url, const string &path, size_t segments, size_t chunkSize)
+    : _url(url), _path(path), _sidecarPath(path + DOWNLOAD_SIDECAR_SUFFIX), _segments(segments == 0 ? DOWNLOAD_SEGMENTS : segments),
+      _chunkSize(chunkSize == 0 ? DOWNLOAD_CHUNK_SIZE : chunkSize)
+{
+}
+
+void SegmentedDownloader::setCredentials(const string &username, const string &password)
+{
+    _credentials = (username.empty() && password.empty()) ? "" : username + ":" + password;
+}
+
+void SegmentedDownloader::setLimits(long minSpeed, long maxSpeed, long timeout)
+{
+    _minSpeed = minSpeed;
+    _maxSpeed = maxSpeed;
+    _timeout = timeout;
+}
+
+size_t SegmentedDownloader::_onHeader(char *buffer, size_t size, size_t nitems, void *downloader)
+{
+    SegmentedDownloader *self = static_cast<SegmentedDownloader *>(downloader);
+    string header(buffer, size * nitems);
+    header.erase(header.find_last_not_of("\r\n") + 1);
+    size_t colon = header.find(':');
+    if (header.compare(0, 5, "HTTP/") == 0)
+    {
+        // A new response after a redirect; only the last one describes the file.
+        self->_supportsRanges = false;
+        self->_validator.clear();
+    }
+    else if (colon != string::npos)
+    {
+        string name = header.substr(0, colon);
+        string value = AgentUtils::trim(header.substr(colon + 1));
+        if (strcasecmp(name.c_str(), "Accept-Ranges") == 0)
+        {
+            self->_supportsRanges = strcasecmp(value.c_str(), "bytes") == 0;
+        }
+        else if (strcasecmp(name.c_str(), "ETag") == 0 || (strcasecmp(name.c_str(), "Last-Modified") == 0 && self->_validator.empty()))
+        {
+            self->_validator = value;
+        }
+    }
+    return size * nitems;
+}
+
+size_t SegmentedDownloader::_onData(char *data, size_t size, size_t nmemb, void *current)
+{
+    segment *part = static_cast<segment *>(current);
+    SegmentedDownloader *self = part->owner;
+    size_t bytes = size * nmemb;
+    if (part->written + bytes > part->length)
+    {
+        // More than the range asked for: the server is sending the whole file.
+        self->_rangesIgnored = true;
+        return 0;
+    }
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t result = pwrite(self->_fd, data + done, bytes - done, part->start + part->written + done);
+        if (result <= 0)
+        {
+            return 0;
+        }
+        done += result;
+    }
+    part->written += bytes;
+    return bytes;
+}
+
+void SegmentedDownloader::_setOptions(CURL *curl)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, _url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    if (!_credentials.empty())
+    {
+        curl_easy_setopt(curl, CURLOPT_USERPWD, _credentials.c_str());
+    }
+    if (_minSpeed > 0 && _timeout > 0)
+    {
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, _minSpeed);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, _timeout);
+    }
+    if (_maxSpeed > 0)
+    {
+        curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)std::max<long>(1, _maxSpeed / (long)_segments));
+    }
+    if (_timeout > 0)
+    {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, _timeout);
+    }
+}
+
+int SegmentedDownloader::probe()
+{
+    CURL *curl = curl_easy_init();
+    if (curl == nullptr)
+    {
+        AgentUtils::writeLog("Failed to initialize curl ", FAILED);
+        return FAILED;
+    }
+    _setOptions(curl);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _onHeader);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, this);
+
+    _supportsRanges = false;
+    _validator.clear();
+    CURLcode result = curl_easy_perform(curl);
+    long httpCode = 0;
+    curl_off_t length = -1;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    curl_easy_cleanup(curl);
+
+    if (result != CURLE_OK || httpCode != 200)
+    {
+        AgentUtils::writeLog("Probing " + _url + " failed: " + (result != CURLE_OK ? string(curl_easy_strerror(result)) : "HTTP " + std::to_string(httpCode)), WARNING);
+        return FAILED;
+    }
+    _length = length > 0 ? (uint64_t)length : 0;
+    if (!_supportsRanges || _length == 0)
+    {
+        AgentUtils::writeLog(_url + " does not support range requests", INFO);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int SegmentedDownloader::_openTarget()
+{
+    _chunks = (_length + _chunkSize - 1) / _chunkSize;
+    _bitmap.assign((_chunks + 7) / 8, 0);
+    _completed = 0;
+    _hashed = 0;
+    _digest.clear();
+    string header = "FWCHUNKS " + std::to_string(_length) + " " + std::to_string(_chunkSize) + " " + _validator + "\n";
+    _headerSize = header.size();
+
+    bool resume = false;
+    struct stat info;
+    std::ifstream sidecar(_sidecarPath, std::ios::binary);
+    if (sidecar && stat(_path.c_str(), &info) == 0 && (uint64_t)info.st_size == _length)
+    {
+        string saved((std::istreambuf_iterator<char>(sidecar)), std::istreambuf_iterator<char>());
+        if (saved.size() == _headerSize + _bitmap.size() && saved.compare(0, _headerSize, header) == 0)
+        {
+            std::copy(saved.begin() + _headerSize, saved.end(), _bitmap.begin());
+            resume = true;
+        }
+    }
+    sidecar.close();
+
+    _fd = open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    _sidecarFd = open(_sidecarPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0 || _sidecarFd < 0)
+    {
+        AgentUtils::writeLog("Failed to open " + _path + " check file path and it's permission", FAILED);
+        _close();
+        return FAILED;
+    }
+
+    if (resume)
+    {
+        for (size_t chunk = 0; chunk < _chunks; chunk++)
+        {
+            _completed += _isDone(chunk) ? 1 : 0;
+        }
+        AgentUtils::writeLog("Resuming " + _path + " with " + std::to_string(_completed) + " of " + std::to_string(_chunks) + " chunks", INFO);
+    }
+    else
+    {
+        // Reserve the whole file now, so a full disk fails here rather than part way through.
+        if (ftruncate(_fd, 0) != 0 || (posix_fallocate(_fd, 0, _length) != 0 && ftruncate(_fd, _length) != 0))
+        {
+            AgentUtils::writeLog("Unable to allocate " + std::to_string(_length) + " bytes for " + _path, FAILED);
+            _close();
+            return FAILED;
+        }
+        string content = header + string(_bitmap.size(), '\0');
+        if (ftruncate(_sidecarFd, 0) != 0 || pwrite(_sidecarFd, content.data(), content.size(), 0) != (ssize_t)content.size() || fdatasync(_sidecarFd) != 0)
+        {
+            AgentUtils::writeLog(FWRITE_FAILED + _sidecarPath, FAILED);
+            _close();
+            return FAILED;
+        }
+    }
+
+    _hash = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(_hash, EVP_sha256(), nullptr);
+    return _advanceHash();
+}
+
+int SegmentedDownloader::_markDone(size_t chunk)
+{
+    // The chunk's data reaches the disk before its bit, so a set bit always means a complete chunk.
+    if (fdatasync(_fd) != 0)
+    {
+        return FAILED;
+    }
+    _bitmap[chunk / 8] |= (unsigned char)(1 << (chunk % 8));
+    if (pwrite(_sidecarFd, &_bitmap[chunk / 8], 1, _headerSize + chunk / 8) != 1 || fdatasync(_sidecarFd) != 0)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + _sidecarPath, FAILED);
+        return FAILED;
+    }
+    _completed++;
+    return _advanceHash();
+}
+
+int SegmentedDownloader::_advanceHash()
+{
+    vector<unsigned char> buffer(DOWNLOAD_HASH_BUFFER);
+    while (_hashed < _chunks && _isDone(_hashed))
+    {
+        uint64_t offset = (uint64_t)_hashed * _chunkSize;
+        uint64_t end = std::min<uint64_t>(offset + _chunkSize, _length);
+        while (offset < end)
+        {
+            ssize_t bytes = pread(_fd, buffer.data(), std::min<uint64_t>(buffer.size(), end - offset), offset);
+            if (bytes <= 0)
+            {
+                AgentUtils::writeLog(FILE_ERROR + _path, FAILED);
+                return FAILED;
+            }
+            EVP_DigestUpdate(_hash, buffer.data(), bytes);
+            offset += bytes;
+        }
+        _hashed++;
+    }
+    if (_hashed == _chunks && _digest.empty())
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        EVP_DigestFinal_ex(_hash, digest, &size);
+        _digest = AgentUtils::toHex(digest, size);
+    }
+    return SUCCESS;
+}
+
+void SegmentedDownloader::_close()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+        _fd = -1;
+    }
+    if (_sidecarFd >= 0)
+    {
+        close(_sidecarFd);
+        _sidecarFd = -1;
+    }
+    if (_hash != nullptr)
+    {
+        EVP_MD_CTX_free(_hash);
+        _hash = nullptr;
+    }
+}
+
+int SegmentedDownloader::run()
+{
+    if (_length == 0 && probe() == FAILED)
+    {
+        return FAILED;
+    }
+    if (_openTarget() == FAILED)
+    {
+        return FAILED;
+    }
+
+    std::deque<size_t> pending;
+    for (size_t chunk = 0; chunk < _chunks; chunk++)
+    {
+        if (!_isDone(chunk))
+            pending.push_back(chunk);
+    }
+    vector<uint64_t> progress(_chunks, 0);
+    _attempts.assign(_chunks, 0);
+    _rangesIgnored = false;
+
+    CURLM *multi = curl_multi_init();
+    vector<CURL *> idle;
+    std::unordered_map<CURL *, segment *> active;
+    bool failed = false;
+    while (!failed && (!pending.empty() || !active.empty()))
+    {
+        while (active.size() < _segments && !pending.empty())
+        {
+            size_t chunk = pending.front();
+            pending.pop_front();
+            CURL *curl = idle.empty() ? curl_easy_init() : idle.back();
+            if (!idle.empty())
+            {
+                idle.pop_back();
+                curl_easy_reset(curl);
+            }
+            if (curl == nullptr)
+            {
+                failed = true;
+                break;
+            }
+            // A chunk cut short earlier continues from the bytes it already wrote.
+            segment *part = new segment();
+            part->owner = this;
+            part->chunk = chunk;
+            part->start = (uint64_t)chunk * _chunkSize + progress[chunk];
+            part->length = std::min<uint64_t>((uint64_t)(chunk + 1) * _chunkSize, _length) - part->start;
+            part->written = 0;
+            snprintf(part->range, sizeof(part->range), "%llu-%llu", (unsigned long long)part->start, (unsigned long long)(part->start + part->length - 1));
+            _setOptions(curl);
+            curl_easy_setopt(curl, CURLOPT_RANGE, part->range);
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _onData);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, part);
+            curl_multi_add_handle(multi, curl);
+            active[curl] = part;
+        }
+
+        int running = 0;
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+        {
+            failed = true;
+            break;
+        }
+        bool finished = false;
+        int queued = 0;
+        CURLMsg *message;
+        while ((message = curl_multi_info_read(multi, &queued)) != nullptr)
+        {
+            if (message->msg != CURLMSG_DONE)
+                continue;
+            CURL *curl = message->easy_handle;
+            CURLcode result = message->data.result;
+            segment *part = active[curl];
+            long httpCode = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+            curl_multi_remove_handle(multi, curl);
+            active.erase(curl);
+            idle.push_back(curl);
+            finished = true;
+
+            bool whole = httpCode == 200 && part->start == 0 && part->length == _length;
+            if (result == CURLE_OK && (httpCode == 206 || whole) && part->written == part->length)
+            {
+                if (_markDone(part->chunk) == FAILED)
+                    failed = true;
+            }
+            else if (_rangesIgnored || (httpCode == 200 && part->length < _length))
+            {
+                _rangesIgnored = true;
+                AgentUtils::writeLog(_url + " ignored a range request", WARNING);
+                failed = true;
+            }
+            else
+            {
+                progress[part->chunk] += httpCode == 206 ? part->written : 0;
+                // Only a try that made no progress counts against the chunk.
+                if (part->written == 0 && ++_attempts[part->chunk] >= DOWNLOAD_CHUNK_RETRY)
+                {
+                    AgentUtils::writeLog("Chunk " + std::to_string(part->chunk) + " of " + _url + " failed: " + (result != CURLE_OK ? string(curl_easy_strerror(result)) : "HTTP " + std::to_string(httpCode)), FAILED);
+                    failed = true;
+                }
+                else
+                {
+                    pending.push_back(part->chunk);
+                }
+            }
+            delete part;
+        }
+        if (!failed && !active.empty() && !finished)
+        {
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+    }
+
+    for (auto &entry : active)
+    {
+        curl_multi_remove_handle(multi, entry.first);
+        curl_easy_cleanup(entry.first);
+        delete entry.second;
+    }
+    for (CURL *curl : idle)
+    {
+        curl_easy_cleanup(curl);
+    }
+    curl_multi_cleanup(multi);
+
+    bool complete = !failed && _completed == _chunks && !_digest.empty();
+    _close();
+    if (!complete)
+    {
+        AgentUtils::writeLog("Download of " + _url + " stopped with " + std::to_string(_completed) + " of " + std::to_string(_chunks) + " chunks", WARNING);
+        return FAILED;
+    }
+    unlink(_sidecarPath.c_str());
+    AgentUtils::writeLog("Downloaded " + _path + " in " + std::to_string(_chunks) + " chunks, sha256 " + _digest, SUCCESS);
+    return SUCCESS;
+}
+
+int SegmentedDownloader::sha256File(const string &path, string &digest)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    EVP_MD_CTX *hash = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(hash, EVP_sha256(), nullptr);
+    vector<unsigned char> buffer(DOWNLOAD_HASH_BUFFER);
+    ssize_t bytes;
+    while ((bytes = read(fd, buffer.data(), buffer.size())) > 0)
+    {
+        EVP_DigestUpdate(hash, buffer.data(), bytes);
+    }
+    close(fd);
+    unsigned char value[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    EVP_DigestFinal_ex(hash, value, &size);
+    EVP_MD_CTX_free(hash);
+    if (bytes < 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    digest = AgentUtils::toHex(value, size);
+    return SUCCESS;
+}
+
+SegmentedDownloader::~SegmentedDownloader()
+{
+    _close();
+}
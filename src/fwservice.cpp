@@ -1,4 +1,5 @@
 #include "service/fwservice.hpp"
+#include <strings.h>
 
 FService::FService(){}
 
@@ -11,8 +12,8 @@ int FService::createDProps(map<string, map<string, string>>& table)
         AgentUtils::writeLog("Write path not defined", WARNING);
         result = FAILED;
     }
-    this->dProperties.writePath = table["firmware"]["root_dir"];
-    if (dProperties.writePath.empty()) 
+    this->dProperties.rootDir = table["firmware"]["root_dir"];
+    if (dProperties.rootDir.empty()) 
     {
         AgentUtils::writeLog("Root directory not defined", WARNING);
         result = FAILED;
@@ -29,6 +30,14 @@ int FService::createDProps(map<string, map<string, string>>& table)
         AgentUtils::writeLog("fileName path not defined", WARNING);
         result = FAILED;
     }
+    if (!dProperties.writePath.empty() && dProperties.writePath.back() != '/')
+    {
+        dProperties.writePath += '/';
+    }
+    if (!dProperties.rootDir.empty() && dProperties.rootDir.back() != '/')
+    {
+        dProperties.rootDir += '/';
+    }
     dProperties.downloadPath = dProperties.writePath + dProperties.fileName;
     if (dProperties.downloadPath.empty()) 
     {
@@ -37,11 +46,33 @@ int FService::createDProps(map<string, map<string, string>>& table)
     }
     username = table["firmware"]["username"];
     password = table["firmware"]["password"];
+    dProperties.sha256 = AgentUtils::trim(table["firmware"]["sha256"]);
+    if (dProperties.sha256.empty())
+    {
+        AgentUtils::writeLog("sha256 not defined, firmware updates are refused without it", FAILED);
+        result = FAILED;
+    }
+    dProperties.targetSha256 = AgentUtils::trim(table["firmware"]["target_sha256"]);
+    dProperties.application = AgentUtils::trim(table["firmware"]["application"]);
+    if (dProperties.application.empty())
+    {
+        AgentUtils::writeLog("application not defined", FAILED);
+        result = FAILED;
+    }
+    dProperties.patchUrl = AgentUtils::trim(table["firmware"]["patch_url"]);
+    if (!dProperties.patchUrl.empty())
+    {
+        dProperties.patchPath = dProperties.writePath + extractFileName(dProperties.patchUrl);
+    }
     try
     {
         dProperties.maxSpeed = std::stoi(table["firmware"]["max_download_speed"]);
         dProperties.minSpeed = std::stoi(table["firmware"]["min_download_speed"]);
         dProperties.timeout = std::stoi(table["firmware"]["time_out"]);
+        string segments = AgentUtils::trim(table["firmware"]["segments"]);
+        string chunkSize = AgentUtils::trim(table["firmware"]["chunk_size"]);
+        if (!segments.empty()) dProperties.segments = std::stoul(segments);
+        if (!chunkSize.empty()) dProperties.chunkSize = std::stoul(chunkSize);
     }
     catch(const std::exception& e)
     {
@@ -68,36 +99,38 @@ string FService::extractFileName(const string &url)
     return "";
 }
 
-int FService::download(const string& username, const string& password)
+int FService::download(const string &url, const string &path)
 {
     int returnVal = SUCCESS;
     string credential = username + ":" + password;
     int retry = dProperties.retry;
     FILE *file = NULL;
     CURLcode res;
-    file = fopen(dProperties.downloadPath.c_str(), "ab");
+    file = fopen(path.c_str(), "ab");
 
     if (file == NULL)
     {
-        AgentUtils::writeLog("Failed to open " + dProperties.downloadPath + " check file path and it's permission", FAILED);
+        AgentUtils::writeLog("Failed to open " + path + " check file path and it's permission", FAILED);
         return FAILED;
     }
 
-    dProperties.size = this->readFileSize(file);
-
     if (curl == NULL)
     {
         AgentUtils::writeLog("Failed to initialize curl ", FAILED);
+        fclose(file);
         return FAILED;
     }
 
-    curl_easy_setopt(curl, CURLOPT_URL, dProperties.url.c_str());
-    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, dProperties.size);
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NULL);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 
-    curl_easy_setopt(curl, CURLOPT_SSH_AUTH_TYPES, CURLSSH_AUTH_PASSWORD); 
-    curl_easy_setopt(curl, CURLOPT_USERPWD, credential.c_str());
+    if (!username.empty() && !password.empty())
+    {
+        curl_easy_setopt(curl, CURLOPT_SSH_AUTH_TYPES, CURLSSH_AUTH_PASSWORD);
+        curl_easy_setopt(curl, CURLOPT_USERPWD, credential.c_str());
+    }
 
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
@@ -109,13 +142,16 @@ int FService::download(const string& username, const string& password)
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
     do
     {
+        // Resume after whatever earlier attempts appended.
+        fflush(file);
+        dProperties.size = this->readFileSize(file);
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)dProperties.size);
         res = curl_easy_perform(curl);
         
         if (res != CURLE_OK)
         {
             string error = curl_easy_strerror(res);
             AgentUtils::writeLog(error, FAILED);
-            std::cerr << "Error: " << error << "\n";
             if (res == CURLE_COULDNT_RESOLVE_HOST)
             {
                 returnVal = FAILED;
@@ -124,8 +160,7 @@ int FService::download(const string& username, const string& password)
             retry--;
             if (retry > 0)
             {
-                std::cerr << "Retrying download in 10 seconds..." << "\n";
-                AgentUtils::writeLog("Retrying download in 10 seconds...");
+                AgentUtils::writeLog("Retrying download in 5 seconds...");
                 std::this_thread::sleep_for(std::chrono::seconds(5));
             }
             else
@@ -133,87 +168,155 @@ int FService::download(const string& username, const string& password)
                 returnVal = SERVER_ERROR;
             }
         }
-        else
-        {
-            retry = dProperties.retry;
-        }
     } while (res != CURLE_OK && retry > 0);
-    if (dProperties.retry <= 0)
-    {
-        returnVal = FAILED;
-    }
     fclose(file);
     return returnVal;
 }
 
-int FService::download()
+int FService::verify(const string &path, const string &digest, const string &expected)
 {
-    int returnVal = SUCCESS;
-    int retry = dProperties.retry;
-    FILE *file = NULL;
-    CURLcode res;
-    file = fopen(dProperties.downloadPath.c_str(), "ab");
-
-    if (file == NULL)
+    if (expected.empty() || digest.empty())
     {
-        AgentUtils::writeLog("Failed to open " + dProperties.downloadPath + " check file path and it's permission", FAILED);
+        AgentUtils::writeLog("Rejecting " + path + ": no sha256 to verify it against", FAILED);
+        OS::deleteFile(path);
         return FAILED;
     }
+    if (strcasecmp(digest.c_str(), expected.c_str()) != 0)
+    {
+        AgentUtils::writeLog("Rejecting " + path + ": sha256 " + digest + " does not match " + expected, FAILED);
+        OS::deleteFile(path);
+        return FAILED;
+    }
+    AgentUtils::writeLog("Verified " + path + " (sha256 " + digest + ")", SUCCESS);
+    return SUCCESS;
+}
 
-    dProperties.size = this->readFileSize(file);
-
-    if (curl == NULL)
+int FService::install(const string &staging)
+{
+    string installed = dProperties.rootDir + dProperties.application;
+    if (rename(staging.c_str(), installed.c_str()) != 0)
     {
-        AgentUtils::writeLog("Failed to initialize curl ", FAILED);
+        AgentUtils::writeLog("Failed to replace " + installed + ": " + strerror(errno), FAILED);
+        OS::deleteFile(staging);
         return FAILED;
     }
+    // Make the rename itself durable before reporting the update as installed.
+    int directory = open(dProperties.rootDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory >= 0)
+    {
+        fsync(directory);
+        close(directory);
+    }
+    return SUCCESS;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, dProperties.url.c_str());
-    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, dProperties.size);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NULL);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, dProperties.minSpeed);
-    curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, dProperties.maxSpeed);
-    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, dProperties.timeout);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, dProperties.timeout);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
-    do
+int FService::fetch(const string &url, const string &path, string &digest)
+{
+    string scheme = url.substr(0, url.find("://"));
+    if (strcasecmp(scheme.c_str(), "http") == 0 || strcasecmp(scheme.c_str(), "https") == 0)
     {
-        res = curl_easy_perform(curl);
-        
-        if (res != CURLE_OK)
+        SegmentedDownloader downloader(url, path, dProperties.segments, dProperties.chunkSize);
+        downloader.setCredentials(username, password);
+        downloader.setLimits(dProperties.minSpeed, dProperties.maxSpeed, dProperties.timeout);
+        if (downloader.probe() == SUCCESS)
         {
-            string error = curl_easy_strerror(res);
-            AgentUtils::writeLog(error, FAILED);
-            std::cerr << "Error: " << error << "\n";
-            if (res == CURLE_COULDNT_RESOLVE_HOST)
+            if (downloader.run() == SUCCESS)
             {
-                returnVal = FAILED;
-                break;
+                digest = downloader.digest();
+                return SUCCESS;
             }
-            retry--;
-            if (retry > 0)
+            if (!downloader.rangesIgnored())
             {
-                std::cerr << "Retrying download in 10 seconds..." << "\n";
-                AgentUtils::writeLog("Retrying download in 10 seconds...");
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-            }
-            else
-            {
-                returnVal = SERVER_ERROR;
+                return FAILED;
             }
         }
-        else
+        // A partial file left by a segmented run is preallocated with chunks at their offsets, which an appending
+        // download cannot continue.
+        OS::deleteFile(path);
+        OS::deleteFile(path + DOWNLOAD_SIDECAR_SUFFIX);
+        AgentUtils::writeLog("Downloading " + url + " serially", INFO);
+    }
+
+    int result = download(url, path);
+    if (result != SUCCESS)
+    {
+        return result;
+    }
+    return SegmentedDownloader::sha256File(path, digest);
+}
+
+int FService::patch()
+{
+    string installed = dProperties.rootDir + dProperties.application;
+    string staging = installed + STAGING_SUFFIX;
+    string digest;
+    if (dProperties.targetSha256.empty())
+    {
+        AgentUtils::writeLog("target_sha256 not defined, patch " + dProperties.patchUrl + " not applied", FAILED);
+        return FAILED;
+    }
+    int result = fetch(dProperties.patchUrl, dProperties.patchPath, digest);
+    if (result != SUCCESS)
+    {
+        return result;
+    }
+    result = DeltaPatch::apply(installed, dProperties.patchPath, staging, digest);
+    OS::deleteFile(dProperties.patchPath);
+    if (result != SUCCESS || verify(staging, digest, dProperties.targetSha256) != SUCCESS || install(staging) != SUCCESS)
+    {
+        return FAILED;
+    }
+    AgentUtils::writeLog("Patched " + installed + " (sha256 " + digest + ")", SUCCESS);
+    return SUCCESS;
+}
+
+int FService::update()
+{
+    if (!dProperties.patchUrl.empty())
+    {
+        if (patch() == SUCCESS)
         {
-            retry = dProperties.retry;
+            return SUCCESS;
         }
-    } while (res != CURLE_OK && retry > 0);
-    if (dProperties.retry <= 0)
+        // Retries in this run go straight to the full image.
+        AgentUtils::writeLog("Patch " + dProperties.patchUrl + " not applied, downloading " + dProperties.url, WARNING);
+        dProperties.patchUrl.clear();
+    }
+    string digest;
+    int result = fetch(dProperties.url, dProperties.downloadPath, digest);
+    if (result != SUCCESS)
     {
-        returnVal = FAILED;
+        return result;
     }
-    fclose(file);
-    return returnVal;
+    if (verify(dProperties.downloadPath, digest, dProperties.sha256) != SUCCESS)
+    {
+        return FAILED;
+    }
+
+    // The image is copied next to the installed binary, keeping its mode, so the rename stays on one file system.
+    string installed = dProperties.rootDir + dProperties.application;
+    string staging = installed + STAGING_SUFFIX;
+    struct stat info;
+    mode_t mode = stat(installed.c_str(), &info) == 0 ? (info.st_mode & 07777) : 0755;
+    std::error_code error;
+    std::filesystem::copy_file(dProperties.downloadPath, staging, std::filesystem::copy_options::overwrite_existing, error);
+    int fd = error ? -1 : open(staging.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fchmod(fd, mode) != 0 || fsync(fd) != 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + staging, FAILED);
+        if (fd >= 0)
+            close(fd);
+        OS::deleteFile(staging);
+        return FAILED;
+    }
+    close(fd);
+    if (install(staging) != SUCCESS)
+    {
+        return FAILED;
+    }
+    OS::deleteFile(dProperties.downloadPath);
+    AgentUtils::writeLog("Installed " + installed + " (sha256 " + digest + ")", SUCCESS);
+    return SUCCESS;
 }
 
 int FService::start(map<string, map<string, string>>& table)
@@ -224,14 +327,7 @@ int FService::start(map<string, map<string, string>>& table)
     curl = curl_easy_init();
     while(count > 0)
     {     
-        if (!username.empty() && !password.empty())   
-        {
-            result = download(username, password);
-        }
-        else
-        {
-            result = download();
-        }
+        result = update();
         if (result == SUCCESS)
         {
             AgentUtils::writeLog("Download completed..", SUCCESS);
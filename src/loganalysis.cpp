@@ -664,6 +664,7 @@ int LogAnalysis::postAnalysis(const vector<log_event> &alerts)
     json["Alerts"] = Json::Value(Json::arrayValue);
     Json::Value alert;
     Json::StreamWriterBuilder writerBuilder;
+    writerBuilder["indentation"] = "";
 
     for (const auto &log : alerts)
     {
@@ -696,10 +697,17 @@ int LogAnalysis::postAnalysis(const vector<log_event> &alerts)
             json["Alerts"].append(alert);
         }
     }
-    std::ofstream ofile(filePath); /*need update*/
+    if (filePath.empty())
+    {
+        return FAILED;
+    }
+    std::ostringstream document;
     std::unique_ptr<Json::StreamWriter> writer(writerBuilder.newStreamWriter());
-    writer->write(json, &ofile);
-    ofile.close();
+    writer->write(json, &document);
+    if (OS::writeFileAtomic(filePath, document.str()) == FAILED)
+    {
+        return FAILED;
+    }
     AgentUtils::writeLog("Log written to " + filePath, SUCCESS);
     return SUCCESS;
 }
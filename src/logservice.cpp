@@ -17,13 +17,8 @@ int LogService::_saveAsJSON(Json::Value &json, const string &path, const vector<
     {
         return FAILED;
     }
-    fstream file(jsonPath, std::ios::out);
     Json::StreamWriterBuilder writerBuilder;
-    if (!file)
-    {
-        AgentUtils::writeLog(FWRITE_FAILED + jsonPath, FAILED);
-        return FAILED;
-    }
+    writerBuilder["indentation"] = "";
 
     json["LogObjects"] = Json::Value(Json::arrayValue);
     for (auto log : logs)
@@ -40,9 +35,13 @@ int LogService::_saveAsJSON(Json::Value &json, const string &path, const vector<
 
         json["LogObjects"].append(jsonLog);
     }
+    std::ostringstream document;
     std::unique_ptr<Json::StreamWriter> writer(writerBuilder.newStreamWriter());
-    writer->write(json, &file);
-    file.close();
+    writer->write(json, &document);
+    if (OS::writeFileAtomic(jsonPath, document.str()) == FAILED)
+    {
+        return FAILED;
+    }
     AgentUtils::writeLog(FWRITE_SUCCESS + jsonPath, SUCCESS);
     return SUCCESS;
 }
@@ -187,9 +186,7 @@ int LogService::getSysLog(const string &appName, Json::Value &json, const vector
 
         if (remote == 'y' || remote == 'Y')
         {
-            UdpQueue queue;
-            result = readRemoteSysLog(queue, logs);
-            queue.stop();
+            result = readRemoteSysLog(_udpQueue, logs);
         }
         else
         {
@@ -374,6 +371,19 @@ int LogService::saveToLocal(const vector<string> &logs, const string &appName)
 
 int LogService::verifyJsonPath(string &timestamp)
 {
+    if (!timestamp.empty() && timestamp[0] == '/')
+    {
+        // An application's own write_path is uploaded by that application alone.
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(timestamp).parent_path(), error);
+        if (error)
+        {
+            AgentUtils::writeLog(FILE_ERROR + timestamp, FAILED);
+            return FAILED;
+        }
+        return SUCCESS;
+    }
+
     string filePath = BASE_LOG_DIR;
 
     if (OS::isDirExist(filePath) == FAILED)
@@ -388,16 +398,12 @@ int LogService::verifyJsonPath(string &timestamp)
         OS::createDir(filePath);
     }
 
-    filePath += "/" + timestamp + ".json";
-
-    std::ofstream file(filePath);
-    if (!file)
+    if (OS::isDirExist(filePath) == FAILED)
     {
         AgentUtils::writeLog(FILE_ERROR + filePath, FAILED);
         return FAILED;
     }
-    file.close();
-    timestamp = filePath;
+    timestamp = filePath + "/" + timestamp + ".json";
     return SUCCESS;
 }
 
@@ -451,7 +457,61 @@ int LogService::readDpkgLog(const string &path, vector<string> &logs, string &pr
 
 int LogService::readRemoteSysLog(UdpQueue &queue, vector<string> &logs)
 {
-    return queue.getMessage(logs);
+    if (queue.start() == FAILED)
+    {
+        return FAILED;
+    }
+    if (_tcpQueue.getPort() > 0 && !_tcpQueue.isRunning() && _tcpQueue.start(queue.getShards()) == FAILED)
+    {
+        AgentUtils::writeLog("TCP syslog listener could not be started on port " + std::to_string(_tcpQueue.getPort()), WARNING);
+    }
+    int result = queue.getMessage(logs);
+    for (size_t shard = 0; shard < queue.getShardCount(); shard++)
+    {
+        const udp_stats &stats = queue.getStats(shard);
+        AgentUtils::writeLog("Remote syslog receiver " + std::to_string(shard) + " received " + std::to_string(stats.received.load()) +
+                                 " messages, dropped " + std::to_string(stats.ringDropped.load()) + " (ring) " +
+                                 std::to_string(stats.kernelDropped.load()) + " (kernel), truncated " + std::to_string(stats.truncated.load()),
+                             DEBUG);
+    }
+    if (_tcpQueue.isRunning())
+    {
+        const tcp_stats &stats = _tcpQueue.getStats();
+        AgentUtils::writeLog("Remote syslog TCP listener has " + std::to_string(stats.active.load()) + " connections, received " +
+                                 std::to_string(stats.received.load()) + " messages, dropped " + std::to_string(stats.ringDropped.load()) +
+                                 " (ring), truncated " + std::to_string(stats.truncated.load()),
+                             DEBUG);
+    }
+    return result;
+}
+
+int LogService::configureRemote(map<string, string> &config)
+{
+    int port = UDP_PORT;
+    int receivers = 1;
+    int tcpPort = 0;
+    try
+    {
+        if (!config["port"].empty())
+            port = std::stoi(config["port"]);
+        if (!config["receivers"].empty())
+            receivers = std::stoi(config["receivers"]);
+        if (!config["tcp_port"].empty())
+            tcpPort = std::stoi(config["tcp_port"]);
+    }
+    catch (const std::exception &e)
+    {
+        AgentUtils::writeLog("Invalid remote syslog port or receivers configured", FAILED);
+        return FAILED;
+    }
+    if (port < 1 || port > 65535 || receivers < 1 || tcpPort < 0 || tcpPort > 65535)
+    {
+        AgentUtils::writeLog("Invalid remote syslog port or receivers configured", FAILED);
+        return FAILED;
+    }
+    _udpQueue.configure(port, receivers);
+    _tcpQueue.setPort(tcpPort);
+    return SUCCESS;
 }
 
 LogService::~LogService() {}
\ No newline at end of file
@@ -1,110 +1,132 @@
 #include "service/monitor.hpp"
 
-static std::mutex p_mutex;
+const string PROC = "/proc/";
 
-const string PROC       = "/proc/";
-const string CPUDATA    = "/stat";
-const string MEMORYDATA = "/statm";
-const string BOOTTIME   = "uptime";
-const string COMM       = "/comm";
-const string IO         = "/io";
+MonitorService::MonitorService() : _pool(std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), MAX_MONITOR_WORKERS)) {}
 
-int CpuTable::_getUpTime()
+process_delta MonitorService::computeDelta(const proc_stat &stat, const proc_io *io, const process_sample *previous, const host_info &host, double interval)
 {
-    string path = PROC + BOOTTIME;
-    fstream file;
-    file.open(path, std::ios::in);
-    string line, word;
-    if (file.is_open())
-    {
-        std::getline(file, line);
-        std::stringstream ss(line);
-        std::getline(ss, word, ' ');
-        file.close();
-    }
-    return stoi(word);
-}
+    process_delta delta;
+    if (previous != nullptr && previous->startTime != stat.startTime)
+    {
+        previous = nullptr;
+    }
+    delta.continued = previous != nullptr;
 
-double MonitorService::_calculateCpuTime(CpuTable &table)
-{
-    double utime = table.getUTime() / CLK_TCK;
-    double stime = table.getSTime() / CLK_TCK;
-    double startTime = table.getStartTime() / CLK_TCK;
-    double elapsedTime = table.getUpTime() - startTime;
-    double cpuRunTime = ((utime + stime) * 100) / elapsedTime;
-    cpuRunTime = cpuRunTime * (1 + (table.getNiceTime() / MAX_NICE_VALUE));
-    return cpuRunTime;
+    double ticks = (double)(stat.utime + stat.stime);
+    double elapsedTime = 0.0;
+    if (previous != nullptr && interval > 0.0)
+    {
+        ticks -= (double)previous->cpuTicks;
+        elapsedTime = interval;
+    }
+    else
+    {
+        elapsedTime = host.upTime - (double)stat.startTime / host.clockTicks;
+    }
+    if (elapsedTime > 0.0 && ticks >= 0.0)
+    {
+        delta.cpuUsage = ticks / host.clockTicks * 100.0 / elapsedTime;
+    }
+
+    if (previous != nullptr)
+    {
+        delta.memChange = (double)(stat.rss - previous->rss) * host.pageSize;
+        unsigned long long ioBytes = io != nullptr ? io->readBytes + io->writeBytes : 0;
+        if (io != nullptr && interval > 0.0 && ioBytes >= previous->ioBytes)
+        {
+            delta.diskRate = (ioBytes - previous->ioBytes) / interval;
+        }
+    }
+    return delta;
 }
 
-vector<int> MonitorService::_getProcessIds() // I don't see it could be optimized
+vector<int> MonitorService::_getProcessIds()
 {
-    int pid = -1;
     vector<int> processIds;
-    DIR *dir = opendir(PROC.c_str());
-    dirent *entry = NULL;
-
-    if (dir == NULL)
+    if (_parser.listPids(processIds) == FAILED)
     {
         AgentUtils::writeLog(INVALID_PATH + PROC, FAILED);
-        return processIds;
-    }
-    while ((entry = readdir(dir)) != NULL)
-    {
-        if (entry->d_type == DT_DIR)
-        {
-            try
-            {
-                pid = std::stoi(entry->d_name);
-                processIds.push_back(pid);
-            }
-            catch (const std::exception &e)
-            {
-            }
-        }
     }
     return processIds;
 }
 
-string MonitorService::_getProcesNameById(const unsigned int &processId)
+Json::Value MonitorService::_toJson(const metric_rollup &rollup)
 {
-    string processName = "";
-    string path = PROC + std::to_string(processId) + COMM;
-    std::ifstream file(path);
+    Json::Value value;
+    value["min"] = rollup.min;
+    value["max"] = rollup.max;
+    value["avg"] = rollup.avg;
+    return value;
+}
 
-    if (file.is_open())
+Json::Value MonitorService::_toJson(const tracked_process &process)
+{
+    Json::Value value;
+    value["processId"] = process.pid;
+    value["parent_id"] = process.ppid;
+    value["process_name"] = process.processName;
+    value["start_time"] = (Json::Int64)process.started;
+    if (process.exited != 0)
     {
-        std::getline(file, processName);
-        file.close();
+        value["exit_time"] = (Json::Int64)process.exited;
+        value["exit_code"] = process.exitCode;
     }
-    return processName;
+    return value;
 }
 
-int MonitorService::_saveLog(const vector<process_data> &logs)
+int MonitorService::_saveLog(const vector<process_data> &logs, const vector<tracked_process> &running, const vector<tracked_process> &exited)
 {
     string hostName;
     string path = OS::getJsonWritePath("process");
     AgentUtils::getHostName(hostName);
-    sys_properties properties = getSystemProperties();
+    sys_properties total, used;
+    system_sample sample;
+    if (_sampler.latest(sample))
+    {
+        total = {sample.ramTotal, sample.diskTotal, sample.cpuTotal};
+        used = {sample.ramUsage, sample.diskUsage, sample.cpuUsage};
+    }
+    else
+    {
+        total = getSystemProperties();
+        used = getAvailedSystemProperties();
+    }
     Json::Value props;
-    props["CpuMemory"] = properties.cpu;
-    props["RamMeomry"] = properties.ram;
-    props["DiskMemory"] = properties.disk;
-    properties = getAvailedSystemProperties();
+    props["CpuMemory"] = total.cpu;
+    props["RamMeomry"] = total.ram;
+    props["DiskMemory"] = total.disk;
     Json::Value availedProps;
-    availedProps["CpuMemory"] = properties.cpu;
-    availedProps["RamMeomry"] = properties.ram;
-    availedProps["DiskMemory"] = properties.disk;
-    fstream file(path, std::ios::app);
+    availedProps["CpuMemory"] = used.cpu;
+    availedProps["RamMeomry"] = used.ram;
+    availedProps["DiskMemory"] = used.disk;
     Json::Value jsonData;
     Json::StreamWriterBuilder writerBuilder;
-    if (!file)
+    writerBuilder["indentation"] = "";
+    if (path.empty())
     {
-        AgentUtils::writeLog(FWRITE_FAILED + path, FAILED);
         return FAILED;
     }
     
     jsonData["DeviceTotalSpace"] = props;
     jsonData["DeviceUsedSpace"] = availedProps;
+    jsonData["SystemMetrics"] = Json::Value(Json::arrayValue);
+    for (const sample_rollup &rollup : _sampler.rollup(_lastReport))
+    {
+        Json::Value window;
+        window["Start"] = (Json::Int64)rollup.start;
+        window["Samples"] = (Json::UInt64)rollup.count;
+        window["CpuUsage"] = _toJson(rollup.cpuUsage);
+        window["RamUsage"] = _toJson(rollup.ramUsage);
+        window["DiskUsage"] = _toJson(rollup.diskUsage);
+        window["NetworkRx"] = _toJson(rollup.networkRx);
+        window["NetworkTx"] = _toJson(rollup.networkTx);
+        jsonData["SystemMetrics"].append(window);
+    }
+    if (_sampler.latest(sample))
+    {
+        _lastReport = sample.timestamp;
+    }
     jsonData["TimeGenerated"] = AgentUtils::getCurrentTime();
     jsonData["Source"] = hostName;
     jsonData["OrgId"] = 12345;
@@ -117,112 +139,41 @@ int MonitorService::_saveLog(const vector<process_data> &logs)
         jsonLog["cpu_usage"] = std::stod(data.cpuTime);
         jsonLog["ram_usage"] = std::stod(data.memUsage);
         jsonLog["disk_usage"] = std::stod(data.diskUsage);
+        jsonLog["ram_change"] = std::stod(data.memChange);
+        jsonLog["disk_rate"] = std::stod(data.diskRate);
         jsonData["ProcessObjects"].append(jsonLog);
     }
-
-    std::unique_ptr<Json::StreamWriter> writer(writerBuilder.newStreamWriter());
-    writer->write(jsonData, &file);
-
-    file.close();
-    AgentUtils::writeLog(FWRITE_SUCCESS + path, SUCCESS);
-    return SUCCESS;
-}
-
-double MonitorService::_getMemoryUsage(const unsigned int &processId)
-{
-    unsigned long size, resident, shared, text, lib, data, dt;
-    double memoryPercentage = -1.0;
-    string line;
-    string path = PROC + std::to_string(processId) + MEMORYDATA;
-
-    long pageSize = sysconf(_SC_PAGESIZE);
-    long totalMemory = sysconf(_SC_PHYS_PAGES) * pageSize;
-
-    std::ifstream file(path);
-    if (!file)
+    for (const tracked_process &process : running)
     {
-        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
-        return memoryPercentage;
+        jsonData["ProcessObjects"].append(_toJson(process));
     }
-    std::getline(file, line);
-    std::istringstream iss(line);
-
-    if (!(iss >> size >> resident >> shared >> text >> lib >> data >> dt))
+    jsonData["ExitedProcesses"] = Json::Value(Json::arrayValue);
+    for (const tracked_process &process : exited)
     {
-        AgentUtils::writeLog("Failed to parse memory statistics.", FAILED);
-        return memoryPercentage;
+        jsonData["ExitedProcesses"].append(_toJson(process));
     }
 
-    memoryPercentage = 100.0 * resident * pageSize / totalMemory;
-    file.close();
-    return memoryPercentage;
-}
-
-CpuTable MonitorService::_readProcessingTimeById(const unsigned int &processId)
-{
-    string path = PROC + std::to_string(processId) + CPUDATA;
-    vector<string> stats;
-    string line, word;
-    fstream file;
+    std::ostringstream document;
+    std::unique_ptr<Json::StreamWriter> writer(writerBuilder.newStreamWriter());
+    writer->write(jsonData, &document);
+    // Documents are kept one per line.
+    document << '\n';
 
-    file.open(path, std::ios::in);
-    if (!(file.is_open()))
+    if (OS::writeFileAtomic(path, document.str()) == FAILED)
     {
-        CpuTable emptyTable;
-        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
-        return emptyTable;
-    }
-    std::getline(file, line);
-    std::stringstream ss(line);
-    while (std::getline(ss, word, ' '))
-    {
-        stats.push_back(word);
+        return FAILED;
     }
-    file.close();
-    CpuTable table{
-        stoi(stats.at(UITME)), stoi(stats.at(STIME)),
-        stoi(stats.at(CUTIME)), stoi(stats.at(CSTIME)),
-        stoi(stats.at(NICETIME)), stoi(stats.at(START_TIME))};
-    return table;
+    AgentUtils::writeLog(FWRITE_SUCCESS + path, SUCCESS);
+    return SUCCESS;
 }
 
-double MonitorService::_getDiskUsage(const unsigned int &processId)
+double MonitorService::_getMemoryUsage(long long rss)
 {
-    double diskUsage = -1.0;
-    int i = 0;
-    string line;
-    string path = PROC + std::to_string(processId) + IO;
-    std::fstream file(path, std::ios::in);
-
-    if (!file.is_open())
+    if (_host.totalMemory == 0)
     {
-        AgentUtils::writeLog("Process does not exist with this id : " + std::to_string(processId), FAILED);
-        return diskUsage;
-    }
-    diskUsage = 0.0;
-
-    while (std::getline(file, line))
-    {
-        string token;
-        std::stringstream ss(line);
-        if (i == 4 || i == 5)
-        {
-            while (std::getline(ss, token, ':'))
-            {
-                try
-                {
-                    double d = std::stod(token);
-                    diskUsage += d;
-                }
-                catch (std::exception &e)
-                {
-                }
-            }
-        }
-        i++;
+        return -1.0;
     }
-    file.close();
-    return diskUsage;
+    return 100.0 * rss * _host.pageSize / _host.totalMemory;
 }
 
 sys_properties MonitorService::getSystemProperties()
@@ -325,47 +276,133 @@ sys_properties MonitorService::getAvailedSystemProperties()
     return properties;
 }
 
-process_data MonitorService::createProcessData(int processId)
+int MonitorService::createProcessData(int processId, process_data &data, process_sample &sample)
 {
-    CpuTable table = _readProcessingTimeById(processId);
-    string processName = _getProcesNameById(processId);
-    double cpuTime = _calculateCpuTime(table);
-    double memUsage = _getMemoryUsage(processId);
-    double diskUsage = _getDiskUsage(processId);
-    process_data processData{
-        std::to_string(processId), processName,
-        std::to_string(cpuTime), std::to_string(memUsage),
-        std::to_string(diskUsage)};
-    // data.push_back(processData);
-    return processData;
+    proc_stat stat;
+    if (_parser.readStat(processId, stat) == FAILED)
+    {
+        AgentUtils::writeLog("Process exited before it was sampled: " + std::to_string(processId), DEBUG);
+        return FAILED;
+    }
+    auto cached = _samples.find(processId);
+    const process_sample *previous = cached != _samples.end() ? &cached->second : nullptr;
+
+    proc_io io;
+    bool ioRead = _parser.readIo(processId, io) == SUCCESS;
+    if (!ioRead)
+    {
+        AgentUtils::writeLog("Unable to read I/O counters of process: " + std::to_string(processId), DEBUG);
+    }
+    process_delta delta = computeDelta(stat, ioRead ? &io : nullptr, previous, _host, _interval);
+
+    sample.startTime = stat.startTime;
+    sample.cpuTicks = stat.utime + stat.stime;
+    sample.rss = stat.rss;
+    sample.ioBytes = ioRead ? io.readBytes + io.writeBytes : 0;
+    if (delta.continued)
+    {
+        sample.processName = previous->processName;
+    }
+    else
+    {
+        _parser.readComm(processId, sample.processName);
+    }
+
+    double diskUsage = ioRead ? (double)sample.ioBytes : -1.0;
+    double memUsage = _getMemoryUsage(stat.rss);
+    data = process_data(
+        std::to_string(processId), sample.processName,
+        std::to_string(delta.cpuUsage), std::to_string(memUsage),
+        std::to_string(diskUsage), std::to_string(delta.memChange),
+        std::to_string(delta.diskRate));
+    return SUCCESS;
 }
 
 int MonitorService::getData()
 {
+    struct slice_result
+    {
+        vector<process_data> data;
+        vector<std::pair<int, process_sample>> samples;
+    };
+
     AgentUtils::writeLog("Request for collecting process details", DEBUG);
+    if (!_sampler.isRunning())
+    {
+        _sampler.start();
+    }
+    if (_events.isRunning())
+    {
+        // The table is written as it is; no /proc file is read. The readings of the last scan are dropped, so a
+        // scan after the listener stops starts from lifetime averages again.
+        _samples.clear();
+        _lastUpTime = 0.0;
+        return _saveLog({}, _events.getProcesses(), _events.drainExited());
+    }
     vector<process_data> parent;
     vector<int> processIds = _getProcessIds();
-    for (int i = 0; i < (int)processIds.size(); i++)
+    _parser.readHostInfo(_host);
+    _interval = _lastUpTime > 0.0 ? _host.upTime - _lastUpTime : 0.0;
+    size_t workers = std::min(_pool.size(), processIds.size());
+    vector<std::future<slice_result>> slices;
+    for (size_t worker = 0; worker < workers; worker++)
     {
-        int p_id = processIds[i];
-        auto asyncTask = [&, p_id]()
-        {
-            // vector<process_data> localData;
-            process_data localData = createProcessData(p_id);
-            std::lock_guard<std::mutex> lock(p_mutex);
-            parent.push_back(localData);
-            // parent.insert(parent.end(), localData.begin(), localData.end());
-        };
-        _asyncTasks.push_back(std::async(std::launch::async, asyncTask));
+        size_t begin = processIds.size() * worker / workers;
+        size_t end = processIds.size() * (worker + 1) / workers;
+        slices.push_back(_pool.submit([this, &processIds, begin, end]()
+                                      {
+            slice_result local;
+            local.data.reserve(end - begin);
+            local.samples.reserve(end - begin);
+            for (size_t i = begin; i < end; i++)
+            {
+                process_data data("", "", "", "", "");
+                process_sample sample;
+                if (createProcessData(processIds[i], data, sample) == SUCCESS)
+                {
+                    local.data.push_back(std::move(data));
+                    local.samples.emplace_back(processIds[i], std::move(sample));
+                }
+            }
+            return local; }));
     }
 
-    // Wait for async tasks to complete
-    for (auto &task : _asyncTasks)
+    std::unordered_map<int, process_sample> samples;
+    samples.reserve(processIds.size());
+    parent.reserve(processIds.size());
+    for (auto &slice : slices)
     {
-        task.wait();
+        slice_result local = slice.get();
+        parent.insert(parent.end(), std::make_move_iterator(local.data.begin()), std::make_move_iterator(local.data.end()));
+        for (auto &entry : local.samples)
+        {
+            samples.emplace(entry.first, std::move(entry.second));
+        }
     }
+    _samples.swap(samples);
+    _lastUpTime = _host.upTime;
     AgentUtils::writeLog("Process information collected", DEBUG);
-    return _saveLog(parent);
+    return _saveLog(parent, {}, {});
+}
+
+int MonitorService::configure(map<string, string> &config)
+{
+    string procEvents = AgentUtils::trim(config["proc_events"]);
+    if (procEvents.empty() || procEvents == "0")
+    {
+        _events.stop();
+        return SUCCESS;
+    }
+    if (procEvents != "1")
+    {
+        AgentUtils::writeLog("Invalid proc_events configured for monitor: " + procEvents, FAILED);
+        return FAILED;
+    }
+    if (!_events.isRunning() && _events.start() == FAILED)
+    {
+        AgentUtils::writeLog("Process events unavailable, scanning /proc instead", WARNING);
+    }
+    return SUCCESS;
 }
 
 MonitorService::~MonitorService() {}
@@ -0,0 +1,328 @@
+#include "service/procevents.hpp"
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+// Kernel ABI values of the process events. The enum moved out of struct proc_event in Linux 6.6, so its
+// enumerators cannot be named the same way from C++ on every kernel header version.
+static const uint32_t EVENT_FORK = 0x00000001;
+static const uint32_t EVENT_EXEC = 0x00000002;
+static const uint32_t EVENT_COMM = 0x00000200;
+static const uint32_t EVENT_EXIT = 0x80000000;
+
+ProcEventListener::ProcEventListener() : _running(false), _events(0), _overflows(0) {}
+
+int ProcEventListener::_subscribe(bool enable)
+{
+    char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))] = {};
+    enum proc_cn_mcast_op operation = enable ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+    struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(operation));
+    header->nlmsg_type = NLMSG_DONE;
+    header->nlmsg_pid = getpid();
+
+    struct cn_msg *message = (struct cn_msg *)NLMSG_DATA(header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(operation);
+    memcpy(message->data, &operation, sizeof(operation));
+
+    if (send(_socket, header, header->nlmsg_len, 0) < 0)
+    {
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void ProcEventListener::_scan()
+{
+    vector<int> processIds;
+    _parser.listPids(processIds);
+    long long now = (long long)time(nullptr);
+    std::unordered_map<int, tracked_process> processes;
+    processes.reserve(processIds.size());
+    for (int pid : processIds)
+    {
+        proc_stat stat;
+        if (_parser.readStat(pid, stat) == FAILED)
+        {
+            continue;
+        }
+        tracked_process &process = processes[pid];
+        process.pid = pid;
+        process.ppid = stat.ppid;
+        process.started = now;
+        _parser.readComm(pid, process.processName);
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto &entry : processes)
+    {
+        auto known = _processes.find(entry.first);
+        if (known != _processes.end())
+        {
+            entry.second.started = known->second.started;
+        }
+    }
+    _processes.swap(processes);
+}
+
+void ProcEventListener::_handle(const char *data, size_t length)
+{
+    if (length < sizeof(struct proc_event))
+    {
+        return;
+    }
+    struct proc_event event;
+    memcpy(&event, data, sizeof(event));
+    long long now = (long long)time(nullptr);
+
+    switch ((uint32_t)event.what)
+    {
+    case EVENT_FORK:
+    {
+        int pid = event.event_data.fork.child_pid;
+        // Thread creation is reported as a fork with child_pid != child_tgid.
+        if (pid != event.event_data.fork.child_tgid)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        tracked_process &process = _processes[pid];
+        process = tracked_process();
+        process.pid = pid;
+        process.ppid = event.event_data.fork.parent_tgid;
+        process.started = now;
+        auto parent = _processes.find(process.ppid);
+        if (parent != _processes.end())
+        {
+            process.processName = parent->second.processName;
+        }
+        break;
+    }
+    case EVENT_EXEC:
+    {
+        int pid = event.event_data.exec.process_pid;
+        if (pid != event.event_data.exec.process_tgid)
+        {
+            return;
+        }
+        string name;
+        _parser.readComm(pid, name);
+        std::lock_guard<std::mutex> lock(_mutex);
+        tracked_process &process = _processes[pid];
+        if (process.pid == 0)
+        {
+            process.pid = pid;
+            process.started = now;
+        }
+        process.processName = name;
+        break;
+    }
+    case EVENT_COMM:
+    {
+        int pid = event.event_data.comm.process_pid;
+        if (pid != event.event_data.comm.process_tgid)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto process = _processes.find(pid);
+        if (process != _processes.end())
+        {
+            process->second.processName.assign(event.event_data.comm.comm, strnlen(event.event_data.comm.comm, sizeof(event.event_data.comm.comm)));
+        }
+        break;
+    }
+    case EVENT_EXIT:
+    {
+        int pid = event.event_data.exit.process_pid;
+        if (pid != event.event_data.exit.process_tgid)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto process = _processes.find(pid);
+        if (process == _processes.end())
+        {
+            return;
+        }
+        process->second.exited = now;
+        process->second.exitCode = (int)event.event_data.exit.exit_code;
+        if (_exited.size() >= PROC_EVENT_MAX_EXITED)
+        {
+            _exited.pop_front();
+        }
+        _exited.push_back(std::move(process->second));
+        _processes.erase(process);
+        break;
+    }
+    default:
+        return;
+    }
+    _events++;
+}
+
+void ProcEventListener::_run()
+{
+    alignas(struct nlmsghdr) char buffer[PROC_EVENT_BUFFER];
+    struct pollfd fds[2] = {{_socket, POLLIN, 0}, {_wakeFd, POLLIN, 0}};
+    while (_running.load())
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            AgentUtils::writeLog("Process event poll failed: " + string(strerror(errno)), FAILED);
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        while (true)
+        {
+            ssize_t bytes = recv(_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (bytes < 0)
+            {
+                if (errno == ENOBUFS)
+                {
+                    // Events were lost, so the table may be stale.
+                    _overflows++;
+                    AgentUtils::writeLog("Process event queue overflowed, rescanning /proc", WARNING);
+                    _scan();
+                    continue;
+                }
+                break;
+            }
+            if (bytes == 0)
+            {
+                break;
+            }
+            for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, (size_t)bytes); header = NLMSG_NEXT(header, bytes))
+            {
+                if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
+                {
+                    continue;
+                }
+                struct cn_msg *message = (struct cn_msg *)NLMSG_DATA(header);
+                if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
+                {
+                    continue;
+                }
+                _handle((const char *)message->data, message->len);
+            }
+        }
+    }
+}
+
+int ProcEventListener::start()
+{
+    if (_running.load())
+    {
+        return SUCCESS;
+    }
+    _socket = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (_socket < 0)
+    {
+        AgentUtils::writeLog("Unable to open process connector socket: " + string(strerror(errno)), FAILED);
+        return FAILED;
+    }
+    int size = PROC_EVENT_RCVBUF;
+    if (setsockopt(_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+    {
+        setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = CN_IDX_PROC;
+    address.nl_pid = 0;
+    if (bind(_socket, (struct sockaddr *)&address, sizeof(address)) < 0 || _subscribe(true) == FAILED)
+    {
+        AgentUtils::writeLog("Unable to subscribe to process events: " + string(strerror(errno)), FAILED);
+        close(_socket);
+        _socket = -1;
+        return FAILED;
+    }
+    _wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_wakeFd < 0)
+    {
+        AgentUtils::writeLog("Unable to create process event wake descriptor", FAILED);
+        close(_socket);
+        _socket = -1;
+        return FAILED;
+    }
+
+    // Subscribe before the scan so no process started in between is missed.
+    _scan();
+    _running.store(true);
+    _thread = std::thread(&ProcEventListener::_run, this);
+    AgentUtils::writeLog("Process event listener started", INFO);
+    return SUCCESS;
+}
+
+void ProcEventListener::stop()
+{
+    if (!_running.exchange(false))
+    {
+        return;
+    }
+    uint64_t value = 1;
+    if (write(_wakeFd, &value, sizeof(value)) < 0)
+    {
+        AgentUtils::writeLog("Unable to wake process event listener", FAILED);
+    }
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    _subscribe(false);
+    close(_socket);
+    close(_wakeFd);
+    _socket = -1;
+    _wakeFd = -1;
+}
+
+vector<int> ProcEventListener::getPids() const
+{
+    vector<int> processIds;
+    std::lock_guard<std::mutex> lock(_mutex);
+    processIds.reserve(_processes.size());
+    for (const auto &entry : _processes)
+    {
+        processIds.push_back(entry.first);
+    }
+    return processIds;
+}
+
+vector<tracked_process> ProcEventListener::getProcesses() const
+{
+    vector<tracked_process> processes;
+    std::lock_guard<std::mutex> lock(_mutex);
+    processes.reserve(_processes.size());
+    for (const auto &entry : _processes)
+    {
+        processes.push_back(entry.second);
+    }
+    return processes;
+}
+
+vector<tracked_process> ProcEventListener::drainExited()
+{
+    std::deque<tracked_process> drained;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        drained.swap(_exited);
+    }
+    return vector<tracked_process>(std::make_move_iterator(drained.begin()), std::make_move_iterator(drained.end()));
+}
+
+ProcEventListener::~ProcEventListener()
+{
+    stop();
+}
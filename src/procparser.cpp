@@ -0,0 +1,428 @@
+#include "service/procparser.hpp"
+
+static const char *skipSpaces(const char *cursor, const char *end)
+{
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n'))
+    {
+        cursor++;
+    }
+    return cursor;
+}
+
+static const char *scanUnsigned(const char *cursor, const char *end, unsigned long long &value)
+{
+    cursor = skipSpaces(cursor, end);
+    if (cursor >= end || *cursor < '0' || *cursor > '9')
+    {
+        return nullptr;
+    }
+    value = 0;
+    while (cursor < end && *cursor >= '0' && *cursor <= '9')
+    {
+        value = value * 10 + (unsigned long long)(*cursor - '0');
+        cursor++;
+    }
+    return cursor;
+}
+
+static const char *scanSigned(const char *cursor, const char *end, long long &value)
+{
+    cursor = skipSpaces(cursor, end);
+    bool negative = cursor < end && *cursor == '-';
+    unsigned long long magnitude = 0;
+    cursor = scanUnsigned(negative ? cursor + 1 : cursor, end, magnitude);
+    value = negative ? -(long long)magnitude : (long long)magnitude;
+    return cursor;
+}
+
+static const char *skipFields(const char *cursor, const char *end, int count)
+{
+    for (int i = 0; i < count && cursor; i++)
+    {
+        cursor = skipSpaces(cursor, end);
+        if (cursor >= end)
+        {
+            return nullptr;
+        }
+        while (cursor < end && *cursor != ' ' && *cursor != '\n')
+        {
+            cursor++;
+        }
+    }
+    return cursor;
+}
+
+ProcParser::ProcParser(const string &root)
+{
+    _procFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (_procFd < 0)
+    {
+        AgentUtils::writeLog(INVALID_PATH + root, FAILED);
+    }
+}
+
+ssize_t ProcParser::_read(int processId, const char *name, char *buffer, size_t size) const
+{
+    char path[32];
+    if (processId > 0)
+    {
+        snprintf(path, sizeof(path), "%d/%s", processId, name);
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s", name);
+    }
+    int fd = openat(_procFd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t bytes = pread(fd, buffer, size - 1, 0);
+    close(fd);
+    if (bytes >= 0)
+    {
+        buffer[bytes] = '\0';
+    }
+    return bytes;
+}
+
+int ProcParser::readHostInfo(host_info &info) const
+{
+    char buffer[128];
+    info.pageSize = sysconf(_SC_PAGESIZE);
+    info.totalMemory = (unsigned long long)sysconf(_SC_PHYS_PAGES) * info.pageSize;
+    info.cpuCount = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    info.clockTicks = std::max(1L, sysconf(_SC_CLK_TCK));
+    ssize_t bytes = _read(0, "uptime", buffer, sizeof(buffer));
+    if (bytes <= 0 || !parseUpTime(buffer, bytes, info.upTime))
+    {
+        AgentUtils::writeLog(FREAD_FAILED + "/proc/uptime", FAILED);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+static int listNumericEntries(int dirFd, const char *path, vector<int> &ids)
+{
+    int fd = openat(dirFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        return FAILED;
+    }
+    dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_type != DT_DIR || entry->d_name[0] < '1' || entry->d_name[0] > '9')
+        {
+            continue;
+        }
+        unsigned long long id = 0;
+        const char *end = entry->d_name + strlen(entry->d_name);
+        if (scanUnsigned(entry->d_name, end, id) == end)
+        {
+            ids.push_back((int)id);
+        }
+    }
+    closedir(dir);
+    return SUCCESS;
+}
+
+int ProcParser::listPids(vector<int> &processIds) const
+{
+    return listNumericEntries(_procFd, ".", processIds);
+}
+
+int ProcParser::listTasks(int processId, vector<int> &taskIds) const
+{
+    char path[32];
+    snprintf(path, sizeof(path), "%d/task", processId);
+    return listNumericEntries(_procFd, path, taskIds);
+}
+
+int ProcParser::readStat(int processId, proc_stat &stat) const
+{
+    char buffer[PROC_READ_BUFFER];
+    ssize_t bytes = _read(processId, "stat", buffer, sizeof(buffer));
+    if (bytes <= 0 || !parseStat(buffer, bytes, stat))
+    {
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int ProcParser::readStatm(int processId, unsigned long long &resident) const
+{
+    char buffer[256];
+    ssize_t bytes = _read(processId, "statm", buffer, sizeof(buffer));
+    if (bytes <= 0 || !parseStatm(buffer, bytes, resident))
+    {
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int ProcParser::readIo(int processId, proc_io &io) const
+{
+    char buffer[512];
+    ssize_t bytes = _read(processId, "io", buffer, sizeof(buffer));
+    if (bytes <= 0 || !parseIo(buffer, bytes, io))
+    {
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int ProcParser::readComm(int processId, string &name) const
+{
+    char buffer[64];
+    ssize_t bytes = _read(processId, "comm", buffer, sizeof(buffer));
+    if (bytes < 0)
+    {
+        return FAILED;
+    }
+    if (bytes > 0 && buffer[bytes - 1] == '\n')
+    {
+        bytes--;
+    }
+    name.assign(buffer, bytes);
+    return SUCCESS;
+}
+
+bool ProcParser::parseStat(const char *buffer, size_t length, proc_stat &stat)
+{
+    const char *end = buffer + length;
+    unsigned long long value = 0;
+    const char *cursor = scanUnsigned(buffer, end, value);
+    if (!cursor)
+    {
+        return false;
+    }
+    stat.pid = (int)value;
+
+    const char *nameEnd = nullptr;
+    for (const char *p = end - 1; p > cursor; p--)
+    {
+        if (*p == ')')
+        {
+            nameEnd = p;
+            break;
+        }
+    }
+    if (!nameEnd || nameEnd + 2 >= end)
+    {
+        return false;
+    }
+    cursor = skipSpaces(nameEnd + 1, end);
+    if (cursor >= end)
+    {
+        return false;
+    }
+    stat.state = *cursor++;
+
+    long long ppid = 0;
+    cursor = scanSigned(cursor, end, ppid);
+    stat.ppid = (int)ppid;
+    cursor = skipFields(cursor, end, 9);
+    if (!cursor)
+        return false;
+    cursor = scanUnsigned(cursor, end, stat.utime);
+    if (!cursor)
+        return false;
+    cursor = scanUnsigned(cursor, end, stat.stime);
+    if (!cursor)
+        return false;
+    cursor = scanSigned(cursor, end, stat.cutime);
+    if (!cursor)
+        return false;
+    cursor = scanSigned(cursor, end, stat.cstime);
+    cursor = skipFields(cursor, end, 1);
+    if (!cursor)
+        return false;
+    cursor = scanSigned(cursor, end, stat.nice);
+    cursor = skipFields(cursor, end, 2);
+    if (!cursor)
+        return false;
+    cursor = scanUnsigned(cursor, end, stat.startTime);
+    if (!cursor)
+        return false;
+    cursor = scanUnsigned(cursor, end, stat.vsize);
+    if (!cursor)
+        return false;
+    cursor = scanSigned(cursor, end, stat.rss);
+    return cursor != nullptr;
+}
+
+bool ProcParser::parseStatm(const char *buffer, size_t length, unsigned long long &resident)
+{
+    const char *end = buffer + length;
+    unsigned long long size = 0;
+    const char *cursor = scanUnsigned(buffer, end, size);
+    return cursor && scanUnsigned(cursor, end, resident);
+}
+
+bool ProcParser::parseIo(const char *buffer, size_t length, proc_io &io)
+{
+    static const char READ_BYTES[] = "read_bytes:";
+    static const char WRITE_BYTES[] = "write_bytes:";
+    const char *end = buffer + length;
+    const char *line = buffer;
+    bool readFound = false, writeFound = false;
+    while (line < end)
+    {
+        size_t remaining = end - line;
+        if (remaining > sizeof(READ_BYTES) - 1 && memcmp(line, READ_BYTES, sizeof(READ_BYTES) - 1) == 0)
+        {
+            readFound = scanUnsigned(line + sizeof(READ_BYTES) - 1, end, io.readBytes) != nullptr;
+        }
+        else if (remaining > sizeof(WRITE_BYTES) - 1 && memcmp(line, WRITE_BYTES, sizeof(WRITE_BYTES) - 1) == 0)
+        {
+            writeFound = scanUnsigned(line + sizeof(WRITE_BYTES) - 1, end, io.writeBytes) != nullptr;
+        }
+        const char *next = (const char *)memchr(line, '\n', remaining);
+        if (!next)
+            break;
+        line = next + 1;
+    }
+    return readFound && writeFound;
+}
+
+bool ProcParser::parseUpTime(const char *buffer, size_t length, double &upTime)
+{
+    const char *end = buffer + length;
+    unsigned long long seconds = 0;
+    const char *cursor = scanUnsigned(buffer, end, seconds);
+    if (!cursor)
+    {
+        return false;
+    }
+    upTime = (double)seconds;
+    if (cursor < end && *cursor == '.')
+    {
+        double scale = 0.1;
+        for (cursor++; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++, scale /= 10)
+        {
+            upTime += (*cursor - '0') * scale;
+        }
+    }
+    return true;
+}
+
+bool ProcParser::parseCpuTimes(const char *buffer, size_t length, unsigned long long &busy, unsigned long long &total)
+{
+    const char *end = buffer + length;
+    if (length < 4 || memcmp(buffer, "cpu ", 4) != 0)
+    {
+        return false;
+    }
+    const char *cursor = buffer + 4;
+    unsigned long long value = 0, idle = 0;
+    busy = 0;
+    total = 0;
+    // user nice system idle iowait irq softirq steal; guest time is already part of user time.
+    for (int field = 0; field < 8; field++)
+    {
+        const char *next = scanUnsigned(cursor, end, value);
+        if (!next)
+        {
+            if (field < 4)
+                return false;
+            break;
+        }
+        cursor = next;
+        total += value;
+        if (field == 3 || field == 4)
+        {
+            idle += value;
+        }
+    }
+    busy = total - idle;
+    return true;
+}
+
+bool ProcParser::parseMemInfo(const char *buffer, size_t length, unsigned long long &total, unsigned long long &available)
+{
+    static const char MEM_TOTAL[] = "MemTotal:";
+    static const char MEM_FREE[] = "MemFree:";
+    static const char MEM_AVAILABLE[] = "MemAvailable:";
+    const char *end = buffer + length;
+    const char *line = buffer;
+    bool totalFound = false, availableFound = false;
+    unsigned long long freeMemory = 0;
+    while (line < end)
+    {
+        size_t remaining = end - line;
+        if (remaining > sizeof(MEM_TOTAL) - 1 && memcmp(line, MEM_TOTAL, sizeof(MEM_TOTAL) - 1) == 0)
+        {
+            totalFound = scanUnsigned(line + sizeof(MEM_TOTAL) - 1, end, total) != nullptr;
+        }
+        else if (remaining > sizeof(MEM_FREE) - 1 && memcmp(line, MEM_FREE, sizeof(MEM_FREE) - 1) == 0)
+        {
+            scanUnsigned(line + sizeof(MEM_FREE) - 1, end, freeMemory);
+        }
+        else if (remaining > sizeof(MEM_AVAILABLE) - 1 && memcmp(line, MEM_AVAILABLE, sizeof(MEM_AVAILABLE) - 1) == 0)
+        {
+            availableFound = scanUnsigned(line + sizeof(MEM_AVAILABLE) - 1, end, available) != nullptr;
+            break;
+        }
+        const char *next = (const char *)memchr(line, '\n', remaining);
+        if (!next)
+            break;
+        line = next + 1;
+    }
+    if (!availableFound)
+    {
+        available = freeMemory;
+    }
+    return totalFound;
+}
+
+bool ProcParser::parseNetDev(const char *buffer, size_t length, unsigned long long &received, unsigned long long &transmitted)
+{
+    const char *end = buffer + length;
+    const char *line = buffer;
+    int lineNumber = 0;
+    received = 0;
+    transmitted = 0;
+    while (line < end)
+    {
+        const char *next = (const char *)memchr(line, '\n', end - line);
+        const char *lineEnd = next ? next : end;
+        // The first two lines are column headers.
+        if (lineNumber++ >= 2)
+        {
+            const char *colon = (const char *)memchr(line, ':', lineEnd - line);
+            if (!colon)
+            {
+                return false;
+            }
+            const char *name = skipSpaces(line, colon);
+            if (!(colon - name == 2 && memcmp(name, "lo", 2) == 0))
+            {
+                unsigned long long rx = 0, tx = 0;
+                const char *cursor = scanUnsigned(colon + 1, lineEnd, rx);
+                cursor = skipFields(cursor, lineEnd, 7);
+                if (!cursor || !scanUnsigned(cursor, lineEnd, tx))
+                {
+                    return false;
+                }
+                received += rx;
+                transmitted += tx;
+            }
+        }
+        if (!next)
+            break;
+        line = next + 1;
+    }
+    return lineNumber >= 2;
+}
+
+ProcParser::~ProcParser()
+{
+    if (_procFd >= 0)
+    {
+        close(_procFd);
+    }
+}
@@ -0,0 +1,183 @@
+#include "service/sampler.hpp"
+
+static ssize_t readAt(int fd, char *buffer, size_t size)
+{
+    ssize_t bytes = pread(fd, buffer, size - 1, 0);
+    if (bytes >= 0)
+    {
+        buffer[bytes] = '\0';
+    }
+    return bytes;
+}
+
+static void addToRollup(metric_rollup &rollup, double value, size_t count)
+{
+    if (count == 0 || value < rollup.min)
+        rollup.min = value;
+    if (count == 0 || value > rollup.max)
+        rollup.max = value;
+    rollup.avg += value;
+}
+
+SystemSampler::SystemSampler(size_t capacity, int intervalMs) : _series(capacity), _intervalMs(intervalMs), _running(false) {}
+
+int SystemSampler::_sample(system_sample &sample)
+{
+    char buffer[16384];
+    unsigned long long busy = 0, total = 0, memTotal = 0, memAvailable = 0, rx = 0, tx = 0;
+    ssize_t bytes = readAt(_statFd, buffer, 4096);
+    if (bytes <= 0 || !ProcParser::parseCpuTimes(buffer, bytes, busy, total))
+    {
+        return FAILED;
+    }
+    bytes = readAt(_memInfoFd, buffer, 4096);
+    if (bytes <= 0 || !ProcParser::parseMemInfo(buffer, bytes, memTotal, memAvailable))
+    {
+        return FAILED;
+    }
+    bytes = readAt(_netDevFd, buffer, sizeof(buffer));
+    bool hasNetwork = bytes > 0 && ProcParser::parseNetDev(buffer, bytes, rx, tx);
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - _lastSample).count();
+    bool first = _lastTotal == 0;
+
+    sample = system_sample();
+    sample.timestamp = (long long)time(nullptr);
+    sample.cpuTotal = (double)total;
+    sample.cpuUsage = total > _lastTotal ? 100.0 * (busy - _lastBusy) / (total - _lastTotal) : 0.0;
+    sample.ramTotal = (double)memTotal / (1024 * 1024);
+    sample.ramUsage = memTotal > 0 ? 100.0 * (memTotal - memAvailable) / memTotal : 0.0;
+
+    struct statvfs disk;
+    if (statvfs("/", &disk) == 0 && disk.f_blocks > 0)
+    {
+        unsigned long long totalSpace = (unsigned long long)disk.f_blocks * disk.f_frsize;
+        unsigned long long availableSpace = (unsigned long long)disk.f_bavail * disk.f_frsize;
+        sample.diskTotal = (double)totalSpace / (1024 * 1024 * 1024);
+        sample.diskUsage = 100.0 * (totalSpace - availableSpace) / totalSpace;
+    }
+    if (hasNetwork && !first && elapsed > 0.0 && rx >= _lastRx && tx >= _lastTx)
+    {
+        sample.networkRx = (rx - _lastRx) / elapsed;
+        sample.networkTx = (tx - _lastTx) / elapsed;
+    }
+
+    _lastBusy = busy;
+    _lastTotal = total;
+    _lastRx = rx;
+    _lastTx = tx;
+    _lastSample = now;
+    return SUCCESS;
+}
+
+void SystemSampler::_run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running.load())
+    {
+        if (_wakeup.wait_for(lock, std::chrono::milliseconds(_intervalMs), [this] { return !_running.load(); }))
+        {
+            break;
+        }
+        system_sample sample;
+        if (_sample(sample) == SUCCESS)
+        {
+            _series.push(sample);
+        }
+    }
+}
+
+int SystemSampler::start()
+{
+    if (_running.load())
+    {
+        return SUCCESS;
+    }
+    if (_statFd < 0)
+    {
+        _statFd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        _memInfoFd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+        _netDevFd = open("/proc/net/dev", O_RDONLY | O_CLOEXEC);
+    }
+    if (_statFd < 0 || _memInfoFd < 0)
+    {
+        AgentUtils::writeLog(FREAD_FAILED + "/proc/stat or /proc/meminfo", FAILED);
+        return FAILED;
+    }
+    system_sample sample;
+    if (_sample(sample) == FAILED)
+    {
+        AgentUtils::writeLog("Failed to take the first system sample", FAILED);
+        return FAILED;
+    }
+    _series.push(sample);
+    _running.store(true);
+    _thread = std::thread(&SystemSampler::_run, this);
+    AgentUtils::writeLog("System sampler started", DEBUG);
+    return SUCCESS;
+}
+
+void SystemSampler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running.store(false);
+    }
+    _wakeup.notify_all();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+vector<sample_rollup> SystemSampler::rollup(long long since, int bucketSeconds) const
+{
+    vector<system_sample> samples;
+    vector<sample_rollup> rollups;
+    _series.snapshot(samples, _series.capacity());
+    if (bucketSeconds <= 0)
+    {
+        bucketSeconds = SAMPLER_ROLLUP_SECONDS;
+    }
+    for (const system_sample &sample : samples)
+    {
+        if (sample.timestamp <= since)
+        {
+            continue;
+        }
+        long long start = sample.timestamp - sample.timestamp % bucketSeconds;
+        if (rollups.empty() || rollups.back().start / bucketSeconds != start / bucketSeconds)
+        {
+            rollups.emplace_back();
+            rollups.back().start = sample.timestamp;
+        }
+        sample_rollup &current = rollups.back();
+        addToRollup(current.cpuUsage, sample.cpuUsage, current.count);
+        addToRollup(current.ramUsage, sample.ramUsage, current.count);
+        addToRollup(current.diskUsage, sample.diskUsage, current.count);
+        addToRollup(current.networkRx, sample.networkRx, current.count);
+        addToRollup(current.networkTx, sample.networkTx, current.count);
+        current.count++;
+    }
+    for (sample_rollup &current : rollups)
+    {
+        for (metric_rollup *metric : {&current.cpuUsage, &current.ramUsage, &current.diskUsage, &current.networkRx, &current.networkTx})
+        {
+            metric->avg /= current.count;
+        }
+    }
+    return rollups;
+}
+
+SystemSampler::~SystemSampler()
+{
+    stop();
+    for (int fd : {_statFd, _memInfoFd, _netDevFd})
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+}
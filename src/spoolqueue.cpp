@@ -0,0 +1,401 @@
+#include "service/spoolqueue.hpp"
+#include <sys/uio.h>
+
+SpoolQueue::SpoolQueue(const string &directory, size_t maxBytes, size_t segmentBytes)
+    : _directory(directory), _maxBytes(maxBytes == 0 ? SPOOL_MAX_BYTES : maxBytes),
+      _segmentBytes(segmentBytes == 0 ? SPOOL_SEGMENT_BYTES : segmentBytes), _random(std::random_device{}())
+{
+    if (!_directory.empty() && _directory.back() == '/')
+    {
+        _directory.pop_back();
+    }
+}
+
+string SpoolQueue::_segmentPath(uint64_t segment) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu" SPOOL_SEGMENT_SUFFIX, (unsigned long long)segment);
+    return _directory + "/" + name;
+}
+
+int SpoolQueue::_openSegment(uint64_t segment)
+{
+    if (_writeFd >= 0)
+    {
+        fdatasync(_writeFd);
+        close(_writeFd);
+    }
+    _writeFd = ::open(_segmentPath(segment).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (_writeFd < 0)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + _segmentPath(segment), FAILED);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int SpoolQueue::_recoverSegment(uint64_t segment, size_t &size)
+{
+    string path = _segmentPath(segment);
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    size_t offset = 0;
+    string payload;
+    while (offset + SPOOL_RECORD_HEADER <= (size_t)info.st_size)
+    {
+        uint32_t header[2];
+        if (pread(fd, header, sizeof(header), offset) != (ssize_t)sizeof(header) ||
+            header[0] > (size_t)info.st_size - offset - SPOOL_RECORD_HEADER)
+            break;
+        payload.resize(header[0]);
+        if (pread(fd, &payload[0], header[0], offset + SPOOL_RECORD_HEADER) != (ssize_t)header[0] ||
+            crc32(0L, (const Bytef *)payload.data(), header[0]) != header[1])
+            break;
+        offset += SPOOL_RECORD_HEADER + header[0];
+    }
+    if (offset < (size_t)info.st_size)
+    {
+        AgentUtils::writeLog("Cutting torn record off spool segment " + path + " at " + std::to_string(offset), WARNING);
+        if (ftruncate(fd, offset) != 0)
+        {
+            close(fd);
+            return FAILED;
+        }
+    }
+    close(fd);
+    size = offset;
+    return SUCCESS;
+}
+
+int SpoolQueue::_loadIndex()
+{
+    std::ifstream file(_directory + "/" SPOOL_INDEX_FILE);
+    unsigned long long segment = 0, offset = 0;
+    long long nextAttempt = 0;
+    if (file && (file >> segment >> offset >> _failures >> nextAttempt))
+    {
+        _committed.segment = segment;
+        _committed.offset = offset;
+        _nextAttempt = (time_t)nextAttempt;
+    }
+    if (!_segments.empty() && (_committed.segment < _segments.front().first || _committed.segment > _segments.back().first))
+    {
+        _committed.segment = _segments.front().first;
+        _committed.offset = 0;
+    }
+    return SUCCESS;
+}
+
+int SpoolQueue::_saveIndex()
+{
+    string path = _directory + "/" SPOOL_INDEX_FILE;
+    string temporary = path + ".tmp";
+    char line[96];
+    int length = snprintf(line, sizeof(line), "%llu %llu %u %lld\n", (unsigned long long)_committed.segment,
+                          (unsigned long long)_committed.offset, _failures, (long long)_nextAttempt);
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || write(fd, line, length) != length || fdatasync(fd) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        AgentUtils::writeLog(FWRITE_FAILED + temporary, FAILED);
+        return FAILED;
+    }
+    close(fd);
+    // The rename replaces the old index in one step, so a crash leaves either the old or the new position.
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + path, FAILED);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+void SpoolQueue::_evict(size_t incoming)
+{
+    size_t dropped = 0;
+    while (_totalBytes + incoming > _maxBytes && _segments.size() > 1)
+    {
+        uint64_t segment = _segments.front().first;
+        size_t size = _segments.front().second;
+        unlink(_segmentPath(segment).c_str());
+        _segments.pop_front();
+        _totalBytes -= size;
+        if (_committed.segment <= segment)
+        {
+            dropped += size - (_committed.segment == segment ? std::min<size_t>(_committed.offset, size) : 0);
+            _committed.segment = _segments.front().first;
+            _committed.offset = 0;
+        }
+    }
+    if (dropped > 0)
+    {
+        _evictedBytes += dropped;
+        AgentUtils::writeLog("Upload spool is over its quota, dropped " + std::to_string(dropped) + " bytes of the oldest records", WARNING);
+        _saveIndex();
+    }
+}
+
+int SpoolQueue::open()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (OS::isDirExist(_directory) == FAILED)
+    {
+        OS::createDir(_directory);
+    }
+    DIR *dir = opendir(_directory.c_str());
+    if (dir == nullptr)
+    {
+        AgentUtils::writeLog(INVALID_PATH + _directory, FAILED);
+        return FAILED;
+    }
+    vector<uint64_t> found;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        string name = entry->d_name;
+        if (name.size() > strlen(SPOOL_SEGMENT_SUFFIX) && name.compare(name.size() - strlen(SPOOL_SEGMENT_SUFFIX), string::npos, SPOOL_SEGMENT_SUFFIX) == 0)
+        {
+            found.push_back(std::strtoull(name.c_str(), nullptr, 10));
+        }
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+
+    _segments.clear();
+    _totalBytes = 0;
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        size_t size = 0;
+        if (i + 1 == found.size())
+        {
+            // Only the newest segment can end in a record cut short by a crash.
+            if (_recoverSegment(found[i], size) == FAILED)
+                return FAILED;
+        }
+        else
+        {
+            struct stat info;
+            if (stat(_segmentPath(found[i]).c_str(), &info) == 0)
+                size = info.st_size;
+        }
+        _segments.emplace_back(found[i], size);
+        _totalBytes += size;
+    }
+    if (_segments.empty())
+    {
+        _segments.emplace_back(1, 0);
+    }
+    _loadIndex();
+    return _openSegment(_segments.back().first);
+}
+
+int SpoolQueue::push(const string &record)
+{
+    size_t needed = SPOOL_RECORD_HEADER + record.size();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (needed > _maxBytes || _writeFd < 0)
+    {
+        AgentUtils::writeLog("Record of " + std::to_string(record.size()) + " bytes not added to the upload spool", FAILED);
+        return FAILED;
+    }
+    size_t current = _segments.back().second;
+    if (current > 0 && (current + needed > _segmentBytes || _totalBytes + needed > _maxBytes))
+    {
+        // A new segment also lets the full one be evicted.
+        uint64_t segment = _segments.back().first + 1;
+        if (_openSegment(segment) == FAILED)
+            return FAILED;
+        _segments.emplace_back(segment, 0);
+    }
+    _evict(needed);
+
+    uint32_t header[2] = {(uint32_t)record.size(), (uint32_t)crc32(0L, (const Bytef *)record.data(), record.size())};
+    struct iovec parts[2] = {{header, sizeof(header)}, {(void *)record.data(), record.size()}};
+    if (writev(_writeFd, parts, 2) != (ssize_t)needed)
+    {
+        // Drop a partial record so the next one starts on a boundary.
+        if (ftruncate(_writeFd, _segments.back().second) != 0)
+            AgentUtils::writeLog("Unable to cut a partial record off the upload spool", FAILED);
+        AgentUtils::writeLog(FWRITE_FAILED + _segmentPath(_segments.back().first), FAILED);
+        return FAILED;
+    }
+    _segments.back().second += needed;
+    _totalBytes += needed;
+    return SUCCESS;
+}
+
+int SpoolQueue::sync()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return (_writeFd >= 0 && fdatasync(_writeFd) == 0) ? SUCCESS : FAILED;
+}
+
+int SpoolQueue::peek(const spool_position &from, size_t maxBytes, vector<string> &records, spool_position &next)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    spool_position position = from;
+    next = from;
+    if (_segments.empty())
+    {
+        return SUCCESS;
+    }
+    if (position.segment < _segments.front().first)
+    {
+        position.segment = _segments.front().first;
+        position.offset = 0;
+    }
+    size_t bytes = 0;
+    for (size_t i = position.segment - _segments.front().first; i < _segments.size(); i++)
+    {
+        string path = _segmentPath(_segments[i].first);
+        size_t size = _segments[i].second;
+        int fd = position.offset < size ? ::open(path.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+        if (position.offset < size && fd < 0)
+        {
+            AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+            return FAILED;
+        }
+        bool budget = false;
+        while (position.offset + SPOOL_RECORD_HEADER <= size)
+        {
+            uint32_t header[2];
+            string record;
+            bool valid = pread(fd, header, sizeof(header), position.offset) == (ssize_t)sizeof(header) &&
+                         header[0] <= size - position.offset - SPOOL_RECORD_HEADER;
+            if (valid)
+            {
+                record.resize(header[0]);
+                valid = pread(fd, &record[0], header[0], position.offset + SPOOL_RECORD_HEADER) == (ssize_t)header[0] &&
+                        crc32(0L, (const Bytef *)record.data(), header[0]) == header[1];
+            }
+            if (!valid)
+            {
+                AgentUtils::writeLog("Skipping corrupt upload spool segment " + path + " from " + std::to_string(position.offset), WARNING);
+                position.offset = size;
+                break;
+            }
+            if (!records.empty() && bytes + record.size() > maxBytes)
+            {
+                budget = true;
+                break;
+            }
+            bytes += record.size();
+            records.push_back(std::move(record));
+            position.offset += SPOOL_RECORD_HEADER + header[0];
+        }
+        if (fd >= 0)
+            close(fd);
+        if (budget || i + 1 == _segments.size())
+            break;
+        position.segment = _segments[i + 1].first;
+        position.offset = 0;
+    }
+    next = position;
+    return SUCCESS;
+}
+
+int SpoolQueue::commit(const spool_position &position)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _committed = position;
+    while (_segments.size() > 1 && _segments.front().first < position.segment)
+    {
+        unlink(_segmentPath(_segments.front().first).c_str());
+        _totalBytes -= _segments.front().second;
+        _segments.pop_front();
+    }
+    if (position.segment == _segments.back().first && position.offset > 0 && position.offset >= _segments.back().second)
+    {
+        // Everything is delivered: start an empty segment so the space is released now rather than at the next roll.
+        uint64_t segment = position.segment + 1;
+        if (_openSegment(segment) == SUCCESS)
+        {
+            unlink(_segmentPath(position.segment).c_str());
+            _totalBytes -= _segments.back().second;
+            _segments.back() = std::make_pair(segment, (size_t)0);
+            _committed.segment = segment;
+            _committed.offset = 0;
+        }
+    }
+    return _saveIndex();
+}
+
+spool_position SpoolQueue::committed() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _committed;
+}
+
+bool SpoolQueue::accepting() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_segments.empty())
+    {
+        return true;
+    }
+    size_t delivered = _committed.segment == _segments.front().first ? std::min<size_t>(_committed.offset, _segments.front().second) : 0;
+    return (_totalBytes - delivered) * 100 < _maxBytes * SPOOL_HIGH_WATER;
+}
+
+size_t SpoolQueue::usage() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _totalBytes;
+}
+
+size_t SpoolQueue::evicted() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _evictedBytes;
+}
+
+bool SpoolQueue::ready(time_t now) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failures == 0 || now >= _nextAttempt;
+}
+
+time_t SpoolQueue::onFailure(time_t now, time_t base, time_t max)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    time_t ceiling = max;
+    if (_failures < 30 && base < (max >> _failures))
+    {
+        ceiling = base << _failures;
+    }
+    // Between half and all of the ceiling, so retries spread out but never come back immediately.
+    std::uniform_int_distribution<long long> jitter(0, ceiling - ceiling / 2);
+    time_t delay = ceiling / 2 + (time_t)jitter(_random);
+    _failures++;
+    _nextAttempt = now + delay;
+    _saveIndex();
+    return delay;
+}
+
+void SpoolQueue::onSuccess()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failures == 0)
+    {
+        return;
+    }
+    _failures = 0;
+    _nextAttempt = 0;
+    _saveIndex();
+}
+
+SpoolQueue::~SpoolQueue()
+{
+    if (_writeFd >= 0)
+    {
+        fdatasync(_writeFd);
+        close(_writeFd);
+    }
+}
@@ -0,0 +1,428 @@
+#include "service/uploader.hpp"
+
+MultiUploader::MultiUploader(size_t maxConcurrent, CURLSH *share) : _share(share), _maxConcurrent(maxConcurrent == 0 ? UPLOAD_MAX_CONCURRENT : maxConcurrent)
+{
+    // Reference counted and thread-safe since libcurl 7.84.
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    _multi = curl_multi_init();
+    curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    setMaxConcurrent(maxConcurrent);
+    _headers = curl_slist_append(_headers, "accept: */*");
+}
+
+size_t MultiUploader::_discard(char *data, size_t size, size_t nmemb, void *response)
+{
+    static_cast<string *>(response)->append(data, size * nmemb);
+    return size * nmemb;
+}
+
+void MultiUploader::setMaxConcurrent(size_t maxConcurrent)
+{
+    _maxConcurrent = maxConcurrent == 0 ? UPLOAD_MAX_CONCURRENT : maxConcurrent;
+    curl_multi_setopt(_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)_maxConcurrent);
+    curl_multi_setopt(_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)_maxConcurrent);
+}
+
+void MultiUploader::add(upload_request request)
+{
+    _queue.push_back(std::move(request));
+}
+
+void MultiUploader::_reject(upload_request &request)
+{
+    if (request.onComplete)
+    {
+        request.onComplete(request, 0, CURLE_READ_ERROR);
+    }
+}
+
+int MultiUploader::_start(upload_request &&request)
+{
+    CURL *curl = nullptr;
+    if (!_idle.empty())
+    {
+        curl = _idle.back();
+        _idle.pop_back();
+        curl_easy_reset(curl);
+    }
+    else
+    {
+        curl = curl_easy_init();
+    }
+    if (curl == nullptr)
+    {
+        AgentUtils::writeLog("Unable to create a curl handle", FAILED);
+        _reject(request);
+        return FAILED;
+    }
+
+    transfer *current = new transfer();
+    current->request = std::move(request);
+    const char *contentType = current->request.contentType.empty() ? UPLOAD_CONTENT_TYPE : current->request.contentType.c_str();
+    curl_easy_setopt(curl, CURLOPT_URL, current->request.url.c_str());
+    if (current->request.contentEncoding.empty())
+    {
+        current->mime = curl_mime_init(curl);
+        curl_mimepart *part = curl_mime_addpart(current->mime);
+        curl_mime_name(part, current->request.formName.c_str());
+        curl_mime_type(part, contentType);
+        if (curl_mime_filedata(part, current->request.filePath.c_str()) != CURLE_OK)
+        {
+            AgentUtils::writeLog(FILE_ERROR + current->request.filePath, FAILED);
+            curl_mime_free(current->mime);
+            _reject(current->request);
+            delete current;
+            _idle.push_back(curl);
+            return FAILED;
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, _headers);
+        curl_easy_setopt(curl, CURLOPT_MIMEPOST, current->mime);
+    }
+    else
+    {
+        // An encoded file is the whole request body, so Content-Encoding describes exactly what is sent.
+        struct stat info;
+        current->body = fopen(current->request.filePath.c_str(), "rb");
+        if (current->body == nullptr || fstat(fileno(current->body), &info) != 0)
+        {
+            AgentUtils::writeLog(FILE_ERROR + current->request.filePath, FAILED);
+            if (current->body != nullptr)
+            {
+                fclose(current->body);
+            }
+            _reject(current->request);
+            delete current;
+            _idle.push_back(curl);
+            return FAILED;
+        }
+        for (struct curl_slist *header = _headers; header != nullptr; header = header->next)
+        {
+            current->headers = curl_slist_append(current->headers, header->data);
+        }
+        current->headers = curl_slist_append(current->headers, ("Content-Type: " + string(contentType)).c_str());
+        current->headers = curl_slist_append(current->headers, ("Content-Encoding: " + current->request.contentEncoding).c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, current->headers);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_READDATA, current->body);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)info.st_size);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _discard);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &current->response);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, current);
+    if (_share != nullptr)
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, _share);
+    }
+    // HTTP/2 over TLS when the server offers it, HTTP/1.1 otherwise; PIPEWAIT makes new transfers wait for a
+    // connection that can multiplex instead of opening another one.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, UPLOAD_KEEPALIVE_IDLE);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, UPLOAD_KEEPALIVE_INTERVAL);
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, UPLOAD_CONNECTION_MAXAGE);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_multi_add_handle(_multi, curl);
+    _active.push_back(curl);
+    return SUCCESS;
+}
+
+void MultiUploader::_finish(CURL *curl, CURLcode result)
+{
+    transfer *current = nullptr;
+    long httpCode = 0;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&current);
+    if (result == CURLE_OK)
+    {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+        AgentUtils::writeLog("Response for " + current->request.filePath + ": " + current->response, DEBUG);
+    }
+    else
+    {
+        AgentUtils::writeLog("Request failed: " + string(curl_easy_strerror(result)) + " for " + current->request.filePath, FAILED);
+    }
+    if (httpCode != POST_SUCCESS)
+    {
+        _failures++;
+    }
+    curl_multi_remove_handle(_multi, curl);
+    _active.erase(std::find(_active.begin(), _active.end(), curl));
+    _idle.push_back(curl);
+
+    if (current->request.onComplete)
+    {
+        current->request.onComplete(current->request, httpCode, result);
+    }
+    curl_mime_free(current->mime);
+    if (current->body != nullptr)
+    {
+        fclose(current->body);
+    }
+    curl_slist_free_all(current->headers);
+    delete current;
+}
+
+int MultiUploader::run()
+{
+    size_t active = 0;
+    _failures = 0;
+    while (!_queue.empty() || active > 0)
+    {
+        while (active < _maxConcurrent && !_queue.empty())
+        {
+            upload_request request = std::move(_queue.front());
+            _queue.pop_front();
+            if (_start(std::move(request)) == SUCCESS)
+            {
+                active++;
+            }
+            else
+            {
+                _failures++;
+            }
+        }
+
+        int running = 0;
+        CURLMcode code = curl_multi_perform(_multi, &running);
+        if (code != CURLM_OK)
+        {
+            AgentUtils::writeLog("Upload driver failed: " + string(curl_multi_strerror(code)), FAILED);
+            _abort();
+            return FAILED;
+        }
+
+        int queued = 0;
+        bool finished = false;
+        CURLMsg *message;
+        while ((message = curl_multi_info_read(_multi, &queued)) != nullptr)
+        {
+            if (message->msg == CURLMSG_DONE)
+            {
+                _finish(message->easy_handle, message->data.result);
+                active--;
+                finished = true;
+            }
+        }
+
+        // Start queued requests right away when a slot was freed, otherwise wait for socket activity.
+        if (active > 0 && !finished)
+        {
+            curl_multi_poll(_multi, nullptr, 0, UPLOAD_POLL_TIMEOUT_MS, nullptr);
+        }
+    }
+    return _failures == 0 ? SUCCESS : FAILED;
+}
+
+void MultiUploader::_abort()
+{
+    while (!_active.empty())
+    {
+        _finish(_active.back(), CURLE_ABORTED_BY_CALLBACK);
+    }
+    while (!_queue.empty())
+    {
+        upload_request request = std::move(_queue.front());
+        _queue.pop_front();
+        _failures++;
+        if (request.onComplete)
+        {
+            request.onComplete(request, 0, CURLE_ABORTED_BY_CALLBACK);
+        }
+    }
+}
+
+MultiUploader::~MultiUploader()
+{
+    for (CURL *curl : _idle)
+    {
+        curl_easy_cleanup(curl);
+    }
+    curl_slist_free_all(_headers);
+    curl_multi_cleanup(_multi);
+    curl_global_cleanup();
+}
+
+PayloadBatcher::PayloadBatcher(const string &directory, size_t maxBytes, time_t maxDelay, int level)
+    : _directory(directory), _maxBytes(maxBytes == 0 ? BATCH_MAX_BYTES : maxBytes), _maxDelay(maxDelay),
+      _level(level < 1 || level > 9 ? BATCH_COMPRESSION_LEVEL : level)
+{
+    if (!_directory.empty() && _directory.back() == '/')
+    {
+        _directory.pop_back();
+    }
+}
+
+size_t PayloadBatcher::splitRecords(char *data, size_t size, bool &open)
+{
+    // Writers put one document on each line, so every line is a record of its own.
+    size_t length = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] == '\n' || data[i] == '\r')
+        {
+            if (open)
+                data[length++] = '\n';
+            open = false;
+            continue;
+        }
+        data[length++] = data[i];
+        open = true;
+    }
+    return length;
+}
+
+gzFile PayloadBatcher::_open(upload_batch &batch)
+{
+    char mode[8];
+    snprintf(mode, sizeof(mode), "wb%d", _level);
+    if (OS::isDirExist(_directory) == FAILED)
+    {
+        OS::createDir(_directory);
+    }
+    batch.path = _directory + "/" + std::to_string(time(nullptr)) + "-" + std::to_string(getpid()) + "-" + std::to_string(_sequence++) + ".ndjson.gz";
+    gzFile output = gzopen(batch.path.c_str(), mode);
+    if (output == nullptr)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + batch.path, FAILED);
+        return nullptr;
+    }
+    gzbuffer(output, BATCH_READ_SIZE);
+    return output;
+}
+
+int PayloadBatcher::_close(upload_batch &batch, gzFile output)
+{
+    if (gzclose(output) != Z_OK)
+    {
+        AgentUtils::writeLog(FWRITE_FAILED + batch.path, FAILED);
+        unlink(batch.path.c_str());
+        return FAILED;
+    }
+    struct stat info;
+    batch.compressedBytes = stat(batch.path.c_str(), &info) == 0 ? (size_t)info.st_size : 0;
+    return SUCCESS;
+}
+
+int PayloadBatcher::packRecords(const vector<string> &records, upload_batch &batch)
+{
+    gzFile output = _open(batch);
+    if (output == nullptr)
+    {
+        return FAILED;
+    }
+    batch.rawBytes = 0;
+    for (const string &record : records)
+    {
+        if (gzwrite(output, record.data(), (unsigned int)record.size()) != (int)record.size() || gzputc(output, '\n') < 0)
+        {
+            AgentUtils::writeLog(FWRITE_FAILED + batch.path, FAILED);
+            gzclose(output);
+            unlink(batch.path.c_str());
+            return FAILED;
+        }
+        batch.rawBytes += record.size() + 1;
+    }
+    return _close(batch, output);
+}
+
+int PayloadBatcher::_write(upload_batch &batch)
+{
+    gzFile output = _open(batch);
+    if (output == nullptr)
+    {
+        return FAILED;
+    }
+
+    vector<char> buffer(BATCH_READ_SIZE);
+    batch.rawBytes = 0;
+    for (const string &source : batch.sources)
+    {
+        int fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            AgentUtils::writeLog(FILE_ERROR + source, FAILED);
+            gzclose(output);
+            unlink(batch.path.c_str());
+            return FAILED;
+        }
+        ssize_t bytes;
+        bool open = false;
+        while ((bytes = read(fd, buffer.data(), buffer.size())) > 0)
+        {
+            size_t length = splitRecords(buffer.data(), bytes, open);
+            if (length > 0 && gzwrite(output, buffer.data(), (unsigned int)length) != (int)length)
+            {
+                bytes = -1;
+                break;
+            }
+            batch.rawBytes += length;
+        }
+        close(fd);
+        if (bytes < 0 || (open && gzputc(output, '\n') < 0))
+        {
+            AgentUtils::writeLog(FWRITE_FAILED + batch.path, FAILED);
+            gzclose(output);
+            unlink(batch.path.c_str());
+            return FAILED;
+        }
+        batch.rawBytes += open ? 1 : 0;
+    }
+    return _close(batch, output);
+}
+
+int PayloadBatcher::pack(const vector<string> &files, vector<upload_batch> &batches, bool flush)
+{
+    struct spooled
+    {
+        string path;
+        size_t size;
+        time_t modified;
+    };
+    vector<spooled> pending;
+    for (const string &file : files)
+    {
+        struct stat info;
+        if (stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+        {
+            pending.push_back({file, (size_t)info.st_size, info.st_mtime});
+        }
+    }
+    if (pending.empty())
+    {
+        return SUCCESS;
+    }
+    std::sort(pending.begin(), pending.end(), [](const spooled &a, const spooled &b) {
+        return a.modified != b.modified ? a.modified < b.modified : a.path < b.path;
+    });
+    time_t now = time(nullptr);
+    upload_batch current;
+    for (size_t i = 0; i <= pending.size(); i++)
+    {
+        bool full = i < pending.size() && !current.sources.empty() && current.rawBytes + pending[i].size > _maxBytes;
+        bool last = i == pending.size();
+        if (full || (last && !current.sources.empty() && (flush || current.rawBytes >= _maxBytes || now - current.oldest >= _maxDelay)))
+        {
+            if (_write(current) == FAILED)
+            {
+                return FAILED;
+            }
+            batches.push_back(current);
+            current = upload_batch();
+        }
+        if (last)
+        {
+            break;
+        }
+        if (current.sources.empty())
+        {
+            current.oldest = pending[i].modified;
+        }
+        current.sources.push_back(pending[i].path);
+        // Sized from stat until written; _write replaces it with the bytes actually read.
+        current.rawBytes += pending[i].size;
+    }
+    return SUCCESS;
+}
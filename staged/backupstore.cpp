@@ -0,0 +1,354 @@
+#include "service/backupstore.hpp"
+#include "service/filecopy.hpp"
+#include <openssl/evp.h>
+#include <sys/mman.h>
+
+/* 256 random 64-bit values for the gear hash, generated with splitmix64 so every build cuts at the same points. */
+static const uint64_t *gearTable()
+{
+    static uint64_t table[256];
+    static std::once_flag once;
+    std::call_once(once, [] {
+        uint64_t state = 0x5c1a9e7d3b2f4c61ULL;
+        for (uint64_t &value : table)
+        {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+    });
+    return table;
+}
+
+static string sha256Hex(const unsigned char *data, size_t size)
+{
+    unsigned char value[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data, size, value, &length, EVP_sha256(), nullptr);
+    return AgentUtils::toHex(value, length);
+}
+
+/* Creates `path` through a temporary file that `fill` writes, synced before the rename. */
+static int writeAtomic(const string &path, const std::function<int(int)> &fill)
+{
+    string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + temporary, FAILED);
+        return FAILED;
+    }
+    bool written = fill(fd) == SUCCESS && fsync(fd) == 0;
+    close(fd);
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        unlink(temporary.c_str());
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+BackupStore::BackupStore(const string &directory) : _directory(directory)
+{
+    if (!_directory.empty() && _directory.back() != '/')
+    {
+        _directory += '/';
+    }
+    std::error_code error;
+    std::filesystem::create_directories(_directory, error);
+}
+
+size_t BackupStore::cut(const unsigned char *data, size_t size)
+{
+    if (size <= CHUNK_MIN_SIZE)
+    {
+        return size;
+    }
+    const uint64_t *gear = gearTable();
+    size_t limit = std::min<size_t>(size, CHUNK_MAX_SIZE);
+    size_t normal = std::min<size_t>(limit, CHUNK_AVG_SIZE);
+    uint64_t hash = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    // Normalized chunking: a stricter mask before the average size and a looser one after it keep most chunks close
+    // to the average.
+    for (; i < normal; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CHUNK_MASK_SMALL))
+            return i + 1;
+    }
+    for (; i < limit; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CHUNK_MASK_LARGE))
+            return i + 1;
+    }
+    return limit;
+}
+
+string BackupStore::_chunkPath(const string &hash) const
+{
+    return _directory + BACKUP_CHUNKS_DIR + hash.substr(0, 2) + "/" + hash;
+}
+
+int BackupStore::_putChunk(const unsigned char *data, size_t size, string &hash, size_t &added)
+{
+    hash = sha256Hex(data, size);
+    string path = _chunkPath(hash);
+    std::error_code error;
+    if (std::filesystem::exists(path, error))
+    {
+        return SUCCESS;
+    }
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    // Written from the bytes that were hashed, so the chunk always matches its address.
+    if (writeAtomic(path, [&](int out) { return OS::writeAll(out, (const char *)data, size); }) == FAILED)
+    {
+        return FAILED;
+    }
+    added += size;
+    return SUCCESS;
+}
+
+int BackupStore::_latest(const string &name, string &manifest)
+{
+    manifest.clear();
+    string directory = _directory + BACKUP_VERSIONS_DIR + name;
+    std::error_code error;
+    string latest;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+    {
+        string version = entry.path().filename();
+        if (entry.is_regular_file() && version.find(".tmp") == string::npos && version > latest)
+        {
+            latest = version;
+        }
+    }
+    if (latest.empty())
+    {
+        return FAILED;
+    }
+    std::ifstream file(directory + "/" + latest);
+    manifest.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return SUCCESS;
+}
+
+int BackupStore::_chunkSnapshot(int fd, const string &path, std::ostringstream &manifest, size_t &size, size_t &added)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    size = info.st_size;
+    const unsigned char *data = nullptr;
+    if (size > 0)
+    {
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = mapped == MAP_FAILED ? nullptr : (const unsigned char *)mapped;
+    }
+    if (size > 0 && data == nullptr)
+    {
+        AgentUtils::writeLog("Failed to map " + path, FAILED);
+        return FAILED;
+    }
+
+    int result = SUCCESS;
+    for (size_t offset = 0; offset < size && result == SUCCESS;)
+    {
+        size_t length = cut(data + offset, size - offset);
+        string hash;
+        result = _putChunk(data + offset, length, hash, added);
+        manifest << hash << ' ' << length << '\n';
+        offset += length;
+    }
+    if (data != nullptr)
+    {
+        munmap((void *)data, size);
+    }
+    return result;
+}
+
+int BackupStore::_chunkLive(int fd, const string &path, std::ostringstream &manifest, size_t &size, size_t &added)
+{
+    struct stat before, after;
+    if (fstat(fd, &before) != 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    vector<unsigned char> buffer(BACKUP_READ_SIZE);
+    size_t begin = 0, end = 0;
+    bool ended = false;
+    size = 0;
+    while (true)
+    {
+        // Keep at least one maximal chunk in the window, so cut points match those of the whole file.
+        if (!ended && end - begin < CHUNK_MAX_SIZE)
+        {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            while (!ended && end < buffer.size())
+            {
+                ssize_t bytes = pread(fd, buffer.data() + end, buffer.size() - end, size + end);
+                if (bytes < 0 && errno == EINTR)
+                    continue;
+                if (bytes < 0)
+                {
+                    AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+                    return FAILED;
+                }
+                ended = bytes == 0;
+                end += bytes;
+            }
+        }
+        if (begin == end)
+        {
+            break;
+        }
+        size_t length = cut(buffer.data() + begin, end - begin);
+        string hash;
+        if (_putChunk(buffer.data() + begin, length, hash, added) == FAILED)
+        {
+            return FAILED;
+        }
+        manifest << hash << ' ' << length << '\n';
+        begin += length;
+        size += length;
+    }
+
+    if (fstat(fd, &after) != 0 || (size_t)before.st_size != size || after.st_size != before.st_size ||
+        after.st_mtim.tv_sec != before.st_mtim.tv_sec || after.st_mtim.tv_nsec != before.st_mtim.tv_nsec)
+    {
+        AgentUtils::writeLog(path + " changed while it was read, version not recorded", WARNING);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int BackupStore::backup(const string &path, const string &name, string &versionPath)
+{
+    versionPath.clear();
+    int source = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source < 0)
+    {
+        AgentUtils::writeLog(FILE_ERROR + path, FAILED);
+        return FAILED;
+    }
+    // Chunk a private reflink snapshot rather than the live file, which its writer may truncate while it is mapped.
+    // The snapshot is unlinked at once so a crash leaves nothing behind. Without reflinks it would be a full copy of
+    // the file, so the live file is read instead.
+    string snapshotPath = _directory + BACKUP_SNAPSHOT_FILE;
+    int snapshot = open(snapshotPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    unlink(snapshotPath.c_str());
+    if (snapshot >= 0 && FileCopy::clone(source, snapshot) == FAILED)
+    {
+        close(snapshot);
+        snapshot = -1;
+    }
+
+    int result;
+    size_t size = 0, added = 0;
+    std::ostringstream manifest;
+    if (snapshot >= 0)
+    {
+        close(source);
+        result = _chunkSnapshot(snapshot, path, manifest, size, added);
+        close(snapshot);
+    }
+    else
+    {
+        result = _chunkLive(source, path, manifest, size, added);
+        close(source);
+    }
+    if (result == FAILED)
+    {
+        return FAILED;
+    }
+
+    string previous;
+    if (_latest(name, previous) == SUCCESS && previous == manifest.str())
+    {
+        return SUCCESS;
+    }
+    string directory = _directory + BACKUP_VERSIONS_DIR + name;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    char stamp[32];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    size_t length = strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now.tv_sec));
+    snprintf(stamp + length, sizeof(stamp) - length, ".%03ld", now.tv_nsec / 1000000);
+    versionPath = directory + "/" + stamp;
+    string content = manifest.str();
+    if (writeAtomic(versionPath, [&](int out) { return OS::writeAll(out, content.data(), content.size()); }) == FAILED)
+    {
+        versionPath.clear();
+        return FAILED;
+    }
+    AgentUtils::writeLog("Backed up " + path + " to " + versionPath + ", " + std::to_string(added) + " of " + std::to_string(size) + " bytes new", DEBUG);
+    return SUCCESS;
+}
+
+int BackupStore::readManifest(const string &versionPath, vector<backup_chunk> &chunks)
+{
+    std::ifstream file(versionPath);
+    if (!file)
+    {
+        AgentUtils::writeLog(FILE_ERROR + versionPath, FAILED);
+        return FAILED;
+    }
+    chunks.clear();
+    backup_chunk chunk;
+    while (file >> chunk.hash >> chunk.length)
+    {
+        if (chunk.hash.size() != 64)
+        {
+            break;
+        }
+        chunks.push_back(chunk);
+    }
+    if (!file.eof())
+    {
+        AgentUtils::writeLog("Invalid manifest " + versionPath, FAILED);
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+int BackupStore::restore(const string &versionPath, const string &outPath)
+{
+    vector<backup_chunk> chunks;
+    if (readManifest(versionPath, chunks) == FAILED)
+    {
+        return FAILED;
+    }
+    return writeAtomic(outPath, [&](int out) {
+        for (const backup_chunk &chunk : chunks)
+        {
+            int fd = open(_chunkPath(chunk.hash).c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat info;
+            bool intact = fd >= 0 && fstat(fd, &info) == 0 && (size_t)info.st_size == chunk.length;
+            if (intact && chunk.length > 0)
+            {
+                void *mapped = mmap(nullptr, chunk.length, PROT_READ, MAP_PRIVATE, fd, 0);
+                intact = mapped != MAP_FAILED && sha256Hex((const unsigned char *)mapped, chunk.length) == chunk.hash;
+                if (mapped != MAP_FAILED)
+                    munmap(mapped, chunk.length);
+            }
+            if (!intact || FileCopy::copyRange(fd, 0, out, chunk.length) == FAILED)
+            {
+                AgentUtils::writeLog("Missing or damaged chunk " + chunk.hash + " of " + versionPath, FAILED);
+                if (fd >= 0)
+                    close(fd);
+                return FAILED;
+            }
+            close(fd);
+        }
+        return SUCCESS;
+    });
+}
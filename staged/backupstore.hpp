@@ -0,0 +1,118 @@
+#ifndef BACKUPSTORE_HPP
+#define BACKUPSTORE_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+
+#define BACKUP_CHUNKS_DIR "chunks/"
+#define BACKUP_VERSIONS_DIR "versions/"
+#define BACKUP_SNAPSHOT_FILE ".snapshot"
+#define CHUNK_MIN_SIZE 1024
+#define CHUNK_AVG_SIZE 4096
+#define CHUNK_MAX_SIZE 32768
+#define BACKUP_READ_SIZE (1024 * 1024) /* Read window over a live file; at least CHUNK_MAX_SIZE. */
+#define CHUNK_MASK_SMALL (((1ULL << 14) - 1) << 50) /* 14 bits below the average size: cuts are rarer. */
+#define CHUNK_MASK_LARGE (((1ULL << 10) - 1) << 54) /* 10 bits above it: cuts are likelier. */
+
+typedef struct backup_chunk backup_chunk;
+
+/**
+ * @brief Backup Chunk
+ *
+ * One entry of a version manifest: the lowercase hexadecimal SHA-256 of a chunk and its length.
+ */
+struct backup_chunk
+{
+    string hash;
+    size_t length = 0;
+};
+
+/**
+ * @cond HIDE_THIS_CLASS
+ * @brief This class is for internal use only and should not be documented.
+ */
+
+/**
+ * @brief Deduplicating Backup Store
+ *
+ * The `BackupStore` class keeps versions of files as lists of content-addressed chunks. A file is split with FastCDC,
+ * a gear rolling hash whose cut points depend on the bytes around them rather than on offsets, so an edit only changes
+ * the chunks it touches and the chunks after it line up again. Each chunk is stored once, under its SHA-256, in
+ * `chunks/<first two digits>/<hash>`. A version is a manifest in `versions/<name>/<time>` listing the chunks in
+ * order; a version identical to the previous one is not recorded.
+ *
+ * Where the filesystem can reflink, a file is chunked from a mapped `FICLONE` snapshot, so its writer can keep going.
+ * Elsewhere a snapshot would be a full copy, so `_chunkLive` reads the live file with `pread` into its own buffer
+ * instead, and the version is dropped if its size or mtime changed meanwhile. Either way new chunks are written from
+ * the user-space bytes that were hashed; `copy_file_range` and `sendfile` are only used by `restore`. Chunks and
+ * manifests are written to a temporary file and renamed into place, so a crash never leaves a partial chunk under a
+ * valid address or a manifest naming chunks that are not on disk.
+ *
+ * One store must not be used by two threads at once.
+ */
+class BackupStore
+{
+private:
+    string _directory;
+
+    string _chunkPath(const string &hash) const;
+    int _putChunk(const unsigned char *data, size_t size, string &hash, size_t &added);
+    int _chunkSnapshot(int fd, const string &path, std::ostringstream &manifest, size_t &size, size_t &added);
+    int _chunkLive(int fd, const string &path, std::ostringstream &manifest, size_t &size, size_t &added);
+    int _latest(const string &name, string &manifest);
+
+public:
+    /**
+     * @brief Backup Store Constructor
+     *
+     * @param[in] directory The root of the store; created if missing.
+     */
+    explicit BackupStore(const string &directory);
+
+    /**
+     * @brief Back Up File
+     *
+     * Stores the chunks of `path` that are not in the store yet and records a version of it under `name`.
+     *
+     * @param[in] path The file to back up.
+     * @param[in] name The name the versions are kept under.
+     * @param[out] versionPath The manifest written, or empty if the file is unchanged since its last version.
+     * @return An integer result code:
+     *         - SUCCESS: The file is backed up.
+     *         - FAILED: The file could not be read or the store could not be written.
+     */
+    int backup(const string &path, const string &name, string &versionPath);
+
+    /**
+     * @brief Restore Version
+     *
+     * Rebuilds the file recorded by a manifest, checking every chunk against its hash.
+     *
+     * @param[in] versionPath The manifest.
+     * @param[in] outPath Where the file is written.
+     * @return SUCCESS, or FAILED if a chunk is missing or damaged.
+     */
+    int restore(const string &versionPath, const string &outPath);
+
+    /**
+     * @brief Find Chunk Boundary
+     *
+     * @param[in] data The bytes from the start of the chunk.
+     * @param[in] size The bytes available.
+     * @return The length of the chunk, between `CHUNK_MIN_SIZE` and `CHUNK_MAX_SIZE` unless `size` is smaller.
+     */
+    static size_t cut(const unsigned char *data, size_t size);
+
+    /**
+     * @brief Read Manifest
+     *
+     * @return SUCCESS, or FAILED if `versionPath` cannot be read or parsed.
+     */
+    static int readManifest(const string &versionPath, vector<backup_chunk> &chunks);
+};
+
+/**
+ * @endcond
+ */
+
+#endif
@@ -1,4 +1,18 @@
 #include "service/connection.hpp"
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+
+static string sslError()
+{
+    unsigned long code = ERR_get_error();
+    if (code == 0)
+    {
+        return errno != 0 ? strerror(errno) : "connection closed";
+    }
+    char buffer[256];
+    ERR_error_string_n(code, buffer, sizeof(buffer));
+    return buffer;
+}
 
 TlsConnection::TlsConnection(string port, string caKey, string serverCert, string serverKey)
 {
@@ -6,6 +20,12 @@ TlsConnection::TlsConnection(string port, string caKey, string serverCert, strin
     this->_caKey = caKey;
     this->_serverCert = serverCert;
     this->_serverKey = serverKey;
+    this->_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    this->_buffer.resize(TLS_READ_BUFFER);
+    this->_handler = [](const string &message) {
+        AgentUtils::writeLog("Received message: " + message, DEBUG);
+        return string("Hello, client!");
+    };
 }
 
 SSL_CTX *TlsConnection::_getServerContext(const string caKey, const string serverCert, const string serverKey)
@@ -20,7 +40,6 @@ SSL_CTX *TlsConnection::_getServerContext(const string caKey, const string serve
         if (!(ctx = SSL_CTX_new(TLS_server_method())))
         {
             throw std::invalid_argument("SSL_CTX_new failed");
-            return nullptr;
         }
 
         if (SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION) != 1)
@@ -37,7 +56,12 @@ SSL_CTX *TlsConnection::_getServerContext(const string caKey, const string serve
             throw std::invalid_argument("Could not set the CA file location");
         }
 
-        SSL_CTX_set_client_CA_list(ctx, SSL_load_client_CA_file(caKey.c_str()));
+        STACK_OF(X509_NAME) *clientCAs = SSL_load_client_CA_file(caKey.c_str());
+        if (clientCAs == nullptr)
+        {
+            throw std::invalid_argument("Could not load the client CA list");
+        }
+        SSL_CTX_set_client_CA_list(ctx, clientCAs);
 
         if (SSL_CTX_use_certificate_file(ctx, serverCert.c_str(), SSL_FILETYPE_PEM) != 1)
         {
@@ -57,10 +81,23 @@ SSL_CTX *TlsConnection::_getServerContext(const string caKey, const string serve
         SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL); // Specify that we need to verify the client as well
 
         SSL_CTX_set_verify_depth(ctx, 1); // We accept only certificates signed only by the CA itself
+
+        // Resumption: sessions of verified clients are only resumed within this context, tickets carry the state.
+        if (SSL_CTX_set_session_id_context(ctx, (const unsigned char *)TLS_SESSION_CONTEXT, strlen(TLS_SESSION_CONTEXT)) != 1)
+        {
+            throw std::invalid_argument("Could not set the session id context");
+        }
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+        SSL_CTX_set_num_tickets(ctx, TLS_SESSION_TICKETS);
+
+        // Idle connections give their read and write buffers back, which matters with thousands of gateways.
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
     }
     catch (const std::exception &e)
     {
         SSL_CTX_free(ctx);
+        ctx = nullptr;
         string error = e.what();
         AgentUtils::writeLog(error, FAILED);
     }
@@ -75,7 +112,7 @@ int TlsConnection::_get_socket(int port_num)
 
     try
     {
-        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
         {
             AgentUtils::writeLog("Cannot create a socket", FAILED);
             return -1;
@@ -86,6 +123,10 @@ int TlsConnection::_get_socket(int port_num)
             throw std::invalid_argument("Could not set SO_REUSEADDR on the socket.");
         }
 
+        // Wake up for a connection only once its ClientHello has arrived.
+        int deferSeconds = TLS_HANDSHAKE_TIMEOUT;
+        setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &deferSeconds, sizeof(deferSeconds));
+
         memset(&sin, 0, sizeof(sin));
         sin.sin_family = AF_INET;
         sin.sin_addr.s_addr = INADDR_ANY;
@@ -113,94 +154,365 @@ int TlsConnection::_get_socket(int port_num)
     return sock;
 }
 
-int TlsConnection::start()
+void TlsConnection::_accept()
 {
-    AgentUtils::writeLog("Starting server...");
-    SSL_CTX *ctx = nullptr;
-    SSL *ssl = nullptr;
-    int port_num, listen_fd, net_fd, rc;
-    struct sockaddr_in sin;
-    socklen_t sin_len;
-    int result = SUCCESS;
-
-    try
+    while (true)
     {
-        port_num = std::stoi(_port);
-        if (port_num < 1 || port_num > 65535)
+        struct sockaddr_in sin;
+        socklen_t sin_len = sizeof(sin);
+        int fd = accept4(_listenFd, (struct sockaddr *)&sin, &sin_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                AgentUtils::writeLog("Failed to accept connection: " + string(strerror(errno)), WARNING);
+            return;
+        }
+        if (_clients.size() >= TLS_MAX_CONNECTIONS)
         {
-            AgentUtils::writeLog("Invalid port number: " + _port, FAILED);
-            return FAILED;
+            _stats.rejected++;
+            close(fd);
+            continue;
         }
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
 
-        if (!(ctx = _getServerContext(_caKey, _serverCert, _serverKey)))
+        std::unique_ptr<client> connection(new client());
+        connection->fd = fd;
+        connection->since = std::chrono::steady_clock::now();
+        char address[INET_ADDRSTRLEN] = "";
+        inet_ntop(AF_INET, &sin.sin_addr, address, sizeof(address));
+        connection->address = address;
+        if (!(connection->ssl = SSL_new(_ctx)) || SSL_set_fd(connection->ssl, fd) != 1)
         {
-            return FAILED;
+            AgentUtils::writeLog("Could not get an SSL handle from the context.", FAILED);
+            SSL_free(connection->ssl);
+            close(fd);
+            continue;
         }
+        SSL_set_accept_state(connection->ssl);
 
-        if ((listen_fd = _get_socket(port_num)) < 0)
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
         {
-            throw std::invalid_argument("Unable to listening to the PORT");
+            SSL_free(connection->ssl);
+            close(fd);
+            continue;
         }
+        connection->events = EPOLLIN;
+        client &added = *connection;
+        _clients[fd] = std::move(connection);
+        _stats.accepted++;
+        _stats.active++;
+        _handshake(added); /* With TCP_DEFER_ACCEPT the ClientHello is usually already here. */
+    }
+}
 
-        while (true)
+void TlsConnection::_watch(client &connection, uint32_t events)
+{
+    if (connection.events == events)
+    {
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events | EPOLLRDHUP;
+    event.data.fd = connection.fd;
+    epoll_ctl(_epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.events = events;
+}
+
+void TlsConnection::_handshake(client &connection)
+{
+    ERR_clear_error();
+    errno = 0;
+    int rc = SSL_do_handshake(connection.ssl);
+    if (rc == 1)
+    {
+        connection.state = TLS_OPEN;
+        connection.since = std::chrono::steady_clock::now();
+        _stats.handshakes++;
+        bool resumed = SSL_session_reused(connection.ssl);
+        if (resumed)
+            _stats.resumed++;
+        AgentUtils::writeLog("SSL Handshake successful with [ " + connection.address + " ] with port " + _port + (resumed ? " (resumed)" : ""), DEBUG);
+        _read(connection); /* Application data may have arrived with the last handshake flight. */
+        return;
+    }
+    int error = SSL_get_error(connection.ssl, rc);
+    if (error == SSL_ERROR_WANT_READ)
+    {
+        _watch(connection, EPOLLIN);
+    }
+    else if (error == SSL_ERROR_WANT_WRITE)
+    {
+        _watch(connection, EPOLLIN | EPOLLOUT);
+    }
+    else
+    {
+        _stats.failed++;
+        AgentUtils::writeLog("Could not perform SSL handshake with [ " + connection.address + " ]: " + sslError(), WARNING);
+        _close(connection.fd);
+    }
+}
+
+void TlsConnection::_read(client &connection)
+{
+    bool closing = false;
+    while (true)
+    {
+        ERR_clear_error();
+        errno = 0;
+        int received = SSL_read(connection.ssl, _buffer.data(), _buffer.size());
+        if (received > 0)
         {
-            sin_len = sizeof(sin);
-            if ((net_fd = accept(listen_fd, (struct sockaddr *)&sin, &sin_len)) < 0)
+            connection.input.append(_buffer.data(), received);
+            connection.since = std::chrono::steady_clock::now();
+            if (connection.input.size() > TLS_MAX_MESSAGE && connection.input.find('\n') == string::npos)
             {
-                std::invalid_argument("Failed to accept connection");
-                continue;
+                AgentUtils::writeLog("Message too long from [ " + connection.address + " ]", WARNING);
+                _close(connection.fd);
+                return;
             }
-            AgentUtils::writeLog("Client connection accepted");
+            continue;
+        }
+        int error = SSL_get_error(connection.ssl, received);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+        {
+            break;
+        }
+        if (error != SSL_ERROR_ZERO_RETURN)
+        {
+            AgentUtils::writeLog("Failed to receive from [ " + connection.address + " ]: " + sslError(), DEBUG);
+            _close(connection.fd);
+            return;
+        }
+        closing = true; /* close_notify: answer what was received, then close. */
+        break;
+    }
 
-            if (!(ssl = SSL_new(ctx)))
-            {
-                std::invalid_argument("Could not get an SSL handle from the context.");
-                close(net_fd);
-                continue;
-            }
+    size_t start = 0, end;
+    while ((end = connection.input.find('\n', start)) != string::npos)
+    {
+        string message = connection.input.substr(start, end - start);
+        if (!message.empty() && message.back() == '\r')
+            message.pop_back();
+        string reply = _handler(message);
+        if (!reply.empty())
+            connection.output += reply + "\n";
+        start = end + 1;
+    }
+    connection.input.erase(0, start);
+    if (closing)
+    {
+        connection.state = TLS_CLOSING;
+    }
+    _write(connection);
+}
 
-            SSL_set_fd(ssl, net_fd);
+void TlsConnection::_write(client &connection)
+{
+    while (!connection.output.empty())
+    {
+        ERR_clear_error();
+        errno = 0;
+        int sent = SSL_write(connection.ssl, connection.output.data(), (int)std::min<size_t>(connection.output.size(), INT_MAX));
+        if (sent > 0)
+        {
+            connection.output.erase(0, sent);
+            continue;
+        }
+        int error = SSL_get_error(connection.ssl, sent);
+        if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ)
+        {
+            _watch(connection, error == SSL_ERROR_WANT_WRITE ? EPOLLIN | EPOLLOUT : EPOLLIN);
+            return;
+        }
+        AgentUtils::writeLog("Failed to send to [ " + connection.address + " ]: " + sslError(), DEBUG);
+        _close(connection.fd);
+        return;
+    }
+    if (connection.state == TLS_CLOSING)
+    {
+        _shutdown(connection);
+        return;
+    }
+    _watch(connection, EPOLLIN);
+}
 
-            if ((rc = SSL_accept(ssl)) != 1)
-            {
-                std::invalid_argument("Could not perform SSL handshake");
-                if (rc != 0)
-                {
-                    SSL_shutdown(ssl);
-                }
-                SSL_free(ssl);
-            }
-            string clientAddress = inet_ntoa(sin.sin_addr);
-            AgentUtils::writeLog("SSL Handshake successful with [ " + clientAddress + " ] with port " + _port);
+void TlsConnection::_shutdown(client &connection)
+{
+    connection.state = TLS_CLOSING;
+    ERR_clear_error();
+    int rc = SSL_shutdown(connection.ssl);
+    if (rc < 0 && SSL_get_error(connection.ssl, rc) == SSL_ERROR_WANT_WRITE)
+    {
+        _watch(connection, EPOLLOUT);
+        return;
+    }
+    _close(connection.fd); /* Our close_notify is out; the peer's is not waited for. */
+}
+
+void TlsConnection::_close(int fd)
+{
+    auto it = _clients.find(fd);
+    if (it == _clients.end())
+    {
+        return;
+    }
+    epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    SSL_free(it->second->ssl);
+    close(fd);
+    _clients.erase(it);
+    _stats.active--;
+}
 
-            char buffer[1024];
-            int received = SSL_read(ssl, buffer, sizeof(buffer));
-            if (received <= 0)
+void TlsConnection::_expire()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    vector<int> handshaking, idle;
+    for (const auto &entry : _clients)
+    {
+        const client &connection = *entry.second;
+        if (connection.state != TLS_OPEN && now - connection.since > std::chrono::seconds(TLS_HANDSHAKE_TIMEOUT))
+            handshaking.push_back(entry.first);
+        else if (connection.state == TLS_OPEN && now - connection.since > std::chrono::seconds(TLS_IDLE_TIMEOUT))
+            idle.push_back(entry.first);
+    }
+    _stats.timedOut += handshaking.size() + idle.size();
+    for (int fd : handshaking)
+    {
+        _close(fd);
+    }
+    for (int fd : idle)
+    {
+        auto it = _clients.find(fd);
+        if (it != _clients.end())
+            _shutdown(*it->second);
+    }
+}
+
+int TlsConnection::start()
+{
+    AgentUtils::writeLog("Starting server...");
+    int port_num = 0;
+    try
+    {
+        port_num = std::stoi(_port);
+    }
+    catch (const std::exception &e)
+    {
+        port_num = 0;
+    }
+    if (port_num < 1 || port_num > 65535)
+    {
+        AgentUtils::writeLog("Invalid port number: " + _port, FAILED);
+        return FAILED;
+    }
+    if (_wakeFd < 0 || !(_ctx = _getServerContext(_caKey, _serverCert, _serverKey)))
+    {
+        return FAILED;
+    }
+    if ((_listenFd = _get_socket(port_num)) < 0)
+    {
+        AgentUtils::writeLog("Unable to listening to the PORT", FAILED);
+        return FAILED;
+    }
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = _listenFd;
+    bool ready = _epollFd >= 0 && epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &event) == 0;
+    event.data.fd = _wakeFd;
+    if (!ready || epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event) != 0)
+    {
+        AgentUtils::writeLog("Failed to create the TLS event loop: " + string(strerror(errno)), FAILED);
+        return FAILED;
+    }
+
+    int result = SUCCESS;
+    vector<struct epoll_event> events(TLS_MAX_EVENTS);
+    std::chrono::steady_clock::time_point swept = std::chrono::steady_clock::now();
+    while (!_stopping.load())
+    {
+        int count = epoll_wait(_epollFd, events.data(), TLS_MAX_EVENTS, TLS_POLL_TIMEOUT_MS);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            AgentUtils::writeLog("TLS event loop failed: " + string(strerror(errno)), FAILED);
+            result = FAILED;
+            break;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == _wakeFd)
+                continue;
+            if (fd == _listenFd)
             {
-                throw std::invalid_argument("Failed to receive response.");
+                _accept();
+                continue;
             }
+            auto it = _clients.find(fd);
+            if (it == _clients.end())
+                continue;
+            client &connection = *it->second;
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN))
+                _close(fd);
+            else if (connection.state == TLS_HANDSHAKE)
+                _handshake(connection);
+            else if (connection.state == TLS_CLOSING)
+                _write(connection); /* Flushes the last replies, then shuts down. */
+            else if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                _read(connection); /* Also flushes pending output. */
             else
-            {
-                std::cout << "Received response: " << std::string(buffer, received) << "\n";
-            }
-            std::string message = "Hello, client!";
-            if (SSL_write(ssl, message.c_str(), message.length()) <= 0)
-            {
-                throw std::invalid_argument("Failed to send message.");
-            }
+                _write(connection);
+        }
+        if (std::chrono::steady_clock::now() - swept >= std::chrono::milliseconds(TLS_POLL_TIMEOUT_MS))
+        {
+            _expire();
+            swept = std::chrono::steady_clock::now();
         }
-
-        close(listen_fd);
-        SSL_CTX_free(ctx);
     }
-    catch (const std::exception &e)
+
+    while (!_clients.empty())
     {
-        result = FAILED;
-        SSL_CTX_free(ctx);
-        string error = e.what();
-        AgentUtils::writeLog(error, FAILED);
+        _close(_clients.begin()->first);
     }
+    close(_listenFd);
+    close(_epollFd);
+    _listenFd = _epollFd = -1;
     return result;
 }
 
-TlsConnection::~TlsConnection() {}
\ No newline at end of file
+void TlsConnection::stop()
+{
+    _stopping.store(true);
+    uint64_t one = 1;
+    if (_wakeFd >= 0 && write(_wakeFd, &one, sizeof(one)) < 0)
+    {
+        AgentUtils::writeLog("Failed to wake the TLS event loop", WARNING);
+    }
+}
+
+TlsConnection::~TlsConnection()
+{
+    for (auto &entry : _clients)
+    {
+        SSL_free(entry.second->ssl);
+        close(entry.first);
+    }
+    if (_listenFd >= 0)
+        close(_listenFd);
+    if (_epollFd >= 0)
+        close(_epollFd);
+    if (_wakeFd >= 0)
+        close(_wakeFd);
+    SSL_CTX_free(_ctx);
+}
@@ -1,24 +1,148 @@
 #ifndef CONNECTION_HPP
-#define CONNNECTION_HPP
+#define CONNECTION_HPP
 
 #include "agentUtils.hpp"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <sys/epoll.h>
 
+#define TLS_MAX_CONNECTIONS 10000
+#define TLS_MAX_EVENTS 256
+#define TLS_READ_BUFFER 16384
+#define TLS_MAX_MESSAGE 65536 /* A client sending more than this without a newline is dropped. */
+#define TLS_HANDSHAKE_TIMEOUT 10
+#define TLS_IDLE_TIMEOUT 300
+#define TLS_SESSION_TIMEOUT 86400 /* Lifetime of a session ticket in seconds. */
+#define TLS_SESSION_TICKETS 2 /* Tickets issued per full handshake, so a client can open two resumed connections. */
+#define TLS_SESSION_CONTEXT "scl-agent-tls"
+#define TLS_POLL_TIMEOUT_MS 1000
+
+typedef struct tls_stats tls_stats;
+
+/**
+ * @brief TLS Server Statistics
+ *
+ * Counters of the connections accepted and the handshakes completed, failed and resumed from a session ticket.
+ */
+struct tls_stats
+{
+    size_t accepted = 0;
+    size_t rejected = 0;
+    size_t handshakes = 0;
+    size_t resumed = 0;
+    size_t failed = 0;
+    size_t timedOut = 0;
+    size_t active = 0;
+};
+
+/**
+ * @cond HIDE_THIS_CLASS
+ * @brief This class is for internal use only and should not be documented.
+ */
+
+/**
+ * @brief Event-Driven TLS Server
+ *
+ * The `TlsConnection` class serves the management channel over mutually authenticated TLS 1.3. One thread drives the
+ * listening socket and every client through `epoll`: sockets are non-blocking and each connection is a small state
+ * machine (handshake, open, closing), so a slow or stalled client never holds up the others and a fleet reconnecting
+ * at once is handshaken concurrently.
+ *
+ * Every full handshake issues session tickets, so a gateway that reconnects resumes with a PSK handshake that skips the
+ * certificate exchange and verification. Each connection keeps its own input and output buffers: input is split into
+ * newline-terminated messages for the handler, and replies are written as the socket accepts them. Connections that do
+ * not finish the handshake within `TLS_HANDSHAKE_TIMEOUT` seconds, or stay silent for `TLS_IDLE_TIMEOUT` seconds, are
+ * closed. A failed connection is closed and freed without affecting the server.
+ */
 class TlsConnection
 {
+public:
+    typedef std::function<string(const string &message)> message_handler;
+
 private:
+    enum tls_state
+    {
+        TLS_HANDSHAKE,
+        TLS_OPEN,
+        TLS_CLOSING
+    };
+
+    struct client
+    {
+        int fd = -1;
+        SSL *ssl = nullptr;
+        tls_state state = TLS_HANDSHAKE;
+        string address;
+        string input;
+        string output;
+        uint32_t events = 0;
+        std::chrono::steady_clock::time_point since; /**< Accepted, or last active once open. */
+    };
+
     string _port;
     string _caKey;
     string _serverCert;
     string _serverKey;
+    SSL_CTX *_ctx = nullptr;
+    int _listenFd = -1;
+    int _epollFd = -1;
+    int _wakeFd = -1;
+    std::atomic<bool> _stopping{false};
+    std::unordered_map<int, std::unique_ptr<client>> _clients;
+    message_handler _handler;
+    tls_stats _stats;
+    vector<char> _buffer;
 
 private:
     SSL_CTX *_getServerContext(const string caKey, const string serverCert, const string serverKey);
     int _get_socket(int port_num);
+    void _accept();
+    void _watch(client &connection, uint32_t events);
+    void _handshake(client &connection);
+    void _read(client &connection);
+    void _write(client &connection);
+    void _shutdown(client &connection);
+    void _close(int fd);
+    void _expire();
 
 public:
     TlsConnection(string port, string caKey, string serverCert, string serverKey);
+
+    /**
+     * @brief Set Message Handler
+     *
+     * @param[in] handler Called with every message received, without its newline; a non-empty result is sent back.
+     */
+    void setHandler(message_handler handler) { _handler = handler; }
+
+    /**
+     * @brief Start Server
+     *
+     * Serves clients on the configured port until `stop` is called.
+     *
+     * @return SUCCESS after `stop`, or FAILED if the context, the socket or the event loop could not be set up.
+     */
     int start();
+
+    /**
+     * @brief Stop Server
+     *
+     * Makes `start` close every connection and return. Safe to call from any thread.
+     */
+    void stop();
+
+    /**
+     * @brief Get Statistics
+     *
+     * Only consistent when read from the thread running `start`, or after it returned.
+     */
+    const tls_stats &stats() const { return _stats; }
+
     ~TlsConnection();
 };
 
-#endif
\ No newline at end of file
+/**
+ * @endcond
+ */
+
+#endif
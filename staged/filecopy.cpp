@@ -0,0 +1,69 @@
+#include "service/filecopy.hpp"
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+/* The errors with which copy_file_range and sendfile say they cannot handle this pair of files, as opposed to I/O
+ * errors. */
+static bool unsupported(int error)
+{
+    return error == EXDEV || error == ENOSYS || error == EINVAL || error == EOPNOTSUPP || error == EBADF;
+}
+
+int FileCopy::copyRange(int in, off_t offset, int out, size_t length)
+{
+    bool rangeCopy = true, sendFile = true;
+    vector<char> buffer;
+    while (length > 0)
+    {
+        ssize_t bytes;
+        if (rangeCopy)
+        {
+            loff_t position = offset;
+            bytes = copy_file_range(in, &position, out, nullptr, length, 0);
+            if (bytes < 0 && unsupported(errno))
+            {
+                rangeCopy = false;
+                continue;
+            }
+        }
+        else if (sendFile)
+        {
+            off_t position = offset;
+            bytes = sendfile(out, in, &position, length);
+            if (bytes < 0 && unsupported(errno))
+            {
+                sendFile = false;
+                continue;
+            }
+        }
+        else
+        {
+            buffer.resize(FILECOPY_BUFFER);
+            bytes = pread(in, buffer.data(), std::min(length, buffer.size()), offset);
+            for (ssize_t done = 0, written; bytes > 0 && done < bytes; done += written)
+            {
+                written = write(out, buffer.data() + done, bytes - done);
+                if (written < 0 && errno != EINTR)
+                    return FAILED;
+                written = std::max<ssize_t>(written, 0);
+            }
+        }
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            return FAILED;
+        }
+        offset += bytes;
+        length -= bytes;
+    }
+    return SUCCESS;
+}
+
+int FileCopy::clone(int in, int out)
+{
+    return ioctl(out, FICLONE, in) == 0 ? SUCCESS : FAILED;
+}
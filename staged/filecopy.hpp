@@ -0,0 +1,50 @@
+#ifndef FILECOPY_HPP
+#define FILECOPY_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+
+#define FILECOPY_BUFFER 65536
+
+/**
+ * @cond HIDE_THIS_CLASS
+ * @brief This class is for internal use only and should not be documented.
+ */
+
+/**
+ * @brief Kernel-Side File Copy
+ *
+ * The `FileCopy` class copies file data without passing it through user space where the kernel allows it. `clone`
+ * shares the extents of a whole file with the `FICLONE` reflink ioctl on btrfs and XFS; the backup store uses it to
+ * snapshot a file before chunking it. `copyRange` copies inside the kernel with `copy_file_range` (or offloads to the
+ * filesystem or NFS server), falls back to `sendfile`, and to a `pread`/`write` loop as a last resort. Only
+ * `BackupStore::restore` copies ranges this way; chunks are written from user-space buffers, including those
+ * `_chunkLive` reads from a file that cannot be snapshotted.
+ */
+class FileCopy
+{
+public:
+    /**
+     * @brief Copy Range
+     *
+     * Copies `length` bytes of `in` from `offset` to the current position of `out`. The offset of `in` is unchanged.
+     *
+     * @return SUCCESS, or FAILED if the copy failed or `in` ended early.
+     */
+    static int copyRange(int in, off_t offset, int out, size_t length);
+
+    /**
+     * @brief Clone File
+     *
+     * Replaces `out` with a reflink of `in`, sharing its extents.
+     *
+     * @return SUCCESS, or FAILED if the filesystem cannot clone this pair of files.
+     */
+    static int clone(int in, int out);
+};
+
+/**
+ * @endcond
+ */
+
+#endif
@@ -12,7 +12,21 @@ private:
     IWatch *watcher = nullptr;
 
 public:
-    WatchController(string watchDirectory, string backupDirectory) : _watchDirectory(watchDirectory), _backupDirectory(backupDirectory), watcher(new WatchService()) {}
+    WatchController(string watchDirectory, string backupDirectory, string excludes = "") : _watchDirectory(watchDirectory), _backupDirectory(backupDirectory)
+    {
+        WatchService *service = new WatchService();
+        vector<string> paths;
+        std::istringstream list(excludes);
+        string path;
+        while (std::getline(list, path, ','))
+        {
+            path = AgentUtils::trim(path);
+            if (!path.empty())
+                paths.push_back(path);
+        }
+        service->exclude(paths);
+        watcher = service;
+    }
 
     void start()
     {
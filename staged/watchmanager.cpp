@@ -0,0 +1,319 @@
+#include "service/watchmanager.hpp"
+#include <unordered_set>
+
+static string joinPath(const string &directory, const char *name)
+{
+    return directory == "/" ? "/" + string(name) : directory + "/" + name;
+}
+
+/* The entries of an ordered map whose key lies below the directory `root`. */
+template <typename T>
+static std::pair<typename map<string, T>::iterator, typename map<string, T>::iterator> below(map<string, T> &entries, const string &root)
+{
+    string prefix = root == "/" ? root : root + "/";
+    auto first = entries.lower_bound(prefix), last = first;
+    while (last != entries.end() && last->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        ++last;
+    }
+    return {first, last};
+}
+
+/* `path` made absolute and normal, without a trailing slash. */
+static string normalPath(const string &path)
+{
+    string normal = std::filesystem::absolute(path).lexically_normal();
+    while (normal.size() > 1 && normal.back() == '/')
+    {
+        normal.pop_back();
+    }
+    return normal;
+}
+
+int WatchManager::open()
+{
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd == -1)
+    {
+        AgentUtils::writeLog("Failed to initialize inotify: " + string(strerror(errno)), FAILED);
+        return FAILED;
+    }
+    _buffer.resize(WATCH_READ_BUFFER);
+    return SUCCESS;
+}
+
+int WatchManager::_watch(const string &directory)
+{
+    int wd = inotify_add_watch(_fd, directory.c_str(), WATCH_FILE_EVENTS | WATCH_DIR_EVENTS);
+    if (wd == -1)
+    {
+        if (errno == ENOSPC && !_limitLogged)
+        {
+            AgentUtils::writeLog("Out of inotify watches at " + std::to_string(_watches.size()) + " directories, raise fs.inotify.max_user_watches", FAILED);
+            _limitLogged = true;
+        }
+        else if (errno != ENOSPC && errno != ENOENT)
+        {
+            AgentUtils::writeLog("Failed to watch " + directory + ": " + strerror(errno), WARNING);
+        }
+        return FAILED;
+    }
+    auto previous = _paths.find(wd);
+    if (previous != _paths.end() && previous->second != directory)
+    {
+        _watches.erase(previous->second);
+    }
+    _paths[wd] = directory;
+    _watches[directory] = wd;
+    return SUCCESS;
+}
+
+bool WatchManager::_excluded(const string &path) const
+{
+    for (const string &exclude : _excludes)
+    {
+        if (path.compare(0, exclude.size(), exclude) == 0 && (path.size() == exclude.size() || path[exclude.size()] == '/' || exclude == "/"))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WatchManager::_walk(const string &root, const std::function<bool(const string &, bool)> &visit)
+{
+    if (_excluded(root) || !visit(root, true))
+    {
+        return;
+    }
+    std::error_code error;
+    std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, error), end;
+    for (; !error && it != end; it.increment(error))
+    {
+        std::filesystem::file_status status = it->symlink_status(error);
+        if (error)
+        {
+            error.clear();
+            continue;
+        }
+        if (_excluded(it->path()))
+        {
+            if (std::filesystem::is_directory(status))
+                it.disable_recursion_pending();
+            continue;
+        }
+        if (std::filesystem::is_directory(status))
+        {
+            if (!visit(it->path(), true))
+            {
+                it.disable_recursion_pending();
+            }
+        }
+        else if (std::filesystem::is_regular_file(status))
+        {
+            visit(it->path(), false);
+        }
+    }
+}
+
+bool WatchManager::_update(const string &path, vector<watch_event> *events)
+{
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        return false;
+    }
+    file_state state = {(int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec, (int64_t)info.st_size};
+    auto known = _files.find(path);
+    if (known == _files.end())
+    {
+        _files.emplace(path, state);
+        if (events != nullptr)
+            events->push_back({path, IN_CREATE});
+        return true;
+    }
+    if (known->second.mtime == state.mtime && known->second.size == state.size)
+    {
+        return false;
+    }
+    known->second = state;
+    if (events != nullptr)
+        events->push_back({path, IN_MODIFY});
+    return true;
+}
+
+void WatchManager::_addTree(const string &root, vector<watch_event> *events)
+{
+    _walk(root, [&](const string &path, bool directory) {
+        return directory ? _watch(path) == SUCCESS : _update(path, events);
+    });
+}
+
+void WatchManager::_removeTree(const string &root, vector<watch_event> &events)
+{
+    auto watch = _watches.find(root);
+    if (watch != _watches.end())
+    {
+        inotify_rm_watch(_fd, watch->second);
+        _paths.erase(watch->second);
+        _watches.erase(watch);
+    }
+    auto watches = below(_watches, root);
+    for (watch = watches.first; watch != watches.second; ++watch)
+    {
+        inotify_rm_watch(_fd, watch->second);
+        _paths.erase(watch->second);
+    }
+    _watches.erase(watches.first, watches.second);
+    auto files = below(_files, root);
+    for (auto file = files.first; file != files.second; ++file)
+    {
+        events.push_back({file->first, IN_DELETE});
+    }
+    _files.erase(files.first, files.second);
+}
+
+void WatchManager::_rescan(vector<watch_event> &events)
+{
+    AgentUtils::writeLog("inotify queue overflowed, rescanning " + std::to_string(_files.size()) + " files", WARNING);
+    std::unordered_set<string> seen;
+    for (const string &root : _roots)
+    {
+        _walk(root, [&](const string &path, bool directory) {
+            seen.insert(path);
+            if (directory)
+            {
+                return _watches.count(path) > 0 || _watch(path) == SUCCESS;
+            }
+            _update(path, &events);
+            return true;
+        });
+    }
+    for (auto file = _files.begin(); file != _files.end();)
+    {
+        if (seen.count(file->first) == 0)
+        {
+            events.push_back({file->first, IN_DELETE});
+            file = _files.erase(file);
+            continue;
+        }
+        ++file;
+    }
+    for (auto watch = _watches.begin(); watch != _watches.end();)
+    {
+        if (seen.count(watch->first) == 0)
+        {
+            inotify_rm_watch(_fd, watch->second);
+            _paths.erase(watch->second);
+            watch = _watches.erase(watch);
+            continue;
+        }
+        ++watch;
+    }
+}
+
+void WatchManager::addExclude(const string &path)
+{
+    _excludes.push_back(normalPath(path));
+}
+
+int WatchManager::addRoot(const string &root)
+{
+    string path = normalPath(root);
+    if (_fd < 0 && open() == FAILED)
+    {
+        return FAILED;
+    }
+    if (!std::filesystem::is_directory(path) || _excluded(path) || _watch(path) == FAILED)
+    {
+        AgentUtils::writeLog(INVALID_PATH + path, FAILED);
+        return FAILED;
+    }
+    _roots.push_back(path);
+    _addTree(path, nullptr);
+    AgentUtils::writeLog("Watching " + path + ": " + std::to_string(_watches.size()) + " directories, " + std::to_string(_files.size()) + " files", DEBUG);
+    return SUCCESS;
+}
+
+int WatchManager::read(vector<watch_event> &events)
+{
+    bool overflowed = false;
+    while (true)
+    {
+        ssize_t length = ::read(_fd, _buffer.data(), _buffer.size());
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (length <= 0)
+        {
+            AgentUtils::writeLog("Failed to read inotify events: " + string(strerror(errno)), FAILED);
+            return FAILED;
+        }
+        for (ssize_t i = 0; i < length;)
+        {
+            struct inotify_event event;
+            memcpy(&event, _buffer.data() + i, sizeof(event));
+            const char *name = _buffer.data() + i + sizeof(event);
+            i += sizeof(event) + event.len;
+            if (event.mask & IN_Q_OVERFLOW)
+            {
+                overflowed = true;
+                continue;
+            }
+            auto directory = _paths.find(event.wd);
+            if (directory == _paths.end())
+            {
+                continue;
+            }
+            if (event.mask & IN_IGNORED)
+            {
+                auto watch = _watches.find(directory->second);
+                if (watch != _watches.end() && watch->second == event.wd)
+                    _watches.erase(watch);
+                _paths.erase(directory);
+                continue;
+            }
+            if (event.len == 0)
+            {
+                continue; /* IN_DELETE_SELF and IN_MOVE_SELF; the parent reports the same change by name. */
+            }
+            string path = joinPath(directory->second, name);
+            if (_excluded(path))
+            {
+                continue;
+            }
+            if (event.mask & IN_ISDIR)
+            {
+                if (event.mask & (IN_CREATE | IN_MOVED_TO))
+                    _addTree(path, &events);
+                else if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+                    _removeTree(path, events);
+                continue;
+            }
+            if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+                _files.erase(path);
+            else
+                _update(path, nullptr);
+            events.push_back({path, event.mask});
+        }
+    }
+    if (overflowed)
+    {
+        _overflows++;
+        _rescan(events);
+    }
+    return SUCCESS;
+}
+
+WatchManager::~WatchManager()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef WATCHMANAGER_HPP
+#define WATCHMANAGER_HPP
+#pragma once
+
+#include "agentUtils.hpp"
+
+#define WATCH_READ_BUFFER (64 * 1024)
+#define WATCH_FILE_EVENTS (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE)
+#define WATCH_DIR_EVENTS (IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+typedef struct watch_event watch_event;
+
+/**
+ * @brief Watch Event
+ *
+ * A change to a file under a watched root: its full path and the inotify mask describing it. After a queue overflow
+ * the changes found by the rescan are reported as `IN_CREATE`, `IN_MODIFY` or `IN_DELETE`.
+ */
+struct watch_event
+{
+    string path;
+    uint32_t mask = 0;
+};
+
+/**
+ * @cond HIDE_THIS_CLASS
+ * @brief This class is for internal use only and should not be documented.
+ */
+
+/**
+ * @brief Recursive Watch Manager
+ *
+ * The `WatchManager` class watches whole directory trees under any number of roots with one inotify instance. It
+ * keeps the mapping from watch descriptors to directories, watches directories as they are created or moved in (and
+ * reports the files already in them, which were written before the watch existed), and forgets directories that are
+ * deleted or moved out.
+ *
+ * The manager keeps the size and modification time of every file it has seen. When the kernel reports
+ * `IN_Q_OVERFLOW`, events were lost, so the trees are walked again and only the files whose size or time changed,
+ * appeared or disappeared are reported, instead of treating every file as changed.
+ *
+ * Excluded paths are neither watched nor walked nor reported, so a tree that contains the agent's own output, such as
+ * its logs or the backup store, does not feed its own changes back.
+ *
+ * The instance is non-blocking: add `fd` to an epoll or poll set alongside other listeners and call `read` when it is
+ * readable.
+ */
+class WatchManager
+{
+private:
+    struct file_state
+    {
+        int64_t mtime;
+        int64_t size;
+    };
+
+    int _fd = -1;
+    vector<string> _roots;
+    vector<string> _excludes;
+    std::unordered_map<int, string> _paths;
+    map<string, int> _watches;       /**< Ordered, so a subtree is one range. */
+    map<string, file_state> _files;
+    vector<char> _buffer;
+    size_t _overflows = 0;
+    bool _limitLogged = false;
+
+    bool _excluded(const string &path) const;
+    int _watch(const string &directory);
+    void _walk(const string &root, const std::function<bool(const string &, bool)> &visit);
+    void _addTree(const string &root, vector<watch_event> *events);
+    void _removeTree(const string &root, vector<watch_event> &events);
+    bool _update(const string &path, vector<watch_event> *events);
+    void _rescan(vector<watch_event> &events);
+
+public:
+    WatchManager() = default;
+
+    WatchManager(const WatchManager &) = delete;
+    WatchManager &operator=(const WatchManager &) = delete;
+
+    /**
+     * @brief Open Watch Manager
+     *
+     * @return SUCCESS, or FAILED if no inotify instance could be created.
+     */
+    int open();
+
+    /**
+     * @brief Add Exclude
+     *
+     * Leaves `path`, a file or a directory with everything below it, out of the watched trees. Call before `addRoot`.
+     */
+    void addExclude(const string &path);
+
+    /**
+     * @brief Add Root
+     *
+     * Watches `root` and every directory below it, except the excluded paths. Symbolic links are not followed.
+     *
+     * @return SUCCESS, or FAILED if `root` is not a directory, is excluded or cannot be watched. Subdirectories that
+     *         cannot be watched are logged and skipped.
+     */
+    int addRoot(const string &root);
+
+    /**
+     * @brief Get Descriptor
+     *
+     * @return The inotify descriptor, to wait on for `EPOLLIN`.
+     */
+    int fd() const { return _fd; }
+
+    /**
+     * @brief Read Events
+     *
+     * Reads every queued event without blocking and appends the file events to `events`.
+     *
+     * @return SUCCESS, or FAILED if the inotify descriptor failed.
+     */
+    int read(vector<watch_event> &events);
+
+    size_t watches() const { return _watches.size(); }
+    size_t files() const { return _files.size(); }
+    size_t overflows() const { return _overflows; }
+
+    ~WatchManager();
+};
+
+/**
+ * @endcond
+ */
+
+#endif
@@ -1,14 +1,5 @@
 #include "service/watchservice.hpp"
 
-std::string getFormattedTime()
-{
-    std::time_t rawTime;
-    std::time(&rawTime);
-    char buffer[80];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", std::localtime(&rawTime));
-    return buffer;
-}
-
 bool isDirectoryExist(const string directory)
 {
     if (!(std::filesystem::exists(directory) && std::filesystem::is_directory(directory)))
@@ -21,66 +12,122 @@ bool isDirectoryExist(const string directory)
 
 int WatchService::start(const string watchDirectory, const string backupDirectory)
 {
-    if (!isDirectoryExist(watchDirectory) || !(isDirectoryExist(backupDirectory)))
+    return start(vector<string>{watchDirectory}, backupDirectory);
+}
+
+int WatchService::start(const vector<string> &watchDirectories, const string backupDirectory)
+{
+    if (!(isDirectoryExist(backupDirectory)))
         return FAILED;
 
-    char buffer[EVENT_BUF_LEN];
-    int result = SUCCESS;
-    int fd = inotify_init();
-    if (fd == -1)
-    {
-        AgentUtils::writeLog("Failed to initialize inotify.", FAILED);
+    WatchManager watcher;
+    if (watcher.open() == FAILED)
         return FAILED;
+    // Backing up the agent's own logs, spool and backups would change them again, in an endless loop.
+    watcher.addExclude(backupDirectory);
+    watcher.addExclude(BASE_LOG_DIR);
+    for (const string &path : _excludes)
+    {
+        watcher.addExclude(path);
+    }
+    for (const string &directory : watchDirectories)
+    {
+        if (!isDirectoryExist(directory) || watcher.addRoot(directory) == FAILED)
+            return FAILED;
     }
 
-    int wd = inotify_add_watch(fd, watchDirectory.c_str(), IN_CREATE | IN_MODIFY);
-    if (wd == -1)
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event readable;
+    memset(&readable, 0, sizeof(readable));
+    readable.events = EPOLLIN;
+    readable.data.fd = watcher.fd();
+    if (epollFd == -1 || epoll_ctl(epollFd, EPOLL_CTL_ADD, watcher.fd(), &readable) == -1)
     {
-        AgentUtils::writeLog("Failed to add watch to the directory.", FAILED);
-        close(fd);
+        AgentUtils::writeLog("Failed to initialize the watch event loop.", FAILED);
+        if (epollFd != -1)
+            close(epollFd);
         return FAILED;
     }
 
+    // Editors and writers touch a file many times per save, so each file is backed up once its events stop. Backups
+    // run on a dedicated I/O thread so this loop keeps draining the inotify queue however long they take; a file
+    // whose backup is still running waits another debounce window.
+    int result = SUCCESS;
+    BackupStore store(backupDirectory);
+    map<string, std::chrono::steady_clock::time_point> pending;
+    std::mutex busyMutex;
+    std::set<string> busy;
+    ThreadPool io(1);
+    vector<watch_event> changes;
+    struct epoll_event events[WATCH_MAX_EVENTS];
     while (true)
     {
-        int length = read(fd, buffer, EVENT_BUF_LEN);
-        if (length <= 0)
+        int timeout = -1;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (const auto &file : pending)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(file.second + std::chrono::milliseconds(_debounceMs) - now).count();
+            remaining = std::max<long>(remaining, 0);
+            timeout = timeout < 0 ? remaining : std::min<int>(timeout, remaining);
+        }
+
+        int count = epoll_wait(epollFd, events, WATCH_MAX_EVENTS, timeout);
+        if (count < 0 && errno != EINTR)
         {
             AgentUtils::writeLog("Failed to read inotify events.", FAILED);
             result = FAILED;
             break;
         }
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.fd == watcher.fd() && watcher.read(changes) == FAILED)
+            {
+                result = FAILED;
+                break;
+            }
+        }
+        if (result == FAILED)
+            break;
+        now = std::chrono::steady_clock::now();
+        for (const watch_event &change : changes)
+        {
+            if (!(change.mask & (IN_DELETE | IN_MOVED_FROM)))
+                pending[change.path] = now;
+        }
+        changes.clear();
 
-        int i = 0;
-        while (i < length)
+        for (auto file = pending.begin(); file != pending.end();)
         {
-            struct inotify_event *event = (struct inotify_event *)&buffer[i];
-            if (event->len > 0)
+            if (now - file->second < std::chrono::milliseconds(_debounceMs))
+            {
+                ++file;
+                continue;
+            }
             {
-                std::string fileName = event->name;
-                std::string filePath = watchDirectory + "/" + fileName;
-                AgentUtils::writeLog("Detected modification or creation of file: " + filePath);
-                try
+                std::lock_guard<std::mutex> lock(busyMutex);
+                if (!busy.insert(file->first).second)
                 {
-                    std::string backupFilePath = backupDirectory + "/" + fileName + "_" + getFormattedTime();
-                    std::ifstream ifs(filePath, std::ios::binary);
-                    std::ofstream ofs(backupFilePath, std::ios::binary);
-                    ofs << ifs.rdbuf();
-                    ifs.close();
-                    ofs.close();
-                    break;
+                    file->second = now;
+                    ++file;
+                    continue;
                 }
-                catch (const std::exception &e)
+            }
+            string filePath = file->first;
+            AgentUtils::writeLog("Detected modification or creation of file: " + filePath);
+            io.submit([&store, &busyMutex, &busy, filePath] {
+                string versionPath;
+                if (std::filesystem::is_regular_file(filePath) && store.backup(filePath, filePath.substr(1), versionPath) == FAILED)
                 {
-                    string error = e.what();
-                    AgentUtils::writeLog("Error during backup process: " + error, FAILED);
-                    result = FAILED;
+                    AgentUtils::writeLog("Error during backup process: " + filePath, FAILED);
                 }
-            }
-            i += EVENT_SIZE + event->len;
+                std::lock_guard<std::mutex> lock(busyMutex);
+                busy.erase(filePath);
+            });
+            file = pending.erase(file);
         }
     }
 
+    close(epollFd);
     return result;
 }
 
@@ -2,9 +2,13 @@
 #define WATCHSERVICE_HPP
 
 #include "agentUtils.hpp"
+#include "service/backupstore.hpp"
+#include "service/threadpool.hpp"
+#include "service/watchmanager.hpp"
+#include <sys/epoll.h>
 
-#define EVENT_SIZE (sizeof(struct inotify_event))
-#define EVENT_BUF_LEN (1024 * (EVENT_SIZE + 16))
+#define WATCH_MAX_EVENTS 16
+#define WATCH_DEBOUNCE_MS 2000 /* Quiet time after the last event of a file before it is backed up. */
 
 /**
  * @cond HIDE_THIS_CLASS
@@ -27,12 +31,28 @@ public:
  */
 class WatchService : public IWatch
 {
+private:
+    int _debounceMs = WATCH_DEBOUNCE_MS;
+    vector<string> _excludes;
 
 public:
     WatchService() = default;
+    explicit WatchService(int debounceMs) : _debounceMs(debounceMs) {}
     ~WatchService();
 
+    /**
+     * Leaves `paths` out of the watched trees, in addition to the backup directory and the agent's log directory,
+     * which are always excluded.
+     */
+    void exclude(const vector<string> &paths) { _excludes = paths; }
+
     int start(const string watchDirectory, const string backupDirectory);
+
+    /**
+     * Watches every root recursively and keeps a version of each changed file in `backupDirectory`, named by its full
+     * path.
+     */
+    int start(const vector<string> &watchDirectories, const string backupDirectory);
 };
 
 /**
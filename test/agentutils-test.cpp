@@ -1,4 +1,5 @@
 #include "agentUtils.hpp"
+#include "tempdir.hpp"
 #include <gtest/gtest.h>
 
 TEST( Utilities, TrimSuccess )
@@ -17,6 +18,33 @@ TEST( Utilities, TrimSuccess )
     EXPECT_STREQ(result.c_str(), "Aunty spotted");
 }
 
+struct JsonFilesTest : public TempDirTest
+{
+};
+
+TEST_F( JsonFilesTest, ReadsOnlyFinishedFiles )
+{
+    std::filesystem::create_directories(root + "/process");
+    ASSERT_EQ(OS::writeFileAtomic(root + "/process/1.json", "{}\n"), SUCCESS);
+    ASSERT_EQ(OS::writeFileAtomic(root + "/2.json", "{}\n"), SUCCESS);
+    // A writer still in progress.
+    std::ofstream(root + "/process/3.json.tmp") << "{";
+
+    vector<string> files;
+    EXPECT_EQ(OS::readRegularFiles(root, files), SUCCESS);
+    std::sort(files.begin(), files.end());
+    ASSERT_EQ(files.size(), 2u);
+    EXPECT_EQ(files[0], root + "/2.json");
+    EXPECT_EQ(files[1], root + "/process/1.json");
+    EXPECT_FALSE(std::filesystem::exists(root + "/process/1.json.tmp"));
+
+    // A single file is the only one sent for its caller.
+    files.clear();
+    EXPECT_EQ(OS::readRegularFiles(root + "/2.json", files), SUCCESS);
+    ASSERT_EQ(files.size(), 1u);
+    EXPECT_EQ(files[0], root + "/2.json");
+}
+
 // int main(int argc, char **argv)
 // {
 //     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,78 @@
+#include "service/deltapatch.hpp"
+#include "service/downloader.hpp"
+#include "tempdir.hpp"
+#include <random>
+
+struct DeltaPatchTest : public TempDirTest
+{
+    string base;
+    std::mt19937 random{7};
+
+    void SetUp() override
+    {
+        TempDirTest::SetUp();
+        base = bytes(200000);
+        write(root + "/agent", base);
+    }
+
+    string bytes(size_t size)
+    {
+        string data;
+        for (size_t i = 0; i < size; i++)
+            data += (char)(random() & 0xff);
+        return data;
+    }
+
+    void write(const string &path, const string &content) { std::ofstream(path, std::ios::binary) << content; }
+
+    string read(const string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+};
+
+TEST_F(DeltaPatchTest, RebuildsTargetFromSmallPatch)
+{
+    // A new build: a function rewritten in the middle, code shifted by an insertion, a table appended.
+    string target = base.substr(0, 50000) + bytes(1000) + base.substr(52000, 100000) + bytes(37) + base.substr(152000) + bytes(3000);
+    write(root + "/agent.new", target);
+    ASSERT_EQ(DeltaPatch::create(root + "/agent", root + "/agent.new", root + "/agent.delta", 1024), SUCCESS);
+    EXPECT_LT(std::filesystem::file_size(root + "/agent.delta"), 10000u);
+
+    string digest, expected;
+    ASSERT_EQ(DeltaPatch::apply(root + "/agent", root + "/agent.delta", root + "/agent.staging", digest), SUCCESS);
+    ASSERT_EQ(SegmentedDownloader::sha256File(root + "/agent.new", expected), SUCCESS);
+    EXPECT_EQ(digest, expected);
+    EXPECT_TRUE(read(root + "/agent.staging") == target);
+}
+
+TEST_F(DeltaPatchTest, RejectsDifferentBase)
+{
+    write(root + "/agent.new", base + "tail");
+    ASSERT_EQ(DeltaPatch::create(root + "/agent", root + "/agent.new", root + "/agent.delta"), SUCCESS);
+
+    string changed = base;
+    changed[100] ^= 1;
+    write(root + "/agent", changed);
+    string digest;
+    EXPECT_EQ(DeltaPatch::apply(root + "/agent", root + "/agent.delta", root + "/agent.staging", digest), FAILED);
+    EXPECT_FALSE(std::filesystem::exists(root + "/agent.staging"));
+}
+
+TEST_F(DeltaPatchTest, RejectsCorruptPatch)
+{
+    write(root + "/agent.new", bytes(5000) + base);
+    ASSERT_EQ(DeltaPatch::create(root + "/agent", root + "/agent.new", root + "/agent.delta"), SUCCESS);
+
+    string patch = read(root + "/agent.delta");
+    patch[patch.size() / 2] ^= 0x55;
+    write(root + "/agent.delta", patch);
+    string digest;
+    EXPECT_EQ(DeltaPatch::apply(root + "/agent", root + "/agent.delta", root + "/agent.staging", digest), FAILED);
+    EXPECT_FALSE(std::filesystem::exists(root + "/agent.staging"));
+
+    write(root + "/agent.delta", patch.substr(0, patch.size() - 100));
+    EXPECT_EQ(DeltaPatch::apply(root + "/agent", root + "/agent.delta", root + "/agent.staging", digest), FAILED);
+    EXPECT_FALSE(std::filesystem::exists(root + "/agent.staging"));
+}
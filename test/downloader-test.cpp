@@ -0,0 +1,198 @@
+#include "service/downloader.hpp"
+#include "tempdir.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <random>
+#include <sys/socket.h>
+
+// Serves one file over keep-alive HTTP/1.1, answering HEAD and GET with or without a byte range.
+class RangeServer
+{
+private:
+    int _listenFd = -1;
+    std::thread _acceptor;
+    vector<std::thread> _connections;
+    std::mutex _mutex;
+
+    void _serve(int fd)
+    {
+        string buffer;
+        char chunk[4096];
+        while (true)
+        {
+            size_t headerEnd;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == string::npos)
+            {
+                ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+                if (bytes <= 0)
+                {
+                    close(fd);
+                    return;
+                }
+                buffer.append(chunk, bytes);
+            }
+            string header = buffer.substr(0, headerEnd);
+            buffer.erase(0, headerEnd + 4);
+            bool head = header.compare(0, 5, "HEAD ") == 0;
+            size_t first = 0, last = body.size() - 1;
+            size_t range = header.find("Range: bytes=");
+            bool partial = range != string::npos && !ignoreRanges;
+            if (partial)
+                sscanf(header.c_str() + range + 13, "%zu-%zu", &first, &last);
+
+            bool fail;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!head)
+                    gets.push_back(first);
+                fail = !head && partial && first >= failFrom;
+            }
+            string response;
+            if (fail)
+                response = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+            else
+            {
+                response = string(partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n") +
+                           (ignoreRanges ? "" : "Accept-Ranges: bytes\r\n") + "ETag: \"v1\"\r\n" +
+                           "Content-Length: " + std::to_string(last - first + 1) + "\r\n";
+                if (partial)
+                    response += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(body.size()) + "\r\n";
+                response += "\r\n";
+                if (!head)
+                    response += body.substr(first, last - first + 1);
+            }
+            send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+
+public:
+    string body;
+    bool ignoreRanges = false;
+    size_t failFrom = SIZE_MAX; /**< Range requests starting at or after this offset get HTTP 503. */
+    vector<size_t> gets;
+    int port = 0;
+
+    explicit RangeServer(const string &content) : body(content)
+    {
+        _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(address);
+        if (bind(_listenFd, (struct sockaddr *)&address, size) != 0 || listen(_listenFd, 64) != 0)
+            return;
+        getsockname(_listenFd, (struct sockaddr *)&address, &size);
+        port = ntohs(address.sin_port);
+        _acceptor = std::thread([this] {
+            int fd;
+            while ((fd = accept(_listenFd, nullptr, nullptr)) >= 0)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _connections.emplace_back(&RangeServer::_serve, this, fd);
+            }
+        });
+    }
+
+    string url() const { return "http://127.0.0.1:" + std::to_string(port) + "/firmware.bin"; }
+
+    ~RangeServer()
+    {
+        shutdown(_listenFd, SHUT_RDWR);
+        close(_listenFd);
+        if (_acceptor.joinable())
+            _acceptor.join();
+        for (std::thread &connection : _connections)
+            connection.join();
+    }
+};
+
+struct DownloaderTest : public TempDirTest
+{
+    string image;
+    string expected;
+
+    void SetUp() override
+    {
+        TempDirTest::SetUp();
+        std::mt19937 random(42);
+        for (int i = 0; i < 300000; i++)
+            image += (char)(random() & 0xff);
+        std::ofstream(root + "/reference", std::ios::binary) << image;
+        ASSERT_EQ(SegmentedDownloader::sha256File(root + "/reference", expected), SUCCESS);
+    }
+
+    string read(const string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+};
+
+TEST_F(DownloaderTest, DownloadsChunksConcurrently)
+{
+    RangeServer server(image);
+    ASSERT_NE(server.port, 0);
+    SegmentedDownloader downloader(server.url(), root + "/firmware.bin", 4, 32768);
+    ASSERT_EQ(downloader.probe(), SUCCESS);
+    EXPECT_EQ(downloader.length(), image.size());
+    ASSERT_EQ(downloader.run(), SUCCESS);
+
+    EXPECT_EQ(server.gets.size(), 10u);
+    EXPECT_EQ(downloader.digest(), expected);
+    EXPECT_TRUE(read(root + "/firmware.bin") == image);
+    EXPECT_FALSE(std::filesystem::exists(root + "/firmware.bin" DOWNLOAD_SIDECAR_SUFFIX));
+}
+
+TEST_F(DownloaderTest, ResumesMissingChunksOnly)
+{
+    {
+        RangeServer server(image);
+        server.failFrom = 5 * 32768;
+        SegmentedDownloader downloader(server.url(), root + "/firmware.bin", 2, 32768);
+        ASSERT_EQ(downloader.probe(), SUCCESS);
+        EXPECT_EQ(downloader.run(), FAILED);
+        EXPECT_TRUE(downloader.digest().empty());
+        EXPECT_TRUE(std::filesystem::exists(root + "/firmware.bin" DOWNLOAD_SIDECAR_SUFFIX));
+    }
+
+    RangeServer server(image);
+    SegmentedDownloader downloader(server.url(), root + "/firmware.bin", 2, 32768);
+    ASSERT_EQ(downloader.probe(), SUCCESS);
+    ASSERT_EQ(downloader.run(), SUCCESS);
+    EXPECT_EQ(server.gets.size(), 5u);
+    for (size_t offset : server.gets)
+        EXPECT_GE(offset, 5u * 32768);
+    EXPECT_EQ(downloader.digest(), expected);
+    EXPECT_TRUE(read(root + "/firmware.bin") == image);
+}
+
+TEST_F(DownloaderTest, RestartsWhenFileChanged)
+{
+    {
+        RangeServer server(image);
+        server.failFrom = 32768;
+        SegmentedDownloader downloader(server.url(), root + "/firmware.bin", 1, 32768);
+        ASSERT_EQ(downloader.probe(), SUCCESS);
+        EXPECT_EQ(downloader.run(), FAILED);
+    }
+
+    // Same length, different content and chunk size: the sidecar does not match, so nothing is reused.
+    string changed = image;
+    changed[0] ^= 1;
+    RangeServer server(changed);
+    SegmentedDownloader downloader(server.url(), root + "/firmware.bin", 4, 65536);
+    ASSERT_EQ(downloader.probe(), SUCCESS);
+    ASSERT_EQ(downloader.run(), SUCCESS);
+    EXPECT_EQ(server.gets.size(), 5u);
+    EXPECT_NE(downloader.digest(), expected);
+    EXPECT_TRUE(read(root + "/firmware.bin") == changed);
+}
+
+TEST_F(DownloaderTest, DeclinesServerWithoutRanges)
+{
+    RangeServer server(image);
+    server.ignoreRanges = true;
+    SegmentedDownloader downloader(server.url(), root + "/firmware.bin");
+    EXPECT_EQ(downloader.probe(), FAILED);
+}
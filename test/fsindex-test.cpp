@@ -0,0 +1,84 @@
+#include "rootkit/dev_check.hpp"
+#include "rootkit/sysfile_check.hpp"
+#include "tempdir.hpp"
+#include <sys/mount.h>
+
+struct FsIndexTest : public TempDirTest
+{
+    void SetUp() override
+    {
+        TempDirTest::SetUp();
+        for (const char *dir : {"/usr/lib/.ark", "/tmp/a/b", "/proc/1", "/dev/shm", "/dev/pts", "/dev/fd"})
+            std::filesystem::create_directories(root + dir);
+        for (const char *file : {"/tmp/mcliZokhb", "/tmp/a/b/.ark", "/proc/1/.ark", "/dev/.hidden", "/dev/shm/keep",
+                                   "/dev/fd/skip", "/signatures.txt"})
+            std::ofstream(root + file) << "x";
+        std::filesystem::create_symlink(root + "/tmp", root + "/dev/link");
+
+        std::ofstream(root + "/signatures.txt") << "# file ! name ::link\n"
+                                                   "tmp/mcliZokhb           ! Bash door ::/rootkits/bashdoor.php\n"
+                                                   "usr/lib/libt            ! Missing ::/rootkits/missing.php\n"
+                                                   "*/.ark                  ! Ark Trojan ::/rootkits/ark.php\n";
+    }
+};
+
+TEST_F(FsIndexTest, SysCheckMatchesPathsAndWildcardsInOneWalk)
+{
+    SysCheck check(root);
+    FsIndex index(root);
+    ASSERT_EQ(check.load(root + "/signatures.txt", index), SUCCESS);
+    ASSERT_EQ(index.build(), SUCCESS);
+    ASSERT_EQ(check.check(index), SUCCESS);
+
+    // tmp/mcliZokhb, usr/lib/.ark and tmp/a/b/.ark; proc is not walked.
+    EXPECT_EQ(check.getTotal(), 3);
+    EXPECT_EQ(check.getFindings(), 3);
+    for (const fs_match &match : index.matches())
+        EXPECT_EQ(match.path.find(root + "/proc"), string::npos);
+}
+
+TEST_F(FsIndexTest, DevCheckSkipsIgnoredSubtreesAndLinks)
+{
+    FsIndex index(root);
+    index.retain(root + "/dev");
+    ASSERT_EQ(index.build(), SUCCESS);
+
+    DevCheck check;
+    ASSERT_EQ(check.check(index, root + "/dev"), SUCCESS);
+    // .hidden is the only regular file outside the ignored shm and fd directories.
+    EXPECT_EQ(check.getFindings(), 1);
+    // .hidden, shm, pts, fd and link.
+    EXPECT_EQ(check.getTotal(), 5);
+}
+
+TEST_F(FsIndexTest, PathsBehindLinksAreNotReachable)
+{
+    FsIndex index(root);
+    index.ignorePath(root + "/proc");
+    EXPECT_TRUE(index.isReachable(root + "/tmp/mcliZokhb"));
+    EXPECT_FALSE(index.isReachable(root + "/proc/1/.ark"));
+    EXPECT_FALSE(index.isReachable(root + "/dev/link/mcliZokhb"));
+}
+
+TEST_F(FsIndexTest, StaysOnTheRootFileSystem)
+{
+    std::filesystem::create_directories(root + "/mnt");
+    if (mount("none", (root + "/mnt").c_str(), "tmpfs", 0, nullptr) != 0)
+        GTEST_SKIP() << "mounting needs CAP_SYS_ADMIN";
+    std::ofstream(root + "/mnt/.ark") << "x";
+
+    FsIndex index(root);
+    index.addSuffix("/.ark", 1);
+    ASSERT_EQ(index.build(), SUCCESS);
+    for (const fs_match &match : index.matches())
+        EXPECT_EQ(match.path.find(root + "/mnt/"), string::npos);
+    EXPECT_FALSE(index.isReachable(root + "/mnt/.ark"));
+
+    // A retained subtree is walked on its own file system.
+    FsIndex retained(root);
+    retained.retain(root + "/mnt");
+    ASSERT_EQ(retained.build(), SUCCESS);
+    EXPECT_EQ(retained.entries().size(), 2u);
+    EXPECT_TRUE(retained.isReachable(root + "/mnt/.ark"));
+    umount((root + "/mnt").c_str());
+}
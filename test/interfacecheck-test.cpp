@@ -0,0 +1,86 @@
+#include "rootkit/interface_check.hpp"
+#include <gtest/gtest.h>
+
+// Builds a link message as the kernel sends it: an ifinfomsg followed by an IFLA_IFNAME attribute.
+static vector<char> linkMessage(unsigned short type, int index, unsigned int flags, const string &name)
+{
+    vector<char> buffer(NLMSG_SPACE(sizeof(struct ifinfomsg)) + RTA_SPACE(name.size() + 1));
+    struct nlmsghdr *header = (struct nlmsghdr *)buffer.data();
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)) + RTA_LENGTH(name.size() + 1);
+    header->nlmsg_type = type;
+    struct ifinfomsg *info = (struct ifinfomsg *)NLMSG_DATA(header);
+    info->ifi_family = AF_UNSPEC;
+    info->ifi_index = index;
+    info->ifi_flags = flags;
+    struct rtattr *attribute = IFLA_RTA(info);
+    attribute->rta_type = IFLA_IFNAME;
+    attribute->rta_len = RTA_LENGTH(name.size() + 1);
+    memcpy(RTA_DATA(attribute), name.c_str(), name.size() + 1);
+    return buffer;
+}
+
+static link_info parsed(const vector<char> &message)
+{
+    link_info link;
+    EXPECT_TRUE(InterfaceCheck::parseLink((const struct nlmsghdr *)message.data(), link));
+    return link;
+}
+
+static vector<string> names(const vector<link_info> &links)
+{
+    vector<string> result;
+    for (const link_info &link : links)
+        result.push_back(link.name);
+    return result;
+}
+
+TEST(InterfaceCheckTest, ParsesNewLinkMessages)
+{
+    link_info link = parsed(linkMessage(RTM_NEWLINK, 3, IFF_UP | IFF_PROMISC, "eth0"));
+    EXPECT_EQ(link.index, 3);
+    EXPECT_EQ(link.flags, (unsigned int)(IFF_UP | IFF_PROMISC));
+    EXPECT_EQ(link.name, "eth0");
+
+    vector<char> removed = linkMessage(RTM_DELLINK, 3, IFF_UP, "eth0");
+    EXPECT_FALSE(InterfaceCheck::parseLink((const struct nlmsghdr *)removed.data(), link));
+
+    vector<char> truncated = linkMessage(RTM_NEWLINK, 3, IFF_UP, "eth0");
+    ((struct nlmsghdr *)truncated.data())->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg) - 1);
+    EXPECT_FALSE(InterfaceCheck::parseLink((const struct nlmsghdr *)truncated.data(), link));
+}
+
+TEST(InterfaceCheckTest, ReportsOnlyPromiscuousTransitions)
+{
+    InterfaceCheck check;
+    link_info up = parsed(linkMessage(RTM_NEWLINK, 2, IFF_UP, "eth0"));
+    link_info promiscuous = parsed(linkMessage(RTM_NEWLINK, 2, IFF_UP | IFF_PROMISC, "eth0"));
+
+    EXPECT_TRUE(check.updateFlags({up}).empty());
+    EXPECT_EQ(names(check.updateFlags({promiscuous})), vector<string>({"eth0"}));
+    // Further notifications while it stays promiscuous, such as an address change, are not reported again.
+    EXPECT_TRUE(check.updateFlags({promiscuous}).empty());
+    EXPECT_TRUE(check.updateFlags({up}).empty());
+    EXPECT_EQ(names(check.updateFlags({promiscuous})), vector<string>({"eth0"}));
+
+    // An interface seen for the first time is reported if it is already promiscuous.
+    link_info added = parsed(linkMessage(RTM_NEWLINK, 7, IFF_PROMISC, "veth1"));
+    EXPECT_EQ(names(check.updateFlags({added})), vector<string>({"veth1"}));
+}
+
+TEST(InterfaceCheckTest, RescanAfterOverflowReportsMissedTransitions)
+{
+    InterfaceCheck check;
+    link_info lo = parsed(linkMessage(RTM_NEWLINK, 1, IFF_UP | IFF_LOOPBACK, "lo"));
+    link_info eth0 = parsed(linkMessage(RTM_NEWLINK, 2, IFF_UP, "eth0"));
+    link_info wlan0 = parsed(linkMessage(RTM_NEWLINK, 3, IFF_UP | IFF_PROMISC, "wlan0"));
+    EXPECT_EQ(names(check.updateFlags({lo, eth0, wlan0}, true)), vector<string>({"wlan0"}));
+
+    // The notifications were lost while eth0 entered promiscuous mode; the dump finds it, and only it.
+    link_info eth0Promiscuous = parsed(linkMessage(RTM_NEWLINK, 2, IFF_UP | IFF_PROMISC, "eth0"));
+    EXPECT_EQ(names(check.updateFlags({lo, eth0Promiscuous, wlan0}, true)), vector<string>({"eth0"}));
+
+    // wlan0 is gone from the next dump, so an interface later created with its index is reported.
+    EXPECT_TRUE(check.updateFlags({lo, eth0Promiscuous}, true).empty());
+    link_info reused = parsed(linkMessage(RTM_NEWLINK, 3, IFF_UP | IFF_PROMISC, "tap0"));
+    EXPECT_EQ(names(check.updateFlags({reused})), vector<string>({"tap0"}));
+}
@@ -0,0 +1,79 @@
+#include "service/monitor.hpp"
+#include <gtest/gtest.h>
+
+static host_info testHost()
+{
+    host_info host;
+    host.pageSize = 4096;
+    host.clockTicks = 100;
+    host.upTime = 1000.0;
+    return host;
+}
+
+static proc_stat testStat(unsigned long long startTime, unsigned long long ticks, long long rss)
+{
+    proc_stat stat;
+    stat.startTime = startTime;
+    stat.utime = ticks;
+    stat.rss = rss;
+    return stat;
+}
+
+TEST(MonitorTest, DeltaCoversTheInterval)
+{
+    process_sample previous;
+    previous.startTime = 5000;
+    previous.cpuTicks = 300;
+    previous.rss = 100;
+    previous.ioBytes = 1000;
+    proc_stat stat = testStat(5000, 800, 150);
+    proc_io io;
+    io.readBytes = 3000;
+    io.writeBytes = 8000;
+
+    process_delta delta = MonitorService::computeDelta(stat, &io, &previous, testHost(), 10.0);
+    EXPECT_TRUE(delta.continued);
+    EXPECT_NEAR(delta.cpuUsage, 50.0, 1e-9); // 5 s of CPU over 10 s.
+    EXPECT_NEAR(delta.memChange, 50.0 * 4096, 1e-9);
+    EXPECT_NEAR(delta.diskRate, 1000.0, 1e-9);
+}
+
+TEST(MonitorTest, DeltaTreatsReusedPidAsNewProcess)
+{
+    process_sample previous;
+    previous.startTime = 5000;
+    previous.cpuTicks = 300;
+    previous.rss = 100;
+    proc_stat stat = testStat(90000, 200, 150);
+    proc_io io;
+    io.writeBytes = 8000;
+
+    // Started 100 s ago and used 2 s of CPU since.
+    process_delta delta = MonitorService::computeDelta(stat, &io, &previous, testHost(), 10.0);
+    EXPECT_FALSE(delta.continued);
+    EXPECT_NEAR(delta.cpuUsage, 2.0, 1e-9);
+    EXPECT_EQ(delta.memChange, 0.0);
+    EXPECT_EQ(delta.diskRate, 0.0);
+}
+
+TEST(MonitorTest, DeltaIgnoresMissingOrResetCounters)
+{
+    process_sample previous;
+    previous.startTime = 5000;
+    previous.cpuTicks = 300;
+    previous.ioBytes = 5000;
+    proc_stat stat = testStat(5000, 200, 0);
+    proc_io io;
+    io.readBytes = 100;
+
+    process_delta delta = MonitorService::computeDelta(stat, &io, &previous, testHost(), 10.0);
+    EXPECT_TRUE(delta.continued);
+    EXPECT_EQ(delta.cpuUsage, 0.0);
+    EXPECT_EQ(delta.diskRate, 0.0);
+    EXPECT_EQ(MonitorService::computeDelta(stat, nullptr, &previous, testHost(), 10.0).diskRate, 0.0);
+
+    // Without a previous round the lifetime average is used: 2 s of CPU over 950 s.
+    process_delta first = MonitorService::computeDelta(stat, &io, nullptr, testHost(), 0.0);
+    EXPECT_FALSE(first.continued);
+    EXPECT_NEAR(first.cpuUsage, 200.0 / 950.0, 1e-9);
+}
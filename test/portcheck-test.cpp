@@ -0,0 +1,45 @@
+#include "rootkit/ports_check.hpp"
+#include "tempdir.hpp"
+
+struct PortCheckTest : public TempDirTest
+{
+    void SetUp() override
+    {
+        TempDirTest::SetUp();
+        std::ofstream(root + "/tcp") << "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n"
+                                        "   0: 0100007F:0CEA 00000000:0000 0A 00000000:00000000 00:00000000 00000000   108        0 27015 1 0000000000000000 100 0 0 10 0\n"
+                                        "  12: 0A00020F:D8A2 5DB8D822:01BB 01 00000000:00000000 02:000009D6 00000000  1000        0 48213 2 0000000000000000 20 4 30 10 -1\n";
+        std::ofstream(root + "/tcp6") << "  sl  local_address                         remote_address                        st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n"
+                                         "   0: 00000000000000000000000000000000:1F90 00000000000000000000000000000000:0000 0A 00000000:00000000 00:00000000 00000000     0        0 31077 1 0000000000000000 100 0 0 10 0\n"
+                                         "   1: 0000000000000000FFFF00000100007F:FFFF 0000000000000000FFFF00000100007F:9C40 01 00000000:00000000 00:00000000 00000000     0        0 31078 1 0000000000000000 20 4 30 10 -1\n"
+                                         "garbage line\n";
+    }
+};
+
+TEST_F(PortCheckTest, ReadsLocalPortsOfIpv4AndIpv6Sockets)
+{
+    PortCheck check;
+    std::bitset<MAX_PORT + 1> ports;
+    ASSERT_EQ(check.readProcNet((root + "/tcp").c_str(), ports), SUCCESS);
+    EXPECT_EQ(ports.count(), 2u);
+    EXPECT_TRUE(ports.test(3306));
+    EXPECT_TRUE(ports.test(55458));
+
+    ASSERT_EQ(check.readProcNet((root + "/tcp6").c_str(), ports), SUCCESS);
+    EXPECT_EQ(ports.count(), 4u);
+    EXPECT_TRUE(ports.test(8080));
+    EXPECT_TRUE(ports.test(65535));
+    // Remote ports are not local sockets.
+    EXPECT_FALSE(ports.test(443));
+    EXPECT_FALSE(ports.test(40000));
+}
+
+TEST_F(PortCheckTest, SkipsHeaderAndMissingFiles)
+{
+    PortCheck check;
+    std::bitset<MAX_PORT + 1> ports;
+    std::ofstream(root + "/empty") << "  sl  local_address rem_address   st\n";
+    EXPECT_EQ(check.readProcNet((root + "/empty").c_str(), ports), SUCCESS);
+    EXPECT_EQ(check.readProcNet((root + "/missing").c_str(), ports), FAILED);
+    EXPECT_TRUE(ports.none());
+}
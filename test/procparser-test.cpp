@@ -0,0 +1,101 @@
+#include "service/procparser.hpp"
+#include <gtest/gtest.h>
+
+TEST(ProcParserTest, ParseStatWithSpacesInName)
+{
+    string line = "1234 (tmux: server) S 1 1234 1234 0 -1 4194560 1603 0 0 0 57 31 4 2 20 -5 1 0 9876 14245888 1029 "
+                  "18446744073709551615 1 1 0 0 0 0 0 4096 134301699 0 0 0 17 3 0 0 0 0 0\n";
+    proc_stat stat;
+    ASSERT_TRUE(ProcParser::parseStat(line.data(), line.size(), stat));
+    EXPECT_EQ(stat.pid, 1234);
+    EXPECT_EQ(stat.state, 'S');
+    EXPECT_EQ(stat.ppid, 1);
+    EXPECT_EQ(stat.utime, 57u);
+    EXPECT_EQ(stat.stime, 31u);
+    EXPECT_EQ(stat.cutime, 4);
+    EXPECT_EQ(stat.cstime, 2);
+    EXPECT_EQ(stat.nice, -5);
+    EXPECT_EQ(stat.startTime, 9876u);
+    EXPECT_EQ(stat.vsize, 14245888u);
+    EXPECT_EQ(stat.rss, 1029);
+}
+
+TEST(ProcParserTest, ParseStatRejectsTruncated)
+{
+    string line = "1234 (bash) S 1 1234 1234 0 -1";
+    proc_stat stat;
+    EXPECT_FALSE(ProcParser::parseStat(line.data(), line.size(), stat));
+}
+
+TEST(ProcParserTest, ParseStatmIoAndUptime)
+{
+    string statm = "3478 1029 815 210 0 379 0\n";
+    unsigned long long resident = 0;
+    ASSERT_TRUE(ProcParser::parseStatm(statm.data(), statm.size(), resident));
+    EXPECT_EQ(resident, 1029u);
+
+    string io = "rchar: 2012\nwchar: 10\nsyscr: 7\nsyscw: 1\nread_bytes: 4096\nwrite_bytes: 8192\n"
+                "cancelled_write_bytes: 0\n";
+    proc_io counters;
+    ASSERT_TRUE(ProcParser::parseIo(io.data(), io.size(), counters));
+    EXPECT_EQ(counters.readBytes, 4096u);
+    EXPECT_EQ(counters.writeBytes, 8192u);
+
+    string uptime = "35821.57 140012.90\n";
+    double upTime = 0.0;
+    ASSERT_TRUE(ProcParser::parseUpTime(uptime.data(), uptime.size(), upTime));
+    EXPECT_NEAR(upTime, 35821.57, 1e-6);
+}
+
+TEST(ProcParserTest, ReadsOwnProcess)
+{
+    ProcParser parser;
+    ASSERT_TRUE(parser.isOpen());
+    proc_stat stat;
+    ASSERT_EQ(parser.readStat(getpid(), stat), SUCCESS);
+    EXPECT_EQ(stat.pid, getpid());
+
+    string name;
+    EXPECT_EQ(parser.readComm(getpid(), name), SUCCESS);
+    EXPECT_FALSE(name.empty());
+
+    vector<int> processIds;
+    ASSERT_EQ(parser.listPids(processIds), SUCCESS);
+    EXPECT_NE(std::find(processIds.begin(), processIds.end(), getpid()), processIds.end());
+}
+
+TEST(ProcParserTest, ParseHostCounters)
+{
+    string stat = "cpu  100 5 50 800 40 3 2 0 0 0\ncpu0 50 2 25 400 20 1 1 0 0 0\n";
+    unsigned long long busy = 0, total = 0;
+    ASSERT_TRUE(ProcParser::parseCpuTimes(stat.data(), stat.size(), busy, total));
+    EXPECT_EQ(total, 1000u);
+    EXPECT_EQ(busy, 160u);
+
+    string meminfo = "MemTotal:       16000000 kB\nMemFree:         1000000 kB\nMemAvailable:    4000000 kB\n";
+    unsigned long long memTotal = 0, available = 0;
+    ASSERT_TRUE(ProcParser::parseMemInfo(meminfo.data(), meminfo.size(), memTotal, available));
+    EXPECT_EQ(memTotal, 16000000u);
+    EXPECT_EQ(available, 4000000u);
+
+    string netdev = "Inter-|   Receive                                                |  Transmit\n"
+                    " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n"
+                    "    lo: 5000      50    0    0    0     0          0         0     5000      50    0    0    0     0       0          0\n"
+                    "  eth0: 1200      10    0    0    0     0          0         0      800       8    0    0    0     0       0          0\n"
+                    "  eth1:300 3 0 0 0 0 0 0 200 2 0 0 0 0 0 0\n";
+    unsigned long long received = 0, transmitted = 0;
+    ASSERT_TRUE(ProcParser::parseNetDev(netdev.data(), netdev.size(), received, transmitted));
+    EXPECT_EQ(received, 1500u);
+    EXPECT_EQ(transmitted, 1000u);
+}
+
+TEST(ProcParserTest, ListsOwnThreads)
+{
+    ProcParser parser;
+    std::thread worker([] { std::this_thread::sleep_for(std::chrono::milliseconds(200)); });
+    vector<int> threadIds;
+    ASSERT_EQ(parser.listTasks(getpid(), threadIds), SUCCESS);
+    worker.join();
+    EXPECT_GE(threadIds.size(), 2u);
+    EXPECT_NE(std::find(threadIds.begin(), threadIds.end(), getpid()), threadIds.end());
+}
@@ -0,0 +1,50 @@
+#include "service/sampler.hpp"
+#include <gtest/gtest.h>
+
+TEST(TimeSeriesTest, KeepsMostRecentSamples)
+{
+    TimeSeries<long long> series(4);
+    vector<long long> samples;
+    EXPECT_EQ(series.snapshot(samples, 10), 0u);
+    for (long long i = 1; i <= 6; i++)
+    {
+        series.push(i);
+    }
+    EXPECT_EQ(series.size(), 4u);
+    ASSERT_EQ(series.snapshot(samples, 10), 4u);
+    EXPECT_EQ(samples.front(), 3);
+    EXPECT_EQ(samples.back(), 6);
+    ASSERT_EQ(series.snapshot(samples, 2), 2u);
+    EXPECT_EQ(samples.front(), 5);
+    long long latest = 0;
+    ASSERT_TRUE(series.latest(latest));
+    EXPECT_EQ(latest, 6);
+}
+
+TEST(SystemSamplerTest, RollsUpBackgroundSamples)
+{
+    SystemSampler sampler(16, 50);
+    ASSERT_EQ(sampler.start(), SUCCESS);
+    EXPECT_TRUE(sampler.isRunning());
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    sampler.stop();
+    EXPECT_FALSE(sampler.isRunning());
+
+    system_sample sample;
+    ASSERT_TRUE(sampler.latest(sample));
+    EXPECT_GT(sample.ramTotal, 0.0);
+    EXPECT_GE(sample.cpuUsage, 0.0);
+    EXPECT_LE(sample.cpuUsage, 100.0);
+
+    vector<sample_rollup> rollups = sampler.rollup(0, 3600);
+    ASSERT_FALSE(rollups.empty());
+    size_t count = 0;
+    for (const sample_rollup &rollup : rollups)
+    {
+        EXPECT_LE(rollup.ramUsage.min, rollup.ramUsage.avg);
+        EXPECT_LE(rollup.ramUsage.avg, rollup.ramUsage.max);
+        count += rollup.count;
+    }
+    EXPECT_GE(count, 3u);
+    EXPECT_TRUE(sampler.rollup(sample.timestamp).empty());
+}
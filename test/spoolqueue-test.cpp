@@ -0,0 +1,149 @@
+#include "service/spoolqueue.hpp"
+#include "tempdir.hpp"
+
+struct SpoolQueueTest : public TempDirTest
+{
+    static string record(int i) { return "{\"Id\": " + std::to_string(i) + ", \"Message\": \"" + string(100, 'x') + "\"}"; }
+
+    static vector<string> drain(SpoolQueue &queue, size_t maxBytes = 1000)
+    {
+        vector<string> all;
+        while (true)
+        {
+            vector<string> records;
+            spool_position next;
+            EXPECT_EQ(queue.peek(queue.committed(), maxBytes, records, next), SUCCESS);
+            if (records.empty())
+                return all;
+            all.insert(all.end(), records.begin(), records.end());
+            queue.commit(next);
+        }
+    }
+};
+
+TEST_F(SpoolQueueTest, ResumesAfterCommittedPositionAcrossRestart)
+{
+    spool_position next;
+    {
+        SpoolQueue queue(root, 1 << 20, 1024);
+        ASSERT_EQ(queue.open(), SUCCESS);
+        for (int i = 0; i < 50; i++)
+            ASSERT_EQ(queue.push(record(i)), SUCCESS);
+        ASSERT_EQ(queue.sync(), SUCCESS);
+
+        vector<string> records;
+        ASSERT_EQ(queue.peek(queue.committed(), 1000, records, next), SUCCESS);
+        ASSERT_EQ(records.size(), 8u);
+        EXPECT_EQ(records[0], record(0));
+        ASSERT_EQ(queue.commit(next), SUCCESS);
+
+        // Peeking ahead does not move the committed position.
+        records.clear();
+        spool_position ahead;
+        ASSERT_EQ(queue.peek(next, 1000, records, ahead), SUCCESS);
+        EXPECT_EQ(records[0], record(8));
+    }
+
+    SpoolQueue reopened(root, 1 << 20, 1024);
+    ASSERT_EQ(reopened.open(), SUCCESS);
+    EXPECT_EQ(reopened.committed().segment, next.segment);
+    EXPECT_EQ(reopened.committed().offset, next.offset);
+    vector<string> rest = drain(reopened);
+    ASSERT_EQ(rest.size(), 42u);
+    for (int i = 0; i < 42; i++)
+        EXPECT_EQ(rest[i], record(i + 8));
+
+    // Consumed segments are deleted, only the one being written remains.
+    size_t segments = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(root))
+        segments += entry.path().extension() == SPOOL_SEGMENT_SUFFIX;
+    EXPECT_EQ(segments, 1u);
+}
+
+TEST_F(SpoolQueueTest, CutsTornRecordOnOpen)
+{
+    string segment;
+    {
+        SpoolQueue queue(root);
+        ASSERT_EQ(queue.open(), SUCCESS);
+        for (int i = 0; i < 3; i++)
+            ASSERT_EQ(queue.push(record(i)), SUCCESS);
+    }
+    for (const auto &entry : std::filesystem::directory_iterator(root))
+        if (entry.path().extension() == SPOOL_SEGMENT_SUFFIX)
+            segment = entry.path();
+    ASSERT_FALSE(segment.empty());
+    std::filesystem::resize_file(segment, std::filesystem::file_size(segment) - 10);
+
+    SpoolQueue queue(root);
+    ASSERT_EQ(queue.open(), SUCCESS);
+    ASSERT_EQ(queue.push(record(3)), SUCCESS);
+    vector<string> records = drain(queue);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0], record(0));
+    EXPECT_EQ(records[1], record(1));
+    EXPECT_EQ(records[2], record(3));
+}
+
+TEST_F(SpoolQueueTest, EvictsOldestWithinQuota)
+{
+    SpoolQueue queue(root, 4096, 1024);
+    ASSERT_EQ(queue.open(), SUCCESS);
+    EXPECT_TRUE(queue.accepting());
+    for (int i = 0; i < 200; i++)
+    {
+        ASSERT_EQ(queue.push(record(i)), SUCCESS);
+        EXPECT_LE(queue.usage(), 4096u);
+    }
+    EXPECT_GT(queue.evicted(), 0u);
+    EXPECT_EQ(queue.push(string(5000, 'x')), FAILED);
+
+    // The newest records survive, in order.
+    vector<string> records = drain(queue);
+    ASSERT_FALSE(records.empty());
+    EXPECT_EQ(records.back(), record(199));
+    for (size_t i = 1; i < records.size(); i++)
+        EXPECT_LT(std::stoi(records[i - 1].substr(7)), std::stoi(records[i].substr(7)));
+    EXPECT_LT(records.size(), 40u);
+}
+
+TEST_F(SpoolQueueTest, SignalsBackpressureNearQuota)
+{
+    SpoolQueue queue(root, 10000, 100000);
+    ASSERT_EQ(queue.open(), SUCCESS);
+    while (queue.accepting())
+        ASSERT_EQ(queue.push(record(0)), SUCCESS);
+    EXPECT_GE(queue.usage() * 100, 10000u * SPOOL_HIGH_WATER);
+
+    drain(queue);
+    ASSERT_EQ(queue.push(record(1)), SUCCESS);
+    EXPECT_TRUE(queue.accepting());
+}
+
+TEST_F(SpoolQueueTest, BacksOffWithJitterAndPersists)
+{
+    time_t now = 1000000;
+    {
+        SpoolQueue queue(root);
+        ASSERT_EQ(queue.open(), SUCCESS);
+        EXPECT_TRUE(queue.ready(now));
+        time_t previous = 0;
+        for (int i = 0; i < 12; i++)
+        {
+            time_t ceiling = std::min<time_t>(1800, (time_t)5 << i);
+            time_t delay = queue.onFailure(now, 5, 1800);
+            EXPECT_GE(delay, ceiling / 2);
+            EXPECT_LE(delay, ceiling);
+            EXPECT_GE(delay, previous / 2);
+            previous = delay;
+        }
+        EXPECT_FALSE(queue.ready(now));
+        EXPECT_TRUE(queue.ready(now + 1800));
+    }
+
+    SpoolQueue reopened(root);
+    ASSERT_EQ(reopened.open(), SUCCESS);
+    EXPECT_FALSE(reopened.ready(now));
+    reopened.onSuccess();
+    EXPECT_TRUE(reopened.ready(now));
+}
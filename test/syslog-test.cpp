@@ -0,0 +1,76 @@
+#include "service/tcp.hpp"
+#include <gtest/gtest.h>
+
+struct SyslogFramerTest : public testing::Test
+{
+    SyslogFramer *framer;
+    vector<string> messages;
+    void SetUp() { framer = new SyslogFramer(64); }
+    void TearDown() { delete framer; }
+
+    int feed(const string &data)
+    {
+        return framer->feed(data.data(), data.size(), [&](string &&message) { messages.push_back(std::move(message)); });
+    }
+};
+
+TEST_F(SyslogFramerTest, NewlineFraming)
+{
+    EXPECT_EQ(feed("<13>first message\n<13>second message\r\n"), 2);
+    ASSERT_EQ(messages.size(), 2u);
+    EXPECT_STREQ(messages[0].c_str(), "<13>first message");
+    EXPECT_STREQ(messages[1].c_str(), "<13>second message");
+}
+
+TEST_F(SyslogFramerTest, OctetCountingSplitAcrossReads)
+{
+    EXPECT_EQ(feed("17 <13>first mes"), 0);
+    EXPECT_EQ(feed("sage18 <13>second message"), 2);
+    ASSERT_EQ(messages.size(), 2u);
+    EXPECT_STREQ(messages[0].c_str(), "<13>first message");
+    EXPECT_STREQ(messages[1].c_str(), "<13>second message");
+}
+
+TEST_F(SyslogFramerTest, MixedFramingAndPartialLine)
+{
+    EXPECT_EQ(feed("5 <13>a<13>line one\n<13>li"), 2);
+    EXPECT_EQ(feed("ne two\n"), 1);
+    ASSERT_EQ(messages.size(), 3u);
+    EXPECT_STREQ(messages[0].c_str(), "<13>a");
+    EXPECT_STREQ(messages[2].c_str(), "<13>line two");
+}
+
+TEST_F(SyslogFramerTest, OversizedFramesAreTruncated)
+{
+    string line(100, 'x');
+    EXPECT_EQ(feed(line + "\n<13>next\n"), 2);
+    EXPECT_EQ(feed("100 " + line), 1);
+    ASSERT_EQ(messages.size(), 3u);
+    EXPECT_EQ(messages[0].size(), 64u);
+    EXPECT_STREQ(messages[1].c_str(), "<13>next");
+    EXPECT_EQ(messages[2].size(), 64u);
+    EXPECT_EQ(framer->truncated, 2u);
+}
+
+TEST_F(SyslogFramerTest, InvalidOctetCount)
+{
+    EXPECT_EQ(feed("12x <13>broken"), -1);
+}
+
+TEST(RingBufferTest, PushPopAndFull)
+{
+    RingBuffer<string> ring(4);
+    EXPECT_EQ(ring.capacity(), 4u);
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(ring.push(std::to_string(i)));
+    }
+    EXPECT_FALSE(ring.push("overflow"));
+    string item;
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(ring.pop(item));
+        EXPECT_STREQ(item.c_str(), std::to_string(i).c_str());
+    }
+    EXPECT_FALSE(ring.pop(item));
+}
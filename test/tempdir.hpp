@@ -0,0 +1,28 @@
+#ifndef TEST_TEMPDIR_HPP
+#define TEST_TEMPDIR_HPP
+
+#include "agentUtils.hpp"
+#include <gtest/gtest.h>
+
+/**
+ * @brief Temporary Directory Fixture
+ *
+ * Gives every test an empty directory `root`, named after its suite and the test process, and removes it afterwards.
+ * Suites with their own `SetUp` call `TempDirTest::SetUp` first.
+ */
+struct TempDirTest : public testing::Test
+{
+    string root;
+
+    void SetUp() override
+    {
+        const testing::TestInfo *info = testing::UnitTest::GetInstance()->current_test_info();
+        root = std::filesystem::temp_directory_path() / (string(info->test_suite_name()) + "-" + std::to_string(getpid()));
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root); }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "rootkit/trojen_check.hpp"
+#include "tempdir.hpp"
+
+TEST(AhoCorasickTest, FindsOverlappingPatterns)
+{
+    AhoCorasick matcher;
+    matcher.add("he", 0);
+    matcher.add("she", 1);
+    matcher.add("hers", 2);
+    matcher.add("his", 3);
+    matcher.build();
+
+    string text = "ushers";
+    vector<int> found;
+    matcher.scan(text.data(), text.size(), [&](int id) {
+        found.push_back(id);
+        return true;
+    });
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(found, vector<int>({0, 1, 2}));
+}
+
+struct TrojenCheckTest : public TempDirTest
+{
+    void SetUp() override
+    {
+        TempDirTest::SetUp();
+        std::filesystem::create_directories(root + "/bin");
+        std::filesystem::create_directories(root + "/usr/bin");
+        writeFile(root + "/signatures.txt",
+                  "# binary    !signature!\n"
+                  "ls          !bash|^/bin/sh|dev/[^clu]|\\.tmp/lsfile|duarawkz|/prof|/security|file\\.h!\n"
+                  "ps          !/dev/xmx|\\.1proc|proc\\.h|bash|^/bin/sh!\n"
+                  "login       !elite|SucKIT|xlogin|vejeta|porcao|/usr/bin/xstat|/bin/envpc!\n"
+                  "du          !w0rm|/prof|file\\.h!\n");
+    }
+
+    static void writeFile(const string &path, const string &content)
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << content;
+    }
+};
+
+TEST_F(TrojenCheckTest, DetectsSignatureAcrossBinaryContent)
+{
+    string clean(3000, '\0');
+    clean.replace(100, 12, "/usr/lib/ls.");
+    writeFile(root + "/bin/ls", clean);
+
+    string trojaned(3000, '\x7f');
+    // Past the last full 1 KB chunk, which the old reader dropped.
+    trojaned.replace(2990, 8, "duarawkz");
+    writeFile(root + "/usr/bin/ps", clean);
+    writeFile(root + "/usr/bin/login", trojaned.replace(40, 6, "xlogin"));
+    writeFile(root + "/usr/bin/du", string("w1rm /pro"));
+
+    TrojenCheck check(root);
+    ASSERT_EQ(check.check(root + "/signatures.txt"), SUCCESS);
+    EXPECT_EQ(check.getFindings(), 1);
+
+    writeFile(root + "/bin/ls", trojaned);
+    ASSERT_EQ(check.check(root + "/signatures.txt"), SUCCESS);
+    EXPECT_EQ(check.getFindings(), 2);
+}
+
+TEST_F(TrojenCheckTest, AnchoredSignatureMatchesOnlyAtStart)
+{
+    writeFile(root + "/bin/ps", "xx/bin/sh");
+    TrojenCheck check(root);
+    ASSERT_EQ(check.check(root + "/signatures.txt"), SUCCESS);
+    EXPECT_EQ(check.getFindings(), 0);
+
+    writeFile(root + "/bin/ps", "/bin/sh and more");
+    ASSERT_EQ(check.check(root + "/signatures.txt"), SUCCESS);
+    EXPECT_EQ(check.getFindings(), 1);
+}
+
+TEST_F(TrojenCheckTest, MissingSignatureFileFails)
+{
+    TrojenCheck check(root);
+    EXPECT_EQ(check.check(root + "/missing.txt"), FAILED);
+}
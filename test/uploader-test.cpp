@@ -0,0 +1,348 @@
+#include "service/curlservice.hpp"
+#include "tempdir.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <utime.h>
+
+// A keep-alive HTTP/1.1 stand-in for the log server: answers 200 on the `ok` path, /ok by default, and 500 on anything
+// else.
+class StandInServer
+{
+private:
+    int _listenFd = -1;
+    std::thread _acceptor;
+    vector<std::thread> _connections;
+    vector<int> _fds;
+    std::mutex _mutex;
+
+    void _serve(int fd)
+    {
+        string buffer;
+        char chunk[4096];
+        while (true)
+        {
+            size_t headerEnd;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == string::npos)
+            {
+                ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+                if (bytes <= 0)
+                    return;
+                buffer.append(chunk, bytes);
+            }
+            string header = buffer.substr(0, headerEnd);
+            size_t length = 0;
+            size_t field = header.find("Content-Length:");
+            if (field != string::npos)
+                length = std::stoul(header.substr(field + 15));
+            if (header.find("Expect: 100-continue") != string::npos)
+                send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+            while (buffer.size() < headerEnd + 4 + length)
+            {
+                ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+                if (bytes <= 0)
+                    return;
+                buffer.append(chunk, bytes);
+            }
+            bool accepted;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                accepted = header.compare(0, ok.size() + 6, "POST " + ok + " ") == 0;
+                requests++;
+                bodyBytes += length;
+                headers.push_back(header);
+                bodies.push_back(buffer.substr(headerEnd + 4, length));
+            }
+            buffer.erase(0, headerEnd + 4 + length);
+            string response = accepted ? "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"
+                                 : "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+            send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+
+public:
+    int port = 0;
+    size_t requests = 0;
+    size_t bodyBytes = 0;
+    size_t connections = 0;
+    vector<string> headers;
+    vector<string> bodies;
+    string ok = "/ok";
+
+    StandInServer()
+    {
+        _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(address);
+        if (bind(_listenFd, (struct sockaddr *)&address, size) != 0 || listen(_listenFd, 64) != 0)
+            return;
+        getsockname(_listenFd, (struct sockaddr *)&address, &size);
+        port = ntohs(address.sin_port);
+        _acceptor = std::thread([this] {
+            int fd;
+            while ((fd = accept(_listenFd, nullptr, nullptr)) >= 0)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                connections++;
+                _fds.push_back(fd);
+                _connections.emplace_back(&StandInServer::_serve, this, fd);
+            }
+        });
+    }
+
+    std::mutex &mutex() { return _mutex; }
+
+    string url(const string &path) const { return "http://127.0.0.1:" + std::to_string(port) + path; }
+
+    ~StandInServer()
+    {
+        shutdown(_listenFd, SHUT_RDWR);
+        close(_listenFd);
+        if (_acceptor.joinable())
+            _acceptor.join();
+        // Clients such as the shared CurlHandler may keep their connections open.
+        for (int fd : _fds)
+            shutdown(fd, SHUT_RDWR);
+        for (std::thread &connection : _connections)
+            connection.join();
+        for (int fd : _fds)
+            close(fd);
+    }
+};
+
+struct UploaderTest : public TempDirTest
+{
+    vector<string> files;
+
+    void SetUp() override
+    {
+        TempDirTest::SetUp();
+        for (int i = 0; i < 40; i++)
+        {
+            files.push_back(root + "/" + std::to_string(i) + ".json");
+            std::ofstream(files.back()) << "{\"Id\": " << i << ", \"Message\": \"" << string(1000, 'x') << "\"}";
+        }
+    }
+};
+
+TEST_F(UploaderTest, DeletesEveryAcceptedFile)
+{
+    std::unique_ptr<StandInServer> server(new StandInServer());
+    ASSERT_NE(server->port, 0);
+    size_t completed = 0;
+    {
+        MultiUploader uploader(4);
+        for (const string &file : files)
+        {
+            uploader.add({server->url("/ok"), "JsonFile", file, [&completed](const upload_request &done, long httpCode, CURLcode result) {
+                              EXPECT_EQ(result, CURLE_OK);
+                              if (httpCode == POST_SUCCESS)
+                                  OS::deleteFile(done.filePath);
+                              completed++;
+                          }});
+        }
+        EXPECT_EQ(uploader.pending(), files.size());
+        EXPECT_EQ(uploader.run(), SUCCESS);
+        EXPECT_EQ(uploader.pending(), 0u);
+    }
+    // Every request was answered, over no more connections than the limit.
+    EXPECT_EQ(server->requests, files.size());
+    EXPECT_LE(server->connections, 4u);
+    server.reset();
+
+    EXPECT_EQ(completed, files.size());
+    for (const string &file : files)
+        EXPECT_FALSE(std::filesystem::exists(file)) << file;
+}
+
+TEST_F(UploaderTest, KeepsFilesOnServerError)
+{
+    StandInServer server;
+    ASSERT_NE(server.port, 0);
+    MultiUploader uploader(4);
+    vector<long> codes;
+    for (size_t i = 0; i < 8; i++)
+    {
+        uploader.add({server.url(i % 2 ? "/fail" : "/ok"), "JsonFile", files[i], [&codes](const upload_request &done, long httpCode, CURLcode) {
+                          codes.push_back(httpCode);
+                          if (httpCode == POST_SUCCESS)
+                              OS::deleteFile(done.filePath);
+                      }});
+    }
+    EXPECT_EQ(uploader.run(), FAILED);
+
+    ASSERT_EQ(codes.size(), 8u);
+    EXPECT_EQ(std::count(codes.begin(), codes.end(), 500L), 4);
+    for (size_t i = 0; i < 8; i++)
+        EXPECT_EQ(std::filesystem::exists(files[i]), i % 2 == 1) << files[i];
+}
+
+TEST_F(UploaderTest, ReportsUnreachableServer)
+{
+    MultiUploader uploader(2);
+    long code = -1;
+    CURLcode error = CURLE_OK;
+    uploader.add({"http://127.0.0.1:1/ok", "JsonFile", files[0], [&](const upload_request &, long httpCode, CURLcode result) {
+                      code = httpCode;
+                      error = result;
+                  }});
+    EXPECT_EQ(uploader.run(), FAILED);
+    EXPECT_EQ(code, 0);
+    EXPECT_NE(error, CURLE_OK);
+    EXPECT_TRUE(std::filesystem::exists(files[0]));
+}
+
+TEST_F(UploaderTest, CompletesMissingFilesWithReadError)
+{
+    StandInServer server;
+    ASSERT_NE(server.port, 0);
+    MultiUploader uploader(2);
+    vector<CURLcode> errors;
+    auto record = [&errors](const upload_request &, long httpCode, CURLcode result) {
+        EXPECT_EQ(httpCode, 0);
+        errors.push_back(result);
+    };
+    uploader.add({server.url("/ok"), "JsonFile", root + "/missing.json", record});
+    uploader.add({server.url("/ok"), "JsonFile", root + "/missing.json", record, BATCH_CONTENT_TYPE, "gzip"});
+    EXPECT_EQ(uploader.run(), FAILED);
+    EXPECT_EQ(errors, vector<CURLcode>({CURLE_READ_ERROR, CURLE_READ_ERROR}));
+    EXPECT_EQ(server.requests, 0u);
+}
+
+static vector<string> readLines(const string &gzipPath)
+{
+    vector<string> lines;
+    gzFile input = gzopen(gzipPath.c_str(), "rb");
+    char line[4096];
+    while (input != nullptr && gzgets(input, line, sizeof(line)) != nullptr)
+        lines.push_back(line);
+    if (input != nullptr)
+        gzclose(input);
+    return lines;
+}
+
+TEST_F(UploaderTest, PacksFilesIntoCompressedBatches)
+{
+    PayloadBatcher batcher(root + "/batch", 10000, 3600);
+    vector<upload_batch> batches;
+    ASSERT_EQ(batcher.pack(files, batches, true), SUCCESS);
+
+    // About 1 KB per file, so nine files fit in each 10000 byte batch.
+    ASSERT_EQ(batches.size(), 5u);
+    size_t lines = 0;
+    for (const upload_batch &batch : batches)
+    {
+        EXPECT_LE(batch.rawBytes, 10000u);
+        EXPECT_LT(batch.compressedBytes, batch.rawBytes / 10);
+        vector<string> content = readLines(batch.path);
+        ASSERT_EQ(content.size(), batch.sources.size());
+        for (const string &line : content)
+        {
+            Json::Value value;
+            std::istringstream stream(line);
+            EXPECT_TRUE(Json::parseFromStream(Json::CharReaderBuilder(), stream, &value, nullptr)) << line;
+        }
+        lines += content.size();
+    }
+    EXPECT_EQ(lines, files.size());
+}
+
+TEST_F(UploaderTest, HoldsPartialBatchUntilDelay)
+{
+    PayloadBatcher batcher(root + "/batch", 10000, 3600);
+    vector<upload_batch> batches;
+    ASSERT_EQ(batcher.pack(files, batches), SUCCESS);
+    EXPECT_EQ(batches.size(), 4u);
+
+    // Once the remaining files are older than the delay they are sent without a full batch.
+    struct utimbuf old = {time(nullptr) - 7200, time(nullptr) - 7200};
+    for (size_t i = 36; i < files.size(); i++)
+        utime(files[i].c_str(), &old);
+    vector<string> rest(files.begin() + 36, files.end());
+    batches.clear();
+    ASSERT_EQ(batcher.pack(rest, batches), SUCCESS);
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0].sources.size(), 4u);
+}
+
+TEST_F(UploaderTest, SendsBatchWithContentEncoding)
+{
+    StandInServer server;
+    ASSERT_NE(server.port, 0);
+    PayloadBatcher batcher(root + "/batch");
+    vector<upload_batch> batches;
+    ASSERT_EQ(batcher.pack(files, batches, true), SUCCESS);
+    ASSERT_EQ(batches.size(), 1u);
+
+    MultiUploader uploader;
+    upload_request request{server.url("/ok"), "JsonFile", batches[0].path, nullptr, BATCH_CONTENT_TYPE, "gzip"};
+    uploader.add(request);
+    EXPECT_EQ(uploader.run(), SUCCESS);
+
+    // The whole body is the gzip stream, not a multipart form around it.
+    ASSERT_EQ(server.bodies.size(), 1u);
+    EXPECT_NE(server.headers[0].find("Content-Encoding: gzip"), string::npos);
+    EXPECT_NE(server.headers[0].find("Content-Type: " BATCH_CONTENT_TYPE), string::npos);
+    EXPECT_EQ(server.bodyBytes, batches[0].compressedBytes);
+    EXPECT_EQ(server.bodies[0].compare(0, 2, "\x1f\x8b"), 0);
+}
+
+TEST_F(UploaderTest, SplitsMultiLineFilesIntoRecords)
+{
+    // Documents appended one per line, as the monitor writes them, with a blank and a CRLF line.
+    string appended = root + "/appended.json";
+    std::ofstream(appended) << "{\"Id\": 1}\n\n{\"Id\": 2}\r\n{\"Id\": 3}";
+    PayloadBatcher batcher(root + "/batch");
+    vector<upload_batch> batches;
+    ASSERT_EQ(batcher.pack({appended}, batches, true), SUCCESS);
+    ASSERT_EQ(batches.size(), 1u);
+
+    vector<string> content = readLines(batches[0].path);
+    ASSERT_EQ(content.size(), 3u);
+    for (size_t i = 0; i < content.size(); i++)
+    {
+        Json::Value value;
+        std::istringstream stream(content[i]);
+        ASSERT_TRUE(Json::parseFromStream(Json::CharReaderBuilder(), stream, &value, nullptr)) << content[i];
+        EXPECT_EQ(value["Id"].asInt(), (int)i + 1);
+    }
+    EXPECT_EQ(batches[0].rawBytes, 30u);
+}
+
+TEST_F(UploaderTest, SpoolRecoversPastHighWater)
+{
+    StandInServer server;
+    ASSERT_NE(server.port, 0);
+    upload_options options;
+    options.spool = true;
+    options.spoolBytes = 44000;
+    options.retryBase = 1;
+    options.retryMax = 1;
+    options.directory = root + "/";
+
+    // Every file is spooled but the server refuses them, so the spool ends up past its high-water mark.
+    CurlHandler::post(server.url("/fail"), "JsonFile", root, options);
+    EXPECT_FALSE(CurlHandler::accepting(server.url("/fail"), "JsonFile", options));
+    size_t refused = server.requests;
+
+    // Checking backpressure never sends anything; the spool of another destination is unaffected.
+    sleep(2);
+    EXPECT_FALSE(CurlHandler::accepting(server.url("/fail"), "JsonFile", options));
+    EXPECT_TRUE(CurlHandler::accepting(server.url("/ok"), "JsonFile", options));
+    EXPECT_EQ(CurlHandler::drain(server.url("/ok"), "JsonFile", options), SUCCESS);
+    EXPECT_EQ(server.requests, refused);
+
+    // Once the retry is due, the owner's drain delivers the records to the URL they were posted to.
+    {
+        std::lock_guard<std::mutex> lock(server.mutex());
+        server.ok = "/fail";
+    }
+    EXPECT_EQ(CurlHandler::drain(server.url("/fail"), "JsonFile", options), SUCCESS);
+    EXPECT_TRUE(CurlHandler::accepting(server.url("/fail"), "JsonFile", options));
+    EXPECT_GT(server.requests, refused);
+    for (size_t i = refused; i < server.headers.size(); i++)
+        EXPECT_EQ(server.headers[i].compare(0, 11, "POST /fail "), 0);
+}